@@ -0,0 +1,408 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "libnip.h"
+#include "nip_lib.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#define NIP_HEX_VALID   0x10
+#define NIP_HEX_SHIFT   4
+#define NIP_HEX_MASK    0x0F
+#define NIP_PORT_MAX    65535
+
+/* Lookup tables instead of per-character range checks, digits carry
+ * NIP_HEX_VALID so that one AND checks both of a byte
+ */
+static const unsigned char nip_hex_val[256] = {
+	['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+	['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+	['a'] = 0x1A, ['b'] = 0x1B, ['c'] = 0x1C, ['d'] = 0x1D, ['e'] = 0x1E, ['f'] = 0x1F,
+	['A'] = 0x1A, ['B'] = 0x1B, ['C'] = 0x1C, ['D'] = 0x1D, ['E'] = 0x1E, ['F'] = 0x1F,
+};
+
+static const char nip_hex_digit[] = "0123456789abcdef";
+
+/* Address length by first byte, 0 for an unused first byte */
+static const unsigned char nip_addr_len_tbl[256] = {
+	[0 ... ADDR_FIRST_DC] = NIP_ADDR_LEN_1,
+	[ADDR_FIRST_DC + 1 ... ADDR_FIRST_F0] = NIP_ADDR_LEN_2,
+	[ADDR_FIRST_F1] = NIP_ADDR_LEN_3,
+	[ADDR_FIRST_F2] = NIP_ADDR_LEN_5,
+	[ADDR_FIRST_F3] = NIP_ADDR_LEN_7,
+	[ADDR_FIRST_FE] = NIP_ADDR_LEN_8,
+	[ADDR_FIRST_FF] = NIP_ADDR_LEN_2,
+};
+
+/* Lower bounds of the multi-byte ranges, as checked by the kernel */
+static int nip_addr_range_ok(const unsigned char *b)
+{
+	switch (b[0]) {
+	case ADDR_FIRST_DC + 1:
+		return b[1] >= ADDR_SECOND_MIN_DD;
+	case ADDR_FIRST_F1:
+		return b[1] >= ADDR_SECOND_MIN_F1;
+	case ADDR_FIRST_F2:
+		return b[1] || b[2] >= ADDR_THIRD_MIN_F2;
+	case ADDR_FIRST_F3:
+		return b[1] || b[2] >= ADDR_THIRD_MIN_F3;
+	default:
+		return 1;
+	}
+}
+
+int nip_addr_parse(const char *str, struct nip_addr *addr)
+{
+	unsigned char b[NIP_8BIT_ADDR_INDEX_MAX] = {0};
+	size_t len = strnlen(str, NIP_ADDR_STR_LEN);
+	size_t i;
+
+	if (!len || len % 2 || len >= NIP_ADDR_STR_LEN)
+		return -1;
+
+	for (i = 0; i < len / 2; i++) {
+		unsigned char hi = nip_hex_val[(unsigned char)str[i * 2]];
+		unsigned char lo = nip_hex_val[(unsigned char)str[i * 2 + 1]];
+
+		if (!(hi & lo & NIP_HEX_VALID))
+			return -1;
+		b[i] = ((hi & NIP_HEX_MASK) << NIP_HEX_SHIFT) | (lo & NIP_HEX_MASK);
+	}
+
+	if (nip_addr_len_tbl[b[0]] != len / 2 || !nip_addr_range_ok(b))
+		return -1;
+
+	memset(addr, 0, sizeof(*addr));
+	memcpy(addr->nip_addr_field8, b, len / 2);
+	addr->bitlen = len / 2 * NIP_ADDR_BIT_LEN_8;
+	return 0;
+}
+
+int nip_addr_format(const struct nip_addr *addr, char *buf, size_t size)
+{
+	int len = addr->bitlen / NIP_ADDR_BIT_LEN_8;
+	int i;
+
+	if (len <= 0 || len > NIP_8BIT_ADDR_INDEX_MAX || size < (size_t)len * 2 + 1)
+		return -1;
+
+	for (i = 0; i < len; i++) {
+		unsigned char v = addr->nip_addr_field8[i];
+
+		buf[i * 2] = nip_hex_digit[v >> NIP_HEX_SHIFT];
+		buf[i * 2 + 1] = nip_hex_digit[v & NIP_HEX_MASK];
+	}
+	buf[len * 2] = '\0';
+	return len * 2;
+}
+
+void nip_sockaddr_set(struct sockaddr_nin *sin, const struct nip_addr *addr,
+		      unsigned short port)
+{
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_NINET;
+	sin->sin_port = htons(port);
+	sin->sin_addr = *addr;
+}
+
+int nip_sockaddr_parse(const char *str, unsigned short port, struct sockaddr_nin *sin)
+{
+	char addr_str[NIP_ADDR_STR_LEN];
+	const char *colon = strchr(str, ':');
+	size_t len = colon ? (size_t)(colon - str) : strlen(str);
+	struct nip_addr addr;
+
+	if (len >= sizeof(addr_str))
+		return -1;
+	memcpy(addr_str, str, len);
+	addr_str[len] = '\0';
+	if (nip_addr_parse(addr_str, &addr))
+		return -1;
+
+	if (colon) {
+		char *end;
+		unsigned long p = strtoul(colon + 1, &end, 10);
+
+		if (*end || end == colon + 1 || p > NIP_PORT_MAX)
+			return -1;
+		port = p;
+	}
+	nip_sockaddr_set(sin, &addr, port);
+	return 0;
+}
+
+unsigned int nip_sock_enable(int fd, unsigned int features, unsigned short gso_size)
+{
+	unsigned int done = 0;
+	int one = 1;
+
+	if (features & NIP_FEAT_NONBLOCK) {
+		int fl = fcntl(fd, F_GETFL);
+
+		if (fl >= 0 && !fcntl(fd, F_SETFL, fl | O_NONBLOCK))
+			done |= NIP_FEAT_NONBLOCK;
+	}
+	if ((features & NIP_FEAT_TIMESTAMP) &&
+	    !setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)))
+		done |= NIP_FEAT_TIMESTAMP;
+	if ((features & NIP_FEAT_RXQ_OVFL) &&
+	    !setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)))
+		done |= NIP_FEAT_RXQ_OVFL;
+	if ((features & NIP_FEAT_ZEROCOPY) &&
+	    !setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+		done |= NIP_FEAT_ZEROCOPY;
+	if ((features & NIP_FEAT_BUSY_POLL)) {
+		int us = NIP_BUSY_POLL_US;
+
+		if (!setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)))
+			done |= NIP_FEAT_BUSY_POLL;
+	}
+
+	/* The NewIP UDP layer accepts any SOL_UDP option without applying
+	 * it, only a value that reads back counts
+	 */
+	if ((features & NIP_FEAT_GSO) && gso_size) {
+		int val = gso_size;
+		int got = 0;
+		socklen_t len = sizeof(got);
+
+		if (!setsockopt(fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) &&
+		    !getsockopt(fd, SOL_UDP, UDP_SEGMENT, &got, &len) && got == val)
+			done |= NIP_FEAT_GSO;
+	}
+	return done;
+}
+
+int nip_socket(int type, unsigned int *features, unsigned short gso_size)
+{
+	int fd = socket(AF_NINET, type, 0);
+
+	if (fd < 0)
+		return -1;
+	if (features)
+		*features = nip_sock_enable(fd, *features, gso_size);
+	return fd;
+}
+
+void nip_batch_init(struct nip_batch *b, unsigned int features, unsigned short gso_size)
+{
+	memset(b, 0, sizeof(*b));
+	b->features = features;
+	b->gso_size = gso_size;
+}
+
+int nip_batch_add(struct nip_batch *b, void *buf, unsigned int len,
+		  const struct sockaddr_nin *addr)
+{
+	struct nip_msg *m;
+
+	if (b->num == NIP_BATCH_MAX)
+		return -1;
+	m = &b->msgs[b->num++];
+	m->buf = buf;
+	m->len = len;
+	m->size = len;
+	if (addr)
+		m->addr = *addr;
+	else
+		memset(&m->addr, 0, sizeof(m->addr));
+	return 0;
+}
+
+/* UDP_SEGMENT cmsg when GSO is active and the datagram is above gso_size */
+static size_t nip_batch_tx_cmsg(struct nip_batch *b, unsigned int i)
+{
+	struct msghdr mh = {
+		.msg_control = b->ctrl[i],
+		.msg_controllen = sizeof(b->ctrl[i]),
+	};
+	struct cmsghdr *cm;
+
+	if (!(b->features & NIP_FEAT_GSO) || b->msgs[i].len <= b->gso_size)
+		return 0;
+
+	cm = CMSG_FIRSTHDR(&mh);
+	cm->cmsg_level = SOL_UDP;
+	cm->cmsg_type = UDP_SEGMENT;
+	cm->cmsg_len = CMSG_LEN(sizeof(unsigned short));
+	memcpy(CMSG_DATA(cm), &b->gso_size, sizeof(b->gso_size));
+	return CMSG_SPACE(sizeof(unsigned short));
+}
+
+static void nip_batch_prepare(struct nip_batch *b, int tx)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->num; i++) {
+		struct msghdr *mh = &b->hdrs[i].msg_hdr;
+
+		b->iovs[i].iov_base = b->msgs[i].buf;
+		b->iovs[i].iov_len = tx ? b->msgs[i].len : b->msgs[i].size;
+		memset(mh, 0, sizeof(*mh));
+		mh->msg_iov = &b->iovs[i];
+		mh->msg_iovlen = 1;
+		mh->msg_name = &b->msgs[i].addr;
+		mh->msg_namelen = sizeof(b->msgs[i].addr);
+		if (tx) {
+			mh->msg_controllen = nip_batch_tx_cmsg(b, i);
+			mh->msg_control = mh->msg_controllen ? b->ctrl[i] : NULL;
+		} else if (b->features & (NIP_FEAT_TIMESTAMP | NIP_FEAT_RXQ_OVFL)) {
+			mh->msg_control = b->ctrl[i];
+			mh->msg_controllen = sizeof(b->ctrl[i]);
+		}
+	}
+}
+
+int nip_batch_send(int fd, struct nip_batch *b, int flags)
+{
+	unsigned int sent = 0;
+
+	if (b->features & NIP_FEAT_ZEROCOPY)
+		flags |= MSG_ZEROCOPY;
+
+	nip_batch_prepare(b, 1);
+	while (sent < b->num) {
+		int ret = sendmmsg(fd, b->hdrs + sent, b->num - sent, flags);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (!sent)
+				return -1;
+			break;
+		}
+		sent += ret;
+	}
+
+	/* Keep what is left for the next call */
+	if (sent < b->num)
+		memmove(b->msgs, b->msgs + sent, (b->num - sent) * sizeof(b->msgs[0]));
+	b->num -= sent;
+	return sent;
+}
+
+static void nip_batch_rx_cmsg(struct msghdr *mh, struct nip_msg *m)
+{
+	struct cmsghdr *cm;
+
+	memset(&m->ts, 0, sizeof(m->ts));
+	for (cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET)
+			continue;
+		if (cm->cmsg_type == SO_TIMESTAMPNS)
+			memcpy(&m->ts, CMSG_DATA(cm), sizeof(m->ts));
+		else if (cm->cmsg_type == SO_RXQ_OVFL)
+			memcpy(&m->drops, CMSG_DATA(cm), sizeof(m->drops));
+	}
+}
+
+int nip_batch_recv(int fd, struct nip_batch *b, int flags)
+{
+	int ret;
+	int i;
+
+	nip_batch_prepare(b, 0);
+	do {
+		ret = recvmmsg(fd, b->hdrs, b->num, flags, NULL);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+
+	for (i = 0; i < ret; i++) {
+		struct msghdr *mh = &b->hdrs[i].msg_hdr;
+
+		b->msgs[i].len = b->hdrs[i].msg_len;
+		b->msgs[i].flags = mh->msg_flags;
+		if (mh->msg_control)
+			nip_batch_rx_cmsg(mh, &b->msgs[i]);
+	}
+	return ret;
+}
+
+long nip_zerocopy_reap(int fd)
+{
+	unsigned char ctrl[NIP_CMSG_SPACE * 2];
+	long hi = -1;
+
+	for (;;) {
+		struct msghdr mh = {
+			.msg_control = ctrl,
+			.msg_controllen = sizeof(ctrl),
+		};
+		struct cmsghdr *cm;
+
+		if (recvmsg(fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			return hi;
+		for (cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+			struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cm);
+
+			if (ee->ee_errno == 0 && ee->ee_origin == SO_EE_ORIGIN_ZEROCOPY &&
+			    (long)ee->ee_data > hi)
+				hi = ee->ee_data;
+		}
+	}
+}
+
+int nip_accept_batch(int lfd, int *fds, int max, int flags)
+{
+	struct nip_accept_batch batch = {
+		.fds = (unsigned long)fds,
+		.max = max,
+		.flags = flags,
+	};
+	int ret = ioctl(lfd, SIOCNIPACCEPTBATCH, &batch);
+
+	if (ret >= 0 || errno != ENOTTY || max <= 0)
+		return ret;
+
+	fds[0] = accept4(lfd, NULL, NULL, flags);
+	return fds[0] < 0 ? -1 : 1;
+}
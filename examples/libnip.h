@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _LIBNIP_H
+#define _LIBNIP_H
+
+/* struct mmsghdr, include this header before the system ones */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stddef.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "nip_uapi.h"
+
+/* libnip: address parse/format, socket feature setup and sendmmsg/recvmmsg
+ * batches for AF_NINET sockets. Build with "make libnip.a".
+ */
+
+/* 16 hex digits + '\0' */
+#define NIP_ADDR_STR_LEN 17
+
+/* Hex string ("de01", "f11400", ...) to address, 0 or -1 if invalid */
+int nip_addr_parse(const char *str, struct nip_addr *addr);
+/* Address to lower case hex, the string length or -1 */
+int nip_addr_format(const struct nip_addr *addr, char *buf, size_t size);
+
+void nip_sockaddr_set(struct sockaddr_nin *sin, const struct nip_addr *addr,
+		      unsigned short port);
+/* "<addr>" with the given port, or "<addr>:<port>", 0 or -1 */
+int nip_sockaddr_parse(const char *str, unsigned short port, struct sockaddr_nin *sin);
+
+/* Socket features, nip_sock_enable() returns the ones the stack accepted.
+ * NIP_FEAT_ZEROCOPY and NIP_FEAT_GSO are only reported when the kernel
+ * really applies them: SO_ZEROCOPY must succeed and UDP_SEGMENT must read
+ * back, a stack ignoring them must not get MSG_ZEROCOPY or GSO cmsgs.
+ */
+#define NIP_FEAT_NONBLOCK   0x01  /* O_NONBLOCK */
+#define NIP_FEAT_TIMESTAMP  0x02  /* SO_TIMESTAMPNS, nip_msg.ts */
+#define NIP_FEAT_RXQ_OVFL   0x04  /* SO_RXQ_OVFL, nip_msg.drops */
+#define NIP_FEAT_ZEROCOPY   0x08  /* SO_ZEROCOPY, batches send with MSG_ZEROCOPY */
+#define NIP_FEAT_GSO        0x10  /* UDP_SEGMENT cmsg on datagrams above gso_size */
+#define NIP_FEAT_BUSY_POLL  0x20  /* SO_BUSY_POLL */
+
+#define NIP_BUSY_POLL_US    50
+
+/* AF_NINET socket with the features applied, the fd or -1.
+ * features is updated to what was applied.
+ */
+int nip_socket(int type, unsigned int *features, unsigned short gso_size);
+unsigned int nip_sock_enable(int fd, unsigned int features, unsigned short gso_size);
+
+/* Batches: messages are added with nip_batch_add(), for sending len is the
+ * data length, for receiving the buffer size. nip_batch_send() sends all
+ * of them with sendmmsg(), nip_batch_recv() fills up to num with
+ * recvmmsg(), together with the address and the cmsg results.
+ */
+#define NIP_BATCH_MAX 64
+#define NIP_CMSG_SPACE 64
+
+struct nip_msg {
+	void *buf;
+	unsigned int len;
+	unsigned int size;
+	struct sockaddr_nin addr;
+	struct timespec ts;   /* NIP_FEAT_TIMESTAMP, zero when not reported */
+	unsigned int drops;   /* NIP_FEAT_RXQ_OVFL, socket drop counter */
+	int flags;            /* msg_flags of the received message */
+};
+
+struct nip_batch {
+	struct mmsghdr hdrs[NIP_BATCH_MAX];
+	struct iovec iovs[NIP_BATCH_MAX];
+	struct nip_msg msgs[NIP_BATCH_MAX];
+	unsigned char ctrl[NIP_BATCH_MAX][NIP_CMSG_SPACE];
+	unsigned int num;
+	unsigned int features;
+	unsigned short gso_size;
+};
+
+void nip_batch_init(struct nip_batch *b, unsigned int features, unsigned short gso_size);
+static inline void nip_batch_reset(struct nip_batch *b)
+{
+	b->num = 0;
+}
+
+/* 0, or -1 when the batch is full */
+int nip_batch_add(struct nip_batch *b, void *buf, unsigned int len,
+		  const struct sockaddr_nin *addr);
+/* Messages sent, unsent ones stay at the front of the batch. -1 on error */
+int nip_batch_send(int fd, struct nip_batch *b, int flags);
+/* Messages received, -1 on error (EAGAIN for a non-blocking socket) */
+int nip_batch_recv(int fd, struct nip_batch *b, int flags);
+
+/* MSG_ZEROCOPY completions: the highest completed send id, -1 if none */
+long nip_zerocopy_reap(int fd);
+
+/* Up to max connections from the listener lfd with one SIOCNIPACCEPTBATCH,
+ * flags as for accept4(). Falls back to a single accept4() on a stack
+ * without the ioctl. The number of fds stored, -1 on error.
+ */
+int nip_accept_batch(int lfd, int *fds, int max, int flags);
+
+#endif /* _LIBNIP_H */
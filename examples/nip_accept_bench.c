@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/sysinfo.h>
+
+#include "nip_uapi.h"
+#include "nip_lib.h"
+
+/* Listener scaling: one listener, 1..N threads, each thread connects to it,
+ * accepts one connection and closes both ends with RST, so neither side
+ * keeps TIME_WAIT state. conn/s should grow with the thread count as long
+ * as SYN and ACK processing does not serialize on the listener.
+ * The listener runs in this process, the address must be a local one.
+ * With an accept batch above 1 every thread connects that many sockets
+ * and takes them back with SIOCNIPACCEPTBATCH instead of accept().
+ *
+ * ./nip_accept_bench <local addr> [max threads] [seconds per step] [accept batch]
+ */
+#define BENCH_SECS_DEF      3
+#define BENCH_PORT          5558
+#define BENCH_BACKLOG       4096
+#define BENCH_BATCH_MAX     64
+
+struct bench_ctx {
+	int lfd;
+	int batch;
+	struct nip_addr addr;
+	volatile int stop;
+};
+
+struct bench_worker {
+	pthread_t th;
+	struct bench_ctx *ctx;
+	unsigned long conns;
+	unsigned long errs;
+};
+
+static int bench_listen(const struct nip_addr *addr)
+{
+	struct sockaddr_nin si_local;
+	int lfd;
+
+	lfd = socket(AF_NINET, SOCK_STREAM, IPPROTO_TCP);
+	if (lfd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&si_local, 0, sizeof(si_local));
+	si_local.sin_family = AF_NINET;
+	si_local.sin_port = htons(BENCH_PORT);
+	si_local.sin_addr = *addr;
+	if (bind(lfd, (struct sockaddr *)&si_local, sizeof(si_local)) < 0) {
+		perror("bind");
+		goto err;
+	}
+
+	if (listen(lfd, BENCH_BACKLOG) < 0) {
+		perror("listen");
+		goto err;
+	}
+	return lfd;
+err:
+	close(lfd);
+	return -1;
+}
+
+static int bench_connect(const struct sockaddr_nin *si_server)
+{
+	int cfd = socket(AF_NINET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (cfd < 0)
+		return -1;
+
+	if (connect(cfd, (struct sockaddr *)si_server, sizeof(*si_server)) < 0) {
+		close(cfd);
+		return -1;
+	}
+	return cfd;
+}
+
+static void bench_close_rst(int cfd)
+{
+	struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+
+	setsockopt(cfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+	close(cfd);
+}
+
+static int bench_one_conn(struct bench_ctx *ctx, const struct sockaddr_nin *si_server)
+{
+	int cfd;
+	int afd;
+
+	cfd = bench_connect(si_server);
+	if (cfd < 0)
+		return -1;
+
+	/* Every thread queues exactly one connection before accepting, so
+	 * accept never waits for long even if it takes another thread's one
+	 */
+	afd = accept(ctx->lfd, NULL, NULL);
+	bench_close_rst(cfd);
+	if (afd < 0)
+		return -1;
+	close(afd);
+	return 0;
+}
+
+/* Same as bench_one_conn for ctx->batch connections, the number accepted */
+static int bench_batch_conn(struct bench_ctx *ctx, const struct sockaddr_nin *si_server)
+{
+	int cfds[BENCH_BATCH_MAX];
+	int afds[BENCH_BATCH_MAX];
+	int conns = 0;
+	int acc = 0;
+	int i;
+
+	for (; conns < ctx->batch; conns++) {
+		cfds[conns] = bench_connect(si_server);
+		if (cfds[conns] < 0)
+			break;
+	}
+
+	while (acc < conns) {
+		struct nip_accept_batch batch = {
+			.fds = (unsigned long)(afds + acc),
+			.max = conns - acc,
+		};
+		int ret = ioctl(ctx->lfd, SIOCNIPACCEPTBATCH, &batch);
+
+		if (ret <= 0)
+			break;
+		acc += ret;
+	}
+
+	for (i = 0; i < conns; i++)
+		bench_close_rst(cfds[i]);
+	for (i = 0; i < acc; i++)
+		close(afds[i]);
+	return acc;
+}
+
+static void *bench_worker_run(void *args)
+{
+	struct bench_worker *w = (struct bench_worker *)args;
+	struct sockaddr_nin si_server;
+
+	memset(&si_server, 0, sizeof(si_server));
+	si_server.sin_family = AF_NINET;
+	si_server.sin_port = htons(BENCH_PORT);
+	si_server.sin_addr = w->ctx->addr;
+
+	while (!w->ctx->stop) {
+		int acc;
+
+		if (w->ctx->batch <= 1) {
+			if (bench_one_conn(w->ctx, &si_server))
+				w->errs++;
+			else
+				w->conns++;
+			continue;
+		}
+
+		acc = bench_batch_conn(w->ctx, &si_server);
+		w->conns += acc;
+		w->errs += w->ctx->batch - acc;
+	}
+	return NULL;
+}
+
+static int bench_step(struct bench_ctx *ctx, int thread_num, int secs)
+{
+	struct bench_worker *w = calloc(thread_num, sizeof(*w));
+	unsigned long conns = 0;
+	unsigned long errs = 0;
+	int started = 0;
+
+	if (!w) {
+		printf("calloc fail\n");
+		return -1;
+	}
+
+	ctx->stop = 0;
+	for (; started < thread_num; started++) {
+		w[started].ctx = ctx;
+		if (pthread_create(&w[started].th, NULL, bench_worker_run, &w[started])) {
+			printf("pthread_create fail\n");
+			break;
+		}
+	}
+
+	sleep(secs);
+	ctx->stop = 1;
+
+	for (int i = 0; i < started; i++) {
+		pthread_join(w[i].th, NULL);
+		conns += w[i].conns;
+		errs += w[i].errs;
+	}
+
+	printf("threads: %3d, rate: %10.0f conn/s, errors: %lu\n",
+	       started, (double)conns / secs, errs);
+	free(w);
+	return started == thread_num ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_ctx ctx = {0};
+	int max_threads = get_nprocs();
+	int secs = BENCH_SECS_DEF;
+
+	if (argc < DEMO_INPUT_1) {
+		printf("usage: %s <local addr> [max threads] [seconds per step] [accept batch]\n",
+		       argv[0]);
+		return -1;
+	}
+
+	if (nip_get_addr(&argv[1], &ctx.addr))
+		return -1;
+
+	if (argc >= DEMO_INPUT_2)
+		max_threads = atoi(argv[2]);
+	if (argc >= DEMO_INPUT_3)
+		secs = atoi(argv[3]);
+	ctx.batch = 1;
+	if (argc >= DEMO_INPUT_4)
+		ctx.batch = atoi(argv[4]);
+	if (max_threads <= 0 || secs <= 0) {
+		printf("invalid thread num or seconds per step\n");
+		return -1;
+	}
+	if (ctx.batch <= 0 || ctx.batch > BENCH_BATCH_MAX) {
+		printf("accept batch must be 1..%d\n", BENCH_BATCH_MAX);
+		return -1;
+	}
+
+	ctx.lfd = bench_listen(&ctx.addr);
+	if (ctx.lfd < 0)
+		return -1;
+
+	for (int i = 1; i <= max_threads; i++) {
+		if (bench_step(&ctx, i, secs))
+			break;
+	}
+
+	close(ctx.lfd);
+	return 0;
+}
@@ -73,7 +73,9 @@ void cmd_help(void)
 {
 	/* nip_addr wlan0 add 01 (在wlan0上配置地址01) */
 	/* nip_addr wlan0 del 01 (在wlan0上删除地址01) */
+	/* nip_addr peer wlan0 de01 (wlan0 链路对端地址为de01, 发往它的报文不带源地址) */
 	printf("[cmd example] nip_addr <netcard-name> { add | del } <addr>\n");
+	printf("[cmd example] nip_addr peer <netcard-name> { <peer addr> | none }\n");
 }
 
 int parse_name(char **argv, int *ifindex, char *dev)
@@ -117,6 +119,31 @@ int parse_cmd(char **argv, int *opt)
 	return 0;
 }
 
+/* nip_addr peer <netcard-name> { <peer addr> | none } */
+static int set_peer(char **argv)
+{
+	char dev[ARRAY_LEN];
+	int ifindex = 0;
+	struct nip_addr addr = {0};
+
+	if (parse_name(argv, &ifindex, dev) != 0)
+		return -1;
+
+	/* bitlen 0 removes the peer */
+	argv++;
+	if (strcmp(*argv, CMD_PEER_NONE) && nip_get_addr(argv, &addr)) {
+		printf("unsupport addr cfg cmd-3\n");
+		cmd_help();
+		return -1;
+	}
+
+	if (nip_add_addr(ifindex, &addr, SIOCNIPSETPEER) != 0)
+		return -1;
+
+	printf("%s (ifindex=%d) cfg peer success\n", dev, ifindex);
+	return 0;
+}
+
 int main(int argc, char **argv_input)
 {
 	char dev[ARRAY_LEN];
@@ -132,6 +159,9 @@ int main(int argc, char **argv_input)
 		return -1;
 	}
 
+	if (!strcmp(argv[1], CMD_PEER))
+		return set_peer(&argv[2]);
+
 	/* 配置参数1解析: <netcard-name> */
 	argv++;
 	ret = parse_name(argv, &ifindex, dev);
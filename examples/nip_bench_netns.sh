@@ -0,0 +1,547 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Copyright (c) 2022 Huawei Device Co., Ltd.
+#
+# Reproducible NewIP benchmark on a single Linux box: network namespaces
+# joined by veth, NewIP addresses and routes set up with nip_addr/nip_route,
+# nip_perf workloads, /proc counters and perf stat around every run, and a
+# comparison of the results against a stored baseline.
+#
+# Topology (-n 2):  nipb-cli wlan0 <--veth--> wlan0 nipb-srv
+# Topology (-n 3):  nipb-cli wlan0 <--veth--> wlan0 nipb-rtr wlan1 <--veth--> wlan0 nipb-srv
+#
+# The interfaces are called wlan* because nip_addr and nip_route only accept
+# those names. btn* devices are not used: a btdev pair is two character
+# devices that need a userspace relay, which would be measured as well.
+#
+# Run as root from examples/ after "make":
+#   ./nip_bench_netns.sh [-n 2|3] [-t "TCP_STREAM TCP_RR ..."] [-l seconds]
+#                        [-T threads] [-m msg size] [-c client addr]
+#                        [-s server addr] [-r router addrs] [-o result dir]
+#                        [-b baseline file] [-B] [-F] [-A batch] [-P]
+#                        [-G packets] [-k]
+#   -b  compare with the baseline file (default: baseline.json in examples/)
+#   -B  store this run as the new baseline instead of comparing
+#   -F  run the tests again with flow accounting on (CONFIG_NEWIP_FLOW_ACCT)
+#       and fail if they lose more than NIP_FLOW_ACCT_MAX_PCT (default 2)
+#       percent against the run with it off
+#   -A  run nip_accept_bench in the server namespace with accept() and with
+#       SIOCNIPACCEPTBATCH batches of the given size, up to -T threads
+#   -P  set each end of the veth as the other's peer (nip_addr peer, -n 2
+#       only) and fail unless UDP_RR frames get shorter (needs tcpdump)
+#   -G  send the given number of packets with nip_pktgen (CONFIG_NEWIP_PKTGEN)
+#       from the client: over the veth, and to a dummy device without and
+#       with clone (veth cannot send an skb twice)
+#   -k  keep the namespaces after the run
+#
+# The worst-case time of the header decoder over nip_decode_corpus is
+# measured as well (test DECODE). NIP_DECODE_MAX_NS sets a hard bound in ns
+# per header on top of the baseline comparison.
+#
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+NS_CLI=nipb-cli
+NS_RTR=nipb-rtr
+NS_SRV=nipb-srv
+NS_NUM=2
+TESTS="TCP_STREAM TCP_RR TCP_CRR UDP_STREAM UDP_RR"
+SECS=10
+THREADS=1
+MSG_SIZE=""
+ADDR_CLI=de00
+ADDR_SRV=de01
+ADDR_RTR_CLI=de02
+ADDR_RTR_SRV=de03
+RESULT_DIR=$BENCH_DIR/nip_bench_results/$(date +%Y%m%d-%H%M%S)
+BASELINE=$BENCH_DIR/baseline.json
+SAVE_BASELINE=0
+KEEP_NS=0
+# Allowed regression in percent before a metric is reported as failed
+TOLERANCE=${NIP_BENCH_TOLERANCE:-5}
+DECODE_MAX_NS=${NIP_DECODE_MAX_NS:-}
+DECODE_FAIL=0
+FLOW_ACCT=0
+FLOW_ACCT_MAX_PCT=${NIP_FLOW_ACCT_MAX_PCT:-2}
+FLOW_ACCT_FAIL=0
+ACCEPT_BATCH=0
+PEER=0
+PEER_FAIL=0
+PKTGEN_COUNT=0
+PKTGEN_CLONE=${NIP_PKTGEN_CLONE:-15}
+PKTGEN_FAIL=0
+PERF_EVENTS="cycles,instructions,cache-misses,context-switches"
+IFA_F_TENTATIVE=0x40
+
+function usage()
+{
+    sed -n '/^# Run as root/,/^#$/p' "$0" | sed 's/^# \{0,1\}//'
+    exit 1
+}
+
+function nsx()
+{
+    local ns=$1
+    shift
+    ip netns exec "$ns" "$@"
+}
+
+function cleanup()
+{
+    if [ $KEEP_NS -eq 1 ]; then
+        return
+    fi
+    for ns in $NS_CLI $NS_RTR $NS_SRV; do
+        ip netns pids $ns 2>/dev/null | xargs -r kill 2>/dev/null || true
+        ip netns del $ns 2>/dev/null || true
+    done
+}
+
+function check_env()
+{
+    if [ "$(id -u)" -ne 0 ]; then
+        echo "must run as root"
+        exit 1
+    fi
+    if [ ! -d /sys/module/newip ] || [ "$(cat /sys/module/newip/parameters/disable 2>/dev/null)" = "1" ]; then
+        echo "NewIP is not enabled in this kernel"
+        exit 1
+    fi
+    for bin in nip_addr nip_route nip_perf; do
+        if [ ! -x "$BENCH_DIR/$bin" ]; then
+            echo "$bin not found, run make in $BENCH_DIR first"
+            exit 1
+        fi
+    done
+}
+
+# link <ns-a> <dev-a> <ns-b> <dev-b>
+function link()
+{
+    ip link add nipb-tmp-a type veth peer name nipb-tmp-b
+    ip link set nipb-tmp-a netns "$1" name "$2"
+    ip link set nipb-tmp-b netns "$3" name "$4"
+    nsx "$1" ip link set "$2" up
+    nsx "$3" ip link set "$4" up
+}
+
+function setup()
+{
+    cleanup
+    ip netns add $NS_CLI
+    ip netns add $NS_SRV
+    nsx $NS_CLI ip link set lo up
+    nsx $NS_SRV ip link set lo up
+
+    if [ "$NS_NUM" -eq 3 ]; then
+        ip netns add $NS_RTR
+        nsx $NS_RTR ip link set lo up
+        link $NS_CLI wlan0 $NS_RTR wlan0
+        link $NS_RTR wlan1 $NS_SRV wlan0
+
+        nsx $NS_CLI "$BENCH_DIR/nip_addr" wlan0 add $ADDR_CLI
+        nsx $NS_RTR "$BENCH_DIR/nip_addr" wlan0 add $ADDR_RTR_CLI
+        nsx $NS_RTR "$BENCH_DIR/nip_addr" wlan1 add $ADDR_RTR_SRV
+        nsx $NS_SRV "$BENCH_DIR/nip_addr" wlan0 add $ADDR_SRV
+
+        nsx $NS_CLI "$BENCH_DIR/nip_route" add $ADDR_SRV wlan0 $ADDR_RTR_CLI
+        nsx $NS_RTR "$BENCH_DIR/nip_route" add $ADDR_CLI wlan0
+        nsx $NS_RTR "$BENCH_DIR/nip_route" add $ADDR_SRV wlan1
+        nsx $NS_SRV "$BENCH_DIR/nip_route" add $ADDR_CLI wlan0 $ADDR_RTR_SRV
+    else
+        link $NS_CLI wlan0 $NS_SRV wlan0
+        nsx $NS_CLI "$BENCH_DIR/nip_addr" wlan0 add $ADDR_CLI
+        nsx $NS_SRV "$BENCH_DIR/nip_addr" wlan0 add $ADDR_SRV
+        nsx $NS_CLI "$BENCH_DIR/nip_route" add $ADDR_SRV wlan0
+        nsx $NS_SRV "$BENCH_DIR/nip_route" add $ADDR_CLI wlan0
+    fi
+}
+
+# New addresses stay tentative until DAD is done and are not used as source
+# or for routes before that. Wait until no namespace has one left, the
+# third column of /proc/net/nip_addr holds the address flags.
+function wait_dad()
+{
+    local tries=50
+    local ns
+    local addr
+    local dev
+    local flags
+    local busy
+
+    while [ $tries -gt 0 ]; do
+        busy=0
+        for ns in $NS_CLI $NS_RTR $NS_SRV; do
+            ip netns list | grep -qw $ns || continue
+            while read -r addr dev flags; do
+                if [ -n "$flags" ] && (( 0x$flags & IFA_F_TENTATIVE )); then
+                    busy=1
+                fi
+            done < <(nsx $ns cat /proc/net/nip_addr)
+        done
+        if [ $busy -eq 0 ]; then
+            return 0
+        fi
+        tries=$((tries - 1))
+        sleep 0.1
+    done
+    echo "addresses still tentative after 5s"
+    exit 1
+}
+
+# snapshot <tag>: NewIP /proc files and device counters of every namespace
+function snapshot()
+{
+    local ns
+    local f
+
+    for ns in $NS_CLI $NS_RTR $NS_SRV; do
+        ip netns list | grep -qw $ns || continue
+        {
+            for f in $(nsx $ns sh -c 'ls /proc/net/nip_* 2>/dev/null'); do
+                echo "== $f"
+                nsx $ns cat "$f" 2>/dev/null || true
+            done
+            echo "== /proc/net/dev"
+            nsx $ns cat /proc/net/dev
+        } > "$RESULT_DIR/$1.$ns.proc"
+    done
+    cat /proc/softirqs > "$RESULT_DIR/$1.softirqs"
+}
+
+# run_test <test> [result file] [tag]
+function run_test()
+{
+    local test=$1
+    local out=${2:-$RESULT_DIR/result.json}
+    local tag=${3:-$test}
+    local args="-t $test -l $SECS -T $THREADS -c $ADDR_SRV"
+    local perf_pid=""
+
+    if [ -n "$MSG_SIZE" ]; then
+        args="$args -m $MSG_SIZE"
+    fi
+
+    snapshot "$tag.before"
+    if command -v perf > /dev/null; then
+        perf stat -a -e $PERF_EVENTS -o "$RESULT_DIR/$tag.perf" -- sleep "$SECS" &
+        perf_pid=$!
+    fi
+    # nip_perf prints one JSON object per run
+    nsx $NS_CLI "$BENCH_DIR/nip_perf" $args | tee -a "$out"
+    if [ -n "$perf_pid" ]; then
+        wait $perf_pid || true
+    fi
+    snapshot "$tag.after"
+}
+
+# Crafted and fuzzer found headers, the decoder must stay fast on all of them
+function run_decode()
+{
+    local args="-j"
+
+    if [ ! -x "$BENCH_DIR/nip_decode_bench" ]; then
+        return
+    fi
+    if [ -n "$DECODE_MAX_NS" ]; then
+        args="$args -m $DECODE_MAX_NS"
+    fi
+    "$BENCH_DIR/nip_decode_bench" $args "$BENCH_DIR/nip_decode_corpus" \
+        >> "$RESULT_DIR/result.json" || DECODE_FAIL=1
+    tail -n 1 "$RESULT_DIR/result.json"
+}
+
+# The tests again with flow accounting on, compared with the run above
+function run_flow_acct()
+{
+    local out=$RESULT_DIR/flow_acct.json
+    local test
+    local key
+    local off
+    local on
+
+    if [ $FLOW_ACCT -eq 0 ]; then
+        return
+    fi
+    if [ ! -w /proc/net/nip_flow ]; then
+        echo "no /proc/net/nip_flow, CONFIG_NEWIP_FLOW_ACCT is not set"
+        FLOW_ACCT_FAIL=1
+        return
+    fi
+
+    echo on > /proc/net/nip_flow
+    for test in $TESTS; do
+        run_test "$test" "$out" "flow_acct.$test"
+    done
+    cat /proc/net/nip_flow > "$RESULT_DIR/flow_acct.stat"
+    echo off > /proc/net/nip_flow
+    # Drain the records of the run, nobody else collects them here
+    cat /proc/net/nip_flow_export > /dev/null
+
+    echo "flow accounting overhead (limit $FLOW_ACCT_MAX_PCT%):"
+    for test in $TESTS; do
+        case $test in
+            *STREAM) key=throughput_mbps ;;
+            *) key=tps ;;
+        esac
+        off=$(metric "$(grep "\"test\": \"$test\"" "$RESULT_DIR/result.json" | tail -n 1)" $key)
+        on=$(metric "$(grep "\"test\": \"$test\"" "$out" | tail -n 1)" $key)
+        if [ -z "$off" ] || [ -z "$on" ]; then
+            continue
+        fi
+        awk -v t="$test" -v k="$key" -v o="$off" -v n="$on" -v max="$FLOW_ACCT_MAX_PCT" 'BEGIN {
+            d = o ? (o - n) * 100 / o : 0
+            printf("%-10s %-16s %12s -> %12s %+7.1f%% %s\n", t, k, o, n, -d, d > max ? "FAIL" : "ok")
+            exit d > max
+        }' || FLOW_ACCT_FAIL=1
+    done
+}
+
+# Connection rate with one accept() per connection and with batches
+function run_accept()
+{
+    local out=$RESULT_DIR/accept.txt
+    local batch
+
+    if [ "$ACCEPT_BATCH" -eq 0 ] || [ ! -x "$BENCH_DIR/nip_accept_bench" ]; then
+        return
+    fi
+    for batch in 1 "$ACCEPT_BATCH"; do
+        echo "accept batch $batch" | tee -a "$out"
+        nsx $NS_SRV "$BENCH_DIR/nip_accept_bench" $ADDR_SRV "$THREADS" "$SECS" "$batch" \
+            | tee -a "$out"
+    done
+}
+
+# frame_len: the most common NewIP frame length on the client side of the
+# link during a short UDP_RR run, all requests and responses have one size
+function frame_len()
+{
+    local cap=$RESULT_DIR/peer.cap
+    local cap_pid
+
+    nsx $NS_CLI tcpdump -i wlan0 -nn -e -l 'ether proto 0xeadd' > "$cap" 2>/dev/null &
+    cap_pid=$!
+    sleep 1
+    nsx $NS_CLI "$BENCH_DIR/nip_perf" -t UDP_RR -l 1 -m 64 -r 64 -c $ADDR_SRV \
+        >> "$RESULT_DIR/peer.json"
+    kill $cap_pid 2>/dev/null || true
+    wait $cap_pid 2>/dev/null || true
+    sed -n 's/.* length \([0-9]*\):.*/\1/p' "$cap" | sort | uniq -c | sort -rn |
+        awk 'NR == 1 { print $2 }'
+}
+
+# Point-to-point peers: packets to the peer are sent without saddr
+function run_peer()
+{
+    local before
+    local after
+
+    if [ $PEER -eq 0 ]; then
+        return
+    fi
+    if [ "$NS_NUM" -ne 2 ] || ! command -v tcpdump > /dev/null; then
+        echo "peer test needs -n 2 and tcpdump"
+        PEER_FAIL=1
+        return
+    fi
+
+    before=$(frame_len)
+    nsx $NS_CLI "$BENCH_DIR/nip_addr" peer wlan0 $ADDR_SRV > /dev/null
+    nsx $NS_SRV "$BENCH_DIR/nip_addr" peer wlan0 $ADDR_CLI > /dev/null
+    after=$(frame_len)
+    nsx $NS_CLI "$BENCH_DIR/nip_addr" peer wlan0 none > /dev/null
+    nsx $NS_SRV "$BENCH_DIR/nip_addr" peer wlan0 none > /dev/null
+
+    echo "UDP_RR frame length without peer: ${before:-none}, with peer: ${after:-none}" |
+        tee "$RESULT_DIR/peer.txt"
+    if [ -z "$before" ] || [ -z "$after" ] || [ "$after" -ge "$before" ]; then
+        echo "peer FAIL"
+        PEER_FAIL=1
+    fi
+}
+
+# pktgen <command>: one command to the client's generator
+function pktgen()
+{
+    nsx $NS_CLI sh -c "echo '$*' > /proc/net/nip_pktgen"
+}
+
+# pktgen_run <tag> <dev> <dst mac> <clone>
+function pktgen_run()
+{
+    pktgen dev "$2"
+    pktgen dst_mac "$3"
+    pktgen clone "$4"
+    if ! pktgen start; then
+        echo "$1 FAIL" | tee -a "$RESULT_DIR/pktgen.txt"
+        PKTGEN_FAIL=1
+        return
+    fi
+    echo "$1 $(nsx $NS_CLI grep '^result' /proc/net/nip_pktgen)" | tee -a "$RESULT_DIR/pktgen.txt"
+}
+
+# Raw transmit rate of the header encapsulation, without sockets
+function run_pktgen()
+{
+    local srv_mac
+
+    if [ "$PKTGEN_COUNT" -eq 0 ]; then
+        return
+    fi
+    if ! nsx $NS_CLI test -w /proc/net/nip_pktgen; then
+        echo "no /proc/net/nip_pktgen, CONFIG_NEWIP_PKTGEN is not set"
+        PKTGEN_FAIL=1
+        return
+    fi
+
+    pktgen saddr $ADDR_CLI
+    pktgen daddr $ADDR_SRV
+    pktgen count "$PKTGEN_COUNT"
+    if [ "$NS_NUM" -eq 3 ]; then
+        srv_mac=$(nsx $NS_RTR cat /sys/class/net/wlan0/address)
+    else
+        srv_mac=$(nsx $NS_SRV cat /sys/class/net/wlan0/address)
+    fi
+    pktgen_run veth wlan0 "$srv_mac" 0
+
+    nsx $NS_CLI ip link add nipb-pg0 type dummy
+    nsx $NS_CLI ip link set nipb-pg0 up
+    pktgen_run dummy nipb-pg0 "$srv_mac" 0
+    pktgen_run dummy_clone nipb-pg0 "$srv_mac" "$PKTGEN_CLONE"
+    nsx $NS_CLI ip link del nipb-pg0
+}
+
+# metric <json line> <key>
+function metric()
+{
+    echo "$1" | sed -n "s/.*\"$2\": \([0-9.]*\).*/\1/p"
+}
+
+# A metric fails when it is TOLERANCE percent worse than the baseline.
+# higher_better is 1 for throughput and transactions, 0 for latency.
+function check_metric()
+{
+    local test=$1
+    local key=$2
+    local higher_better=$3
+    local old
+    local new
+
+    old=$(metric "$(grep "\"test\": \"$test\"" "$BASELINE" | tail -n 1)" "$key")
+    new=$(metric "$(grep "\"test\": \"$test\"" "$RESULT_DIR/result.json" | tail -n 1)" "$key")
+    if [ -z "$old" ] || [ -z "$new" ]; then
+        return 0
+    fi
+
+    awk -v t="$test" -v k="$key" -v o="$old" -v n="$new" -v hb="$higher_better" \
+        -v tol="$TOLERANCE" 'BEGIN {
+        if (o == 0) { printf("%-10s %-16s %12s -> %12s\n", t, k, o, n); exit 0 }
+        d = (n - o) * 100 / o
+        bad = hb ? (d < -tol) : (d > tol)
+        printf("%-10s %-16s %12s -> %12s %+7.1f%% %s\n", t, k, o, n, d, bad ? "FAIL" : "ok")
+        exit bad
+    }'
+}
+
+function compare()
+{
+    local fail=0
+    local test
+
+    if [ $SAVE_BASELINE -eq 1 ]; then
+        cp "$RESULT_DIR/result.json" "$BASELINE"
+        echo "baseline stored in $BASELINE"
+        return 0
+    fi
+    if [ ! -f "$BASELINE" ]; then
+        echo "no baseline at $BASELINE, run with -B to store one"
+        return 0
+    fi
+
+    echo "comparison with $BASELINE (tolerance $TOLERANCE%):"
+    for test in $TESTS; do
+        case $test in
+            *STREAM)
+                check_metric $test throughput_mbps 1 || fail=1
+                ;;
+            *)
+                check_metric $test tps 1 || fail=1
+                check_metric $test p50 0 || fail=1
+                check_metric $test p99 0 || fail=1
+                ;;
+        esac
+    done
+    check_metric DECODE worst_ns 0 || fail=1
+    return $fail
+}
+
+function main()
+{
+    local opt
+    local test
+    local ret
+
+    while getopts "n:t:l:T:m:c:s:r:o:b:BFA:PG:kh" opt; do
+        case $opt in
+            n) NS_NUM=$OPTARG ;;
+            t) TESTS=$OPTARG ;;
+            l) SECS=$OPTARG ;;
+            T) THREADS=$OPTARG ;;
+            m) MSG_SIZE=$OPTARG ;;
+            c) ADDR_CLI=$OPTARG ;;
+            s) ADDR_SRV=$OPTARG ;;
+            r) ADDR_RTR_CLI=${OPTARG%,*}; ADDR_RTR_SRV=${OPTARG#*,} ;;
+            o) RESULT_DIR=$OPTARG ;;
+            b) BASELINE=$OPTARG ;;
+            B) SAVE_BASELINE=1 ;;
+            F) FLOW_ACCT=1 ;;
+            A) ACCEPT_BATCH=$OPTARG ;;
+            P) PEER=1 ;;
+            G) PKTGEN_COUNT=$OPTARG ;;
+            k) KEEP_NS=1 ;;
+            *) usage ;;
+        esac
+    done
+    if [ "$NS_NUM" -ne 2 ] && [ "$NS_NUM" -ne 3 ]; then
+        usage
+    fi
+
+    check_env
+    mkdir -p "$RESULT_DIR"
+    trap cleanup EXIT
+    setup
+    wait_dad
+
+    {
+        echo "kernel: $(uname -r)"
+        echo "cpus: $(nproc)"
+        echo "namespaces: $NS_NUM client: $ADDR_CLI server: $ADDR_SRV"
+        echo "tests: $TESTS seconds: $SECS threads: $THREADS msg: ${MSG_SIZE:-default}"
+    } > "$RESULT_DIR/env.txt"
+
+    nsx $NS_SRV "$BENCH_DIR/nip_perf" -s $ADDR_SRV > "$RESULT_DIR/server.log" 2>&1 &
+    sleep 1
+
+    for test in $TESTS; do
+        run_test "$test"
+    done
+    run_decode
+    run_flow_acct
+    run_accept
+    run_peer
+    run_pktgen
+
+    echo "results in $RESULT_DIR"
+    ret=0
+    compare || ret=1
+    if [ $DECODE_FAIL -eq 1 ] || [ $FLOW_ACCT_FAIL -eq 1 ] || [ $PEER_FAIL -eq 1 ] ||
+       [ $PKTGEN_FAIL -eq 1 ]; then
+        ret=1
+    fi
+    exit $ret
+}
+
+main "$@"
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "nip_uapi.h"
+#include "nip_lib.h"
+
+/* connect() rate under port-space pressure: every connection is kept open,
+ * so each new connect() has to find a free ephemeral port among the ones
+ * already used towards the same destination.
+ * The listener runs in this process, the address must be a local one.
+ *
+ * ./nip_connect_bench <local addr> [connection num] [report step]
+ */
+#define BENCH_CONN_NUM_DEF  20000
+#define BENCH_STEP_DEF      1000
+#define BENCH_PORT          5557
+#define BENCH_FD_RESERVED   64
+#define NSEC_PER_SEC        1000000000.0
+
+struct bench_ctx {
+	int lfd;
+	int conn_num;
+	int *afds;
+};
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / NSEC_PER_SEC;
+}
+
+static void *bench_accept(void *args)
+{
+	struct bench_ctx *ctx = (struct bench_ctx *)args;
+
+	for (int i = 0; i < ctx->conn_num; i++) {
+		ctx->afds[i] = accept(ctx->lfd, NULL, NULL);
+		if (ctx->afds[i] < 0) {
+			perror("accept");
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int bench_listen(const struct nip_addr *addr, int conn_num)
+{
+	struct sockaddr_nin si_local;
+	int lfd;
+
+	lfd = socket(AF_NINET, SOCK_STREAM, IPPROTO_TCP);
+	if (lfd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&si_local, 0, sizeof(si_local));
+	si_local.sin_family = AF_NINET;
+	si_local.sin_port = htons(BENCH_PORT);
+	si_local.sin_addr = *addr;
+	if (bind(lfd, (struct sockaddr *)&si_local, sizeof(si_local)) < 0) {
+		perror("bind");
+		goto err;
+	}
+
+	if (listen(lfd, conn_num) < 0) {
+		perror("listen");
+		goto err;
+	}
+	return lfd;
+err:
+	close(lfd);
+	return -1;
+}
+
+static int bench_raise_nofile(int conn_num)
+{
+	struct rlimit rl;
+
+	rl.rlim_cur = (rlim_t)conn_num * 2 + BENCH_FD_RESERVED;
+	rl.rlim_max = rl.rlim_cur;
+	if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+		perror("setrlimit");
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_connect(struct bench_ctx *ctx, const struct nip_addr *addr,
+			 int *cfds, int step)
+{
+	struct sockaddr_nin si_server;
+	double start = bench_now();
+	double last = start;
+	int i;
+
+	memset(&si_server, 0, sizeof(si_server));
+	si_server.sin_family = AF_NINET;
+	si_server.sin_port = htons(BENCH_PORT);
+	si_server.sin_addr = *addr;
+
+	for (i = 0; i < ctx->conn_num; i++) {
+		cfds[i] = socket(AF_NINET, SOCK_STREAM, IPPROTO_TCP);
+		if (cfds[i] < 0) {
+			perror("socket");
+			break;
+		}
+
+		if (connect(cfds[i], (struct sockaddr *)&si_server, sizeof(si_server)) < 0) {
+			printf("connect %d failed: %s\n", i, strerror(errno));
+			close(cfds[i]);
+			break;
+		}
+
+		if ((i + 1) % step == 0) {
+			double now = bench_now();
+
+			printf("connections: %6d, rate: %10.0f conn/s\n",
+			       i + 1, step / (now - last));
+			last = now;
+		}
+	}
+
+	if (i > 0)
+		printf("total: %d connections in %.3f s, %.0f conn/s\n",
+		       i, bench_now() - start, i / (bench_now() - start));
+	return i;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_ctx ctx = {0};
+	struct nip_addr addr;
+	pthread_t th;
+	int *cfds;
+	int step = BENCH_STEP_DEF;
+	int done;
+
+	if (argc < DEMO_INPUT_1) {
+		printf("usage: %s <local addr> [connection num] [report step]\n", argv[0]);
+		return -1;
+	}
+
+	if (nip_get_addr(&argv[1], &addr))
+		return -1;
+
+	ctx.conn_num = argc >= DEMO_INPUT_2 ? atoi(argv[2]) : BENCH_CONN_NUM_DEF;
+	if (argc >= DEMO_INPUT_3)
+		step = atoi(argv[3]);
+	if (ctx.conn_num <= 0 || step <= 0) {
+		printf("invalid connection num or report step\n");
+		return -1;
+	}
+
+	if (bench_raise_nofile(ctx.conn_num))
+		return -1;
+
+	cfds = calloc(ctx.conn_num, sizeof(int));
+	ctx.afds = calloc(ctx.conn_num, sizeof(int));
+	if (!cfds || !ctx.afds) {
+		printf("calloc fail\n");
+		return -1;
+	}
+
+	ctx.lfd = bench_listen(&addr, ctx.conn_num);
+	if (ctx.lfd < 0)
+		return -1;
+
+	pthread_create(&th, NULL, bench_accept, &ctx);
+	done = bench_connect(&ctx, &addr, cfds, step);
+
+	/* Unblock the accept thread if some connect() failed */
+	shutdown(ctx.lfd, SHUT_RDWR);
+	pthread_join(th, NULL);
+
+	for (int i = 0; i < done; i++)
+		close(cfds[i]);
+	for (int i = 0; i < ctx.conn_num; i++) {
+		if (ctx.afds[i] > 0)
+			close(ctx.afds[i]);
+	}
+	close(ctx.lfd);
+	free(cfds);
+	free(ctx.afds);
+	return 0;
+}
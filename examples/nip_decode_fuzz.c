@@ -0,0 +1,657 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <net/tcp_nip.h>
+
+#include "nip_hdr.h"
+
+/* Fuzz and worst-case cost harness for the NewIP header decoder of
+ * src/common: nip_hdr_parse(), nip_hdr_parse_burst() and decode_nip_addr().
+ * The TCP header after a NewIP header with nexthdr TCP goes through
+ * tcp_nip_parse_options() of src/linux/net/newip/tcp_nip_options.c, built
+ * against the userspace stand-ins in nip_kshim.
+ *
+ * With clang and libFuzzer (make nip_decode_fuzz):
+ *   ./nip_decode_fuzz nip_decode_corpus
+ *   NIP_FUZZ_COST_DIR=<dir> ./nip_decode_fuzz nip_decode_corpus
+ * The second form also stores every input that sets a new cycle record for
+ * its length in <dir>, the slowest headers found make the worst-case corpus.
+ *
+ * Without libFuzzer the same file builds as nip_decode_bench (make all):
+ *   nip_decode_bench [-r rounds] [-m max ns] [-j] <file|dir>...
+ *     replay the inputs and report the worst decode time, fail when it is
+ *     above -m, -j prints one JSON line for nip_bench_netns.sh
+ *   nip_decode_bench -f <iterations> -o <dir> [-s seed] <file|dir>...
+ *     simple mutation fuzzing seeded with the inputs, cost records go to dir
+ *   nip_decode_bench -g <dir>
+ *     write the hand-made seeds (long bitmap chains, every address length,
+ *     long NOP runs, truncated options and bad option lengths)
+ *
+ * The decoders read at most NIP_DECODE_INPUT_MAX bytes of any input, the
+ * longest NewIP header and the longest TCP header, longer ones are cut
+ * there so that their cost is not spread over bytes never read.
+ */
+
+#define NIP_COST_REPEAT    32
+#define NIP_BENCH_ROUNDS   1000
+#define NIP_BENCH_BATCHES  5
+#define NIP_MAX_INPUTS     4096
+#define NIP_TCP_HDR_MAX    60
+#define NIP_TCP_DOFF_BYTE  12
+#define NIP_TCP_DOFF_SHIFT 4
+#define NIP_TCP_FLAGS_BYTE 13
+#define NIP_TCP_FLAG_SYN   0x02
+#define NIP_DECODE_INPUT_MAX (NIP_HDR_PARSE_MAX + NIP_TCP_HDR_MAX)
+
+struct nip_input {
+	char name[256];
+	unsigned char data[NIP_DECODE_INPUT_MAX];
+	unsigned int len;
+};
+
+static unsigned long long nip_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static unsigned long long nip_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* nip_dbg() of the option parser, never on here */
+bool get_nip_debug(void)
+{
+	return false;
+}
+
+/* The checks of tcp_nip_rcv() before the options are parsed, then the parse
+ * on an aligned copy of the TCP header. With exact the copy is a heap buffer
+ * of doff bytes, so that a sanitizer sees any read past the options. The MSS
+ * found or -1 if the TCP header is invalid.
+ */
+static int nip_tcp_opts_parse(const unsigned char *th, unsigned int left, int exact)
+{
+	struct tcp_options_received opt_rx = {0};
+	union {
+		struct tcphdr th;
+		unsigned char buf[NIP_TCP_HDR_MAX];
+	} hdr;
+	struct sk_buff skb;
+	unsigned int doff;
+
+	if (left < sizeof(struct tcphdr))
+		return -1;
+	doff = (th[NIP_TCP_DOFF_BYTE] >> NIP_TCP_DOFF_SHIFT) * 4;
+	if (doff < sizeof(struct tcphdr) || doff > left)
+		return -1;
+
+	skb.data = exact ? malloc(doff) : hdr.buf;
+	if (!skb.data)
+		return -1;
+	skb.len = doff;
+	memcpy(skb.data, th, doff);
+	tcp_nip_parse_options(&skb, &opt_rx, 0, NULL);
+	if (exact)
+		free(skb.data);
+	return opt_rx.mss_clamp;
+}
+
+/* Where the TCP header of a NewIP packet starts, 0 if it has none */
+static unsigned int nip_tcp_offset(const struct nip_hdr_decap *niph, int hdr_len,
+				   unsigned int len)
+{
+	if (hdr_len <= 0 || (unsigned int)hdr_len >= len || niph->nexthdr != IPPROTO_TCP)
+		return 0;
+	return hdr_len;
+}
+
+/* One decode of an input, what a flood of crafted headers costs per packet */
+static int nip_decode_one(unsigned char *buf, unsigned int len)
+{
+	struct nip_hdr_decap niph = {0};
+	struct nip_addr addr = {0};
+	unsigned int th;
+	int ret;
+
+	ret = nip_hdr_parse(buf, len, &niph);
+	th = nip_tcp_offset(&niph, ret, len);
+	if (th)
+		ret += nip_tcp_opts_parse(buf + th, len - th, 0);
+	if (len >= NIP_8BIT_ADDR_INDEX_MAX && decode_nip_addr(buf, &addr))
+		ret++;
+	return ret;
+}
+
+/* The burst decoder must give the same result as the scalar one */
+static void nip_decode_check(unsigned char *buf, unsigned int len)
+{
+	struct nip_hdr_decap niph = {0};
+	struct nip_hdr_decap burst = {0};
+	unsigned int th;
+	int ret;
+	int burst_ret;
+
+	ret = nip_hdr_parse(buf, len, &niph);
+	nip_hdr_parse_burst(&buf, &len, &burst, &burst_ret, 1);
+	if (ret != burst_ret || (ret >= 0 && memcmp(&niph, &burst, sizeof(niph)))) {
+		fprintf(stderr, "burst decode differs: %d != %d\n", ret, burst_ret);
+		abort();
+	}
+
+	/* The option parser must not read past doff even when payload follows */
+	th = nip_tcp_offset(&niph, ret, len);
+	if (th)
+		nip_tcp_opts_parse(buf + th, len - th, 1);
+}
+
+static unsigned long long nip_decode_cost(unsigned char *buf, unsigned int len)
+{
+	unsigned long long best = ~0ULL;
+	int i;
+
+	for (i = 0; i < NIP_COST_REPEAT; i++) {
+		unsigned long long start = nip_cycles();
+		unsigned long long cost;
+
+		nip_decode_one(buf, len);
+		cost = nip_cycles() - start;
+		if (cost < best)
+			best = cost;
+	}
+	return best;
+}
+
+/* Highest cost seen so far for each input length */
+static unsigned long long nip_cost_record[NIP_DECODE_INPUT_MAX + 1];
+
+static void nip_cost_save(const char *dir, const unsigned char *buf, unsigned int len,
+			  unsigned long long cost)
+{
+	char path[512];
+	FILE *fp;
+
+	if (cost <= nip_cost_record[len])
+		return;
+	nip_cost_record[len] = cost;
+
+	snprintf(path, sizeof(path), "%s/cost-%02u", dir, len);
+	fp = fopen(path, "wb");
+	if (!fp)
+		return;
+	fwrite(buf, 1, len, fp);
+	fclose(fp);
+}
+
+/* The input is copied to a buffer of its own size, so that a sanitizer
+ * sees every read past the end
+ */
+static void nip_decode_input(const uint8_t *data, size_t size, const char *cost_dir)
+{
+	unsigned int len = size > NIP_DECODE_INPUT_MAX ? NIP_DECODE_INPUT_MAX : size;
+	unsigned char *buf;
+
+	if (!len)
+		return;
+	buf = malloc(len);
+	if (!buf)
+		return;
+	memcpy(buf, data, len);
+
+	nip_decode_check(buf, len);
+	if (cost_dir)
+		nip_cost_save(cost_dir, buf, len, nip_decode_cost(buf, len));
+	free(buf);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static const char *cost_dir;
+	static int init;
+
+	if (!init) {
+		cost_dir = getenv("NIP_FUZZ_COST_DIR");
+		init = 1;
+	}
+	nip_decode_input(data, size, cost_dir);
+	return 0;
+}
+
+#ifdef NIP_DECODE_STANDALONE
+static struct nip_input inputs[NIP_MAX_INPUTS];
+static int input_num;
+
+static void load_file(const char *path)
+{
+	struct nip_input *in;
+	FILE *fp;
+
+	if (input_num >= NIP_MAX_INPUTS)
+		return;
+	fp = fopen(path, "rb");
+	if (!fp) {
+		perror(path);
+		return;
+	}
+	in = &inputs[input_num];
+	in->len = fread(in->data, 1, sizeof(in->data), fp);
+	fclose(fp);
+	if (!in->len)
+		return;
+	snprintf(in->name, sizeof(in->name), "%s", path);
+	input_num++;
+}
+
+static void load_path(const char *path)
+{
+	char file[512];
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+
+	if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+		load_file(path);
+		return;
+	}
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+		load_file(file);
+	}
+	closedir(dir);
+}
+
+static int bench(int rounds, double max_ns, int json)
+{
+	unsigned long long worst_cycles = 0;
+	double worst_cpb = 0;
+	double worst_ns = 0;
+	double total_ns = 0;
+	int worst = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < input_num; i++) {
+		struct nip_input *in = &inputs[i];
+		unsigned long long cycles;
+		double ns = 0;
+		int k;
+
+		nip_decode_check(in->data, in->len);
+		cycles = nip_decode_cost(in->data, in->len);
+
+		/* Best batch, so that a preemption does not count as decode time */
+		for (k = 0; k < NIP_BENCH_BATCHES; k++) {
+			unsigned long long start = nip_now_ns();
+			double batch_ns;
+
+			for (j = 0; j < rounds; j++)
+				nip_decode_one(in->data, in->len);
+			batch_ns = (double)(nip_now_ns() - start) / rounds;
+			if (!k || batch_ns < ns)
+				ns = batch_ns;
+		}
+
+		total_ns += ns;
+		if (ns > worst_ns) {
+			worst_ns = ns;
+			worst = i;
+		}
+		if (cycles > worst_cycles)
+			worst_cycles = cycles;
+		if ((double)cycles / in->len > worst_cpb)
+			worst_cpb = (double)cycles / in->len;
+	}
+
+	if (json)
+		printf("{\"test\": \"DECODE\", \"inputs\": %d, \"mean_ns\": %.1f, \"worst_ns\": %.1f, "
+		       "\"worst_cycles\": %llu, \"worst_cycles_per_byte\": %.1f, \"worst_input\": \"%s\"}\n",
+		       input_num, total_ns / input_num, worst_ns, worst_cycles, worst_cpb,
+		       inputs[worst].name);
+	else
+		printf("%d inputs, mean %.1f ns, worst %.1f ns (%s), worst %llu cycles, %.1f cycles/byte\n",
+		       input_num, total_ns / input_num, worst_ns, inputs[worst].name,
+		       worst_cycles, worst_cpb);
+
+	if (max_ns > 0 && worst_ns > max_ns) {
+		fprintf(stderr, "worst decode time %.1f ns is above the %.1f ns bound\n",
+			worst_ns, max_ns);
+		return 1;
+	}
+	return 0;
+}
+
+/* Byte flips, bitmap bit flips, insertions and truncations of a corpus entry */
+static unsigned int mutate(unsigned char *buf, unsigned int len)
+{
+	unsigned int pos = rand() % (len + 1);
+
+	switch (rand() % 5) {
+	case 0:
+		if (pos < len)
+			buf[pos] = rand();
+		break;
+	case 1:
+		if (pos < len)
+			buf[pos] ^= 1 << (rand() % NIP_ADDR_BIT_LEN_8);
+		break;
+	case 2:
+		if (len < NIP_DECODE_INPUT_MAX) {
+			memmove(buf + pos + 1, buf + pos, len - pos);
+			buf[pos] = rand();
+			len++;
+		}
+		break;
+	case 3:
+		if (len > 1)
+			len = 1 + rand() % len;
+		break;
+	default:
+		/* keep the bitmap chain going */
+		if (pos < len)
+			buf[pos] |= NIP_BITMAP_HAVE_MORE_BIT;
+		break;
+	}
+	return len;
+}
+
+static int fuzz(long iterations, const char *cost_dir)
+{
+	unsigned char buf[NIP_DECODE_INPUT_MAX];
+	unsigned int len;
+	long i;
+	int k;
+
+	if (!input_num) {
+		fprintf(stderr, "fuzzing needs at least one seed input\n");
+		return 1;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		struct nip_input *in = &inputs[rand() % input_num];
+
+		memcpy(buf, in->data, in->len);
+		len = in->len;
+		for (k = rand() % 4; k >= 0; k--)
+			len = mutate(buf, len);
+		nip_decode_input(buf, len, cost_dir);
+	}
+
+	for (k = 1; k <= NIP_DECODE_INPUT_MAX; k++)
+		if (nip_cost_record[k])
+			printf("len %2d: %llu cycles\n", k, nip_cost_record[k]);
+	return 0;
+}
+
+static void seed_save(const char *dir, const char *name, const unsigned char *buf,
+		      unsigned int len)
+{
+	char path[512];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "wb");
+	if (!fp) {
+		perror(path);
+		return;
+	}
+	fwrite(buf, 1, len, fp);
+	fclose(fp);
+}
+
+/* A SYN after a NewIP header with nexthdr TCP, the options are padded with
+ * EOL to a multiple of 4. doff is taken from the options unless given.
+ */
+static void tcp_seed_save(const char *dir, const char *name, const unsigned char *opts,
+			  unsigned int opt_len, unsigned int doff)
+{
+	unsigned char buf[NIP_DECODE_INPUT_MAX] = {0};
+	unsigned int len = 0;
+	unsigned int th;
+
+	buf[len++] = NIP_UDP_BITMAP_1;
+	buf[len++] = 0xff;
+	buf[len++] = IPPROTO_TCP;
+	buf[len++] = 0x05;
+	buf[len++] = 0x06;
+
+	th = len;
+	len += sizeof(struct tcphdr);
+	memcpy(buf + len, opts, opt_len);
+	len += (opt_len + 3) & ~3U;
+	buf[th + NIP_TCP_DOFF_BYTE] = (doff ? doff : (len - th) / 4) << NIP_TCP_DOFF_SHIFT;
+	buf[th + NIP_TCP_FLAGS_BYTE] = NIP_TCP_FLAG_SYN;
+	seed_save(dir, name, buf, len);
+}
+
+/* Hand-made seeds: the common UDP and TCP headers, bitmap chains of every
+ * length up to BITMAP_MAX and one more, each address length, and TCP
+ * options: long NOP runs, options cut by the end of the header and bad
+ * option lengths
+ */
+static int gen_seeds(const char *dir)
+{
+	static const unsigned char addrs[][NIP_8BIT_ADDR_INDEX_MAX] = {
+		{ 0x05 },
+		{ 0xdd, 0x20 },
+		{ 0xf1, 0x14, 0x00 },
+		{ 0xf2, 0x00, 0x01, 0x00, 0x00 },
+		{ 0xf3, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 },
+		{ 0xfe, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00 },
+	};
+	static const unsigned int addr_lens[] = { 1, 2, 3, 5, 7, 8 };
+	static const struct {
+		const char *name;
+		unsigned int nops;  /* NOPs in front of opts */
+		unsigned char opts[4];
+		unsigned int opt_len;
+		unsigned int doff;  /* 0 for the options' length */
+	} tcp_seeds[] = {
+		{ "tcpopt-mss",         0,  { TCPOPT_MSS, TCPOLEN_MSS, 0x05, 0xb4 }, 4 },
+		{ "tcpopt-nop-run",     36, { TCPOPT_MSS, TCPOLEN_MSS, 0x05, 0xb4 }, 4 },
+		{ "tcpopt-nop-only",    40, { 0 }, 0 },
+		{ "tcpopt-trunc-kind",  39, { TCPOPT_MSS }, 1 },
+		{ "tcpopt-trunc-len",   38, { TCPOPT_MSS, TCPOLEN_MSS }, 2 },
+		{ "tcpopt-trunc-doff",  0,  { TCPOPT_MSS, TCPOLEN_MSS, 0x05, 0xb4 }, 4, 15 },
+		{ "tcpopt-len0",        0,  { TCPOPT_MSS, 0, 0x05, 0xb4 }, 4 },
+		{ "tcpopt-len1",        0,  { TCPOPT_MSS, 1, 0x05, 0xb4 }, 4 },
+		{ "tcpopt-len3",        0,  { TCPOPT_MSS, 3, 0x05, 0xb4 }, 4 },
+		{ "tcpopt-len-long",    0,  { TCPOPT_MSS, 0xff, 0x05, 0xb4 }, 4 },
+		{ "tcpopt-unknown",     0,  { 0xfe, 4, 0x00, 0x00 }, 4 },
+	};
+	unsigned char buf[NIP_DECODE_INPUT_MAX + 1];
+	unsigned int len;
+	char name[64];
+	unsigned int i;
+
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		perror(dir);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(addr_lens) / sizeof(addr_lens[0]); i++) {
+		/* bitmap, ttl, next header, daddr, saddr, then payload */
+		len = 0;
+		buf[len++] = NIP_UDP_BITMAP_1;
+		buf[len++] = 0xff;
+		buf[len++] = 0x11;
+		memcpy(buf + len, addrs[i], addr_lens[i]);
+		len += addr_lens[i];
+		memcpy(buf + len, addrs[i], addr_lens[i]);
+		len += addr_lens[i];
+		memset(buf + len, 0, 8);
+		len += 8;
+		snprintf(name, sizeof(name), "udp-addr%u", addr_lens[i]);
+		seed_save(dir, name, buf, len);
+
+		/* every field, with a header length */
+		len = 0;
+		buf[len++] = NIP_NORMAL_BITMAP_1_INC_2 | NIP_BITMAP_INCLUDE_TCLASS;
+		buf[len++] = NIP_NORMAL_BITMAP_2;
+		buf[len++] = 0xff;
+		buf[len++] = 0x00;
+		buf[len++] = 0x40;
+		buf[len++] = 0x06;
+		buf[len++] = 0x10;
+		memcpy(buf + len, addrs[i], addr_lens[i]);
+		len += addr_lens[i];
+		memcpy(buf + len, addrs[i], addr_lens[i]);
+		len += addr_lens[i];
+		buf[len] = len + 1;
+		len++;
+		memset(buf + len, 0, 4);
+		len += 4;
+		snprintf(name, sizeof(name), "tcp-addr%u", addr_lens[i]);
+		seed_save(dir, name, buf, len > NIP_HDR_PARSE_MAX ? NIP_HDR_PARSE_MAX : len);
+	}
+
+	/* bitmap chains, the last one is one byte longer than allowed */
+	for (i = 2; i <= BITMAP_MAX + 1; i++) {
+		memset(buf, NIP_BITMAP_HAVE_MORE_BIT, i);
+		buf[0] = NIP_UDP_BITMAP_1_INC_2;
+		buf[1] = NIP_INVALID_BITMAP_2;
+		buf[i - 1] &= ~NIP_BITMAP_HAVE_MORE_BIT;
+		len = i;
+		buf[len++] = 0xff;
+		buf[len++] = 0x11;
+		memcpy(buf + len, addrs[5], 8);
+		len += 8;
+		memcpy(buf + len, addrs[5], 8);
+		len += 8;
+		buf[len] = len + 1;
+		len++;
+		snprintf(name, sizeof(name), "bitmap-chain%u", i);
+		seed_save(dir, name, buf, len > NIP_HDR_PARSE_MAX ? NIP_HDR_PARSE_MAX : len);
+	}
+
+	for (i = 0; i < sizeof(tcp_seeds) / sizeof(tcp_seeds[0]); i++) {
+		unsigned int nops = tcp_seeds[i].nops;
+
+		memset(buf, TCPOPT_NOP, nops);
+		memcpy(buf + nops, tcp_seeds[i].opts, tcp_seeds[i].opt_len);
+		tcp_seed_save(dir, tcp_seeds[i].name, buf, nops + tcp_seeds[i].opt_len,
+			      tcp_seeds[i].doff);
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("nip_decode_bench [-r rounds] [-m max ns] [-j] <file|dir>...\n");
+	printf("nip_decode_bench -f <iterations> -o <dir> [-s seed] <file|dir>...\n");
+	printf("nip_decode_bench -g <dir>\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *cost_dir = NULL;
+	int rounds = NIP_BENCH_ROUNDS;
+	long iterations = 0;
+	double max_ns = 0;
+	int json = 0;
+	int opt;
+	int i;
+
+	srand(1);
+	while ((opt = getopt(argc, argv, "r:m:jf:o:s:g:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'm':
+			max_ns = atof(optarg);
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'f':
+			iterations = atol(optarg);
+			break;
+		case 'o':
+			cost_dir = optarg;
+			break;
+		case 's':
+			srand(atoi(optarg));
+			break;
+		case 'g':
+			return gen_seeds(optarg);
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	for (i = optind; i < argc; i++)
+		load_path(argv[i]);
+	if (!input_num || rounds <= 0) {
+		usage();
+		return 1;
+	}
+
+	if (iterations) {
+		if (!cost_dir) {
+			usage();
+			return 1;
+		}
+		if (mkdir(cost_dir, 0755) && errno != EEXIST) {
+			perror(cost_dir);
+			return 1;
+		}
+		return fuzz(iterations, cost_dir);
+	}
+	return bench(rounds, max_ns, json);
+}
+#endif /* NIP_DECODE_STANDALONE */
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "libnip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "nip_lib.h"
+
+/* Event loop example on libnip: one epoll loop serving a UDP echo with
+ * recvmmsg/sendmmsg batches and a TCP echo with non-blocking sockets.
+ *
+ * ./nip_evloop -s <addr> [-u port] [-t port] [-f features] [-a]
+ *   -u  UDP port (default 9090), 0 to disable
+ *   -t  TCP port (default 5556), 0 to disable
+ *   -f  libnip features to request, e.g. 0x26 for timestamps, drop counter
+ *       and busy poll (see NIP_FEAT_* in libnip.h)
+ *   -a  accept connections in batches with nip_accept_batch()
+ * Counters are printed every second.
+ */
+#define EV_MAX        64
+#define EV_BUF_LEN    2048
+#define EV_TCP_BUF    65536
+#define EV_TIMEOUT_MS 1000
+
+struct ev_conn {
+	int fd;
+	unsigned int len;  /* bytes waiting to be echoed */
+	unsigned char buf[EV_TCP_BUF];
+};
+
+struct ev_stats {
+	unsigned long long udp_pkts;
+	unsigned long long udp_bytes;
+	unsigned long long tcp_bytes;
+	unsigned long long conns;
+	unsigned int drops;
+};
+
+static volatile int g_stop;
+static int g_accept_batch;
+static struct ev_stats g_stats;
+
+static void ev_sig(int sig)
+{
+	g_stop = 1;
+}
+
+static int ev_add(int ep, int fd, unsigned int events, void *ptr)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = ptr };
+
+	return epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int ev_mod(int ep, int fd, unsigned int events, void *ptr)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = ptr };
+
+	return epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static int ev_bind(int type, const struct nip_addr *addr, unsigned short port,
+		   unsigned int *features)
+{
+	struct sockaddr_nin sin;
+	int fd = nip_socket(type, features, 0);
+
+	if (fd < 0)
+		return -1;
+	nip_sockaddr_set(&sin, addr, port);
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) ||
+	    (type == SOCK_STREAM && listen(fd, SOMAXCONN))) {
+		printf("bind port %u fail, errno=%d\n", port, errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Echo a whole burst back with one sendmmsg */
+static void ev_udp(int fd, struct nip_batch *b, unsigned char (*bufs)[EV_BUF_LEN])
+{
+	for (;;) {
+		int n;
+		int i;
+
+		nip_batch_reset(b);
+		for (i = 0; i < NIP_BATCH_MAX; i++)
+			nip_batch_add(b, bufs[i], EV_BUF_LEN, NULL);
+		n = nip_batch_recv(fd, b, MSG_DONTWAIT);
+		if (n <= 0)
+			return;
+
+		b->num = n;
+		for (i = 0; i < n; i++) {
+			g_stats.udp_bytes += b->msgs[i].len;
+			if (b->msgs[i].drops > g_stats.drops)
+				g_stats.drops = b->msgs[i].drops;
+		}
+		g_stats.udp_pkts += n;
+		nip_batch_send(fd, b, MSG_DONTWAIT);
+		if (n < NIP_BATCH_MAX)
+			return;
+	}
+}
+
+static void ev_conn_close(struct ev_conn *c)
+{
+	close(c->fd);
+	free(c);
+}
+
+/* Read what is there and echo it, waiting for EPOLLOUT if the socket is full */
+static void ev_tcp(int ep, struct ev_conn *c, unsigned int events)
+{
+	for (;;) {
+		ssize_t ret;
+
+		if (c->len) {
+			ret = send(c->fd, c->buf, c->len, MSG_DONTWAIT);
+			if (ret < 0 && errno != EAGAIN)
+				goto close;
+			if (ret > 0) {
+				memmove(c->buf, c->buf + ret, c->len - ret);
+				c->len -= ret;
+			}
+			if (c->len) {
+				ev_mod(ep, c->fd, EPOLLOUT, c);
+				return;
+			}
+			if (events & EPOLLOUT) {
+				ev_mod(ep, c->fd, EPOLLIN, c);
+				events &= ~EPOLLOUT;
+			}
+		}
+
+		ret = recv(c->fd, c->buf, sizeof(c->buf), MSG_DONTWAIT);
+		if (ret == 0 || (ret < 0 && errno != EAGAIN))
+			goto close;
+		if (ret < 0)
+			return;
+		c->len = ret;
+		g_stats.tcp_bytes += ret;
+	}
+close:
+	ev_conn_close(c);
+}
+
+static void ev_conn_add(int ep, int fd)
+{
+	struct ev_conn *c = malloc(sizeof(*c));
+
+	if (!c) {
+		close(fd);
+		return;
+	}
+	c->fd = fd;
+	c->len = 0;
+	if (ev_add(ep, fd, EPOLLIN, c)) {
+		ev_conn_close(c);
+		return;
+	}
+	g_stats.conns++;
+}
+
+static void ev_accept(int ep, int lfd)
+{
+	int fds[EV_MAX];
+
+	for (;;) {
+		int n = 1;
+		int i;
+
+		if (g_accept_batch)
+			n = nip_accept_batch(lfd, fds, EV_MAX, SOCK_NONBLOCK);
+		else
+			fds[0] = accept4(lfd, NULL, NULL, SOCK_NONBLOCK);
+		if (n <= 0 || fds[0] < 0)
+			return;
+		for (i = 0; i < n; i++)
+			ev_conn_add(ep, fds[i]);
+	}
+}
+
+static void ev_report(void)
+{
+	static struct ev_stats last;
+
+	printf("udp %llu pkt/s %llu B/s, tcp %llu B/s, conns %llu, drops %u\n",
+	       g_stats.udp_pkts - last.udp_pkts, g_stats.udp_bytes - last.udp_bytes,
+	       g_stats.tcp_bytes - last.tcp_bytes, g_stats.conns, g_stats.drops);
+	last = g_stats;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char udp_bufs[NIP_BATCH_MAX][EV_BUF_LEN];
+	static struct nip_batch batch;
+	struct epoll_event events[EV_MAX];
+	unsigned short udp_port = UDP_SERVER_PORT;
+	unsigned short tcp_port = TCP_SERVER_PORT;
+	unsigned int want = NIP_FEAT_NONBLOCK;
+	unsigned int udp_feat;
+	unsigned int tcp_feat;
+	struct nip_addr addr;
+	int udp_fd = -1;
+	int tcp_fd = -1;
+	int have_addr = 0;
+	time_t last;
+	int ep;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:u:t:f:a")) != -1) {
+		switch (opt) {
+		case 's':
+			if (nip_addr_parse(optarg, &addr)) {
+				printf("bad address %s\n", optarg);
+				return -1;
+			}
+			have_addr = 1;
+			break;
+		case 'u':
+			udp_port = atoi(optarg);
+			break;
+		case 't':
+			tcp_port = atoi(optarg);
+			break;
+		case 'f':
+			want |= strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			g_accept_batch = 1;
+			break;
+		default:
+			have_addr = 0;
+			optind = argc;
+			break;
+		}
+	}
+	if (!have_addr) {
+		printf("usage: %s -s <addr> [-u udp port] [-t tcp port] [-f features] [-a]\n", argv[0]);
+		return -1;
+	}
+
+	ep = epoll_create1(0);
+	if (ep < 0)
+		return -1;
+
+	if (udp_port) {
+		udp_feat = want;
+		udp_fd = ev_bind(SOCK_DGRAM, &addr, udp_port, &udp_feat);
+		if (udp_fd < 0 || ev_add(ep, udp_fd, EPOLLIN, &udp_fd))
+			return -1;
+		nip_batch_init(&batch, udp_feat, 0);
+		printf("udp port %u, features 0x%x of 0x%x\n", udp_port, udp_feat, want);
+	}
+	if (tcp_port) {
+		tcp_feat = want & ~NIP_FEAT_GSO;
+		tcp_fd = ev_bind(SOCK_STREAM, &addr, tcp_port, &tcp_feat);
+		if (tcp_fd < 0 || ev_add(ep, tcp_fd, EPOLLIN, &tcp_fd))
+			return -1;
+		printf("tcp port %u, features 0x%x of 0x%x\n", tcp_port, tcp_feat, want);
+	}
+
+	signal(SIGINT, ev_sig);
+	signal(SIGTERM, ev_sig);
+	last = time(NULL);
+	while (!g_stop) {
+		int n = epoll_wait(ep, events, EV_MAX, EV_TIMEOUT_MS);
+		int i;
+
+		for (i = 0; i < n; i++) {
+			void *ptr = events[i].data.ptr;
+
+			if (ptr == &udp_fd)
+				ev_udp(udp_fd, &batch, udp_bufs);
+			else if (ptr == &tcp_fd)
+				ev_accept(ep, tcp_fd);
+			else
+				ev_tcp(ep, ptr, events[i].events);
+		}
+
+		if (time(NULL) != last) {
+			last = time(NULL);
+			ev_report();
+		}
+	}
+
+	close(ep);
+	return 0;
+}
@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nip_uapi.h"
+
+/* Collector for the NewIP flow table (CONFIG_NEWIP_FLOW_ACCT): switches
+ * accounting on, drains /proc/net/nip_flow_export every interval and
+ * prints one CSV line per flow. The table is per CPU, the records of a flow
+ * exported in one interval are added up, cpus is how many there were and
+ * reason is the one of the latest record.
+ *   nip_flow [-i interval s] [-n rounds] [-k]
+ *   -k  keep accounting on at exit, otherwise the table is flushed and
+ *       switched off
+ */
+
+#define NIP_FLOW_CTL     "/proc/net/nip_flow"
+#define NIP_FLOW_EXPORT  "/proc/net/nip_flow_export"
+#define NIP_FLOW_BATCH   256
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static int flow_ctl(const char *cmd)
+{
+	int fd = open(NIP_FLOW_CTL, O_WRONLY);
+	int ret;
+
+	if (fd < 0) {
+		perror(NIP_FLOW_CTL);
+		return -1;
+	}
+	ret = write(fd, cmd, strlen(cmd)) < 0 ? -1 : 0;
+	if (ret)
+		perror(cmd);
+	close(fd);
+	return ret;
+}
+
+static void print_addr(const struct nip_addr *addr)
+{
+	int i;
+
+	for (i = 0; i < addr->bitlen / NIP_ADDR_BIT_LEN_8; i++)
+		printf("%02x", addr->nip_addr_field8[i]);
+	printf(",");
+}
+
+static const char *reason_name(unsigned char reason)
+{
+	switch (reason) {
+	case NIP_FLOW_END_IDLE:
+		return "idle";
+	case NIP_FLOW_END_ACTIVE:
+		return "active";
+	case NIP_FLOW_END_FORCED:
+		return "forced";
+	default:
+		return "unknown";
+	}
+}
+
+static int addr_cmp(const struct nip_addr *a, const struct nip_addr *b)
+{
+	if (a->bitlen != b->bitlen)
+		return a->bitlen < b->bitlen ? -1 : 1;
+	return memcmp(a->nip_addr_field8, b->nip_addr_field8, a->bitlen / NIP_ADDR_BIT_LEN_8);
+}
+
+/* Order by flow key, the records of one flow end up next to each other */
+static int rec_cmp(const void *pa, const void *pb)
+{
+	const struct nip_flow_record *a = pa;
+	const struct nip_flow_record *b = pb;
+	int ret;
+
+	if (a->netns != b->netns)
+		return a->netns < b->netns ? -1 : 1;
+	if (a->dir != b->dir)
+		return a->dir - b->dir;
+	if (a->nexthdr != b->nexthdr)
+		return a->nexthdr - b->nexthdr;
+	if (a->sport != b->sport)
+		return a->sport - b->sport;
+	if (a->dport != b->dport)
+		return a->dport - b->dport;
+	ret = addr_cmp(&a->saddr, &b->saddr);
+	return ret ? ret : addr_cmp(&a->daddr, &b->daddr);
+}
+
+static void print_flow(const struct nip_flow_record *r, unsigned int cpus)
+{
+	printf("%llu,%llu,%s,", r->first_ms, r->last_ms,
+	       r->dir == NIP_FLOW_DIR_IN ? "in" : "out");
+	print_addr(&r->saddr);
+	print_addr(&r->daddr);
+	printf("%u,%u,%u,%llu,%llu,%u,%u,%s\n", r->nexthdr, ntohs(r->sport),
+	       ntohs(r->dport), r->packets, r->bytes, r->netns, cpus,
+	       reason_name(r->reason));
+}
+
+/* Sort by key and print one line per run of equal keys */
+static int merge_print(struct nip_flow_record *recs, size_t num)
+{
+	int flows = 0;
+	size_t i = 0;
+
+	if (!num)
+		return 0;
+	qsort(recs, num, sizeof(recs[0]), rec_cmp);
+	while (i < num) {
+		struct nip_flow_record flow = recs[i];
+		unsigned int cpus = 1;
+
+		for (i++; i < num && !rec_cmp(&flow, &recs[i]); i++, cpus++) {
+			flow.packets += recs[i].packets;
+			flow.bytes += recs[i].bytes;
+			if (recs[i].first_ms < flow.first_ms)
+				flow.first_ms = recs[i].first_ms;
+			if (recs[i].last_ms >= flow.last_ms) {
+				flow.last_ms = recs[i].last_ms;
+				flow.reason = recs[i].reason;
+			}
+		}
+		print_flow(&flow, cpus);
+		flows++;
+	}
+	fflush(stdout);
+	return flows;
+}
+
+/* Read until the ring is empty, every read returns a batch of records */
+static int drain(int fd)
+{
+	struct nip_flow_record *recs = NULL;
+	size_t size = 0;
+	size_t num = 0;
+	ssize_t len;
+	int flows;
+
+	for (;;) {
+		if (num + NIP_FLOW_BATCH > size) {
+			struct nip_flow_record *p;
+
+			size = size ? size * 2 : NIP_FLOW_BATCH;
+			p = realloc(recs, size * sizeof(*recs));
+			if (!p) {
+				len = -1;
+				break;
+			}
+			recs = p;
+		}
+
+		len = pread(fd, recs + num, NIP_FLOW_BATCH * sizeof(*recs), 0);
+		if (len <= 0)
+			break;
+		num += len / sizeof(*recs);
+	}
+
+	/* What was read before an error is printed as well */
+	flows = merge_print(recs, num);
+	free(recs);
+	return len < 0 ? -1 : flows;
+}
+
+int main(int argc, char **argv)
+{
+	int interval = 1;
+	int rounds = 0;
+	int keep = 0;
+	int round;
+	int opt;
+	int fd;
+
+	while ((opt = getopt(argc, argv, "i:n:kh")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		default:
+			printf("nip_flow [-i interval s] [-n rounds] [-k]\n");
+			return 1;
+		}
+	}
+	if (interval <= 0)
+		interval = 1;
+
+	fd = open(NIP_FLOW_EXPORT, O_RDONLY);
+	if (fd < 0) {
+		perror(NIP_FLOW_EXPORT);
+		return 1;
+	}
+	if (flow_ctl("on")) {
+		close(fd);
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	printf("first_ms,last_ms,dir,saddr,daddr,nexthdr,sport,dport,packets,bytes,netns,cpus,reason\n");
+	for (round = 0; !stop && (!rounds || round < rounds); round++) {
+		sleep(interval);
+		if (drain(fd) < 0) {
+			perror(NIP_FLOW_EXPORT);
+			break;
+		}
+	}
+
+	if (!keep) {
+		flow_ctl("off");
+		drain(fd);
+	}
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,1095 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_packet.h>
+#include <linux/if_xdp.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "nip_hdr.h"
+
+/* Userspace NewIP forwarder: frames are decoded with nip_hdr_parse() from
+ * src/common, the destination is looked up in a longest prefix match FIB,
+ * TTL is decremented, the MACs are rewritten and the frame leaves on the
+ * route's port. Headers of an RX batch are decoded together with
+ * nip_hdr_parse_burst(). One run-to-completion worker per queue, pinned to
+ * a CPU, serves that queue on every port with batched RX and TX.
+ *
+ * AF_XDP is used when the kernel accepts the XDP program (only NewIP frames
+ * are redirected, the rest goes up the stack), AF_PACKET with recvmmsg /
+ * sendmmsg otherwise. Frames are copied once from the RX to the TX UMEM.
+ *
+ * ./nip_fwd -i <ifname> [-i <ifname> ...] -r <addr>[/bits],<ifname>,<next hop mac> ...
+ *           [-w workers] [-c first cpu] [-t seconds] [-P] [-S] [-z]
+ *           [-g <daddr>,<saddr>,<dst mac> [-l payload len]]
+ *   -w  workers, worker i serves queue i of every port (default 1)
+ *   -P  AF_PACKET only, -S generic (skb) XDP, -z force zero-copy
+ *   -g  generator: send frames built with nip_hdr_comm_encap() out of the
+ *       first port instead of forwarding
+ *
+ * Benchmark on veth: gen ns --veth-- fwd ns --veth-- sink ns, with the
+ * generator and the sink being nip_fwd as well (a sink is a forwarder
+ * without routes, its rx counter is the delivered rate). Every worker
+ * prints its Mpps once per second.
+ */
+#define ETH_P_NEWIP         0xEADD
+#define FWD_PORT_MAX        4
+#define FWD_WORKER_MAX      64
+#define FWD_ROUTE_MAX       4096
+#define FWD_BATCH           64
+#define FWD_FRAME_SIZE      2048
+#define FWD_FRAME_NUM       4096
+#define FWD_RING_SIZE       2048
+#define FWD_GEN_LEN_DEF     64
+#define FWD_ADDR_BYTES      (NIP_ADDR_BIT_LEN_MAX / NIP_ADDR_BIT_LEN_8)
+#define FWD_CACHELINE       64
+#define NSEC_PER_SEC        1000000000ULL
+#define MPPS_DIV            1000000.0
+
+struct fwd_port {
+	char name[IF_NAMESIZE];
+	int ifindex;
+	unsigned char mac[ETH_ALEN];
+	int xsk_map_fd;
+	int link_fd;
+};
+
+/* Longest prefix match: one open addressing table keyed on (prefix, len),
+ * probed from the longest configured prefix length down. Read only once
+ * the workers run.
+ */
+struct fwd_route {
+	uint64_t prefix;
+	uint8_t plen;
+	uint8_t used;
+	uint8_t port;
+	unsigned char mac[ETH_ALEN];
+};
+
+struct fwd_fib {
+	struct fwd_route *slots;
+	uint32_t mask;
+	uint8_t plens[NIP_ADDR_BIT_LEN_MAX + 1];
+	int plen_num;
+};
+
+struct fwd_stats {
+	uint64_t rx;
+	uint64_t tx;
+	uint64_t drop_decap;
+	uint64_t drop_route;
+	uint64_t drop_ttl;
+	uint64_t drop_tx;
+} __attribute__((aligned(FWD_CACHELINE)));
+
+struct xsk_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *desc;
+	uint32_t size;
+	uint32_t mask;
+	uint32_t cached_prod;
+	uint32_t cached_cons;
+	void *map;
+	size_t map_len;
+};
+
+struct xsk {
+	int fd;
+	unsigned char *umem;
+	struct xsk_ring rx;
+	struct xsk_ring tx;
+	struct xsk_ring fq;
+	struct xsk_ring cq;
+	uint64_t free_frames[FWD_FRAME_NUM];
+	uint32_t free_num;
+	uint32_t tx_pending;
+};
+
+struct fwd_worker {
+	pthread_t th;
+	int id;
+	struct fwd_stats stats;
+	struct xsk *xsks[FWD_PORT_MAX];
+	int pkt_fds[FWD_PORT_MAX];
+};
+
+struct fwd_cfg {
+	struct fwd_port ports[FWD_PORT_MAX];
+	int port_num;
+	struct fwd_fib fib;
+	int workers;
+	int first_cpu;
+	int secs;
+	int use_packet;
+	uint32_t xdp_flags;
+	uint16_t bind_flags;
+	int gen;
+	unsigned char gen_frame[FWD_FRAME_SIZE];
+	uint32_t gen_len;
+};
+
+static struct fwd_cfg g_cfg;
+static struct fwd_worker g_workers[FWD_WORKER_MAX];
+static volatile int g_stop;
+
+static void fwd_sig(int sig)
+{
+	g_stop = 1;
+}
+
+/* Address parsing and FIB */
+static uint64_t fwd_addr_key(const struct nip_addr *addr)
+{
+	uint64_t key = 0;
+	int len = addr->bitlen / NIP_ADDR_BIT_LEN_8;
+
+	for (int i = 0; i < FWD_ADDR_BYTES; i++)
+		key = (key << NIP_ADDR_BIT_LEN_8) | (i < len ? addr->nip_addr_field8[i] : 0);
+	return key;
+}
+
+static uint64_t fwd_prefix_mask(int plen)
+{
+	return plen ? ~0ULL << (NIP_ADDR_BIT_LEN_MAX - plen) : 0;
+}
+
+static uint32_t fwd_fib_hash(uint64_t prefix, int plen)
+{
+	uint64_t h = (prefix ^ (uint64_t)plen) * 0x9E3779B97F4A7C15ULL;
+
+	return (uint32_t)(h >> 32);
+}
+
+static int fwd_fib_add(struct fwd_fib *fib, uint64_t key, int plen, int port,
+		       const unsigned char *mac)
+{
+	uint64_t prefix = key & fwd_prefix_mask(plen);
+	uint32_t i = fwd_fib_hash(prefix, plen) & fib->mask;
+	int j;
+
+	while (fib->slots[i].used) {
+		if (fib->slots[i].prefix == prefix && fib->slots[i].plen == plen)
+			break;
+		i = (i + 1) & fib->mask;
+	}
+	fib->slots[i].prefix = prefix;
+	fib->slots[i].plen = plen;
+	fib->slots[i].port = port;
+	fib->slots[i].used = 1;
+	memcpy(fib->slots[i].mac, mac, ETH_ALEN);
+
+	/* Keep the prefix lengths sorted, longest first */
+	for (j = 0; j < fib->plen_num; j++) {
+		if (fib->plens[j] == plen)
+			return 0;
+		if (fib->plens[j] < plen)
+			break;
+	}
+	memmove(&fib->plens[j + 1], &fib->plens[j], fib->plen_num - j);
+	fib->plens[j] = plen;
+	fib->plen_num++;
+	return 0;
+}
+
+static const struct fwd_route *fwd_fib_lookup(const struct fwd_fib *fib, uint64_t key)
+{
+	for (int j = 0; j < fib->plen_num; j++) {
+		int plen = fib->plens[j];
+		uint64_t prefix = key & fwd_prefix_mask(plen);
+		uint32_t i = fwd_fib_hash(prefix, plen) & fib->mask;
+
+		while (fib->slots[i].used) {
+			if (fib->slots[i].prefix == prefix && fib->slots[i].plen == plen)
+				return &fib->slots[i];
+			i = (i + 1) & fib->mask;
+		}
+	}
+	return NULL;
+}
+
+static int fwd_parse_addr(const char *str, struct nip_addr *addr)
+{
+	unsigned char buf[FWD_ADDR_BYTES] = {0};
+	size_t len = strlen(str);
+	unsigned char *end;
+
+	if (!len || len % 2 || len / 2 > sizeof(buf))
+		return -1;
+	for (size_t i = 0; i < len / 2; i++) {
+		unsigned int byte;
+
+		if (sscanf(str + i * 2, "%2x", &byte) != 1)
+			return -1;
+		buf[i] = byte;
+	}
+	memset(addr, 0, sizeof(*addr));
+	end = decode_nip_addr(buf, addr);
+	return end && (size_t)(end - buf) == len / 2 ? 0 : -1;
+}
+
+static int fwd_parse_mac(const char *str, unsigned char *mac)
+{
+	unsigned int b[ETH_ALEN];
+
+	if (sscanf(str, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != ETH_ALEN)
+		return -1;
+	for (int i = 0; i < ETH_ALEN; i++)
+		mac[i] = b[i];
+	return 0;
+}
+
+static int fwd_port_index(struct fwd_cfg *cfg, const char *name)
+{
+	for (int i = 0; i < cfg->port_num; i++) {
+		if (!strcmp(cfg->ports[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+/* <addr>[/bits],<ifname>,<mac> */
+static int fwd_parse_route(struct fwd_cfg *cfg, char *arg)
+{
+	char *addr_str = strtok(arg, ",");
+	char *dev = strtok(NULL, ",");
+	char *mac_str = strtok(NULL, ",");
+	char *slash = addr_str ? strchr(addr_str, '/') : NULL;
+	unsigned char mac[ETH_ALEN];
+	struct nip_addr addr;
+	int plen;
+	int port;
+
+	if (!addr_str || !dev || !mac_str)
+		return -1;
+	if (slash)
+		*slash = '\0';
+	if (fwd_parse_addr(addr_str, &addr) || fwd_parse_mac(mac_str, mac))
+		return -1;
+	plen = slash ? atoi(slash + 1) : addr.bitlen;
+	port = fwd_port_index(cfg, dev);
+	if (plen < 0 || plen > addr.bitlen || port < 0) {
+		printf("bad route %s (port %s must be given with -i first)\n", addr_str, dev);
+		return -1;
+	}
+	return fwd_fib_add(&cfg->fib, fwd_addr_key(&addr), plen, port, mac);
+}
+
+/* Forwarding: the egress port if the frame goes out, -1 if it is dropped */
+static int fwd_packet(struct fwd_cfg *cfg, struct fwd_stats *st, unsigned char *frame,
+		      const struct nip_hdr_decap *niph, int hdr_ret)
+{
+	struct ethhdr *eth = (struct ethhdr *)frame;
+	const struct fwd_route *rt;
+	unsigned char *hdr = frame + ETH_HLEN;
+	int ttl_off = 0;
+
+	if (hdr_ret < 0) {
+		st->drop_decap++;
+		return -1;
+	}
+
+	rt = fwd_fib_lookup(&cfg->fib, fwd_addr_key(&niph->daddr));
+	if (!rt) {
+		st->drop_route++;
+		return -1;
+	}
+
+	/* TTL is the first field after the bitmaps */
+	while (hdr[ttl_off++] & NIP_BITMAP_HAVE_MORE_BIT)
+		;
+	if (hdr[ttl_off] <= 1) {
+		st->drop_ttl++;
+		return -1;
+	}
+	hdr[ttl_off]--;
+
+	memcpy(eth->h_dest, rt->mac, ETH_ALEN);
+	memcpy(eth->h_source, cfg->ports[rt->port].mac, ETH_ALEN);
+	return rt->port;
+}
+
+/* The headers of a burst are decoded together by nip_hdr_parse_burst(),
+ * ports[i] is the fwd_packet() result of frames[i]
+ */
+static void fwd_burst(struct fwd_cfg *cfg, struct fwd_stats *st, unsigned char *frames[],
+		      const uint32_t lens[], int ports[], unsigned int n)
+{
+	struct nip_hdr_decap niphs[FWD_BATCH];
+	unsigned char *hdrs[FWD_BATCH];
+	unsigned int hdr_lens[FWD_BATCH];
+	unsigned int idx[FWD_BATCH];
+	int rets[FWD_BATCH];
+	unsigned int num = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		struct ethhdr *eth = (struct ethhdr *)frames[i];
+
+		if (lens[i] <= ETH_HLEN || eth->h_proto != htons(ETH_P_NEWIP)) {
+			st->drop_decap++;
+			ports[i] = -1;
+			continue;
+		}
+		idx[num] = i;
+		hdrs[num] = frames[i] + ETH_HLEN;
+		hdr_lens[num] = lens[i] - ETH_HLEN;
+		num++;
+	}
+
+	memset(niphs, 0, sizeof(niphs[0]) * num);
+	nip_hdr_parse_burst(hdrs, hdr_lens, niphs, rets, num);
+	for (i = 0; i < num; i++)
+		ports[idx[i]] = fwd_packet(cfg, st, frames[idx[i]], &niphs[i], rets[i]);
+}
+
+/* Generator frame: Ethernet + NewIP (nip_hdr_comm_encap) + UDP + zeros */
+static int fwd_build_gen_frame(struct fwd_cfg *cfg, const struct nip_addr *daddr,
+			       const struct nip_addr *saddr, const unsigned char *dmac,
+			       uint32_t payload)
+{
+	struct ethhdr *eth = (struct ethhdr *)cfg->gen_frame;
+	struct nip_hdr_encap head = {0};
+	unsigned short udp_len = NIP_UDP_HDR_LEN + payload;
+
+	memcpy(eth->h_dest, dmac, ETH_ALEN);
+	memcpy(eth->h_source, cfg->ports[0].mac, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_NEWIP);
+
+	head.daddr = *daddr;
+	head.saddr = *saddr;
+	head.ttl = NIP_DEFAULT_TTL;
+	head.nexthdr = IPPROTO_UDP;
+	head.hdr_buf = cfg->gen_frame + ETH_HLEN;
+	nip_hdr_comm_encap(&head);
+	if (ETH_HLEN + head.hdr_buf_pos + udp_len > FWD_FRAME_SIZE)
+		return -1;
+	nip_update_total_len(&head, htons(head.hdr_buf_pos + udp_len));
+	nip_build_udp_hdr(htons(FWD_GEN_LEN_DEF), htons(FWD_GEN_LEN_DEF), htons(udp_len),
+			  head.hdr_buf + head.hdr_buf_pos, 0);
+	cfg->gen_len = ETH_HLEN + head.hdr_buf_pos + udp_len;
+	return 0;
+}
+
+/* AF_XDP, raw syscalls so that no libbpf is needed */
+static long sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+#define INSN(c, d, s, o, i) \
+	((struct bpf_insn) { .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+
+/* Redirect NewIP frames to the XSK of their RX queue, pass everything else */
+static int fwd_xdp_load(int map_fd)
+{
+	struct bpf_insn prog[] = {
+		INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),            /* r6 = ctx */
+		INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 6, 0, 0),              /* r2 = data */
+		INSN(BPF_LDX | BPF_MEM | BPF_W, 3, 6, 4, 0),              /* r3 = data_end */
+		INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+		INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, ETH_HLEN),
+		INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 8, 0),              /* short: pass */
+		INSN(BPF_LDX | BPF_MEM | BPF_H, 4, 2, 12, 0),             /* r4 = h_proto */
+		INSN(BPF_JMP | BPF_JNE | BPF_K, 4, 0, 6, htons(ETH_P_NEWIP)),
+		INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 6, 16, 0),             /* rx_queue_index */
+		INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+		INSN(0, 0, 0, 0, 0),
+		INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),     /* no XSK: pass */
+		INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+		INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+	static char log[4096];
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uint64_t)(unsigned long)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (uint64_t)(unsigned long)"Dual BSD/GPL";
+	attr.log_buf = (uint64_t)(unsigned long)log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0)
+		printf("xdp prog load failed: %s\n%s\n", strerror(errno), log);
+	return fd;
+}
+
+static int fwd_xdp_attach(struct fwd_cfg *cfg, struct fwd_port *port)
+{
+	union bpf_attr attr;
+	int prog_fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(int);
+	attr.value_size = sizeof(int);
+	attr.max_entries = cfg->workers;
+	port->xsk_map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (port->xsk_map_fd < 0)
+		return -1;
+
+	prog_fd = fwd_xdp_load(port->xsk_map_fd);
+	if (prog_fd < 0)
+		return -1;
+
+	/* The link goes away with the process, no stale program is left */
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = prog_fd;
+	attr.link_create.target_ifindex = port->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = cfg->xdp_flags;
+	port->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	close(prog_fd);
+	if (port->link_fd < 0) {
+		printf("xdp attach to %s failed: %s\n", port->name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int xsk_map_ring(int fd, struct xsk_ring *r, const struct xdp_ring_offset *off,
+			size_t desc_size, off_t pgoff)
+{
+	r->map_len = off->desc + FWD_RING_SIZE * desc_size;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		      fd, pgoff);
+	if (r->map == MAP_FAILED)
+		return -1;
+	r->producer = (uint32_t *)((char *)r->map + off->producer);
+	r->consumer = (uint32_t *)((char *)r->map + off->consumer);
+	r->flags = (uint32_t *)((char *)r->map + off->flags);
+	r->desc = (char *)r->map + off->desc;
+	r->size = FWD_RING_SIZE;
+	r->mask = FWD_RING_SIZE - 1;
+	r->cached_prod = *r->producer;
+	r->cached_cons = *r->consumer;
+	return 0;
+}
+
+/* Free slots of a ring the application produces to (fill, tx) */
+static uint32_t ring_prod_free(struct xsk_ring *r)
+{
+	uint32_t free = r->size - (r->cached_prod - r->cached_cons);
+
+	if (free)
+		return free;
+	r->cached_cons = __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE);
+	return r->size - (r->cached_prod - r->cached_cons);
+}
+
+/* Entries of a ring the application consumes from (rx, completion) */
+static uint32_t ring_cons_avail(struct xsk_ring *r, uint32_t max)
+{
+	uint32_t avail = r->cached_prod - r->cached_cons;
+
+	if (!avail) {
+		r->cached_prod = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE);
+		avail = r->cached_prod - r->cached_cons;
+	}
+	return avail < max ? avail : max;
+}
+
+static void ring_submit(struct xsk_ring *r)
+{
+	__atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+}
+
+static void ring_release(struct xsk_ring *r)
+{
+	__atomic_store_n(r->consumer, r->cached_cons, __ATOMIC_RELEASE);
+}
+
+static void xsk_fill(struct xsk *x, uint64_t addr)
+{
+	((uint64_t *)x->fq.desc)[x->fq.cached_prod++ & x->fq.mask] = addr;
+}
+
+static struct xsk *xsk_create(struct fwd_cfg *cfg, struct fwd_port *port, int queue)
+{
+	struct xdp_umem_reg mr = {0};
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp = {0};
+	socklen_t optlen = sizeof(off);
+	int ring = FWD_RING_SIZE;
+	struct xsk *x = calloc(1, sizeof(*x));
+
+	if (!x)
+		return NULL;
+	x->fd = socket(AF_XDP, SOCK_RAW, 0);
+	x->umem = mmap(NULL, FWD_FRAME_NUM * FWD_FRAME_SIZE, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (x->fd < 0 || x->umem == MAP_FAILED)
+		goto err;
+
+	mr.addr = (uint64_t)(unsigned long)x->umem;
+	mr.len = FWD_FRAME_NUM * FWD_FRAME_SIZE;
+	mr.chunk_size = FWD_FRAME_SIZE;
+	if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring, sizeof(ring)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring, sizeof(ring)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &ring, sizeof(ring)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &ring, sizeof(ring)) ||
+	    getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen))
+		goto err;
+
+	if (xsk_map_ring(x->fd, &x->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+	    xsk_map_ring(x->fd, &x->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) ||
+	    xsk_map_ring(x->fd, &x->fq, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+	    xsk_map_ring(x->fd, &x->cq, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING))
+		goto err;
+
+	/* First half of the UMEM receives, the second half transmits */
+	for (uint32_t i = 0; i < FWD_FRAME_NUM / 2; i++)
+		xsk_fill(x, (uint64_t)i * FWD_FRAME_SIZE);
+	ring_submit(&x->fq);
+	for (uint32_t i = FWD_FRAME_NUM / 2; i < FWD_FRAME_NUM; i++)
+		x->free_frames[x->free_num++] = (uint64_t)i * FWD_FRAME_SIZE;
+
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = port->ifindex;
+	sxdp.sxdp_queue_id = queue;
+	sxdp.sxdp_flags = cfg->bind_flags;
+	if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+		printf("xsk bind %s queue %d failed: %s\n", port->name, queue, strerror(errno));
+		goto err;
+	}
+
+	if (!cfg->gen) {
+		union bpf_attr attr;
+		int key = queue;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = port->xsk_map_fd;
+		attr.key = (uint64_t)(unsigned long)&key;
+		attr.value = (uint64_t)(unsigned long)&x->fd;
+		if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr))
+			goto err;
+	}
+	return x;
+err:
+	if (x->fd >= 0)
+		close(x->fd);
+	free(x);
+	return NULL;
+}
+
+static void xsk_complete_tx(struct xsk *x)
+{
+	uint32_t n = ring_cons_avail(&x->cq, FWD_BATCH);
+
+	for (uint32_t i = 0; i < n; i++)
+		x->free_frames[x->free_num++] =
+			((uint64_t *)x->cq.desc)[x->cq.cached_cons++ & x->cq.mask];
+	if (n)
+		ring_release(&x->cq);
+}
+
+static int xsk_tx(struct xsk *x, const unsigned char *frame, uint32_t len)
+{
+	struct xdp_desc *desc;
+	uint64_t addr;
+
+	if (!x->free_num)
+		xsk_complete_tx(x);
+	if (!x->free_num || !ring_prod_free(&x->tx))
+		return -1;
+	addr = x->free_frames[--x->free_num];
+	memcpy(x->umem + addr, frame, len);
+	desc = &((struct xdp_desc *)x->tx.desc)[x->tx.cached_prod++ & x->tx.mask];
+	desc->addr = addr;
+	desc->len = len;
+	desc->options = 0;
+	x->tx_pending++;
+	return 0;
+}
+
+static void xsk_tx_flush(struct xsk *x)
+{
+	if (!x->tx_pending)
+		return;
+	ring_submit(&x->tx);
+	x->tx_pending = 0;
+	if (!(g_cfg.bind_flags & XDP_USE_NEED_WAKEUP) ||
+	    (*x->tx.flags & XDP_RING_NEED_WAKEUP))
+		sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+static void xsk_worker_loop(struct fwd_cfg *cfg, struct fwd_worker *w)
+{
+	unsigned char *frames[FWD_BATCH];
+	uint32_t lens[FWD_BATCH];
+	int outs[FWD_BATCH];
+	struct fwd_stats *st = &w->stats;
+
+	while (!g_stop) {
+		for (int p = 0; p < cfg->port_num; p++) {
+			struct xsk *x = w->xsks[p];
+			uint32_t n = ring_cons_avail(&x->rx, FWD_BATCH);
+			uint32_t i;
+
+			if (!n) {
+				if (*x->fq.flags & XDP_RING_NEED_WAKEUP)
+					recvfrom(x->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+				continue;
+			}
+
+			/* The frame is copied to the egress TX UMEM, so the RX
+			 * buffer goes straight back to the fill ring
+			 */
+			while (ring_prod_free(&x->fq) < n)
+				;
+			for (i = 0; i < n; i++) {
+				const struct xdp_desc *d =
+					&((struct xdp_desc *)x->rx.desc)[(x->rx.cached_cons + i) & x->rx.mask];
+
+				frames[i] = x->umem + d->addr;
+				lens[i] = d->len;
+			}
+			fwd_burst(cfg, st, frames, lens, outs, n);
+
+			for (i = 0; i < n; i++) {
+				const struct xdp_desc *d =
+					&((struct xdp_desc *)x->rx.desc)[x->rx.cached_cons++ & x->rx.mask];
+
+				if (outs[i] >= 0) {
+					if (xsk_tx(w->xsks[outs[i]], frames[i], lens[i]))
+						st->drop_tx++;
+					else
+						st->tx++;
+				}
+				xsk_fill(x, d->addr & ~(uint64_t)(FWD_FRAME_SIZE - 1));
+			}
+			st->rx += n;
+			ring_release(&x->rx);
+			ring_submit(&x->fq);
+		}
+
+		for (int p = 0; p < cfg->port_num; p++) {
+			xsk_tx_flush(w->xsks[p]);
+			xsk_complete_tx(w->xsks[p]);
+		}
+	}
+}
+
+static void xsk_gen_loop(struct fwd_cfg *cfg, struct fwd_worker *w)
+{
+	struct xsk *x = w->xsks[0];
+
+	while (!g_stop) {
+		for (int i = 0; i < FWD_BATCH; i++) {
+			if (xsk_tx(x, cfg->gen_frame, cfg->gen_len)) {
+				w->stats.drop_tx++;
+				break;
+			}
+			w->stats.tx++;
+		}
+		xsk_tx_flush(x);
+		xsk_complete_tx(x);
+	}
+}
+
+/* AF_PACKET fallback: one socket per worker and port, fanout by CPU */
+static int pkt_open(struct fwd_cfg *cfg, struct fwd_port *port)
+{
+	struct sockaddr_ll sll = {0};
+	int one = 1;
+	int fanout = (port->ifindex & 0xFFFF) | (PACKET_FANOUT_CPU << 16);
+	int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_NEWIP));
+
+	if (fd < 0)
+		return -1;
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_NEWIP);
+	sll.sll_ifindex = port->ifindex;
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) ||
+	    setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)) ||
+	    (!cfg->gen && setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)))) {
+		printf("packet socket on %s failed: %s\n", port->name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+struct pkt_batch {
+	struct mmsghdr msgs[FWD_BATCH];
+	struct iovec iovs[FWD_BATCH];
+	int num;
+};
+
+static void pkt_flush(int fd, struct pkt_batch *b, struct fwd_stats *st)
+{
+	int sent = 0;
+
+	while (sent < b->num) {
+		int ret = sendmmsg(fd, b->msgs + sent, b->num - sent, MSG_DONTWAIT);
+
+		if (ret <= 0)
+			break;
+		sent += ret;
+	}
+	st->tx += sent;
+	st->drop_tx += b->num - sent;
+	b->num = 0;
+}
+
+static void pkt_worker_loop(struct fwd_cfg *cfg, struct fwd_worker *w)
+{
+	static __thread unsigned char bufs[FWD_BATCH][FWD_FRAME_SIZE];
+	static __thread struct pkt_batch out[FWD_PORT_MAX];
+	struct mmsghdr msgs[FWD_BATCH];
+	struct iovec iovs[FWD_BATCH];
+	unsigned char *frames[FWD_BATCH];
+	uint32_t lens[FWD_BATCH];
+	int outs[FWD_BATCH];
+	struct pollfd pfds[FWD_PORT_MAX];
+	struct fwd_stats *st = &w->stats;
+
+	for (int p = 0; p < cfg->port_num; p++) {
+		pfds[p].fd = w->pkt_fds[p];
+		pfds[p].events = POLLIN;
+	}
+
+	while (!g_stop) {
+		if (poll(pfds, cfg->port_num, 100) <= 0)
+			continue;
+
+		for (int p = 0; p < cfg->port_num; p++) {
+			int n;
+
+			if (!(pfds[p].revents & POLLIN))
+				continue;
+			for (int i = 0; i < FWD_BATCH; i++) {
+				iovs[i].iov_base = bufs[i];
+				iovs[i].iov_len = FWD_FRAME_SIZE;
+				memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+				msgs[i].msg_hdr.msg_iov = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+			n = recvmmsg(w->pkt_fds[p], msgs, FWD_BATCH, MSG_DONTWAIT, NULL);
+			if (n <= 0)
+				continue;
+			st->rx += n;
+
+			/* Frames are sent from the RX buffers, flush before reuse */
+			for (int i = 0; i < n; i++) {
+				frames[i] = bufs[i];
+				lens[i] = msgs[i].msg_len;
+			}
+			fwd_burst(cfg, st, frames, lens, outs, n);
+			for (int i = 0; i < n; i++) {
+				struct pkt_batch *b;
+
+				if (outs[i] < 0)
+					continue;
+				b = &out[outs[i]];
+				b->iovs[b->num].iov_base = bufs[i];
+				b->iovs[b->num].iov_len = msgs[i].msg_len;
+				memset(&b->msgs[b->num].msg_hdr, 0, sizeof(b->msgs[b->num].msg_hdr));
+				b->msgs[b->num].msg_hdr.msg_iov = &b->iovs[b->num];
+				b->msgs[b->num].msg_hdr.msg_iovlen = 1;
+				b->num++;
+			}
+			for (int o = 0; o < cfg->port_num; o++)
+				pkt_flush(w->pkt_fds[o], &out[o], st);
+		}
+	}
+}
+
+static void pkt_gen_loop(struct fwd_cfg *cfg, struct fwd_worker *w)
+{
+	struct pkt_batch b;
+
+	while (!g_stop) {
+		for (int i = 0; i < FWD_BATCH; i++) {
+			b.iovs[i].iov_base = cfg->gen_frame;
+			b.iovs[i].iov_len = cfg->gen_len;
+			memset(&b.msgs[i].msg_hdr, 0, sizeof(b.msgs[i].msg_hdr));
+			b.msgs[i].msg_hdr.msg_iov = &b.iovs[i];
+			b.msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		b.num = FWD_BATCH;
+		pkt_flush(w->pkt_fds[0], &b, &w->stats);
+	}
+}
+
+static void *fwd_worker_run(void *args)
+{
+	struct fwd_worker *w = (struct fwd_worker *)args;
+	struct fwd_cfg *cfg = &g_cfg;
+	cpu_set_t set;
+
+	if (cfg->first_cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cfg->first_cpu + w->id, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	if (cfg->use_packet)
+		cfg->gen ? pkt_gen_loop(cfg, w) : pkt_worker_loop(cfg, w);
+	else
+		cfg->gen ? xsk_gen_loop(cfg, w) : xsk_worker_loop(cfg, w);
+	return NULL;
+}
+
+static int fwd_setup_sockets(struct fwd_cfg *cfg)
+{
+	for (int i = 0; i < cfg->workers; i++) {
+		g_workers[i].id = i;
+		for (int p = 0; p < cfg->port_num; p++) {
+			if (cfg->use_packet) {
+				g_workers[i].pkt_fds[p] = pkt_open(cfg, &cfg->ports[p]);
+				if (g_workers[i].pkt_fds[p] < 0)
+					return -1;
+				continue;
+			}
+			g_workers[i].xsks[p] = xsk_create(cfg, &cfg->ports[p], i);
+			if (!g_workers[i].xsks[p])
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int fwd_setup_ports(struct fwd_cfg *cfg)
+{
+	struct ifreq ifr;
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (fd < 0)
+		return -1;
+	for (int p = 0; p < cfg->port_num; p++) {
+		struct fwd_port *port = &cfg->ports[p];
+
+		memset(&ifr, 0, sizeof(ifr));
+		strncpy(ifr.ifr_name, port->name, IF_NAMESIZE - 1);
+		port->ifindex = if_nametoindex(port->name);
+		if (!port->ifindex || ioctl(fd, SIOCGIFHWADDR, &ifr)) {
+			printf("no such interface %s\n", port->name);
+			close(fd);
+			return -1;
+		}
+		memcpy(port->mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	}
+	close(fd);
+
+	if (cfg->use_packet || cfg->gen)
+		return 0;
+	for (int p = 0; p < cfg->port_num; p++) {
+		if (fwd_xdp_attach(cfg, &cfg->ports[p])) {
+			printf("AF_XDP unavailable, falling back to AF_PACKET\n");
+			cfg->use_packet = 1;
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static void fwd_report(struct fwd_cfg *cfg)
+{
+	static struct fwd_stats last[FWD_WORKER_MAX];
+	unsigned long long prev = 0;
+	struct timespec ts;
+	int elapsed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	prev = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+	while (!g_stop && (!cfg->secs || elapsed < cfg->secs)) {
+		unsigned long long now;
+		double secs;
+		double total = 0;
+
+		sleep(1);
+		elapsed++;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+		secs = (double)(now - prev) / NSEC_PER_SEC;
+		prev = now;
+
+		for (int i = 0; i < cfg->workers; i++) {
+			struct fwd_stats cur = g_workers[i].stats;
+			double rx = (cur.rx - last[i].rx) / secs / MPPS_DIV;
+			double tx = (cur.tx - last[i].tx) / secs / MPPS_DIV;
+
+			printf("worker %2d: rx %7.3f Mpps tx %7.3f Mpps drop decap %llu route %llu ttl %llu tx %llu\n",
+			       i, rx, tx, (unsigned long long)cur.drop_decap,
+			       (unsigned long long)cur.drop_route, (unsigned long long)cur.drop_ttl,
+			       (unsigned long long)cur.drop_tx);
+			total += cfg->gen ? tx : rx;
+			last[i] = cur;
+		}
+		printf("total: %.3f Mpps, %.3f Mpps per worker\n", total, total / cfg->workers);
+	}
+	g_stop = 1;
+}
+
+static int fwd_parse_gen(struct fwd_cfg *cfg, char *arg, uint32_t payload)
+{
+	char *daddr_str = strtok(arg, ",");
+	char *saddr_str = strtok(NULL, ",");
+	char *mac_str = strtok(NULL, ",");
+	struct nip_addr daddr;
+	struct nip_addr saddr;
+	unsigned char mac[ETH_ALEN];
+
+	if (!daddr_str || !saddr_str || !mac_str ||
+	    fwd_parse_addr(daddr_str, &daddr) || fwd_parse_addr(saddr_str, &saddr) ||
+	    fwd_parse_mac(mac_str, mac))
+		return -1;
+	return fwd_build_gen_frame(cfg, &daddr, &saddr, mac, payload);
+}
+
+static void fwd_usage(const char *prog)
+{
+	printf("usage: %s -i <ifname> [-i <ifname> ...] -r <addr>[/bits],<ifname>,<mac> ...\n"
+	       "          [-w workers] [-c first cpu] [-t seconds] [-P] [-S] [-z]\n"
+	       "          [-g <daddr>,<saddr>,<dst mac> [-l payload len]]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct fwd_cfg *cfg = &g_cfg;
+	char *routes[FWD_ROUTE_MAX];
+	char *gen_arg = NULL;
+	uint32_t payload = FWD_GEN_LEN_DEF;
+	int route_num = 0;
+	int started = 0;
+	int opt;
+
+	cfg->workers = 1;
+	cfg->first_cpu = -1;
+	cfg->bind_flags = XDP_USE_NEED_WAKEUP;
+	while ((opt = getopt(argc, argv, "i:r:w:c:t:PSzg:l:")) != -1) {
+		switch (opt) {
+		case 'i':
+			if (cfg->port_num == FWD_PORT_MAX)
+				return -1;
+			strncpy(cfg->ports[cfg->port_num++].name, optarg, IF_NAMESIZE - 1);
+			break;
+		case 'r':
+			if (route_num == FWD_ROUTE_MAX)
+				return -1;
+			routes[route_num++] = optarg;
+			break;
+		case 'w':
+			cfg->workers = atoi(optarg);
+			break;
+		case 'c':
+			cfg->first_cpu = atoi(optarg);
+			break;
+		case 't':
+			cfg->secs = atoi(optarg);
+			break;
+		case 'P':
+			cfg->use_packet = 1;
+			break;
+		case 'S':
+			cfg->xdp_flags |= XDP_FLAGS_SKB_MODE;
+			break;
+		case 'z':
+			cfg->bind_flags |= XDP_ZEROCOPY;
+			break;
+		case 'g':
+			gen_arg = optarg;
+			cfg->gen = 1;
+			break;
+		case 'l':
+			payload = atoi(optarg);
+			break;
+		default:
+			fwd_usage(argv[0]);
+			return -1;
+		}
+	}
+	if (!cfg->port_num || cfg->workers <= 0 || cfg->workers > FWD_WORKER_MAX) {
+		fwd_usage(argv[0]);
+		return -1;
+	}
+
+	cfg->fib.mask = FWD_ROUTE_MAX * 2 - 1;
+	cfg->fib.slots = calloc(FWD_ROUTE_MAX * 2, sizeof(struct fwd_route));
+	if (!cfg->fib.slots)
+		return -1;
+	if (fwd_setup_ports(cfg))
+		return -1;
+	for (int i = 0; i < route_num; i++) {
+		if (fwd_parse_route(cfg, routes[i])) {
+			printf("bad route %s\n", routes[i]);
+			return -1;
+		}
+	}
+	if (gen_arg && fwd_parse_gen(cfg, gen_arg, payload)) {
+		printf("bad generator arguments\n");
+		return -1;
+	}
+	if (fwd_setup_sockets(cfg))
+		return -1;
+
+	signal(SIGINT, fwd_sig);
+	signal(SIGTERM, fwd_sig);
+	printf("%s on %d port(s), %d worker(s), %s\n", cfg->gen ? "generating" : "forwarding",
+	       cfg->port_num, cfg->workers, cfg->use_packet ? "AF_PACKET" : "AF_XDP");
+	for (; started < cfg->workers; started++) {
+		if (pthread_create(&g_workers[started].th, NULL, fwd_worker_run,
+				   &g_workers[started])) {
+			g_stop = 1;
+			break;
+		}
+	}
+	fwd_report(cfg);
+	for (int i = 0; i < started; i++)
+		pthread_join(g_workers[i].th, NULL);
+	return 0;
+}
@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2022 Huawei Device Co., Ltd. */
+#ifndef _NIP_KSHIM_ASM_UNALIGNED_H
+#define _NIP_KSHIM_ASM_UNALIGNED_H
+
+static inline unsigned short get_unaligned_be16(const void *p)
+{
+	const unsigned char *b = p;
+
+	return (unsigned short)(b[0] << 8 | b[1]);
+}
+
+#endif /* _NIP_KSHIM_ASM_UNALIGNED_H */
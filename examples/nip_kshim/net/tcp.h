@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2022 Huawei Device Co., Ltd. */
+#ifndef _NIP_KSHIM_NET_TCP_H
+#define _NIP_KSHIM_NET_TCP_H
+
+/* Userspace stand-in for what src/linux/net/newip/tcp_nip_options.c uses
+ * of the kernel, so that nip_decode_fuzz can run the TCP option parser.
+ * The skb is only the linear TCP header and options.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <linux/tcp.h>
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+
+#define TCPOPT_EOL   0
+#define TCPOPT_NOP   1
+#define TCPOPT_MSS   2
+#define TCPOLEN_MSS  4
+
+#define pr_crit(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+
+struct sk_buff {
+	unsigned char *data;
+	unsigned int len;
+};
+
+static inline const struct tcphdr *tcp_hdr(const struct sk_buff *skb)
+{
+	return (const struct tcphdr *)skb->data;
+}
+
+struct tcp_options_received {
+	u16 saw_tstamp : 1;
+	u16 user_mss;
+	u16 mss_clamp;
+};
+
+struct tcp_fastopen_cookie {
+	int len;
+};
+
+#endif /* _NIP_KSHIM_NET_TCP_H */
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2022 Huawei Device Co., Ltd. */
+#ifndef _NIP_KSHIM_NET_TCP_NIP_H
+#define _NIP_KSHIM_NET_TCP_NIP_H
+
+#include <net/tcp.h>
+
+#define TCP_NUM_2 2
+
+void tcp_nip_parse_options(const struct sk_buff *skb,
+			   struct tcp_options_received *opt_rx, int estab,
+			   struct tcp_fastopen_cookie *foc);
+
+#endif /* _NIP_KSHIM_NET_TCP_NIP_H */
@@ -44,6 +44,8 @@
 #define NIC_NAME_CHECK "wlan"
 #define CMD_ADD        "add"
 #define CMD_DEL        "del"
+#define CMD_PEER       "peer"
+#define CMD_PEER_NONE  "none"
 
 #define BUFLEN          1024
 #define LISTEN_MAX      3
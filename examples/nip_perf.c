@@ -0,0 +1,708 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/sysinfo.h>
+
+#define __USE_GNU
+#include <sched.h>
+#include <pthread.h>
+
+#include "nip_uapi.h"
+#include "nip_lib.h"
+
+/* netperf-style throughput and latency benchmark for AF_NINET.
+ *
+ * ./nip_perf -s <local addr> [-p port] [-C first cpu]
+ * ./nip_perf -c <server addr> [-t test] [-l seconds] [-m request size]
+ *            [-r response size] [-T threads] [-C first cpu] [-p port]
+ *
+ * Tests: TCP_STREAM, TCP_RR, TCP_CRR, UDP_STREAM, UDP_RR.
+ * The header length follows the address lengths, so the server and client
+ * addresses select the encoding that is measured.
+ * Every client thread runs its own connection (or socket), -C pins thread
+ * i to CPU (first + i). The result is printed as one JSON object;
+ * UDP_STREAM reports the send rate of the client.
+ */
+#define PERF_PORT_DEF       5559
+#define PERF_SECS_DEF       10
+#define PERF_MSG_DEF        1024
+#define PERF_RR_MSG_DEF     64
+#define PERF_MSG_MAX        65536
+#define PERF_UDP_MSG_MAX    1400
+#define PERF_RR_TIMEOUT_MS  1000
+#define NSEC_PER_SEC        1000000000ULL
+#define NSEC_PER_USEC       1000.0
+
+/* Latency histogram: exact below 16 ns, then 8 buckets per power of two */
+#define HIST_EXACT          16
+#define HIST_SUB_BITS       3
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        (HIST_EXACT + 64 * HIST_SUB)
+
+enum perf_test {
+	TCP_STREAM = 0,
+	TCP_RR,
+	TCP_CRR,
+	UDP_STREAM,
+	UDP_RR,
+	PERF_TEST_MAX,
+};
+
+static const char * const perf_test_name[PERF_TEST_MAX] = {
+	"TCP_STREAM", "TCP_RR", "TCP_CRR", "UDP_STREAM", "UDP_RR",
+};
+
+/* Sent first on every TCP connection and at the start of every datagram,
+ * the UDP_RR server echoes it so that a late reply is told from the
+ * current one by seq
+ */
+struct perf_hdr {
+	uint32_t test;
+	uint32_t req_size;
+	uint32_t resp_size;
+	uint32_t seq;
+};
+
+struct perf_cfg {
+	enum perf_test test;
+	struct sockaddr_nin si_server;
+	const char *addr_str;
+	int addr_len;
+	int secs;
+	int req_size;
+	int resp_size;
+	int threads;
+	int first_cpu;
+	volatile int stop;
+};
+
+struct perf_worker {
+	pthread_t th;
+	int id;
+	struct perf_cfg *cfg;
+	unsigned long long bytes;
+	unsigned long long trans;
+	unsigned long long errs;
+	unsigned long long max_ns;
+	unsigned long long hist[HIST_BUCKETS];
+};
+
+struct perf_conn {
+	int fd;
+	int cpu;
+};
+
+static unsigned long long perf_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int hist_bucket(unsigned long long v)
+{
+	int e;
+
+	if (v < HIST_EXACT)
+		return v;
+	e = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	return HIST_EXACT + (e - 1) * HIST_SUB + (int)((v >> e) - HIST_SUB);
+}
+
+/* Middle of the bucket, the error is below 1/16 of the value */
+static unsigned long long hist_value(int b)
+{
+	int e;
+
+	if (b < HIST_EXACT)
+		return b;
+	e = (b - HIST_EXACT) / HIST_SUB + 1;
+	return ((unsigned long long)((b - HIST_EXACT) % HIST_SUB + HIST_SUB) << e) +
+	       (1ULL << (e - 1));
+}
+
+static double hist_percentile(const unsigned long long *hist,
+			      unsigned long long total, double pct)
+{
+	unsigned long long want = (unsigned long long)(total * pct / 100.0);
+	unsigned long long seen = 0;
+
+	if (!total)
+		return 0;
+	if (want >= total)
+		want = total - 1;
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen > want)
+			return hist_value(b) / NSEC_PER_USEC;
+	}
+	return 0;
+}
+
+static void perf_record(struct perf_worker *w, unsigned long long start)
+{
+	unsigned long long ns = perf_now_ns() - start;
+
+	w->hist[hist_bucket(ns)]++;
+	if (ns > w->max_ns)
+		w->max_ns = ns;
+	w->trans++;
+}
+
+static void perf_pin(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu % get_nprocs(), &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		printf("failed to pin to cpu %d\n", cpu);
+}
+
+static int send_all(int fd, const char *buf, int len)
+{
+	int done = 0;
+
+	while (done < len) {
+		int ret = send(fd, buf + done, len - done, 0);
+
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += ret;
+	}
+	return 0;
+}
+
+static int recv_all(int fd, char *buf, int len)
+{
+	int done = 0;
+
+	while (done < len) {
+		int ret = recv(fd, buf + done, len - done, 0);
+
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += ret;
+	}
+	return 0;
+}
+
+static void perf_hdr_fill(struct perf_hdr *hdr, const struct perf_cfg *cfg)
+{
+	hdr->test = htonl(cfg->test);
+	hdr->req_size = htonl(cfg->req_size);
+	hdr->resp_size = htonl(cfg->resp_size);
+	hdr->seq = 0;
+}
+
+static int perf_hdr_parse(const struct perf_hdr *hdr, struct perf_hdr *out)
+{
+	out->test = ntohl(hdr->test);
+	out->req_size = ntohl(hdr->req_size);
+	out->resp_size = ntohl(hdr->resp_size);
+	out->seq = ntohl(hdr->seq);
+	if (out->test >= PERF_TEST_MAX || !out->req_size ||
+	    out->req_size > PERF_MSG_MAX || out->resp_size > PERF_MSG_MAX)
+		return -1;
+	if (out->test >= UDP_STREAM && out->resp_size > PERF_UDP_MSG_MAX)
+		return -1;
+	return 0;
+}
+
+/* Server side */
+static void *server_tcp_conn(void *args)
+{
+	struct perf_conn *conn = (struct perf_conn *)args;
+	struct perf_hdr hdr;
+	char *buf = malloc(PERF_MSG_MAX);
+
+	perf_pin(conn->cpu);
+	if (!buf || recv_all(conn->fd, (char *)&hdr, sizeof(hdr)) ||
+	    perf_hdr_parse(&hdr, &hdr))
+		goto out;
+
+	if (hdr.test == TCP_STREAM) {
+		while (recv(conn->fd, buf, PERF_MSG_MAX, 0) > 0)
+			;
+		goto out;
+	}
+
+	/* TCP_RR and TCP_CRR, CRR closes after the first transaction */
+	while (!recv_all(conn->fd, buf, hdr.req_size)) {
+		if (hdr.resp_size && send_all(conn->fd, buf, hdr.resp_size))
+			break;
+	}
+out:
+	close(conn->fd);
+	free(buf);
+	free(conn);
+	return NULL;
+}
+
+static void *server_tcp(void *args)
+{
+	struct perf_cfg *cfg = (struct perf_cfg *)args;
+	pthread_t th;
+	int conns = 0;
+	int lfd;
+
+	lfd = socket(AF_NINET, SOCK_STREAM, IPPROTO_TCP);
+	if (lfd < 0) {
+		perror("socket");
+		return NULL;
+	}
+	if (bind(lfd, (struct sockaddr *)&cfg->si_server, sizeof(cfg->si_server)) < 0 ||
+	    listen(lfd, SOMAXCONN) < 0) {
+		perror("tcp bind/listen");
+		close(lfd);
+		return NULL;
+	}
+
+	for (;;) {
+		struct perf_conn *conn = malloc(sizeof(*conn));
+
+		if (!conn)
+			break;
+		conn->fd = accept(lfd, NULL, NULL);
+		if (conn->fd < 0) {
+			free(conn);
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			break;
+		}
+		conn->cpu = cfg->first_cpu < 0 ? -1 : cfg->first_cpu + conns++;
+		if (pthread_create(&th, NULL, server_tcp_conn, conn)) {
+			close(conn->fd);
+			free(conn);
+			continue;
+		}
+		pthread_detach(th);
+	}
+	close(lfd);
+	return NULL;
+}
+
+static void *server_udp(void *args)
+{
+	struct perf_cfg *cfg = (struct perf_cfg *)args;
+	struct sockaddr_nin si_remote;
+	struct perf_hdr hdr;
+	socklen_t slen;
+	char *buf = malloc(PERF_MSG_MAX);
+	int fd;
+	int ret;
+
+	fd = socket(AF_NINET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0 || !buf) {
+		perror("socket");
+		goto out;
+	}
+	if (bind(fd, (struct sockaddr *)&cfg->si_server, sizeof(cfg->si_server)) < 0) {
+		perror("udp bind");
+		goto out;
+	}
+
+	perf_pin(cfg->first_cpu);
+	for (;;) {
+		slen = sizeof(si_remote);
+		ret = recvfrom(fd, buf, PERF_MSG_MAX, 0, (struct sockaddr *)&si_remote, &slen);
+		if (ret < (int)sizeof(hdr))
+			continue;
+		if (perf_hdr_parse((struct perf_hdr *)buf, &hdr) || hdr.test != UDP_RR)
+			continue;
+		if (hdr.resp_size < sizeof(hdr))
+			hdr.resp_size = sizeof(hdr);
+		sendto(fd, buf, hdr.resp_size, 0, (struct sockaddr *)&si_remote, slen);
+	}
+out:
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int perf_server(struct perf_cfg *cfg)
+{
+	pthread_t tcp_th;
+	pthread_t udp_th;
+
+	printf("nip_perf server on %s port %d\n", cfg->addr_str, ntohs(cfg->si_server.sin_port));
+	pthread_create(&tcp_th, NULL, server_tcp, cfg);
+	pthread_create(&udp_th, NULL, server_udp, cfg);
+	pthread_join(tcp_th, NULL);
+	pthread_join(udp_th, NULL);
+	return 0;
+}
+
+/* Client side */
+/* A blocked receive gives up after the timeout, so that the worker sees
+ * stop even when the peer never answers
+ */
+static void perf_set_rcvtimeo(int fd)
+{
+	struct timeval tv = {
+		.tv_sec = PERF_RR_TIMEOUT_MS / 1000,
+		.tv_usec = (PERF_RR_TIMEOUT_MS % 1000) * 1000,
+	};
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static int client_tcp_connect(const struct perf_cfg *cfg)
+{
+	struct perf_hdr hdr;
+	int fd;
+
+	fd = socket(AF_NINET, SOCK_STREAM, IPPROTO_TCP);
+	if (fd < 0)
+		return -1;
+	if (cfg->test != TCP_STREAM)
+		perf_set_rcvtimeo(fd);
+	perf_hdr_fill(&hdr, cfg);
+	if (connect(fd, (struct sockaddr *)&cfg->si_server, sizeof(cfg->si_server)) < 0 ||
+	    send_all(fd, (char *)&hdr, sizeof(hdr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void client_tcp_stream(struct perf_worker *w, char *buf)
+{
+	struct perf_cfg *cfg = w->cfg;
+	int fd = client_tcp_connect(cfg);
+	int ret;
+
+	if (fd < 0) {
+		w->errs++;
+		return;
+	}
+	while (!cfg->stop) {
+		ret = send(fd, buf, cfg->req_size, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			w->errs++;
+			break;
+		}
+		w->bytes += ret;
+	}
+	close(fd);
+}
+
+static void client_tcp_rr(struct perf_worker *w, char *buf)
+{
+	struct perf_cfg *cfg = w->cfg;
+	unsigned long long start;
+	int fd = -1;
+
+	while (!cfg->stop) {
+		start = perf_now_ns();
+		if (fd < 0) {
+			fd = client_tcp_connect(cfg);
+			if (fd < 0) {
+				w->errs++;
+				continue;
+			}
+		}
+		if (send_all(fd, buf, cfg->req_size) ||
+		    (cfg->resp_size && recv_all(fd, buf, cfg->resp_size))) {
+			w->errs++;
+			close(fd);
+			fd = -1;
+			continue;
+		}
+		w->bytes += cfg->req_size + cfg->resp_size;
+		if (cfg->test == TCP_CRR) {
+			close(fd);
+			fd = -1;
+		}
+		perf_record(w, start);
+	}
+	if (fd >= 0)
+		close(fd);
+}
+
+static void client_udp(struct perf_worker *w, char *buf)
+{
+	struct perf_cfg *cfg = w->cfg;
+	struct perf_hdr *req = (struct perf_hdr *)buf;
+	struct perf_hdr *resp = (struct perf_hdr *)(buf + cfg->req_size);
+	unsigned long long start;
+	uint32_t seq = 0;
+	int fd;
+	int ret;
+
+	fd = socket(AF_NINET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0) {
+		w->errs++;
+		return;
+	}
+	perf_set_rcvtimeo(fd);
+	perf_hdr_fill(req, cfg);
+
+	while (!cfg->stop) {
+		req->seq = htonl(++seq);
+		start = perf_now_ns();
+		ret = sendto(fd, buf, cfg->req_size, 0, (struct sockaddr *)&cfg->si_server,
+			     sizeof(cfg->si_server));
+		if (ret < 0) {
+			w->errs++;
+			continue;
+		}
+		w->bytes += ret;
+		if (cfg->test == UDP_STREAM)
+			continue;
+
+		/* A lost request or response costs one timeout, a reply that
+		 * arrives after it belongs to an older request and is dropped
+		 */
+		do {
+			ret = recv(fd, resp, PERF_MSG_MAX - cfg->req_size, 0);
+		} while (ret >= (int)sizeof(*resp) && resp->seq != req->seq && !cfg->stop);
+		if (ret < (int)sizeof(*resp) || resp->seq != req->seq) {
+			w->errs++;
+			continue;
+		}
+		w->bytes += ret;
+		perf_record(w, start);
+	}
+	close(fd);
+}
+
+static void *client_worker(void *args)
+{
+	struct perf_worker *w = (struct perf_worker *)args;
+	char *buf = calloc(1, PERF_MSG_MAX * 2);
+
+	if (!buf) {
+		w->errs++;
+		return NULL;
+	}
+	perf_pin(w->cfg->first_cpu < 0 ? -1 : w->cfg->first_cpu + w->id);
+	switch (w->cfg->test) {
+	case TCP_STREAM:
+		client_tcp_stream(w, buf);
+		break;
+	case TCP_RR:
+	case TCP_CRR:
+		client_tcp_rr(w, buf);
+		break;
+	default:
+		client_udp(w, buf);
+		break;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void perf_report(const struct perf_cfg *cfg, struct perf_worker *w,
+			int started, double secs)
+{
+	static unsigned long long hist[HIST_BUCKETS];
+	unsigned long long bytes = 0;
+	unsigned long long trans = 0;
+	unsigned long long errs = 0;
+	unsigned long long max_ns = 0;
+
+	for (int i = 0; i < started; i++) {
+		bytes += w[i].bytes;
+		trans += w[i].trans;
+		errs += w[i].errs;
+		if (w[i].max_ns > max_ns)
+			max_ns = w[i].max_ns;
+		for (int b = 0; b < HIST_BUCKETS; b++)
+			hist[b] += w[i].hist[b];
+	}
+
+	printf("{\"test\": \"%s\", \"addr\": \"%s\", \"addr_len\": %d, ",
+	       perf_test_name[cfg->test], cfg->addr_str, cfg->addr_len);
+	printf("\"threads\": %d, \"seconds\": %.3f, \"req_size\": %d, \"resp_size\": %d, ",
+	       started, secs, cfg->req_size, cfg->resp_size);
+	printf("\"bytes\": %llu, \"throughput_mbps\": %.2f, ",
+	       bytes, bytes * 8 / secs / 1e6);
+	printf("\"transactions\": %llu, \"tps\": %.1f, \"errors\": %llu, ",
+	       trans, trans / secs, errs);
+	printf("\"latency_us\": {\"p50\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}}\n",
+	       hist_percentile(hist, trans, 50.0), hist_percentile(hist, trans, 99.0),
+	       hist_percentile(hist, trans, 99.9), max_ns / NSEC_PER_USEC);
+}
+
+static int perf_client(struct perf_cfg *cfg)
+{
+	struct perf_worker *w = calloc(cfg->threads, sizeof(*w));
+	unsigned long long start;
+	int started = 0;
+
+	if (!w) {
+		printf("calloc fail\n");
+		return -1;
+	}
+
+	start = perf_now_ns();
+	for (; started < cfg->threads; started++) {
+		w[started].id = started;
+		w[started].cfg = cfg;
+		if (pthread_create(&w[started].th, NULL, client_worker, &w[started])) {
+			printf("pthread_create fail\n");
+			break;
+		}
+	}
+
+	sleep(cfg->secs);
+	cfg->stop = 1;
+	for (int i = 0; i < started; i++)
+		pthread_join(w[i].th, NULL);
+
+	perf_report(cfg, w, started, (perf_now_ns() - start) / (double)NSEC_PER_SEC);
+	free(w);
+	return started == cfg->threads ? 0 : -1;
+}
+
+static int perf_parse_test(const char *name)
+{
+	for (int i = 0; i < PERF_TEST_MAX; i++) {
+		if (!strcasecmp(name, perf_test_name[i]))
+			return i;
+	}
+	return -1;
+}
+
+static void perf_usage(const char *prog)
+{
+	printf("usage: %s -s <local addr> [-p port] [-C first cpu]\n", prog);
+	printf("       %s -c <server addr> [-t TCP_STREAM|TCP_RR|TCP_CRR|UDP_STREAM|UDP_RR]\n"
+	       "          [-l seconds] [-m request size] [-r response size] [-T threads]\n"
+	       "          [-C first cpu] [-p port]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct perf_cfg cfg = {0};
+	char addr_arg[ARRAY_LEN] = {0};
+	char *addr_ptr = addr_arg;
+	int port = PERF_PORT_DEF;
+	int server = -1;
+	int test = TCP_STREAM;
+	int opt;
+
+	cfg.secs = PERF_SECS_DEF;
+	cfg.req_size = -1;
+	cfg.resp_size = -1;
+	cfg.threads = 1;
+	cfg.first_cpu = -1;
+	while ((opt = getopt(argc, argv, "s:c:t:l:m:r:T:C:p:")) != -1) {
+		switch (opt) {
+		case 's':
+		case 'c':
+			server = opt == 's';
+			strncpy(addr_arg, optarg, ARRAY_LEN - 1);
+			break;
+		case 't':
+			test = perf_parse_test(optarg);
+			break;
+		case 'l':
+			cfg.secs = atoi(optarg);
+			break;
+		case 'm':
+			cfg.req_size = atoi(optarg);
+			break;
+		case 'r':
+			cfg.resp_size = atoi(optarg);
+			break;
+		case 'T':
+			cfg.threads = atoi(optarg);
+			break;
+		case 'C':
+			cfg.first_cpu = atoi(optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		default:
+			perf_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (server < 0 || test < 0 || port <= 0 || port > 0xFFFF) {
+		perf_usage(argv[0]);
+		return -1;
+	}
+
+	cfg.test = test;
+	cfg.addr_str = addr_arg;
+	if (nip_get_addr(&addr_ptr, &cfg.si_server.sin_addr))
+		return -1;
+	cfg.addr_len = cfg.si_server.sin_addr.bitlen / NIP_ADDR_BIT_LEN_8;
+	cfg.si_server.sin_family = AF_NINET;
+	cfg.si_server.sin_port = htons(port);
+	if (server)
+		return perf_server(&cfg);
+
+	if (cfg.req_size < 0)
+		cfg.req_size = cfg.test == TCP_STREAM || cfg.test == UDP_STREAM ?
+			       PERF_MSG_DEF : PERF_RR_MSG_DEF;
+	if (cfg.resp_size < 0)
+		cfg.resp_size = cfg.test == TCP_STREAM || cfg.test == UDP_STREAM ?
+				0 : cfg.req_size;
+	if (cfg.test >= UDP_STREAM && cfg.req_size > PERF_UDP_MSG_MAX)
+		cfg.req_size = PERF_UDP_MSG_MAX;
+	if (cfg.test >= UDP_STREAM && cfg.resp_size > PERF_UDP_MSG_MAX)
+		cfg.resp_size = PERF_UDP_MSG_MAX;
+	if (cfg.test >= UDP_STREAM && cfg.req_size < (int)sizeof(struct perf_hdr))
+		cfg.req_size = sizeof(struct perf_hdr);
+	if (cfg.secs <= 0 || cfg.threads <= 0 || cfg.req_size <= 0 ||
+	    cfg.req_size > PERF_MSG_MAX || cfg.resp_size > PERF_MSG_MAX) {
+		perf_usage(argv[0]);
+		return -1;
+	}
+	return perf_client(&cfg);
+}
@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nip_uapi.h"
+#include "nip_lib.h"
+
+/* Save the NewIP addresses and routes of this namespace to a file and add
+ * them back with a single ioctl, instead of one nip_addr/nip_route call
+ * per entry:
+ *   nip_snapshot save <file>
+ *   nip_snapshot restore <file> [nodad]
+ *   nip_snapshot show <file>
+ */
+
+static void cmd_help(void)
+{
+	printf("\n[cmd example]\n");
+	printf("nip_snapshot save <file>\n");
+	printf("nip_snapshot restore <file> [nodad]\n");
+	printf("nip_snapshot show <file>\n");
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void print_addr(const struct nip_addr *addr)
+{
+	int i;
+
+	for (i = 0; i < addr->bitlen / NIP_ADDR_BIT_LEN_8; i++)
+		printf("%02x", addr->nip_addr_field8[i]);
+	printf("\t");
+}
+
+static int snap_show(const void *buf, size_t len)
+{
+	const struct nip_snap_hdr *hdr = buf;
+	const struct nip_snap_addr *addr = (const struct nip_snap_addr *)(hdr + 1);
+	const struct nip_snap_route *route;
+	unsigned int i;
+
+	if (len < sizeof(*hdr) || hdr->magic != NIP_SNAP_MAGIC ||
+	    len != sizeof(*hdr) + hdr->naddr * sizeof(*addr) +
+		   hdr->nroute * sizeof(*route)) {
+		printf("not a NewIP snapshot\n");
+		return -1;
+	}
+	route = (const struct nip_snap_route *)(addr + hdr->naddr);
+
+	printf("version %u, %u addresses, %u routes\n", hdr->version, hdr->naddr, hdr->nroute);
+	for (i = 0; i < hdr->naddr; i++) {
+		printf("addr\t");
+		print_addr(&addr[i].addr);
+		printf("%s\n", addr[i].dev_name);
+	}
+	for (i = 0; i < hdr->nroute; i++) {
+		printf("route\t");
+		print_addr(&route[i].dst);
+		print_addr(&route[i].gateway);
+		printf("%4u %u %s\n", route[i].flags, route[i].metric, route[i].dev_name);
+	}
+	return 0;
+}
+
+static void *read_file(const char *path, size_t *len)
+{
+	FILE *fp = fopen(path, "rb");
+	void *buf = NULL;
+	long size;
+
+	if (!fp) {
+		perror(path);
+		return NULL;
+	}
+	if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET))
+		goto out;
+
+	buf = malloc(size ? size : 1);
+	if (buf && fread(buf, 1, size, fp) != (size_t)size) {
+		free(buf);
+		buf = NULL;
+	}
+	*len = size;
+out:
+	fclose(fp);
+	return buf;
+}
+
+static int snap_save(int fd, const char *path)
+{
+	struct nip_snap_req req = {0};
+	void *buf = NULL;
+	FILE *fp;
+	int ret;
+
+	/* The first call only reports the size, retry if the tables grew */
+	for (;;) {
+		req.buf = (unsigned long long)(uintptr_t)buf;
+		ret = ioctl(fd, SIOCNIPSNAPDUMP, &req);
+		if (ret == 0)
+			break;
+		free(buf);
+		if (errno != ENOSPC) {
+			printf("dump fail, errno=%d\n", errno);
+			return -1;
+		}
+		buf = malloc(req.len);
+		if (!buf)
+			return -1;
+	}
+
+	fp = fopen(path, "wb");
+	if (!fp || fwrite(buf, 1, req.len, fp) != req.len) {
+		perror(path);
+		ret = -1;
+	}
+	if (fp && fclose(fp))
+		ret = -1;
+	if (ret == 0)
+		snap_show(buf, req.len);
+	free(buf);
+	return ret;
+}
+
+static int snap_restore(int fd, const char *path, unsigned int flags)
+{
+	struct nip_snap_req req = {0};
+	const struct nip_snap_hdr *hdr;
+	double start;
+	size_t len;
+	void *buf;
+	int ret;
+
+	buf = read_file(path, &len);
+	if (!buf)
+		return -1;
+
+	hdr = buf;
+	req.buf = (unsigned long long)(uintptr_t)buf;
+	req.len = len;
+	req.flags = flags;
+	start = now_ms();
+	ret = ioctl(fd, SIOCNIPSNAPRESTORE, &req);
+	if (ret < 0)
+		printf("restore fail, errno=%d\n", errno);
+	else
+		printf("restored %u addresses and %u routes in %.3f ms\n",
+		       hdr->naddr, hdr->nroute, now_ms() - start);
+	free(buf);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int flags = 0;
+	size_t len;
+	void *buf;
+	int ret;
+	int fd;
+
+	if (argc < DEMO_INPUT_2 || argc > DEMO_INPUT_3) {
+		cmd_help();
+		return -1;
+	}
+
+	if (!strcmp(argv[1], "show")) {
+		buf = read_file(argv[2], &len);
+		if (!buf)
+			return -1;
+		ret = snap_show(buf, len);
+		free(buf);
+		return ret;
+	}
+
+	fd = socket(AF_NINET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (!strcmp(argv[1], "save")) {
+		ret = snap_save(fd, argv[2]);
+	} else if (!strcmp(argv[1], "restore")) {
+		if (argc == DEMO_INPUT_3 && !strcmp(argv[DEMO_INPUT_2], "nodad"))
+			flags |= NIP_SNAP_F_NODAD;
+		ret = snap_restore(fd, argv[2], flags);
+	} else {
+		cmd_help();
+		ret = -1;
+	}
+
+	close(fd);
+	return ret;
+}
@@ -3,6 +3,7 @@
 #ifndef _NIP_UAPI_H
 #define _NIP_UAPI_H
 
+#include <linux/sockios.h>
 #include "nip.h"
 
 /* The following structure must be larger than V4. System calls use V4.
@@ -23,6 +24,100 @@ struct nip_ifreq {
 	int ifrn_ifindex;
 };
 
+/* SIOCNIPACCEPTBATCH on a listening socket: accept up to max connections
+ * in one call, the new fds are stored in the array at fds and their number
+ * is returned. Only the first one may block, flags as for accept4().
+ */
+struct nip_accept_batch {
+	unsigned long long fds; /* int array of max entries */
+	int max;
+	int flags;
+};
+
+#define SIOCNIPACCEPTBATCH (SIOCPROTOPRIVATE + 0)
+
+/* SIOCNIPSETPEER with struct nip_ifreq: ifrn_addr is the only peer of the
+ * point-to-point link ifrn_ifindex. Packets to it are sent without saddr,
+ * packets received without saddr on the link come from it. A zero bitlen
+ * turns this off.
+ */
+#define SIOCNIPSETPEER     (SIOCPROTOPRIVATE + 1)
+
+/* Binary snapshot of the NewIP addresses and main table routes of a
+ * namespace: a struct nip_snap_hdr, naddr struct nip_snap_addr and nroute
+ * struct nip_snap_route. Devices are stored by name.
+ */
+#define NIP_SNAP_MAGIC     0x4e495053 /* "NIPS" */
+#define NIP_SNAP_VERSION   1
+#define NIP_SNAP_IFNAMSIZ  16 /* IFNAMSIZ */
+
+struct nip_snap_hdr {
+	unsigned int magic;
+	unsigned short version;
+	unsigned short resv;
+	unsigned int naddr;
+	unsigned int nroute;
+};
+
+struct nip_snap_addr {
+	unsigned int flags; /* IFA_F_* */
+	char dev_name[NIP_SNAP_IFNAMSIZ];
+	struct nip_addr addr;
+	unsigned char resv[3];
+};
+
+struct nip_snap_route {
+	unsigned int flags; /* RTF_* */
+	unsigned int metric;
+	char dev_name[NIP_SNAP_IFNAMSIZ];
+	struct nip_addr dst;
+	struct nip_addr gateway;
+	unsigned char resv[2];
+};
+
+/* SIOCNIPSNAPDUMP stores the snapshot in buf and its size in len, it fails
+ * with ENOSPC and sets len to the size needed if buf is too small.
+ * SIOCNIPSNAPRESTORE adds all entries of the len bytes at buf in one call,
+ * entries that already exist are skipped.
+ */
+#define NIP_SNAP_F_NODAD   0x1 /* restore: addresses skip DAD */
+
+struct nip_snap_req {
+	unsigned long long buf;
+	unsigned int len;
+	unsigned int flags;
+};
+
+#define SIOCNIPSNAPDUMP    (SIOCPROTOPRIVATE + 2)
+#define SIOCNIPSNAPRESTORE (SIOCPROTOPRIVATE + 3)
+
+/* Flow record read from /proc/net/nip_flow_export, one per flow and CPU
+ * for each export, times are CLOCK_REALTIME in ms
+ */
+#define NIP_FLOW_DIR_IN      0
+#define NIP_FLOW_DIR_OUT     1
+
+#define NIP_FLOW_END_IDLE    1
+#define NIP_FLOW_END_ACTIVE  2
+#define NIP_FLOW_END_FORCED  4
+
+struct nip_flow_record {
+	unsigned long long packets;
+	unsigned long long bytes;
+	unsigned long long first_ms;
+	unsigned long long last_ms;
+	unsigned int netns;
+	unsigned int cpu;
+	unsigned short sport; /* big-endian */
+	unsigned short dport; /* big-endian */
+	struct nip_addr daddr;
+	struct nip_addr saddr;
+	unsigned char nexthdr;
+	unsigned char dir;
+	unsigned char reason;
+	unsigned char resv[7];
+};
+
 struct thread_args {
 	int cfd;
 	struct sockaddr_nin si_server;
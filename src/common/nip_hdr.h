@@ -62,7 +62,7 @@
 #define NIP_BITMAP_INCLUDE_TTL       0x40                      /* Bit 1 is set */
 #define NIP_BITMAP_INCLUDE_TOTAL_LEN 0x20                      /* Bit 2 is set */
 #define NIP_BITMAP_INCLUDE_NEXT_HDR  0x10                      /* Bit 3 is set */
-#define NIP_BITMAP_INCLUDE_RES1      0x08                      /* Bit 4 is set */
+#define NIP_BITMAP_INCLUDE_TCLASS    0x08                      /* Bit 4 is set */
 #define NIP_BITMAP_INCLUDE_DADDR     0x04                      /* Bit 5 is set */
 #define NIP_BITMAP_INCLUDE_SADDR     0x02                      /* Bit 6 is set */
 #define NIP_BITMAP_HAVE_BYTE_2       NIP_BITMAP_HAVE_MORE_BIT  /* Bit 7 is set */
@@ -78,15 +78,15 @@
 #define NIP_BITMAP_HAVE_BYTE_3       NIP_BITMAP_HAVE_MORE_BIT  /* Bit 7 is set */
 
 /* Bitmap 1st Byte:
- * | valid | ttl | total_len | next_hdr | res1 | daddr | saddr | have byte2 |
- * |   0   |  1  |     0     |     1    |  0   |   1   |   1   |     0      |
+ * | valid | ttl | total_len | next_hdr | tclass | daddr | saddr | have byte2 |
+ * |   0   |  1  |     0     |     1    |    0   |   1   |   1   |     0      |
  */
 #define NIP_UDP_BITMAP_1          0x56
 #define NIP_UDP_BITMAP_1_INC_2    0x57
 
 /* Bitmap 1st Byte:
- * | valid | ttl | total_len | next_hdr | res1 | daddr | saddr | have byte2 |
- * |   0   |  1  |     1     |     1    |  0   |   1   |   1   |     0      |
+ * | valid | ttl | total_len | next_hdr | tclass | daddr | saddr | have byte2 |
+ * |   0   |  1  |     1     |     1    |    0   |   1   |   1   |     0      |
  */
 #define NIP_NORMAL_BITMAP_1        0x76
 #define NIP_NORMAL_BITMAP_1_INC_2  0x77
@@ -104,6 +104,17 @@
  */
 #define NIP_INVALID_BITMAP_2       0x7F
 
+/* The traffic class byte carries the IP_TOS of the sender, it is only
+ * encapsulated when non-zero so that default traffic keeps the old format
+ */
+#define NIP_TCLASS_LEN 1
+
+/* Upper bound of the bytes nip_hdr_parse() reads: every bitmap byte, ttl,
+ * total_len, next header, tclass, two 8 byte addresses and the header length
+ */
+#define NIP_HDR_PARSE_MAX (BITMAP_MAX + 1 + 2 + 1 + NIP_TCLASS_LEN + \
+			   2 * NIP_8BIT_ADDR_INDEX_MAX + 1)
+
 #define NIP_DEFAULT_TTL 128
 #define NIP_ARP_DEFAULT_TTL 64
 #define IPPROTO_NIP_ICMP 0xB1
@@ -145,6 +156,7 @@ struct nip_hdr_decap {
 	unsigned char nexthdr;      /* Upper-layer Protocol Type: IPPROTO_UDP */
 	unsigned char hdr_len;      /* Indicates the length of the packet header */
 	unsigned char hdr_real_len; /* Indicates the actual length of the packet header */
+	unsigned char tclass;       /* Traffic class, 0 if not carried */
 
 	unsigned short total_len;   /* Packet length (Header + packet), network order.(big end) */
 	unsigned short no_hdr_len : 1;  /* The header does not contain a header length field */
@@ -155,7 +167,8 @@ struct nip_hdr_decap {
 	unsigned short include_nexthdr : 1;
 	unsigned short include_hdr_len : 1;
 	unsigned short include_total_len : 1;
-	unsigned short res : 8;
+	unsigned short include_tclass : 1;
+	unsigned short res : 7;
 
 	unsigned int rcv_buf_len;
 };
@@ -172,6 +185,8 @@ struct nip_hdr_encap {
 	unsigned char ttl;     /* Hop count limit */
 	unsigned char nexthdr; /* Upper-layer Protocol Type: IPPROTO_UDP */
 	unsigned short total_len; /* Packet header length + packet data length */
+	unsigned char tclass;     /* Traffic class (IP_TOS), not encapsulated if 0 */
+	unsigned char saddr_elided; /* Leave saddr out, the receiver knows the peer */
 
 	void *usr_data;             /* User data pointer */
 	unsigned int usr_data_len;  /* Length of data sent by the user */
@@ -227,13 +242,26 @@ void nip_update_total_len(struct nip_hdr_encap *head, unsigned short total_len);
 /* Note: a function call requires its own byte order conversion.(niph->total_len) */
 int nip_hdr_parse(unsigned char *rcv_buf, unsigned int buf_len, struct nip_hdr_decap *niph);
 
+/* Parse n headers at once, ret[i] is the nip_hdr_parse() result of bufs[i].
+ * Returns the number of headers that were parsed successfully.
+ */
+int nip_hdr_parse_burst(unsigned char *bufs[], const unsigned int lens[],
+			struct nip_hdr_decap out[], int ret[], unsigned int n);
+
 /* The length of the packet header is obtained according to the packet type,
- * source ADDRESS, and destination address.
+ * source ADDRESS, destination address and traffic class, exactly as encoded.
  * If the packet does not carry the source address or destination address, fill in the blank
  */
 int get_nip_hdr_len(enum NIP_HDR_TYPE hdr_type,
 		    const struct nip_addr *saddr,
-		    const struct nip_addr *daddr);
+		    const struct nip_addr *daddr,
+		    unsigned char tclass);
+
+/* Extra header length when a traffic class is carried */
+static inline int get_nip_tclass_len(unsigned char tclass)
+{
+	return tclass ? NIP_TCLASS_LEN : 0;
+}
 
 struct udp_hdr {
 	unsigned short	sport;
@@ -32,18 +32,24 @@
 
 /* Must carry the current field */
 static int _get_nip_hdr_bitmap(unsigned char *buf,
+			       unsigned int left,
 			       unsigned char bitmap[],
 			       unsigned char bitmap_index_max)
 {
 	int i = 0;
 	unsigned char *p = buf;
 
+	if (!left)
+		return -NIP_HDR_RCV_BUF_READ_OUT_RANGE;
+
 	if (*p & NIP_BITMAP_INVALID_SET)
 		return -NIP_HDR_BITMAP_INVALID;
 
 	do {
 		if (i >= bitmap_index_max)
 			return -NIP_HDR_BITMAP_NUM_OUT_RANGE;
+		if ((unsigned int)i >= left)
+			return -NIP_HDR_RCV_BUF_READ_OUT_RANGE;
 
 		bitmap[i] = *p;
 		p++;
@@ -54,11 +60,14 @@ static int _get_nip_hdr_bitmap(unsigned char *buf,
 
 /* Must carry the current field */
 static int _get_nip_hdr_ttl(const unsigned char *buf,
+			    unsigned int left,
 			    unsigned char bitmap,
 			    struct nip_hdr_decap *niph)
 {
 	if (!(bitmap & NIP_BITMAP_INCLUDE_TTL))
 		return -NIP_HDR_NO_TTL;
+	if (left < sizeof(niph->ttl))
+		return -NIP_HDR_RCV_BUF_READ_OUT_RANGE;
 
 	niph->ttl = *buf;
 	niph->include_ttl = 1;
@@ -71,11 +80,14 @@ static int _get_nip_hdr_ttl(const unsigned char *buf,
  * but communication between devices of different versions must carry packet header length
  */
 static int _get_nip_hdr_len(const unsigned char *buf,
+			    unsigned int left,
 			    unsigned char bitmap,
 			    struct nip_hdr_decap *niph)
 {
 	if (!(bitmap & NIP_BITMAP_INCLUDE_HDR_LEN))
 		return 0;
+	if (left < sizeof(niph->hdr_len))
+		return -NIP_HDR_RCV_BUF_READ_OUT_RANGE;
 
 	/* Total_len is a network sequence and cannot be
 	 * compared directly with the local sequence
@@ -91,11 +103,14 @@ static int _get_nip_hdr_len(const unsigned char *buf,
 
 /* Must carry the current field */
 static int _get_nip_hdr_nexthdr(const unsigned char *buf,
+				unsigned int left,
 				unsigned char bitmap,
 				struct nip_hdr_decap *niph)
 {
 	if (!(bitmap & NIP_BITMAP_INCLUDE_NEXT_HDR))
 		return -NIP_HDR_NO_NEXT_HDR;
+	if (left < sizeof(niph->nexthdr))
+		return -NIP_HDR_RCV_BUF_READ_OUT_RANGE;
 
 	niph->nexthdr = *buf;
 	niph->include_nexthdr = 1;
@@ -103,9 +118,38 @@ static int _get_nip_hdr_nexthdr(const unsigned char *buf,
 	return sizeof(niph->nexthdr);
 }
 
+/* Optional fields */
+static int _get_nip_hdr_tclass(const unsigned char *buf,
+			       unsigned int left,
+			       unsigned char bitmap,
+			       struct nip_hdr_decap *niph)
+{
+	if (!(bitmap & NIP_BITMAP_INCLUDE_TCLASS))
+		return 0;
+	if (left < sizeof(niph->tclass))
+		return -NIP_HDR_RCV_BUF_READ_OUT_RANGE;
+
+	niph->tclass = *buf;
+	niph->include_tclass = 1;
+
+	return sizeof(niph->tclass);
+}
+
+/* The first byte of an address gives its length, all of it must be in buf */
+static int _nip_hdr_addr_fits(const unsigned char *buf, unsigned int left)
+{
+	struct nip_addr addr;
+
+	if (!left)
+		return 0;
+	addr.nip_addr_field8[0] = buf[0];
+	return (unsigned int)get_nip_addr_len(&addr) <= left;
+}
+
 /* Must carry the current field */
 /* Note: niph->saddr is network order.(big end) */
 static int _get_nip_hdr_daddr(unsigned char *buf,
+			      unsigned int left,
 			      unsigned char bitmap,
 			      struct nip_hdr_decap *niph)
 {
@@ -113,6 +157,8 @@ static int _get_nip_hdr_daddr(unsigned char *buf,
 
 	if (!(bitmap & NIP_BITMAP_INCLUDE_DADDR))
 		return -NIP_HDR_NO_DADDR;
+	if (!_nip_hdr_addr_fits(buf, left))
+		return -NIP_HDR_RCV_BUF_READ_OUT_RANGE;
 
 	p = decode_nip_addr(buf, &niph->daddr);
 	if (!p)
@@ -128,6 +174,7 @@ static int _get_nip_hdr_daddr(unsigned char *buf,
 /* Optional fields */
 /* Note: niph->daddr is network order.(big end) */
 static int _get_nip_hdr_saddr(unsigned char *buf,
+			      unsigned int left,
 			      unsigned char bitmap,
 			      struct nip_hdr_decap *niph)
 {
@@ -135,6 +182,8 @@ static int _get_nip_hdr_saddr(unsigned char *buf,
 
 	if (!(bitmap & NIP_BITMAP_INCLUDE_SADDR))
 		return 0;
+	if (!_nip_hdr_addr_fits(buf, left))
+		return -NIP_HDR_RCV_BUF_READ_OUT_RANGE;
 
 	p = decode_nip_addr(buf, &niph->saddr);
 	if (!p)
@@ -147,53 +196,73 @@ static int _get_nip_hdr_saddr(unsigned char *buf,
 	return (niph->saddr.bitlen / NIP_ADDR_BIT_LEN_8);
 }
 
+/* total_len is not aligned on the wire, copy it bytewise */
+static inline void _nip_hdr_get_total_len(const unsigned char *buf,
+					  struct nip_hdr_decap *niph)
+{
+	unsigned char *p = (unsigned char *)&niph->total_len;
+
+	p[0] = buf[0];
+	p[1] = buf[1];
+}
+
 /* Optional fields: tcp/arp need, udp needless */
 /* Note: niph->total_len is network order.(big end), need change to host order */
 static int _get_nip_total_len(unsigned char *buf,
+			      unsigned int left,
 			      unsigned char bitmap,
 			      struct nip_hdr_decap *niph)
 {
 	if (!(bitmap & NIP_BITMAP_INCLUDE_TOTAL_LEN))
 		return 0;
+	if (left < sizeof(niph->total_len))
+		return -NIP_HDR_RCV_BUF_READ_OUT_RANGE;
 
 	/* Total_len is a network sequence and cannot be
 	 * compared directly with the local sequence
 	 */
-	niph->total_len = *((unsigned short *)buf);
+	_nip_hdr_get_total_len(buf, niph);
 	niph->include_total_len = 1;
 
 	return sizeof(niph->total_len);
 }
 
 static int _nip_hdr_bitmap0_parse(unsigned char *buf,
+				  unsigned int left,
 				  unsigned char bitmap,
 				  struct nip_hdr_decap *niph)
 {
 	int len;
 	int len_total = 0;
 
-	len = _get_nip_hdr_ttl(buf, bitmap, niph);
+	len = _get_nip_hdr_ttl(buf, left, bitmap, niph);
 	if (len < 0)
 		return len;
 	len_total += len;
 
 	/* Optional fields */
-	len = _get_nip_total_len(buf + len_total, bitmap, niph);
+	len = _get_nip_total_len(buf + len_total, left - len_total, bitmap, niph);
+	if (len < 0)
+		return len;
+	len_total += len;
+
+	len = _get_nip_hdr_nexthdr(buf + len_total, left - len_total, bitmap, niph);
 	if (len < 0)
 		return len;
 	len_total += len;
 
-	len = _get_nip_hdr_nexthdr(buf + len_total, bitmap, niph);
+	/* Optional fields */
+	len = _get_nip_hdr_tclass(buf + len_total, left - len_total, bitmap, niph);
 	if (len < 0)
 		return len;
 	len_total += len;
 
-	len = _get_nip_hdr_daddr(buf + len_total, bitmap, niph);
+	len = _get_nip_hdr_daddr(buf + len_total, left - len_total, bitmap, niph);
 	if (len < 0)
 		return len;
 	len_total += len;
 
-	len = _get_nip_hdr_saddr(buf + len_total, bitmap, niph);
+	len = _get_nip_hdr_saddr(buf + len_total, left - len_total, bitmap, niph);
 	if (len < 0)
 		return len;
 	len_total += len;
@@ -202,6 +271,7 @@ static int _nip_hdr_bitmap0_parse(unsigned char *buf,
 }
 
 static int _nip_hdr_bitmap1_parse(unsigned char *buf,
+				  unsigned int left,
 				  unsigned char bitmap,
 				  struct nip_hdr_decap *niph)
 {
@@ -213,7 +283,7 @@ static int _nip_hdr_bitmap1_parse(unsigned char *buf,
 		niph->include_unknown_bit = 1;
 
 	/* Optional fields */
-	len = _get_nip_hdr_len(buf + len_total, bitmap, niph);
+	len = _get_nip_hdr_len(buf + len_total, left - len_total, bitmap, niph);
 	if (len < 0)
 		return len;
 	len_total += len;
@@ -222,6 +292,7 @@ static int _nip_hdr_bitmap1_parse(unsigned char *buf,
 }
 
 static int _nip_hdr_unknown_bit_check(unsigned char *buf,
+				      unsigned int left,
 				      unsigned char bitmap,
 				      struct nip_hdr_decap *niph)
 {
@@ -231,6 +302,7 @@ static int _nip_hdr_unknown_bit_check(unsigned char *buf,
 
 #define FACTORY_NUM_MAX 3
 static int (*hdr_parse_factory[FACTORY_NUM_MAX])(unsigned char *,
+						 unsigned int,
 						 unsigned char,
 						 struct nip_hdr_decap *) = {
 	_nip_hdr_bitmap0_parse,
@@ -263,9 +335,14 @@ int nip_hdr_parse(unsigned char *rcv_buf, unsigned int buf_len, struct nip_hdr_d
 	int ret;
 	unsigned char *buf = rcv_buf;
 	unsigned char bitmap[BITMAP_MAX] = {0};
-	int num = _get_nip_hdr_bitmap(buf, bitmap, BITMAP_MAX);
+	int num;
+
+	if (!rcv_buf)
+		return 0;
 
-	if (num <= 0 || !rcv_buf)
+	/* Every field parser checks what is left of buf_len before it reads */
+	num = _get_nip_hdr_bitmap(buf, buf_len, bitmap, BITMAP_MAX);
+	if (num <= 0)
 		return num;
 
 	niph->hdr_real_len = num * sizeof(bitmap[0]);
@@ -277,7 +354,7 @@ int nip_hdr_parse(unsigned char *rcv_buf, unsigned int buf_len, struct nip_hdr_d
 
 		if (i >= FACTORY_NUM_MAX)
 			break;
-		len = hdr_parse_factory[i](buf, bitmap[i], niph);
+		len = hdr_parse_factory[i](buf, buf_len - niph->hdr_real_len, bitmap[i], niph);
 		if (len < 0)
 			return len;
 
@@ -296,3 +373,152 @@ int nip_hdr_parse(unsigned char *rcv_buf, unsigned int buf_len, struct nip_hdr_d
 	       niph->hdr_len : niph->hdr_real_len;
 }
 
+
+/* Burst parse
+ * Almost every header on the wire has a single bitmap byte with TTL, next
+ * header and daddr set, plus short (1 or 2 byte) addresses. The first
+ * bitmap bytes of NIP_BURST_GROUP headers are gathered into one word and
+ * classified together, the headers of that shape are decoded without the
+ * bitmap loop and the per-field callbacks, the rest (and every error, so
+ * that the error code is the same) go through nip_hdr_parse().
+ * SWAR rather than SIMD registers, so that the code also runs in the kernel.
+ */
+#define NIP_BURST_GROUP   8
+#define NIP_BURST_ONES    0x0101010101010101ULL
+#define NIP_BURST_LOW7    0x7F7F7F7F7F7F7F7FULL
+#define NIP_BURST_HIGH    0x8080808080808080ULL
+
+/* Bits that must match in the first bitmap byte of a fast path header */
+#define NIP_BURST_BITMAP_MASK (NIP_BITMAP_INVALID_SET | NIP_BITMAP_INCLUDE_TTL | \
+			       NIP_BITMAP_INCLUDE_NEXT_HDR | NIP_BITMAP_INCLUDE_DADDR | \
+			       NIP_BITMAP_HAVE_MORE_BIT)
+#define NIP_BURST_BITMAP_WANT (NIP_BITMAP_INCLUDE_TTL | NIP_BITMAP_INCLUDE_NEXT_HDR | \
+			       NIP_BITMAP_INCLUDE_DADDR)
+
+/* Same result as decode_nip_addr(), short addresses inline */
+static inline unsigned char *_nip_burst_decode_addr(unsigned char *buf, struct nip_addr *addr)
+{
+	unsigned char first = buf[0];
+
+	if (first <= ADDR_FIRST_DC) {
+		if (addr->nip_addr_field8[NIP_8BIT_ADDR_INDEX_1] ||
+		    addr->nip_addr_field16[NIP_16BIT_ADDR_INDEX_1] ||
+		    addr->nip_addr_field32[NIP_32BIT_ADDR_INDEX_1])
+			return decode_nip_addr(buf, addr);
+		addr->nip_addr_field8[NIP_8BIT_ADDR_INDEX_0] = first;
+		addr->bitlen = NIP_ADDR_BIT_LEN_8;
+		return buf + NIP_ADDR_LEN_1;
+	}
+
+	if ((first > ADDR_FIRST_DC + 1 && first <= ADDR_FIRST_F0) ||
+	    (first == ADDR_FIRST_DC + 1 && buf[1] >= ADDR_SECOND_MIN_DD) ||
+	    first == ADDR_FIRST_FF) {
+		if (addr->nip_addr_field16[NIP_16BIT_ADDR_INDEX_1] ||
+		    addr->nip_addr_field32[NIP_32BIT_ADDR_INDEX_1])
+			return decode_nip_addr(buf, addr);
+		addr->nip_addr_field8[NIP_8BIT_ADDR_INDEX_0] = first;
+		addr->nip_addr_field8[NIP_8BIT_ADDR_INDEX_1] = buf[1];
+		addr->bitlen = NIP_ADDR_BIT_LEN_16;
+		return buf + NIP_ADDR_LEN_2;
+	}
+
+	return decode_nip_addr(buf, addr);
+}
+
+/* Header with one bitmap byte that carries TTL, next header and daddr.
+ * Fields are written in the order nip_hdr_parse() writes them, so a failed
+ * header can simply be parsed again by it.
+ */
+static int _nip_hdr_parse_fast(unsigned char *rcv_buf, unsigned int buf_len,
+			       struct nip_hdr_decap *niph)
+{
+	unsigned char bitmap = rcv_buf[0];
+	unsigned char *p = rcv_buf + 1;
+
+	niph->rcv_buf_len = buf_len;
+	niph->ttl = *p++;
+	niph->include_ttl = 1;
+
+	if (bitmap & NIP_BITMAP_INCLUDE_TOTAL_LEN) {
+		_nip_hdr_get_total_len(p, niph);
+		niph->include_total_len = 1;
+		p += sizeof(niph->total_len);
+	}
+
+	niph->nexthdr = *p++;
+	niph->include_nexthdr = 1;
+
+	if (bitmap & NIP_BITMAP_INCLUDE_TCLASS) {
+		niph->tclass = *p++;
+		niph->include_tclass = 1;
+	}
+
+	p = _nip_burst_decode_addr(p, &niph->daddr);
+	if (!p)
+		return -1;
+	niph->include_daddr = 1;
+
+	if (bitmap & NIP_BITMAP_INCLUDE_SADDR) {
+		p = _nip_burst_decode_addr(p, &niph->saddr);
+		if (!p)
+			return -1;
+		niph->include_saddr = 1;
+	}
+
+	niph->hdr_real_len = p - rcv_buf;
+	if (niph->hdr_real_len >= buf_len || nip_hdr_check(niph) < 0)
+		return -1;
+
+	return niph->hdr_len > niph->hdr_real_len ?
+	       niph->hdr_len : niph->hdr_real_len;
+}
+
+/* Lane i of the result has its high bit set if byte i of the word is not zero */
+static inline unsigned long long _nip_burst_nonzero(unsigned long long w)
+{
+	return (((w & NIP_BURST_LOW7) + NIP_BURST_LOW7) | w) & NIP_BURST_HIGH;
+}
+
+/* Note: out[] must be initialized by the caller as for nip_hdr_parse(),
+ * ret[i] is what nip_hdr_parse() returns for bufs[i].
+ */
+int nip_hdr_parse_burst(unsigned char *bufs[], const unsigned int lens[],
+			struct nip_hdr_decap out[], int ret[], unsigned int n)
+{
+	unsigned int ok = 0;
+	unsigned int base;
+	unsigned int i;
+
+	for (base = 0; base < n; base += NIP_BURST_GROUP) {
+		unsigned int num = n - base < NIP_BURST_GROUP ? n - base : NIP_BURST_GROUP;
+		unsigned long long bitmaps = 0;
+		unsigned long long slow;
+
+		for (i = base + NIP_BURST_GROUP; i < base + NIP_BURST_GROUP * 2 && i < n; i++)
+			__builtin_prefetch(bufs[i]);
+
+		/* Unused lanes and short buffers are left zero and classified as slow */
+		for (i = 0; i < num; i++)
+			if (lens[base + i] >= NIP_HDR_PARSE_MAX)
+				bitmaps |= (unsigned long long)bufs[base + i][0] <<
+					   (i * NIP_ADDR_BIT_LEN_8);
+		slow = _nip_burst_nonzero((bitmaps & (NIP_BURST_BITMAP_MASK * NIP_BURST_ONES)) ^
+					  (NIP_BURST_BITMAP_WANT * NIP_BURST_ONES));
+
+		for (i = 0; i < num; i++) {
+			unsigned int k = base + i;
+			int len = -1;
+
+			if (!(slow & (0x80ULL << (i * NIP_ADDR_BIT_LEN_8))))
+				len = _nip_hdr_parse_fast(bufs[k], lens[k], &out[k]);
+			if (len < 0)
+				len = nip_hdr_parse(bufs[k], lens[k], &out[k]);
+
+			ret[k] = len;
+			if (len >= 0)
+				ok++;
+		}
+	}
+
+	return ok;
+}
@@ -81,6 +81,15 @@ static inline void _nip_hdr_nexthdr_encap(struct nip_hdr_encap *head)
 	head->hdr_buf_pos += sizeof(head->nexthdr);
 }
 
+static inline void _nip_hdr_tclass_encap(struct nip_hdr_encap *head)
+{
+	if (!head->tclass)
+		return;
+
+	*(head->hdr_buf + head->hdr_buf_pos) = head->tclass;
+	head->hdr_buf_pos += sizeof(head->tclass);
+}
+
 static inline void _nip_hdr_daddr_encap(struct nip_hdr_encap *head)
 {
 	(void)build_nip_addr(&head->daddr, (head->hdr_buf + head->hdr_buf_pos));
@@ -89,6 +98,9 @@ static inline void _nip_hdr_daddr_encap(struct nip_hdr_encap *head)
 
 static inline void _nip_hdr_saddr_encap(struct nip_hdr_encap *head)
 {
+	if (head->saddr_elided)
+		return;
+
 	(void)build_nip_addr(&head->saddr, (head->hdr_buf + head->hdr_buf_pos));
 	head->hdr_buf_pos += (head->saddr.bitlen / NIP_ADDR_BIT_LEN_8);
 }
@@ -105,17 +117,22 @@ void nip_update_total_len(struct nip_hdr_encap *head, unsigned short total_len)
 	*head->total_len_pos = total_len;
 }
 
+static inline unsigned int _nip_hdr_saddr_len(const struct nip_hdr_encap *head)
+{
+	return head->saddr_elided ? 0 : head->saddr.bitlen / NIP_ADDR_BIT_LEN_8;
+}
+
 #define BITMAP1_OFFSET 1
 #define BITMAP2_OFFSET 2
 static inline void _nip_hdr_encap_udp_bitmap(struct nip_hdr_encap *head)
 {
-	/* bitmap(1B) + ttl(1B) + total_len(2B) + nexthdr(1B) + daddr(xB) + saddr(xB) */
+	/* bitmap(1B) + ttl(1B) + nexthdr(1B) + [tclass(1B)] + daddr(xB) + [saddr(xB)] */
 	/* If the length of the destination address and the source address is even,
 	 * the length of the packet header must be odd. You need to add 1-byte alignment
 	 * and 1-byte bitmap
 	 */
-	if (((head->daddr.bitlen / NIP_ADDR_BIT_LEN_8) + (head->saddr.bitlen / NIP_ADDR_BIT_LEN_8))
-	    % NIP_BYTE_ALIGNMENT != 0) {
+	if (((head->daddr.bitlen / NIP_ADDR_BIT_LEN_8) + _nip_hdr_saddr_len(head) +
+	     get_nip_tclass_len(head->tclass)) % NIP_BYTE_ALIGNMENT != 0) {
 		head->hdr_buf[0] = NIP_UDP_BITMAP_1;
 		head->hdr_buf_pos = BITMAP1_OFFSET;
 	} else {
@@ -123,17 +140,24 @@ static inline void _nip_hdr_encap_udp_bitmap(struct nip_hdr_encap *head)
 		head->hdr_buf[1] = NIP_NODATA_BITMAP_2;
 		head->hdr_buf_pos = BITMAP2_OFFSET;
 	}
+
+	if (head->tclass)
+		head->hdr_buf[0] |= NIP_BITMAP_INCLUDE_TCLASS;
+	if (head->saddr_elided)
+		head->hdr_buf[0] &= ~NIP_BITMAP_INCLUDE_SADDR;
 }
 
 static inline void _nip_hdr_encap_comm_bitmap(struct nip_hdr_encap *head)
 {
-	/* bitmap(1B) + ttl(1B) + nexthdr(1B) + daddr(xB) + saddr(xB) */
+	/* bitmap(1B) + ttl(1B) + total_len(2B) + nexthdr(1B) + [tclass(1B)] +
+	 * daddr(xB) + [saddr(xB)]
+	 */
 	/* If the length of the destination address and the source address is even,
 	 * the length of the packet header must be odd. You need to add 1-byte alignment
 	 * and 1-byte bitmap
 	 */
-	if (((head->daddr.bitlen / NIP_ADDR_BIT_LEN_8) + (head->saddr.bitlen / NIP_ADDR_BIT_LEN_8))
-	    % NIP_BYTE_ALIGNMENT != 0) {
+	if (((head->daddr.bitlen / NIP_ADDR_BIT_LEN_8) + _nip_hdr_saddr_len(head) +
+	     get_nip_tclass_len(head->tclass)) % NIP_BYTE_ALIGNMENT != 0) {
 		head->hdr_buf[0] = NIP_NORMAL_BITMAP_1;
 		head->hdr_buf_pos = BITMAP1_OFFSET;
 	} else {
@@ -141,6 +165,11 @@ static inline void _nip_hdr_encap_comm_bitmap(struct nip_hdr_encap *head)
 		head->hdr_buf[1] = NIP_NODATA_BITMAP_2;
 		head->hdr_buf_pos = BITMAP2_OFFSET;
 	}
+
+	if (head->tclass)
+		head->hdr_buf[0] |= NIP_BITMAP_INCLUDE_TCLASS;
+	if (head->saddr_elided)
+		head->hdr_buf[0] &= ~NIP_BITMAP_INCLUDE_SADDR;
 }
 
 #define NEWIP_BYTE_ALIGNMENT_ENABLE 1 // 0: disable; 1: enable
@@ -152,12 +181,17 @@ void nip_hdr_udp_encap(struct nip_hdr_encap *head)
 	_nip_hdr_encap_udp_bitmap(head);
 #else
 	head->hdr_buf[0] = NIP_UDP_BITMAP_1;
+	if (head->tclass)
+		head->hdr_buf[0] |= NIP_BITMAP_INCLUDE_TCLASS;
+	if (head->saddr_elided)
+		head->hdr_buf[0] &= ~NIP_BITMAP_INCLUDE_SADDR;
 	head->hdr_buf_pos = 1;
 #endif
 
 	/* Encapsulate bitmap fields into newIP packet header BUF */
 	_nip_hdr_ttl_encap(head);
 	_nip_hdr_nexthdr_encap(head);
+	_nip_hdr_tclass_encap(head);
 	_nip_hdr_daddr_encap(head);
 	_nip_hdr_saddr_encap(head);
 }
@@ -170,6 +204,10 @@ void nip_hdr_comm_encap(struct nip_hdr_encap *head)
 	_nip_hdr_encap_comm_bitmap(head);
 #else
 	head->hdr_buf[0] = NIP_NORMAL_BITMAP_1;
+	if (head->tclass)
+		head->hdr_buf[0] |= NIP_BITMAP_INCLUDE_TCLASS;
+	if (head->saddr_elided)
+		head->hdr_buf[0] &= ~NIP_BITMAP_INCLUDE_SADDR;
 	head->hdr_buf_pos = 1;
 #endif
 
@@ -177,17 +215,14 @@ void nip_hdr_comm_encap(struct nip_hdr_encap *head)
 	_nip_hdr_ttl_encap(head);
 	_nip_hdr_total_len_encap(head); /* ARP/TCP need include hdr total len */
 	_nip_hdr_nexthdr_encap(head);
+	_nip_hdr_tclass_encap(head);
 	_nip_hdr_daddr_encap(head);
 	_nip_hdr_saddr_encap(head);
 }
 
-#if (NEWIP_BYTE_ALIGNMENT_ENABLE == 1)    // include bitmap2
-#define NIP_COMM_HDR_LEN_NOINCLUDE_ADDR 6 // include total len
-#define NIP_UDP_HDR_LEN_NOINCLUDE_ADDR  4 // not include total len
-#else
-#define NIP_COMM_HDR_LEN_NOINCLUDE_ADDR 5 // include total len
-#define NIP_UDP_HDR_LEN_NOINCLUDE_ADDR  3 // not include total len
-#endif
+#define NIP_COMM_HDR_LEN_NOINCLUDE_ADDR 5 // bitmap1, include total len
+#define NIP_UDP_HDR_LEN_NOINCLUDE_ADDR  3 // bitmap1, not include total len
+#define NIP_BITMAP2_LEN                 1
 /* bitmap1 + bitmap2 + TTL + total len + nexthd + daddr + saddr
  * 1B        1B        1B    2B          1B       7B      7B    = 20B
  * NIP_HDR_MAX 20
@@ -195,18 +230,21 @@ void nip_hdr_comm_encap(struct nip_hdr_encap *head)
  * NIP TCP 1430 + 30 = 1460
  */
 /* The length of the packet header is obtained according to the packet type,
- * source ADDRESS, and destination address.
+ * source ADDRESS, destination address and traffic class. It is the length
+ * the encap functions write, bitmap2 is only counted when alignment needs it.
  * If the packet does not carry the source address or destination address, fill in the blank
  */
 int get_nip_hdr_len(enum NIP_HDR_TYPE hdr_type,
 		    const struct nip_addr *saddr,
-		    const struct nip_addr *daddr)
+		    const struct nip_addr *daddr,
+		    unsigned char tclass)
 {
 	int saddr_len = 0;
 	int daddr_len = 0;
-	enum NIP_HDR_TYPE base_len = hdr_type == NIP_HDR_UDP ?
-				     NIP_UDP_HDR_LEN_NOINCLUDE_ADDR :
-				     NIP_COMM_HDR_LEN_NOINCLUDE_ADDR;
+	int tclass_len = get_nip_tclass_len(tclass);
+	int base_len = hdr_type == NIP_HDR_UDP ?
+		       NIP_UDP_HDR_LEN_NOINCLUDE_ADDR :
+		       NIP_COMM_HDR_LEN_NOINCLUDE_ADDR;
 
 	if (hdr_type >= NIP_HDR_TYPE_MAX)
 		return 0;
@@ -223,6 +261,12 @@ int get_nip_hdr_len(enum NIP_HDR_TYPE hdr_type,
 			return 0;
 	}
 
-	return base_len + saddr_len + daddr_len;
+#if (NEWIP_BYTE_ALIGNMENT_ENABLE == 1)
+	/* same rule as _nip_hdr_encap_comm_bitmap / _nip_hdr_encap_udp_bitmap */
+	if ((saddr_len + daddr_len + tclass_len) % NIP_BYTE_ALIGNMENT == 0)
+		base_len += NIP_BITMAP2_LEN;
+#endif
+
+	return base_len + tclass_len + saddr_len + daddr_len;
 }
 
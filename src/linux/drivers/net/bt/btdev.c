@@ -17,12 +17,15 @@ static int bt_seq_show(struct seq_file *m, void *v)
 		   BT_RING_BUFFER_SIZE);
 
 	list_for_each_entry(vnet, &bt_drv->devices_table->head, virnet_entry) {
+		int band;
+
 		seq_printf(m, "dev: %12s, interface: %5s, state: %12s, MTU: %4d\n",
 			   bt_virnet_get_cdev_name(vnet), bt_virnet_get_ndev_name(vnet),
 			   bt_virnet_get_state_rep(vnet), vnet->ndev->mtu);
-		seq_printf(m, "ring head: %4d, ring tail: %4d, packets num: %4d\n",
-			   vnet->tx_ring->head, vnet->tx_ring->tail,
-			   bt_virnet_get_ring_packets(vnet));
+		for (band = 0; band < BT_VIRNET_BAND_NUM; band++)
+			seq_printf(m, "band: %d, ring head: %4d, ring tail: %4d, packets num: %4d\n",
+				   band, vnet->tx_ring[band]->head, vnet->tx_ring[band]->tail,
+				   bt_virnet_get_ring_packets(vnet, band));
 	}
 
 	return OK;
@@ -133,19 +136,20 @@ static ssize_t bt_io_file_read(struct file *filp,
 	struct bt_virnet *vnet = filp->private_data;
 	ssize_t out_sz;
 	struct sk_buff *skb = NULL;
+	int band;
 
 	pr_devel("bt io file read called");
 
-	while (unlikely(bt_ring_is_empty(vnet->tx_ring))) {
+	while (unlikely((band = bt_virnet_next_band(vnet)) < 0)) {
 		if (filp->f_flags & O_NONBLOCK)
 			return -EAGAIN;
 
 		if (wait_event_interruptible(vnet->rx_queue,
-					     !bt_ring_is_empty(vnet->tx_ring)))
+					     bt_virnet_next_band(vnet) >= 0))
 			return -ERESTARTSYS;
 	}
 
-	skb = bt_ring_current(vnet->tx_ring);
+	skb = bt_ring_current(vnet->tx_ring[band]);
 	out_sz = skb->len - MACADDR_LEN;
 	if (unlikely(out_sz > size)) {
 		pr_err("io file read: buffer too small: skb's len=%ld buffer's len=%ld",
@@ -153,7 +157,7 @@ static ssize_t bt_io_file_read(struct file *filp,
 		return -EINVAL;
 	}
 
-	bt_ring_consume(vnet->tx_ring);
+	bt_ring_consume(vnet->tx_ring[band]);
 	if (copy_to_user(buffer, skb->data + MACADDR_LEN, out_sz)) {
 		pr_err("io file read: copy_to_user failed");
 		return -EIO;
@@ -162,9 +166,9 @@ static ssize_t bt_io_file_read(struct file *filp,
 	dev_kfree_skb(skb);
 	skb = NULL;
 
-	if (unlikely(netif_queue_stopped(vnet->ndev))) {
-		pr_devel("consume data: wake the queue");
-		netif_wake_queue(vnet->ndev);
+	if (unlikely(__netif_subqueue_stopped(vnet->ndev, band))) {
+		pr_devel("consume data: wake the queue of band %d", band);
+		netif_wake_subqueue(vnet->ndev, band);
 	}
 
 	return out_sz;
@@ -197,6 +201,11 @@ static ssize_t bt_io_file_write(struct file *filp,
 	len = skb->len;
 	skb->dev = bt_virnet_get_ndev(vnet);
 	skb->protocol = eth_type_trans(skb, bt_virnet_get_ndev(vnet));
+#if IS_ENABLED(CONFIG_NEWIP)
+	/* give RPS/RFS a per-flow hash, the flow dissector cannot parse NewIP */
+	if (skb->protocol == htons(ETH_P_NEWIP))
+		nip_skb_set_hash(skb);
+#endif
 	ret = netif_rx_ni(skb);
 
 	if (ret == NET_RX_SUCCESS) {
@@ -303,15 +312,18 @@ static int bt_cmd_change_mtu(struct bt_virnet *vnet, unsigned long arg)
 static int bt_cmd_peek_packet(struct bt_virnet *vnet, unsigned long arg)
 {
 	struct sk_buff *skb = NULL;
+	int band;
 
 	pr_devel("bt peek packet called");
 
-	if (unlikely(bt_ring_is_empty(vnet->tx_ring))) {
+	/* peek the packet the next read returns */
+	band = bt_virnet_next_band(vnet);
+	if (unlikely(band < 0)) {
 		pr_err("bt peek packet ring is empty");
 		return -EAGAIN;
 	}
 
-	skb = bt_ring_current(vnet->tx_ring);
+	skb = bt_ring_current(vnet->tx_ring[band]);
 	if (unlikely(put_user(skb->len - MACADDR_LEN, (int __user *)arg))) {
 		pr_err("put_user failed");
 		return -EIO;
@@ -358,10 +370,10 @@ static unsigned int bt_io_file_poll(struct file *filp, poll_table *wait)
 	poll_wait(filp, &vnet->rx_queue, wait);
 	poll_wait(filp, &vnet->tx_queue, wait);
 
-	if (!bt_ring_is_empty(vnet->tx_ring)) // readable
+	if (bt_virnet_next_band(vnet) >= 0) // readable
 		mask |= POLLIN | POLLRDNORM;
 
-	if (!bt_ring_is_full(vnet->tx_ring)) // writable
+	if (!bt_ring_is_full(vnet->tx_ring[BT_VIRNET_BAND_NORMAL])) // writable
 		mask |= POLLOUT | POLLWRNORM;
 
 	return mask;
@@ -544,16 +556,17 @@ static netdev_tx_t bt_virnet_xmit(struct sk_buff *skb,
 	int ret;
 	struct bt_virnet *vnet = NULL;
 	int len = skb->len;
+	int band = skb_get_queue_mapping(skb);
 
 	pr_alert("alert: bt virnet_xmit: called");
 	vnet = bt_table_find(bt_drv->devices_table, dev->name);
 	WARN_ON(!vnet);
 
-	ret = bt_virnet_produce_data(vnet, (void *)skb);
+	ret = bt_virnet_produce_data(vnet, band, (void *)skb);
 
 	if (unlikely(ret < 0)) {
 		pr_devel("virnet xmit: produce data failed: ring is full, need to stop queue");
-		netif_stop_queue(vnet->ndev);
+		netif_stop_subqueue(vnet->ndev, band);
 		return NETDEV_TX_BUSY;
 	}
 
@@ -563,8 +576,18 @@ static netdev_tx_t bt_virnet_xmit(struct sk_buff *skb,
 	return NETDEV_TX_OK;
 }
 
+/**
+ * one tx queue per band, so a full bulk ring does not stop control traffic
+ */
+static u16 bt_virnet_select_queue(struct net_device *dev, struct sk_buff *skb,
+				  struct net_device *sb_dev)
+{
+	return bt_virnet_prio_band(skb->priority);
+}
+
 static const struct net_device_ops bt_virnet_ops = {
 	.ndo_start_xmit = bt_virnet_xmit,
+	.ndo_select_queue = bt_virnet_select_queue,
 	.ndo_change_mtu = bt_virnet_change_mtu};
 
 static struct bt_table *bt_table_init(void)
@@ -745,23 +768,38 @@ static void bt_ring_destroy(struct bt_ring *ring)
 	kfree(ring);
 }
 
-static int bt_virnet_produce_data(struct bt_virnet *dev, void *data)
+static int bt_virnet_produce_data(struct bt_virnet *dev, int band, void *data)
 {
 	WARN_ON(!dev);
 	WARN_ON(!data);
-	if (unlikely(bt_ring_is_full(dev->tx_ring))) {
-		pr_devel("ring is full");
+	if (unlikely(bt_ring_is_full(dev->tx_ring[band]))) {
+		pr_devel("ring of band %d is full", band);
 		return -ENFILE;
 	}
 
 	smp_wmb(); // Make sure the write order is correct
-	bt_ring_produce(dev->tx_ring, data);
+	bt_ring_produce(dev->tx_ring[band], data);
 	smp_wmb(); // Make sure twrite order is correct
 
 	wake_up(&dev->rx_queue);
 	return OK;
 }
 
+/**
+ * the first band with data, -1 if all the rings are empty
+ */
+static int bt_virnet_next_band(const struct bt_virnet *vn)
+{
+	int band;
+
+	WARN_ON(!vn);
+	for (band = 0; band < BT_VIRNET_BAND_NUM; band++) {
+		if (!bt_ring_is_empty(vn->tx_ring[band]))
+			return band;
+	}
+	return -1;
+}
+
 /**
  * register all the region
  */
@@ -995,7 +1033,8 @@ static struct net_device *bt_net_device_create(u32 id)
 	char ifa_name[IFNAMSIZ];
 
 	snprintf(ifa_name, sizeof(ifa_name), "%s%d", BT_VIRNET_NAME_PREFIX, id);
-	ndev = alloc_netdev(0, ifa_name, NET_NAME_UNKNOWN, ether_setup);
+	ndev = alloc_netdev_mqs(0, ifa_name, NET_NAME_UNKNOWN, ether_setup,
+				BT_VIRNET_BAND_NUM, 1);
 	if (unlikely(!ndev)) {
 		pr_err("alloc_netdev failed");
 		return NULL;
@@ -1027,6 +1066,16 @@ static void bt_net_device_destroy(struct net_device *dev)
 	free_netdev(dev);
 }
 
+static void bt_virnet_destroy_rings(struct bt_virnet *vnet)
+{
+	int band;
+
+	for (band = 0; band < BT_VIRNET_BAND_NUM; band++) {
+		if (vnet->tx_ring[band])
+			bt_ring_destroy(vnet->tx_ring[band]);
+	}
+}
+
 static struct bt_io_file *bt_get_io_file(struct bt_drv *drv, int id)
 {
 	WARN_ON(id < 1);
@@ -1039,29 +1088,32 @@ static struct bt_io_file *bt_get_io_file(struct bt_drv *drv, int id)
  */
 static struct bt_virnet *bt_virnet_create(struct bt_drv *bt_mng, u32 id)
 {
-	struct bt_virnet *vnet = kmalloc(sizeof(*vnet), GFP_KERNEL);
+	struct bt_virnet *vnet = kzalloc(sizeof(*vnet), GFP_KERNEL);
+	int band;
 
 	if (unlikely(!vnet)) {
 		pr_err("error: bt_virnet init failed");
 		goto failure1;
 	}
 
-	vnet->tx_ring = bt_ring_create();
-	if (unlikely(!vnet->tx_ring)) {
-		pr_err("create ring failed");
-		goto failure2;
+	for (band = 0; band < BT_VIRNET_BAND_NUM; band++) {
+		vnet->tx_ring[band] = bt_ring_create();
+		if (unlikely(!vnet->tx_ring[band])) {
+			pr_err("create ring failed");
+			goto failure2;
+		}
 	}
 
 	vnet->ndev = bt_net_device_create(id);
 	if (unlikely(!vnet->ndev)) {
 		pr_err("create net device failed");
-		goto failure3;
+		goto failure2;
 	}
 
 	vnet->io_file = bt_get_io_file(bt_mng, id);
 	if (unlikely(!vnet->io_file)) {
 		pr_err("create cdev failed");
-		goto failure4;
+		goto failure3;
 	}
 
 	init_waitqueue_head(&vnet->rx_queue);
@@ -1070,13 +1122,11 @@ static struct bt_virnet *bt_virnet_create(struct bt_drv *bt_mng, u32 id)
 	SET_STATE(vnet, BT_VIRNET_STATE_CREATED);
 	return vnet;
 
-failure4:
-	bt_net_device_destroy(vnet->ndev);
-
 failure3:
-	bt_ring_destroy(vnet->tx_ring);
+	bt_net_device_destroy(vnet->ndev);
 
 failure2:
+	bt_virnet_destroy_rings(vnet);
 	kfree(vnet);
 
 failure1:
@@ -1086,7 +1136,7 @@ failure1:
 static void bt_virnet_destroy(struct bt_virnet *vnet)
 {
 	WARN_ON(!vnet);
-	bt_ring_destroy(vnet->tx_ring);
+	bt_virnet_destroy_rings(vnet);
 	bt_net_device_destroy(vnet->ndev);
 
 	SET_STATE(vnet, BT_VIRNET_STATE_DELETED);
@@ -32,6 +32,11 @@
 #include <linux/seq_file.h>
 #include <linux/ktime.h>
 #include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+#if IS_ENABLED(CONFIG_NEWIP)
+#include <linux/nip.h>
+#include <net/nip.h>
+#endif
 
 /* must include btdev_user.h first before any macro definition */
 #include "btdev_user.h"
@@ -103,11 +108,20 @@ enum bt_virnet_state {
 	BT_VIRNET_STAET_NUM
 };
 
+/**
+ * tx bands, strict priority: the high band is always drained first
+ */
+enum bt_virnet_band {
+	BT_VIRNET_BAND_HIGH,
+	BT_VIRNET_BAND_NORMAL,
+	BT_VIRNET_BAND_NUM
+};
+
 /**
  * one virnet device
  */
 struct bt_virnet {
-	struct bt_ring *tx_ring;
+	struct bt_ring *tx_ring[BT_VIRNET_BAND_NUM];
 	struct bt_io_file *io_file;
 	struct net_device *ndev;
 	struct list_head virnet_entry;
@@ -216,18 +230,28 @@ static inline int bt_get_total_device(const struct bt_drv *bt_drv)
 	return bt_drv->devices_table->num;
 }
 
-static inline int bt_virnet_get_ring_packets(const struct bt_virnet *vn)
+static inline int bt_virnet_get_ring_packets(const struct bt_virnet *vn, int band)
 {
 	int packets = 0;
 
 	WARN_ON(!vn);
-	packets = vn->tx_ring->head - vn->tx_ring->tail;
+	packets = vn->tx_ring[band]->head - vn->tx_ring[band]->tail;
 	if (unlikely(packets < 0))
 		packets += BT_RING_BUFFER_SIZE;
 
 	return packets;
 }
 
+/**
+ * skb->priority to tx band, rt_tos2priority maps IPTOS_LOWDELAY to
+ * TC_PRIO_INTERACTIVE, control traffic uses TC_PRIO_CONTROL
+ */
+static inline int bt_virnet_prio_band(u32 priority)
+{
+	return (priority & TC_PRIO_MAX) >= TC_PRIO_INTERACTIVE ?
+	       BT_VIRNET_BAND_HIGH : BT_VIRNET_BAND_NORMAL;
+}
+
 static struct bt_table *bt_table_init(void);
 static int bt_table_add_device(struct bt_table *tbl, struct bt_virnet *vn);
 static void bt_table_remove_device(struct bt_table *tbl, struct bt_virnet *vn);
@@ -245,7 +269,8 @@ static void bt_ring_produce(struct bt_ring *ring, void *data);
 static void bt_ring_consume(struct bt_ring *ring);
 static void bt_ring_destroy(struct bt_ring *ring);
 
-static int bt_virnet_produce_data(struct bt_virnet *dev, void *data);
+static int bt_virnet_produce_data(struct bt_virnet *dev, int band, void *data);
+static int bt_virnet_next_band(const struct bt_virnet *vn);
 static struct bt_virnet *bt_virnet_create(struct bt_drv *bt_mng, u32 id);
 static void bt_virnet_destroy(struct bt_virnet *vnet);
 
@@ -32,6 +32,7 @@ struct nip_devconf {
 	__s32 nndisc_notify;
 	__s32 use_oif_addrs_only;
 	__s32 keep_addr_on_down;
+	__s32 dad_transmits;
 
 	struct ctl_table_header *sysctl_header;
 };
@@ -40,7 +41,7 @@ struct nip_devconf {
  * The common CB structure: struct sk_buff->char cb[48]
  * TCP CB structure       : struct tcp_skb_cb
  * struct tcp_skb_cb->header is union, include IPv4/IPv6/NewIP xx_skb_parm, max size is 24
- * sizeof(struct ninet_skb_parm)=19
+ * sizeof(struct ninet_skb_parm)=20
  * sizeof(struct inet_skb_parm)=24
  * sizeof(struct inet6_skb_parm)=20
  * sizeof(struct tcp_skb_cb->exclude skb_parm)=24 |__ total size is 48, struct sk_buff->char cb[48]
@@ -51,23 +52,34 @@ struct ninet_skb_parm {
 	struct nip_addr dstaddr;
 	struct nip_addr srcaddr;
 	u8 nexthdr;
+	u8 tclass;
 };
 #pragma pack()
 
+/* NewIP private TCP state, appended to struct tcp_sock.
+ * The fields touched for every segment come first and the alignment keeps
+ * them inside one cache line, keepalive state is only used by the timer
+ * and when the application toggles keepalive.
+ */
+#define TCP_NIP_COMMON_ALIGN 32
 struct tcp_nip_common {
-	u32 ack_retrans_num;
-	u32 ack_retrans_seq;
+	/* per ACK: tcp_nip_ack */
 	u32 nip_ssthresh;
 	u32 nip_ssthresh_reset;
-	bool nip_keepalive_enable;
-	u32 idle_ka_probes_out;
-	u32 nip_keepalive_out;
+	u32 ack_retrans_num;
+	u32 ack_retrans_seq;
+	/* per data segment: dup ack of tcp_nip_ack_snd_check */
 	u32 last_rcv_nxt;
 	u32 dup_ack_cnt;
+
+	/* keepalive */
+	u32 nip_keepalive_out;
+	u32 idle_ka_probes_out;
 	u32 keepalive_time_bak;
-	u32 keepalive_probes_bak;
 	u32 keepalive_intvl_bak;
-};
+	u8 keepalive_probes_bak; /* same width as tcp_sock->keepalive_probes */
+	bool nip_keepalive_enable;
+} __aligned(TCP_NIP_COMMON_ALIGN);
 
 struct tcp_nip_request_sock {
 	struct tcp_request_sock tcp_nip_rsk_tcp;
@@ -78,9 +90,22 @@ struct nip_udp_sock {
 	struct udp_sock udp;
 };
 
+/* NewIP header of a connection, built once, only total_len is patched per
+ * segment. Rebuilt when the traffic class or saddr elision changes.
+ */
+#define TCP_NIP_HDR_TMPL_MAX 24 /* NIP_HDR_MAX */
+struct tcp_nip_hdr_tmpl {
+	u8 len; /* 0: not built yet */
+	u8 tclass;
+	u8 saddr_elided;
+	u8 total_len_off;
+	u8 buf[TCP_NIP_HDR_TMPL_MAX];
+};
+
 struct tcp_nip_sock {
 	struct tcp_sock tcp;
 	struct tcp_nip_common common;
+	struct tcp_nip_hdr_tmpl hdr_tmpl;
 };
 
 #endif /* _NIP_H */
@@ -11,6 +11,10 @@
 #define _NET_IF_NINET_H
 
 #include <linux/nip.h>
+#include <linux/if_addr.h>
+
+/* Addresses still under DAD, or that lost it, must not be used or defended */
+#define NINET_IFA_F_UNUSABLE (IFA_F_TENTATIVE | IFA_F_DADFAILED)
 
 enum {
 	NINET_IFADDR_STATE_NEW,
@@ -31,6 +35,8 @@ struct ninet_ifaddr {
 	int state;
 
 	__u32 flags;
+	/* NS probes left before a tentative address becomes usable */
+	__u8 dad_probes;
 
 	unsigned long cstamp; /* created timestamp */
 	unsigned long tstamp; /* updated timestamp */
@@ -44,6 +50,12 @@ struct ninet_ifaddr {
 	struct rcu_head rcu;
 };
 
+/* Peer of a point-to-point link, set with SIOCNIPSETPEER */
+struct nip_p2p_peer {
+	struct nip_addr addr;
+	struct rcu_head rcu;
+};
+
 struct ninet_dev {
 	struct net_device *dev;
 
@@ -58,6 +70,7 @@ struct ninet_dev {
 	struct nip_devconf cnf;
 
 	unsigned long tstamp; /* newip InterfaceTable update timestamp */
+	struct nip_p2p_peer __rcu *p2p_peer;
 	struct rcu_head rcu;
 };
 
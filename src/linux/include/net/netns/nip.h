@@ -11,12 +11,27 @@
 
 #include <net/inet_frag.h>
 #include <net/dst_ops.h>
+#include <linux/workqueue.h>
+#include <linux/netfilter.h>
 
 struct ctl_table_header;
+struct nip_nf_hook_entries;
+struct nip_flow_offload_table;
 
 struct netns_sysctl_newip {
 	int nip_rt_gc_interval;
 };
+
+/* Packets waiting in neighbour queues for address resolution */
+struct nip_nndisc_pending_stats {
+	atomic_long_t queued;       /* packets queued on an unresolved neighbour */
+	atomic_long_t flow_drops;   /* older packets of a flow replaced by newer ones */
+	atomic_long_t failed;       /* packets dropped because resolution failed */
+	atomic_long_t resolved;     /* neighbours resolved with packets pending */
+	atomic_long_t wait_ms;      /* total time those neighbours were unresolved */
+	unsigned long wait_max_ms;
+};
+
 struct netns_newip {
 	uint32_t resv;
 	struct netns_sysctl_newip sysctl;
@@ -28,6 +43,14 @@ struct netns_newip {
 	struct dst_ops nip_dst_ops;
 	struct nip_fib_table *nip_fib_main_tbl;
 	struct nip_fib_table *nip_fib_local_tbl;
+
+	struct nip_nndisc_pending_stats nndisc_pending;
+
+	struct nip_nf_hook_entries __rcu *nf_hooks[NF_INET_NUMHOOKS];
+	struct nip_flow_offload_table *nip_flowtable;
+
+	/* DAD and address lifetime processing for all addresses in the netns */
+	struct delayed_work addr_chk_work;
 };
 
 #endif
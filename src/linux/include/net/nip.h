@@ -51,9 +51,11 @@ extern const struct proto_ops ninet_dgram_ops;
 extern const struct proto_ops ninet_stream_ops;
 extern struct neigh_table nnd_tbl;
 
+void tcp_nip_build_hdr_tmpl(struct sock *sk, const struct dst_entry *dst);
 int tcp_nip_queue_xmit(struct sock *sk, struct sk_buff *skb, struct flowi *fl);
 void tcp_nip_actual_send_reset(struct sock *sk, struct sk_buff *skb, u32 seq,
 				 u32 ack_seq, u32 win, int rst, u32 priority);
+void nip_skb_set_hash(struct sk_buff *skb);
 int nip_rcv(struct sk_buff *skb, struct net_device *dev,
 		  struct packet_type *pt, struct net_device *orig_dev);
 struct nip_rt_info *nip_dst_alloc(struct net *net, struct net_device *dev,
@@ -88,6 +90,12 @@ static inline u32 nip_addr_hash(const struct nip_addr *a)
 
 int nip_send_skb(struct sk_buff *skb);
 
+/* Routes to local addresses point at the loopback device */
+static inline bool nip_dst_loopback(const struct dst_entry *dst)
+{
+	return dst && dst->dev && (dst->dev->flags & IFF_LOOPBACK);
+}
+
 void ninet_destroy_sock(struct sock *sk);
 int nip_datagram_dst_update(struct sock *sk, bool fix_sk_saddr);
 int ninet_add_protocol(const struct ninet_protocol *prot, unsigned char protocol);
@@ -96,6 +104,7 @@ int ninet_register_protosw(struct inet_protosw *p);
 void ninet_unregister_protosw(struct inet_protosw *p);
 int nip_input(struct sk_buff *skb);
 int nip_output(struct net *net, struct sock *sk, struct sk_buff *skb);
+int nip_finish_output(struct net *net, struct sock *sk, struct sk_buff *skb);
 int nip_forward(struct sk_buff *skb);
 
 unsigned int tcp_nip_sync_mss(struct sock *sk, u32 pmtu);
@@ -125,4 +134,23 @@ int nip_getsockopt(struct sock *sk, int level,
 /* functions defined in nip_addrconf.c */
 int nip_addrconf_get_ifaddr(struct net *net, unsigned int cmd, void __user *arg);
 
+/* functions defined in nip_snapshot.c */
+int nip_snapshot_dump(struct net *net, void __user *arg);
+int nip_snapshot_restore(struct net *net, void __user *arg);
+
+/* functions defined in nip_pktgen.c */
+#ifdef CONFIG_NEWIP_PKTGEN
+int nip_pktgen_init(void);
+void nip_pktgen_exit(void);
+#else
+static inline int nip_pktgen_init(void)
+{
+	return 0;
+}
+
+static inline void nip_pktgen_exit(void)
+{
+}
+#endif
+
 #endif
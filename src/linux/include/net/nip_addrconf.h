@@ -22,9 +22,12 @@
 
 int nip_addrconf_add_ifaddr(struct net *net, void __user *arg);
 int nip_addrconf_del_ifaddr(struct net *net, void __user *arg);
+int nip_addrconf_restore_addr(struct net *net, int ifindex,
+			      const struct nip_addr *addr, __u32 ifa_flags);
 
 int nip_dev_get_saddr(struct net *net, const struct net_device *dev,
 		      const struct nip_addr *daddr, struct nip_addr *saddr);
+void nip_addrconf_dad_failure(struct net_device *dev, const struct nip_addr *addr);
 
 int nip_addrconf_init(void);
 void nip_addrconf_cleanup(void);
@@ -66,6 +69,34 @@ static inline struct neigh_parms *__nin_dev_nd_parms_get_rcu(
 	return idev ? idev->nd_parms : NULL;
 }
 
+/* While a peer is set on a point-to-point link, packets to that peer leave
+ * saddr out and packets received without saddr are taken to come from it.
+ * Only the peer itself is sent to without saddr, so it is never forwarded.
+ * Caller must hold rcu_read_lock.
+ */
+static inline bool nip_dev_elide_saddr(const struct net_device *dev,
+				       const struct nip_addr *daddr)
+{
+	struct ninet_dev *idev = __nin_dev_get(dev);
+	struct nip_p2p_peer *peer = idev ? rcu_dereference(idev->p2p_peer) : NULL;
+
+	return peer && nip_addr_eq(&peer->addr, daddr);
+}
+
+static inline bool nip_dev_peer_addr(const struct net_device *dev, struct nip_addr *addr)
+{
+	struct ninet_dev *idev = __nin_dev_get(dev);
+	struct nip_p2p_peer *peer = idev ? rcu_dereference(idev->p2p_peer) : NULL;
+
+	if (!peer)
+		return false;
+
+	*addr = peer->addr;
+	return true;
+}
+
+int nip_addrconf_set_peer(struct net *net, void __user *arg);
+
 void nin_dev_finish_destroy(struct ninet_dev *idev);
 
 static inline void nin_dev_put(struct ninet_dev *idev)
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * NewIP per-flow accounting
+ * Linux NewIP INET implementation
+ */
+#ifndef _NIP_FLOW_ACCT_H
+#define _NIP_FLOW_ACCT_H
+
+#include <linux/skbuff.h>
+#include <linux/nip.h>
+
+#ifdef CONFIG_NEWIP_FLOW_ACCT
+#include <linux/jump_label.h>
+
+DECLARE_STATIC_KEY_FALSE(nip_flow_acct_enabled);
+
+void __nip_flow_acct(struct net *net, struct sk_buff *skb, u8 dir);
+
+/* NIPCB() and the transport header of skb must be set. A disabled flow
+ * table costs one patched jump per packet.
+ */
+static __always_inline void nip_flow_acct(struct net *net, struct sk_buff *skb, u8 dir)
+{
+	if (static_branch_unlikely(&nip_flow_acct_enabled))
+		__nip_flow_acct(net, skb, dir);
+}
+
+int nip_flow_acct_init(void);
+void nip_flow_acct_exit(void);
+#else
+static inline void nip_flow_acct(struct net *net, struct sk_buff *skb, u8 dir)
+{
+}
+
+static inline int nip_flow_acct_init(void)
+{
+	return 0;
+}
+
+static inline void nip_flow_acct_exit(void)
+{
+}
+#endif
+
+#endif /* _NIP_FLOW_ACCT_H */
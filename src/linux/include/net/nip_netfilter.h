@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * NewIP netfilter hooks and flow offload
+ * Linux NewIP INET implementation
+ *
+ * Based on include/linux/netfilter.h
+ * Based on include/net/netfilter/nf_flow_table.h
+ */
+#ifndef _NIP_NETFILTER_H
+#define _NIP_NETFILTER_H
+
+#include <linux/netfilter.h>
+#include <linux/jump_label.h>
+#include <linux/skbuff.h>
+#include <net/net_namespace.h>
+
+/* The core has no NFPROTO slot for NewIP, so the hooks live in the NewIP
+ * stack. They take a regular struct nf_hook_ops (pf is ignored, hooknum is
+ * one of enum nf_inet_hooks) and are ordered by priority. Verdicts follow
+ * netfilter, except that NF_QUEUE is not supported and acts as NF_DROP.
+ */
+struct nip_nf_hook_entries {
+	u16 num;
+	struct rcu_head rcu;
+	const struct nf_hook_ops *ops[];
+};
+
+DECLARE_STATIC_KEY_FALSE(nip_nf_hooks_needed);
+
+int nip_nf_register_net_hook(struct net *net, const struct nf_hook_ops *reg);
+void nip_nf_unregister_net_hook(struct net *net, const struct nf_hook_ops *reg);
+int nip_nf_hook_slow(unsigned int hook, struct net *net, struct sock *sk,
+		     struct sk_buff *skb, struct net_device *in,
+		     struct net_device *out,
+		     int (*okfn)(struct net *, struct sock *, struct sk_buff *));
+
+/* Returns 1 from nip_nf_hook_slow if okfn should be called */
+static inline int NIP_NF_HOOK(unsigned int hook, struct net *net, struct sock *sk,
+			      struct sk_buff *skb, struct net_device *in,
+			      struct net_device *out,
+			      int (*okfn)(struct net *, struct sock *, struct sk_buff *))
+{
+	if (static_branch_unlikely(&nip_nf_hooks_needed)) {
+		int ret = nip_nf_hook_slow(hook, net, sk, skb, in, out, okfn);
+
+		if (ret != 1)
+			return ret;
+	}
+	return okfn(net, sk, skb);
+}
+
+/* Flow offload: a FORWARD hook calls nip_flow_offload_add() for a flow it
+ * has accepted, later packets of that flow are sent from nip_rcv straight to
+ * the cached route, without route lookup or any hook. A flow is the
+ * addresses, next header, ports and input device of the accepted packet.
+ */
+int nip_flow_offload_add(struct net *net, const struct sk_buff *skb);
+bool nip_flow_offload_xmit(struct net *net, struct sk_buff *skb);
+void nip_flow_offload_flush(struct net *net, const struct net_device *dev);
+
+int nip_netfilter_init(void);
+void nip_netfilter_cleanup(void);
+
+#endif /* _NIP_NETFILTER_H */
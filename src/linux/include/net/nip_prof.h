@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * NewIP per-stage time accounting
+ * Linux NewIP INET implementation
+ */
+#ifndef _NIP_PROF_H
+#define _NIP_PROF_H
+
+#include <linux/types.h>
+
+/* Stages timed by the profiler, times are inclusive: nip_rcv contains
+ * route input and delivery when they run in its context.
+ */
+enum nip_prof_stage {
+	NIP_PROF_RCV,
+	NIP_PROF_ROUTE_INPUT,
+	NIP_PROF_DELIVER,
+	NIP_PROF_TCP_ESTABLISHED,
+	NIP_PROF_TCP_WRITE_XMIT,
+	NIP_PROF_OUTPUT,
+	NIP_PROF_CHECKSUM,
+	NIP_PROF_STAGE_MAX,
+};
+
+#ifdef CONFIG_NEWIP_PROF
+#include <linux/jump_label.h>
+#include <linux/percpu.h>
+#include <linux/sched/clock.h>
+
+struct nip_prof_stat {
+	u64 ns;
+	u64 calls;
+};
+
+DECLARE_STATIC_KEY_FALSE(nip_prof_enabled);
+DECLARE_PER_CPU(struct nip_prof_stat[NIP_PROF_STAGE_MAX], nip_prof_stats);
+
+/* A disabled profiler costs one patched jump per call site. Times are in
+ * ns from local_clock(): get_cycles() is not a CPU cycle count on every
+ * architecture (the arch timer on arm64) and is 0 on some.
+ */
+static __always_inline u64 nip_prof_begin(void)
+{
+	if (static_branch_unlikely(&nip_prof_enabled))
+		return local_clock();
+	return 0;
+}
+
+static __always_inline void nip_prof_end(enum nip_prof_stage stage, u64 start)
+{
+	/* start is 0 if profiling was switched on during the call */
+	if (static_branch_unlikely(&nip_prof_enabled) && start) {
+		this_cpu_add(nip_prof_stats[stage].ns, local_clock() - start);
+		this_cpu_inc(nip_prof_stats[stage].calls);
+	}
+}
+
+int nip_prof_init(void);
+void nip_prof_exit(void);
+#else
+static inline u64 nip_prof_begin(void)
+{
+	return 0;
+}
+
+static inline void nip_prof_end(enum nip_prof_stage stage, u64 start)
+{
+}
+
+static inline int nip_prof_init(void)
+{
+	return 0;
+}
+
+static inline void nip_prof_exit(void)
+{
+}
+#endif
+
+#endif /* _NIP_PROF_H */
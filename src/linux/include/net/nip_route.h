@@ -58,6 +58,7 @@ static inline int nip_route_get_saddr(struct net *net, struct nip_rt_info *rt,
 void nip_rt_ifdown(struct net *net, struct net_device *dev);
 
 int nip_route_ioctl(struct net *net, unsigned int cmd, struct nip_rtmsg *rtmsg);
+int nip_route_add(struct nip_fib_config *cfg);
 
 int nip_route_init(void);
 
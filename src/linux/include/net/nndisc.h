@@ -66,6 +66,8 @@ static inline struct neighbour *__nip_neigh_lookup(struct net_device *dev,
 }
 
 int nndisc_rcv(struct sk_buff *skb);
+void nndisc_send_dad_ns(struct net_device *dev, const struct nip_addr *addr);
+void nndisc_pending_trim(struct neighbour *neigh, const struct sk_buff *skb);
 
 int nndisc_init(void);
 
@@ -103,6 +103,7 @@ void tcp_nip_send_fin(struct sock *sk);
 void tcp_nip_send_active_reset(struct sock *sk, gfp_t priority);
 void tcp_nip_send_probe0(struct sock *sk);
 int tcp_nip_write_wakeup(struct sock *sk, int mib);
+int tcp_nip_mtu_to_advmss(const struct sock *sk, u32 mtu);
 
 /* tcp_nip_timer */
 void tcp_nip_init_xmit_timers(struct sock *sk);
@@ -179,6 +180,9 @@ struct sock *tcp_nip_create_openreq_child(const struct sock *sk,
 				      struct request_sock *req,
 				      struct sk_buff *skb);
 void tcp_nip_initialize_rcv_mss(struct sock *sk);
+void tcp_nip_parse_options(const struct sk_buff *skb,
+			   struct tcp_options_received *opt_rx, int estab,
+			   struct tcp_fastopen_cookie *foc);
 
 /* release */
 void tcp_nip_release_cb(struct sock *sk);
@@ -13,6 +13,7 @@
 #include <linux/types.h>
 #include "nip_addr.h"
 #include <linux/if.h>
+#include <linux/sockios.h>
 
 struct nip_ifreq {
 	struct nip_addr ifrn_addr;
@@ -44,4 +45,103 @@ struct nip_devreq {
 #define nip_dev_addr devreq.addr    /* nip address */
 #define nip_dev_flags devreq.flags  /* net device flags */
 
+/* SIOCNIPACCEPTBATCH on a listening socket: accept up to max connections
+ * in one call, the new fds are stored in the array at fds and their number
+ * is returned. Only the first one may block, flags as for accept4().
+ */
+struct nip_accept_batch {
+	__u64 fds; /* int array of max entries */
+	__s32 max;
+	__s32 flags;
+};
+
+#define SIOCNIPACCEPTBATCH (SIOCPROTOPRIVATE + 0)
+
+/* SIOCNIPSETPEER with struct nip_ifreq: ifrn_addr is the only peer of the
+ * point-to-point link ifrn_ifindex. Packets to it are sent without saddr,
+ * packets received without saddr on the link come from it. A zero bitlen
+ * turns this off.
+ */
+#define SIOCNIPSETPEER     (SIOCPROTOPRIVATE + 1)
+
+/* Binary snapshot of the NewIP addresses and main table routes of a
+ * namespace: a struct nip_snap_hdr, naddr struct nip_snap_addr and nroute
+ * struct nip_snap_route. Devices are stored by name, so a snapshot taken
+ * before a reboot can be restored after it.
+ */
+#define NIP_SNAP_MAGIC     0x4e495053 /* "NIPS" */
+#define NIP_SNAP_VERSION   1
+
+struct nip_snap_hdr {
+	__u32 magic;
+	__u16 version;
+	__u16 resv;
+	__u32 naddr;
+	__u32 nroute;
+};
+
+struct nip_snap_addr {
+	__u32 flags; /* IFA_F_* */
+	char dev_name[IFNAMSIZ];
+	struct nip_addr addr;
+	__u8 resv[3];
+};
+
+struct nip_snap_route {
+	__u32 flags; /* RTF_* */
+	__u32 metric;
+	char dev_name[IFNAMSIZ];
+	struct nip_addr dst;
+	struct nip_addr gateway;
+	__u8 resv[2];
+};
+
+/* SIOCNIPSNAPDUMP stores the snapshot in buf and its size in len. If len
+ * is too small, nothing is copied, len is set to the size needed and the
+ * call fails with ENOSPC.
+ * SIOCNIPSNAPRESTORE adds all addresses and then all routes of the len
+ * bytes at buf under a single RTNL hold. Entries that already exist are
+ * skipped. The snapshot is checked before anything is added; if adding
+ * an entry fails, the entries added before it are kept.
+ */
+#define NIP_SNAP_F_NODAD   0x1 /* restore: addresses skip DAD */
+
+struct nip_snap_req {
+	__u64 buf;
+	__u32 len;
+	__u32 flags;
+};
+
+#define SIOCNIPSNAPDUMP    (SIOCPROTOPRIVATE + 2)
+#define SIOCNIPSNAPRESTORE (SIOCPROTOPRIVATE + 3)
+
+/* Flow record read from /proc/net/nip_flow_export. A flow seen on several
+ * CPUs gives one record per CPU, packets and bytes count since the previous
+ * record of the same flow and CPU, times are CLOCK_REALTIME in ms.
+ */
+#define NIP_FLOW_DIR_IN      0
+#define NIP_FLOW_DIR_OUT     1
+
+/* flowEndReason values of IPFIX */
+#define NIP_FLOW_END_IDLE    1
+#define NIP_FLOW_END_ACTIVE  2
+#define NIP_FLOW_END_FORCED  4
+
+struct nip_flow_record {
+	__u64 packets;
+	__u64 bytes;
+	__u64 first_ms;
+	__u64 last_ms;
+	__u32 netns;  /* inode number of the network namespace */
+	__u32 cpu;
+	__be16 sport; /* 0 unless nexthdr is TCP or UDP */
+	__be16 dport;
+	struct nip_addr daddr;
+	struct nip_addr saddr;
+	__u8 nexthdr;
+	__u8 dir;     /* NIP_FLOW_DIR_* */
+	__u8 reason;  /* NIP_FLOW_END_* */
+	__u8 resv[7];
+};
+
 #endif /* _UAPI_NEWIP_H */
@@ -23,6 +23,8 @@
 #include <linux/stat.h>
 #include <linux/init.h>
 #include <linux/sched/signal.h> /* for signal_pending() */
+#include <linux/fdtable.h>
+#include <linux/file.h>
 
 #include <net/nip.h>
 #include <net/udp.h>
@@ -38,6 +40,9 @@
 #include <net/nip_fib.h>
 #include <net/nip_route.h>
 #include <net/nip_addrconf.h>
+#include <net/nip_netfilter.h>
+#include <net/nip_prof.h>
+#include <net/nip_flow_acct.h>
 #include <net/tcp_nip.h>
 #include <linux/nip.h>
 #include <linux/newip_route.h>
@@ -422,6 +427,42 @@ int ninet_stream_connect(struct socket *sock, struct sockaddr *uaddr,
 	return err;
 }
 
+/* One call for a burst of connections: the listener is woken once and the
+ * files are created in a row. io_uring accept of 5.10 goes through
+ * inet_accept() as well and needs nothing NewIP specific.
+ */
+static int ninet_accept_batch(struct socket *sock, void __user *arg)
+{
+	struct nip_accept_batch batch;
+	int __user *ufds;
+	int num = 0;
+	int fd;
+
+	if (copy_from_user(&batch, arg, sizeof(batch)))
+		return -EFAULT;
+
+	if (batch.max <= 0 || (batch.flags & ~(SOCK_CLOEXEC | SOCK_NONBLOCK)))
+		return -EINVAL;
+
+	if (sock->sk->sk_state != TCP_LISTEN || !sock->file)
+		return -EINVAL;
+
+	ufds = u64_to_user_ptr(batch.fds);
+	while (num < batch.max) {
+		fd = __sys_accept4_file(sock->file, num ? O_NONBLOCK : 0, NULL, NULL,
+					batch.flags, rlimit(RLIMIT_NOFILE));
+		if (fd < 0)
+			return num ? num : fd;
+
+		if (put_user(fd, ufds + num)) {
+			__close_fd(current->files, fd);
+			return num ? num : -EFAULT;
+		}
+		num++;
+	}
+	return num;
+}
+
 int ninet_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 {
 	struct sock *sk = sock->sk;
@@ -445,6 +486,14 @@ int ninet_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 		return nip_addrconf_del_ifaddr(net, (void __user *)arg);
 	case SIOCGIFADDR:
 		return nip_addrconf_get_ifaddr(net, cmd, (void __user *)arg);
+	case SIOCNIPACCEPTBATCH:
+		return ninet_accept_batch(sock, (void __user *)arg);
+	case SIOCNIPSETPEER:
+		return nip_addrconf_set_peer(net, (void __user *)arg);
+	case SIOCNIPSNAPDUMP:
+		return nip_snapshot_dump(net, (void __user *)arg);
+	case SIOCNIPSNAPRESTORE:
+		return nip_snapshot_restore(net, (void __user *)arg);
 
 	default:
 		if (!sk->sk_prot->ioctl) {
@@ -497,6 +546,14 @@ int ninet_compat_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 	case SIOCADDRT:
 	case SIOCDELRT:
 		return ninet_compat_routing_ioctl(sk, cmd, argp);
+	case SIOCNIPACCEPTBATCH: /* same layout for compat tasks */
+		return ninet_accept_batch(sock, argp);
+	case SIOCNIPSETPEER: /* struct nip_ifreq has no long or pointer */
+		return nip_addrconf_set_peer(sock_net(sk), argp);
+	case SIOCNIPSNAPDUMP:
+		return nip_snapshot_dump(sock_net(sk), argp);
+	case SIOCNIPSNAPRESTORE:
+		return nip_snapshot_restore(sock_net(sk), argp);
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -504,6 +561,21 @@ int ninet_compat_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 EXPORT_SYMBOL_GPL(ninet_compat_ioctl);
 #endif /* CONFIG_COMPAT */
 
+/* Poll runs on the CPU of the application, record it for RFS like recvmsg
+ * does, so event driven servers are steered before their first read.
+ */
+static __poll_t ninet_dgram_poll(struct file *file, struct socket *sock, poll_table *wait)
+{
+	sock_rps_record_flow(sock->sk);
+	return datagram_poll(file, sock, wait);
+}
+
+static __poll_t ninet_stream_poll(struct file *file, struct socket *sock, poll_table *wait)
+{
+	sock_rps_record_flow(sock->sk);
+	return tcp_poll(file, sock, wait);
+}
+
 /* register new	IP socket */
 const struct proto_ops ninet_dgram_ops = {
 	.family = PF_NINET,
@@ -514,7 +586,7 @@ const struct proto_ops ninet_dgram_ops = {
 	.socketpair = sock_no_socketpair,
 	.accept = sock_no_accept,
 	.getname = ninet_getname,
-	.poll = datagram_poll,
+	.poll = ninet_dgram_poll,
 	.ioctl = ninet_ioctl,
 	.gettstamp = sock_gettstamp,
 	.listen = sock_no_listen,
@@ -540,7 +612,7 @@ const struct proto_ops ninet_stream_ops = {
 	.socketpair	   = sock_no_socketpair,
 	.accept		   = inet_accept,
 	.getname	   = ninet_getname,
-	.poll		   = tcp_poll,
+	.poll		   = ninet_stream_poll,
 	.ioctl		   = ninet_ioctl,
 	.listen		   = ninet_listen,
 	.shutdown	   = inet_shutdown,
@@ -639,6 +711,11 @@ static int __init nip_packet_init(void)
 	return 0;
 }
 
+static void nip_packet_exit(void)
+{
+	dev_remove_pack(&nip_packet_type);
+}
+
 static int __net_init ninet_net_init(struct net *net)
 {
 	int err = 0;
@@ -710,6 +787,10 @@ static int __init ninet_init(void)
 	if (err)
 		goto nip_route_fail;
 
+	err = nip_netfilter_init();
+	if (err)
+		goto nip_netfilter_fail;
+
 	err = nip_addrconf_init();
 	if (err)
 		goto nip_addr_fail;
@@ -734,11 +815,29 @@ static int __init ninet_init(void)
 		goto nip_packet_fail;
 	}
 
+	err = nip_pktgen_init();
+	if (err) {
+		nip_dbg("failed to init packet generator");
+		goto nip_pktgen_fail;
+	}
+
+	err = nip_prof_init();
+	if (err) {
+		nip_dbg("failed to init stage profiler");
+		goto nip_prof_fail;
+	}
+
+	err = nip_flow_acct_init();
+	if (err) {
+		nip_dbg("failed to init flow accounting");
+		goto nip_flow_acct_fail;
+	}
+
 #ifdef CONFIG_NEWIP_HOOKS
 	err = ninet_hooks_register();
 	if (err) {
 		nip_dbg("failed to register to nip hooks");
-		goto nip_packet_fail;
+		goto nip_hooks_fail;
 	}
 #endif
 	nip_dbg("init newip address family ok");
@@ -746,6 +845,16 @@ static int __init ninet_init(void)
 out:
 	return err;
 
+#ifdef CONFIG_NEWIP_HOOKS
+nip_hooks_fail:
+	nip_flow_acct_exit();
+#endif
+nip_flow_acct_fail:
+	nip_prof_exit();
+nip_prof_fail:
+	nip_pktgen_exit();
+nip_pktgen_fail:
+	nip_packet_exit();
 nip_packet_fail:
 	tcp_nip_exit();
 tcp_fail:
@@ -753,6 +862,8 @@ tcp_fail:
 udp_fail:
 	nip_addrconf_cleanup();
 nip_addr_fail:
+	nip_netfilter_cleanup();
+nip_netfilter_fail:
 	nip_route_cleanup();
 nip_route_fail:
 nndisc_fail:
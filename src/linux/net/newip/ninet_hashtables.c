@@ -100,14 +100,18 @@ static inline u32 nip_portaddr_hash(const struct net *net,
 	return jhash_1word(v, net_hash_mix(net)) ^ port;
 }
 
+/* Hash every byte of the address. Bytes beyond bitlen are not part of
+ * the address (nip_addr_eq ignores them), so they must not reach the hash.
+ */
 static u32 __nip_addr_jhash(const struct nip_addr *a, const u32 initval)
 {
-	u32 v = (__force u32)a->nip_addr_field32[0] ^ (__force u32)a->nip_addr_field32[1];
+	u32 v[NIP_32BIT_ADDR_INDEX_MAX] = {0};
+	u8 len = a->bitlen >> 3;
 
-	return jhash_3words(v,
-			    (__force u32)a->nip_addr_field32[0],
-			    (__force u32)a->nip_addr_field32[1],
-			    initval);
+	memcpy(v, &a->v.u, min_t(u8, len, sizeof(v)));
+	return jhash_3words((__force u32)v[NIP_32BIT_ADDR_INDEX_0],
+			    (__force u32)v[NIP_32BIT_ADDR_INDEX_1],
+			    a->bitlen, initval);
 }
 
 static struct inet_listen_hashbucket *
@@ -156,8 +160,11 @@ u32 ninet_ehashfn(const struct net *net,
 	net_get_random_once(&ninet_ehash_secret, sizeof(ninet_ehash_secret));
 	net_get_random_once(&ninet_hash_secret, sizeof(ninet_hash_secret));
 
-	/* Ipv6 uses S6_ADdr32 [3], the last 32bits of the address */
-	lhash = (__force u32)laddr->nip_addr_field32[0];
+	/* Unlike Ipv6 (S6_ADdr32 [3] only), both addresses are fully hashed,
+	 * a NewIP address is short and its first bytes are mostly a prefix
+	 * shared by every local address.
+	 */
+	lhash = __nip_addr_jhash(laddr, ninet_hash_secret);
 	fhash = __nip_addr_jhash(faddr, ninet_hash_secret);
 
 	return __ninet_ehashfn(lhash, lport, fhash, fport,
@@ -472,16 +479,126 @@ static u64 ninet_sk_port_offset(const struct sock *sk)
 					  inet->inet_dport);
 }
 
+/* Per-destination ephemeral port cursors, indexed by the low bits of
+ * secure_newip_port_ephemeral(). Connections to the same destination
+ * resume the scan right after the last port they got, instead of probing
+ * again every port already in use towards it.
+ */
+#define NINET_PORT_CURSOR_BITS 12
+#define NINET_PORT_CURSOR_SIZE (1 << NINET_PORT_CURSOR_BITS)
+static u32 ninet_port_cursor[NINET_PORT_CURSOR_SIZE];
+
+/* Based on __inet_hash_connect(), for sockets without a local port */
+static int __ninet_hash_connect(struct inet_timewait_death_row *death_row,
+				struct sock *sk, u64 port_offset)
+{
+	struct inet_hashinfo *hinfo = death_row->hashinfo;
+	struct inet_timewait_sock *tw = NULL;
+	struct inet_bind_hashbucket *head;
+	struct net *net = sock_net(sk);
+	struct inet_bind_bucket *tb;
+	u32 remaining;
+	u32 offset;
+	u32 index;
+	int port;
+	int low;
+	int high;
+	int l3mdev;
+	int i;
+
+	l3mdev = inet_sk_bound_l3mdev(sk);
+
+	inet_get_local_port_range(net, &low, &high);
+	high++; /* [32768, 60999] -> [32768, 61000[ */
+	remaining = high - low;
+	if (likely(remaining > 1))
+		remaining &= ~1U;
+
+	net_get_random_once(ninet_port_cursor, sizeof(ninet_port_cursor));
+	index = port_offset & (NINET_PORT_CURSOR_SIZE - 1);
+	offset = READ_ONCE(ninet_port_cursor[index]) + (port_offset >> 32);
+	offset %= remaining;
+
+	/* In first pass we try ports of @low parity.
+	 * inet_csk_get_port() does the opposite choice.
+	 */
+	offset &= ~1U;
+other_parity_scan:
+	port = low + offset;
+	for (i = 0; i < remaining; i += 2, port += 2) {
+		if (unlikely(port >= high))
+			port -= remaining;
+		if (inet_is_local_reserved_port(net, port))
+			continue;
+		head = &hinfo->bhash[inet_bhashfn(net, port, hinfo->bhash_size)];
+		spin_lock_bh(&head->lock);
+
+		/* Does not bother with rcv_saddr checks, because
+		 * the established check is already unique enough.
+		 */
+		inet_bind_bucket_for_each(tb, &head->chain) {
+			if (net_eq(ib_net(tb), net) && tb->l3mdev == l3mdev &&
+			    tb->port == port) {
+				if (tb->fastreuse >= 0 || tb->fastreuseport >= 0)
+					goto next_port;
+				WARN_ON(hlist_empty(&tb->owners));
+				if (!__ninet_check_established(death_row, sk, port, &tw))
+					goto ok;
+				goto next_port;
+			}
+		}
+
+		tb = inet_bind_bucket_create(hinfo->bind_bucket_cachep,
+					     net, head, port, l3mdev);
+		if (!tb) {
+			spin_unlock_bh(&head->lock);
+			return -ENOMEM;
+		}
+		tb->fastreuse = -1;
+		tb->fastreuseport = -1;
+		goto ok;
+next_port:
+		spin_unlock_bh(&head->lock);
+		cond_resched();
+	}
+
+	offset++;
+	if ((offset & 1) && remaining > 1)
+		goto other_parity_scan;
+
+	nip_dbg("no free port, range=[%d-%d]", low, high - 1);
+	return -EADDRNOTAVAIL;
+
+ok:
+	/* Keep a little randomness in the next port of this destination:
+	 * maximal on low contention, none on high contention.
+	 */
+	i = max_t(int, i, (prandom_u32() & 7) * 2);
+	WRITE_ONCE(ninet_port_cursor[index], READ_ONCE(ninet_port_cursor[index]) + i + 2);
+
+	/* Head lock still held and bh's disabled */
+	inet_bind_hash(sk, tb, port);
+	if (sk_unhashed(sk)) {
+		inet_sk(sk)->inet_sport = htons(port);
+		inet_ehash_nolisten(sk, (struct sock *)tw, NULL);
+	}
+	if (tw)
+		inet_twsk_bind_unhash(tw, hinfo);
+	spin_unlock(&head->lock);
+	if (tw)
+		inet_twsk_deschedule_put(tw);
+	local_bh_enable();
+	return 0;
+}
+
 /* Bind local ports randomly */
 int ninet_hash_connect(struct inet_timewait_death_row *death_row,
 		       struct sock *sk)
 {
-	u64 port_offset = 0;
-
-	if (!inet_sk(sk)->inet_num)
-		port_offset = ninet_sk_port_offset(sk);
+	if (inet_sk(sk)->inet_num)
+		return __inet_hash_connect(death_row, sk, 0,
+					   __ninet_check_established);
 
-	return __inet_hash_connect(death_row, sk, port_offset,
-	__ninet_check_established);
+	return __ninet_hash_connect(death_row, sk, ninet_sk_port_offset(sk));
 }
 
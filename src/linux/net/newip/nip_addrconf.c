@@ -36,6 +36,7 @@
 #include <net/netlink.h>
 #include <net/pkt_sched.h>
 #include <net/addrconf.h>
+#include <net/nndisc.h>
 #include <linux/rtnetlink.h>
 #include <linux/export.h>
 
@@ -43,6 +44,7 @@
 #include "tcp_nip_parameter.h"
 
 #define	INFINITY_LIFE_TIME	0xFFFFFFFF
+#define	NIP_DAD_TRANSMITS	1
 
 /* Configured unicast address hash table */
 static struct hlist_head ninet_addr_lst[NIN_ADDR_HSIZE];
@@ -59,6 +61,7 @@ static struct nip_devconf newip_devconf_dflt __read_mostly = {
 	.mtu = NIP_MIN_MTU,
 	.disable_nip = 0,
 	.ignore_routes_with_linkdown = 0,
+	.dad_transmits = NIP_DAD_TRANSMITS,
 };
 
 /* Check if link is ready: is it up and is a valid qdisc available */
@@ -77,6 +80,21 @@ static u32 ninet_addr_hash(const struct nip_addr *addr)
 	return hash_32(nip_addr_hash(addr), NIN_ADDR_HSIZE_SHIFT);
 }
 
+/* Links without neighbour discovery cannot see a conflicting address */
+static bool nip_addrconf_dad_needed(const struct ninet_dev *idev)
+{
+	const struct net_device *dev = idev->dev;
+
+	return idev->cnf.dad_transmits > 0 && dev->header_ops &&
+	       !(dev->flags & (IFF_LOOPBACK | IFF_NOARP));
+}
+
+static void nip_addr_chk_schedule(struct net *net, unsigned long delay)
+{
+	mod_delayed_work(system_power_efficient_wq,
+			 &net->newip.addr_chk_work, delay);
+}
+
 static struct ninet_ifaddr *nip_add_addr(struct ninet_dev *idev,
 					 const struct nip_addr *addr,
 					 u32 flags, u32 valid_lft,
@@ -138,6 +156,10 @@ static struct ninet_ifaddr *nip_add_addr(struct ninet_dev *idev,
 	spin_lock_init(&ifa->lock);
 	INIT_HLIST_NODE(&ifa->addr_lst);
 	ifa->flags = flags;
+	if (!(flags & IFA_F_NODAD) && nip_addrconf_dad_needed(idev)) {
+		ifa->flags |= IFA_F_TENTATIVE;
+		ifa->dad_probes = idev->cnf.dad_transmits;
+	}
 	ifa->valid_lft = valid_lft;
 	ifa->preferred_lft = preferred_lft;
 	ifa->tstamp = jiffies;
@@ -299,7 +321,11 @@ static int ninet_addr_add(struct net *net, int ifindex,
 			   preferred_lft);
 	if (!IS_ERR(ifp)) {
 		nin_ifa_put(ifp);
-		nip_ins_rt(ifp->rt);
+		/* A tentative address gets its local route once DAD completes */
+		if (!(ifp->flags & IFA_F_TENTATIVE))
+			nip_ins_rt(ifp->rt);
+		if (!(ifp->flags & IFA_F_PERMANENT) || (ifp->flags & IFA_F_TENTATIVE))
+			nip_addr_chk_schedule(net, 0);
 		nip_dbg("success, ifp->refcnt=%u", refcount_read(&ifp->refcnt));
 		return 0;
 	}
@@ -355,6 +381,163 @@ out:
 	nin_ifa_put(ifp);
 }
 
+void nip_addrconf_dad_failure(struct net_device *dev, const struct nip_addr *addr)
+{
+	struct ninet_dev *idev;
+	struct ninet_ifaddr *ifp;
+
+	rcu_read_lock();
+	idev = __nin_dev_get(dev);
+	if (!idev)
+		goto out;
+
+	read_lock_bh(&idev->lock);
+	list_for_each_entry(ifp, &idev->addr_list, if_list) {
+		if (!nip_addr_eq(addr, &ifp->addr))
+			continue;
+
+		spin_lock_bh(&ifp->lock);
+		if (ifp->flags & IFA_F_TENTATIVE) {
+			char str[NIP_ADDR_BIT_LEN_MAX] = {0};
+
+			ifp->flags &= ~IFA_F_TENTATIVE;
+			ifp->flags |= IFA_F_DADFAILED;
+			nip_addr_to_str(addr, str, NIP_ADDR_BIT_LEN_MAX);
+			nip_dbg("%s: duplicate address detected, addr=%s", dev->name, str);
+		}
+		spin_unlock_bh(&ifp->lock);
+		break;
+	}
+	read_unlock_bh(&idev->lock);
+out:
+	rcu_read_unlock();
+}
+
+static void nip_addrconf_dad_completed(struct ninet_ifaddr *ifp)
+{
+	bool completed = false;
+
+	spin_lock_bh(&ifp->lock);
+	if (ifp->flags & IFA_F_TENTATIVE) {
+		ifp->flags &= ~IFA_F_TENTATIVE;
+		/* tstamp carried the probe times, lifetimes count from creation */
+		ifp->tstamp = ifp->cstamp;
+		completed = true;
+	}
+	spin_unlock_bh(&ifp->lock);
+
+	if (completed)
+		nip_ins_rt(ifp->rt);
+}
+
+/* Send the next DAD probe of a tentative address or complete DAD */
+static void nip_addr_dad_verify(struct ninet_ifaddr *ifp, unsigned long now,
+				unsigned long *next)
+{
+	unsigned long retrans = NEIGH_VAR(ifp->idev->nd_parms, RETRANS_TIME);
+	unsigned long when = ifp->tstamp + retrans;
+
+	/* First probe goes out immediately */
+	if (ifp->dad_probes == ifp->idev->cnf.dad_transmits)
+		when = now;
+
+	if (time_before(now, when)) {
+		if (time_before(when, *next))
+			*next = when;
+		return;
+	}
+
+	if (ifp->dad_probes) {
+		ifp->dad_probes--;
+		ifp->tstamp = now;
+		nndisc_send_dad_ns(ifp->idev->dev, &ifp->addr);
+		if (time_before(now + retrans, *next))
+			*next = now + retrans;
+		return;
+	}
+
+	nip_addrconf_dad_completed(ifp);
+}
+
+/* Expire and deprecate addresses. Returns true if @ifp was deleted */
+static bool nip_addr_lft_verify(struct ninet_ifaddr *ifp, unsigned long now,
+				unsigned long *next)
+{
+	unsigned long age = (now - ifp->tstamp) / HZ;
+	unsigned long when;
+
+	if (age >= ifp->valid_lft) {
+		nin_ifa_hold(ifp);
+		nip_del_addr(ifp);
+		return true;
+	}
+
+	if (ifp->preferred_lft != INFINITY_LIFE_TIME && age >= ifp->preferred_lft) {
+		spin_lock_bh(&ifp->lock);
+		ifp->flags |= IFA_F_DEPRECATED;
+		spin_unlock_bh(&ifp->lock);
+	}
+
+	if ((ifp->flags & IFA_F_DEPRECATED) || ifp->preferred_lft == INFINITY_LIFE_TIME)
+		when = ifp->tstamp + ifp->valid_lft * HZ;
+	else
+		when = ifp->tstamp + ifp->preferred_lft * HZ;
+
+	if (time_before(when, *next))
+		*next = when;
+	return false;
+}
+
+/* One walk over the address hash drives DAD probing and lifetimes of every
+ * address in @net, so the cost does not grow with a timer per address and
+ * the transmit path never waits on it.
+ */
+static void nip_addr_verify_rtnl(struct net *net)
+{
+	unsigned long now = jiffies;
+	unsigned long next = now + MAX_JIFFY_OFFSET;
+	struct ninet_ifaddr *ifp;
+	bool pending = false;
+	int i;
+
+	ASSERT_RTNL();
+
+restart:
+	for (i = 0; i < NIN_ADDR_HSIZE; i++) {
+		/* All writers of the hash hold RTNL */
+		hlist_for_each_entry(ifp, &ninet_addr_lst[i], addr_lst) {
+			if (!net_eq(dev_net(ifp->idev->dev), net))
+				continue;
+
+			if (ifp->flags & IFA_F_TENTATIVE) {
+				nip_addr_dad_verify(ifp, now, &next);
+				pending = true;
+				continue;
+			}
+
+			if (ifp->flags & (IFA_F_PERMANENT | IFA_F_DADFAILED))
+				continue;
+
+			if (nip_addr_lft_verify(ifp, now, &next))
+				goto restart;
+			pending = true;
+		}
+	}
+
+	if (pending)
+		nip_addr_chk_schedule(net, time_after(next, now) ? next - now : 0);
+}
+
+static void nip_addr_chk_work(struct work_struct *work)
+{
+	struct net *net = container_of(to_delayed_work(work), struct net,
+				       newip.addr_chk_work);
+
+	rtnl_lock();
+	nip_addr_verify_rtnl(net);
+	rtnl_unlock();
+}
+
 static int ninet_addr_del(struct net *net, int ifindex, u32 ifa_flags,
 			  const struct nip_addr *pfx)
 {
@@ -414,6 +597,59 @@ int nip_addrconf_ifaddr_check(struct net *net, void __user *arg, struct nip_ifre
 	return 0;
 }
 
+/* ifrn_ifindex is the link, ifrn_addr its peer, bitlen 0 removes the peer */
+int nip_addrconf_set_peer(struct net *net, void __user *arg)
+{
+	struct nip_p2p_peer *peer = NULL;
+	struct nip_ifreq ireq;
+	struct ninet_dev *idev;
+	struct net_device *dev;
+	int ret = -ENODEV;
+
+	if (!ns_capable(net->user_ns, CAP_NET_ADMIN)) {
+		nip_dbg("not admin can`t cfg");
+		return -EPERM;
+	}
+
+	if (copy_from_user(&ireq, arg, sizeof(struct nip_ifreq))) {
+		nip_dbg("fail to copy cfg data");
+		return -EFAULT;
+	}
+
+	if (ireq.ifrn_addr.bitlen) {
+		if (nip_addr_invalid(&ireq.ifrn_addr)) {
+			nip_dbg("nip addr invalid, bitlen=%u", ireq.ifrn_addr.bitlen);
+			return -EINVAL;
+		}
+
+		peer = kzalloc(sizeof(*peer), GFP_KERNEL);
+		if (!peer)
+			return -ENOMEM;
+		peer->addr = ireq.ifrn_addr;
+	}
+
+	rtnl_lock();
+	dev = __dev_get_by_index(net, ireq.ifrn_ifindex);
+	if (!dev)
+		goto out;
+
+	idev = __nin_dev_get(dev);
+	if (!idev)
+		goto out;
+
+	if (peer && !(dev->flags & IFF_POINTOPOINT))
+		nip_dbg("%s is not point-to-point, make sure it has a single peer", dev->name);
+
+	/* swap, the old peer is freed below */
+	peer = rcu_replace_pointer(idev->p2p_peer, peer, lockdep_rtnl_is_held());
+	ret = 0;
+out:
+	rtnl_unlock();
+	if (peer)
+		kfree_rcu(peer, rcu);
+	return ret;
+}
+
 int nip_addrconf_add_ifaddr(struct net *net, void __user *arg)
 {
 	struct nip_ifreq ireq;
@@ -433,6 +669,17 @@ int nip_addrconf_add_ifaddr(struct net *net, void __user *arg)
 	return err;
 }
 
+/* Add a permanent address from a snapshot, called with RTNL held */
+int nip_addrconf_restore_addr(struct net *net, int ifindex,
+			      const struct nip_addr *addr, __u32 ifa_flags)
+{
+	if (nip_addr_invalid(addr) || nip_addr_public(addr))
+		return -EINVAL;
+
+	return ninet_addr_add(net, ifindex, addr, IFA_F_PERMANENT | ifa_flags,
+			      INFINITY_LIFE_TIME, INFINITY_LIFE_TIME);
+}
+
 int nip_addrconf_del_ifaddr(struct net *net, void __user *arg)
 {
 	struct nip_ifreq ireq;
@@ -473,6 +720,9 @@ static int __nip_get_firstaddr(struct ninet_dev *idev, struct nip_addr *addr)
 	int err = -EADDRNOTAVAIL;
 
 	list_for_each_entry(ifp, &idev->addr_list, if_list) {
+		/* Tentative addresses are skipped, never waited for */
+		if (ifp->flags & NINET_IFA_F_UNUSABLE)
+			continue;
 		*addr = ifp->addr;
 		err = 0;
 		break;
@@ -705,7 +955,9 @@ static int nip_addr_proc_show(struct seq_file *seq, void *v)
 
 			for (j = 0; j < ifp->addr.bitlen / NIP_ADDR_BIT_LEN_8; j++)
 				seq_printf(seq, "%02x", ifp->addr.nip_addr_field8[j]);
-			seq_printf(seq, "\t%8s\n", ifp->idev->dev ? ifp->idev->dev->name : "");
+			/* flags as in if_inet6, tools wait for IFA_F_TENTATIVE to clear */
+			seq_printf(seq, "\t%8s\t%02x\n", ifp->idev->dev ? ifp->idev->dev->name : "",
+				   READ_ONCE(ifp->flags) & 0xff);
 		}
 
 	rcu_read_unlock();
@@ -724,6 +976,7 @@ static int __net_init nip_addr_net_init(struct net *net)
 		goto err_alloc_dflt;
 
 	net->newip.devconf_dflt = dflt;
+	INIT_DEFERRABLE_WORK(&net->newip.addr_chk_work, nip_addr_chk_work);
 
 	if (!proc_create_net_single("nip_addr", 0444, net->proc_net,
 				    nip_addr_proc_show, NULL)) {
@@ -740,6 +993,7 @@ err_alloc_dflt:
 
 static void __net_exit nip_addr_net_exit(struct net *net)
 {
+	cancel_delayed_work_sync(&net->newip.addr_chk_work);
 	kfree(net->newip.devconf_dflt);
 	remove_proc_entry("nip_addr", net->proc_net);
 }
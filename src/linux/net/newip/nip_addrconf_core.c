@@ -19,6 +19,7 @@ static void nin_dev_finish_destroy_rcu(struct rcu_head *head)
 {
 	struct ninet_dev *idev = container_of(head, struct ninet_dev, rcu);
 
+	kfree(rcu_dereference_protected(idev->p2p_peer, 1));
 	kfree(idev);
 }
 
@@ -0,0 +1,414 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * NewIP INET
+ * An implementation of the TCP/IP protocol suite for the LINUX
+ * operating system. NewIP INET is implemented using the  BSD Socket
+ * interface as the means of communication with the user level.
+ *
+ * Per-flow packet and byte accounting. Every CPU counts the packets it
+ * handles in a table of its own, so the receive and output paths take no
+ * shared lock and touch no shared cache line. Once a second a worker turns
+ * flows that went idle or stayed active too long into struct
+ * nip_flow_record and queues them on a ring, which userspace drains in
+ * batches by reading /proc/net/nip_flow_export.
+ * /proc/net/nip_flow of the initial namespace controls the table:
+ *   echo on > /proc/net/nip_flow      start accounting
+ *   echo off > /proc/net/nip_flow     stop, every flow is exported
+ *   echo flush > /proc/net/nip_flow   export every flow now
+ *   echo idle 15 > /proc/net/nip_flow, active 60, max 8192 (flows per CPU)
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": [%s:%d] " fmt, __func__, __LINE__
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <net/net_namespace.h>
+#include <net/nip.h>
+#include <net/nip_flow_acct.h>
+#include "tcp_nip_parameter.h"
+
+#define NIP_FLOW_HSIZE_SHIFT	10
+#define NIP_FLOW_HSIZE		(1 << NIP_FLOW_HSIZE_SHIFT)
+#define NIP_FLOW_RING_SIZE	16384 /* records, power of 2 */
+#define NIP_FLOW_IDLE_SEC	15
+#define NIP_FLOW_ACTIVE_SEC	60
+#define NIP_FLOW_MAX_PER_CPU	8192
+
+/* Addresses are copied up to bitlen and zero padded, so that the key can
+ * be hashed and compared as words
+ */
+struct nip_flow_key {
+	struct nip_addr daddr;
+	struct nip_addr saddr;
+	u8 nexthdr;
+	u8 dir;
+	__be16 sport;
+	__be16 dport;
+	u32 netns;
+};
+
+struct nip_flow_entry {
+	struct hlist_node node;
+	struct nip_flow_key key;
+	u64 packets;
+	u64 bytes;
+	unsigned long first;    /* jiffies of the first packet since the last export */
+	unsigned long last;
+	unsigned long exported;
+};
+
+struct nip_flow_cpu {
+	spinlock_t lock; /* taken by its CPU and the export worker */
+	unsigned int count;
+	u64 untracked;   /* packets of flows that did not fit */
+	struct hlist_head hash[NIP_FLOW_HSIZE];
+};
+
+DEFINE_STATIC_KEY_FALSE(nip_flow_acct_enabled);
+static struct nip_flow_cpu __percpu *nip_flow_cpus;
+static struct kmem_cache *nip_flow_cache;
+
+static unsigned int nip_flow_idle = NIP_FLOW_IDLE_SEC;
+static unsigned int nip_flow_active = NIP_FLOW_ACTIVE_SEC;
+static unsigned int nip_flow_max = NIP_FLOW_MAX_PER_CPU;
+
+/* Export ring, records are dropped and counted when userspace falls behind */
+static struct nip_flow_record *nip_flow_ring;
+static unsigned int nip_flow_ring_head;
+static unsigned int nip_flow_ring_tail;
+static u64 nip_flow_exported;
+static u64 nip_flow_lost;
+static DEFINE_SPINLOCK(nip_flow_ring_lock);
+
+static DEFINE_MUTEX(nip_flow_lock); /* configuration and on/off */
+static void nip_flow_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(nip_flow_work, nip_flow_work_fn);
+
+static void nip_flow_key_addr(struct nip_addr *dst, const struct nip_addr *src)
+{
+	int len = min_t(int, src->bitlen / NIP_ADDR_BIT_LEN_8, NIP_8BIT_ADDR_INDEX_MAX);
+
+	dst->bitlen = src->bitlen;
+	memcpy(dst->nip_addr_field8, src->nip_addr_field8, len);
+}
+
+static void nip_flow_key_init(struct net *net, struct sk_buff *skb, u8 dir,
+			      struct nip_flow_key *key)
+{
+	__be16 ports[2];
+	const __be16 *p;
+
+	memset(key, 0, sizeof(*key));
+	nip_flow_key_addr(&key->daddr, &NIPCB(skb)->dstaddr);
+	nip_flow_key_addr(&key->saddr, &NIPCB(skb)->srcaddr);
+	key->nexthdr = NIPCB(skb)->nexthdr;
+	key->dir = dir;
+	key->netns = net->ns.inum;
+
+	if ((key->nexthdr == IPPROTO_TCP || key->nexthdr == IPPROTO_UDP) &&
+	    skb_transport_header_was_set(skb)) {
+		p = skb_header_pointer(skb, skb_transport_offset(skb), sizeof(ports), ports);
+		if (p) {
+			key->sport = p[0];
+			key->dport = p[1];
+		}
+	}
+}
+
+static void nip_flow_record_fill(struct nip_flow_record *rec, const struct nip_flow_entry *e,
+				 int cpu, u8 reason, u64 now_ms, unsigned long now)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->packets = e->packets;
+	rec->bytes = e->bytes;
+	rec->first_ms = now_ms - jiffies_to_msecs(now - e->first);
+	rec->last_ms = now_ms - jiffies_to_msecs(now - e->last);
+	rec->netns = e->key.netns;
+	rec->cpu = cpu;
+	rec->sport = e->key.sport;
+	rec->dport = e->key.dport;
+	rec->daddr = e->key.daddr;
+	rec->saddr = e->key.saddr;
+	rec->nexthdr = e->key.nexthdr;
+	rec->dir = e->key.dir;
+	rec->reason = reason;
+}
+
+/* Called with the lock of the flow's CPU held */
+static void nip_flow_export(const struct nip_flow_entry *e, int cpu, u8 reason,
+			    u64 now_ms, unsigned long now)
+{
+	spin_lock_bh(&nip_flow_ring_lock);
+	if (nip_flow_ring_head - nip_flow_ring_tail >= NIP_FLOW_RING_SIZE) {
+		nip_flow_lost++;
+	} else {
+		nip_flow_record_fill(&nip_flow_ring[nip_flow_ring_head & (NIP_FLOW_RING_SIZE - 1)],
+				     e, cpu, reason, now_ms, now);
+		nip_flow_ring_head++;
+		nip_flow_exported++;
+	}
+	spin_unlock_bh(&nip_flow_ring_lock);
+}
+
+void __nip_flow_acct(struct net *net, struct sk_buff *skb, u8 dir)
+{
+	struct nip_flow_entry *e;
+	struct nip_flow_cpu *fc;
+	struct nip_flow_key key;
+	unsigned int packets = skb_is_gso(skb) ? skb_shinfo(skb)->gso_segs : 1;
+	u32 hash;
+
+	nip_flow_key_init(net, skb, dir, &key);
+	hash = jhash2((const u32 *)&key, sizeof(key) / sizeof(u32), 0);
+
+	local_bh_disable();
+	fc = this_cpu_ptr(nip_flow_cpus);
+	spin_lock(&fc->lock);
+	hlist_for_each_entry(e, &fc->hash[hash & (NIP_FLOW_HSIZE - 1)], node) {
+		if (!memcmp(&e->key, &key, sizeof(key)))
+			goto found;
+	}
+
+	if (fc->count >= READ_ONCE(nip_flow_max)) {
+		fc->untracked += packets;
+		goto out;
+	}
+	e = kmem_cache_alloc(nip_flow_cache, GFP_ATOMIC);
+	if (!e) {
+		fc->untracked += packets;
+		goto out;
+	}
+	e->key = key;
+	e->packets = 0;
+	e->bytes = 0;
+	e->exported = jiffies;
+	hlist_add_head(&e->node, &fc->hash[hash & (NIP_FLOW_HSIZE - 1)]);
+	fc->count++;
+found:
+	if (!e->packets)
+		e->first = jiffies;
+	e->packets += packets;
+	e->bytes += skb->len;
+	e->last = jiffies;
+out:
+	spin_unlock(&fc->lock);
+	local_bh_enable();
+}
+
+/* Export flows that are idle, active for too long, or all of them when
+ * forced. Idle flows and all flows when removing are freed.
+ */
+static void nip_flow_expire(bool force, bool remove)
+{
+	unsigned long idle = READ_ONCE(nip_flow_idle) * HZ;
+	unsigned long active = READ_ONCE(nip_flow_active) * HZ;
+	u64 now_ms = div_u64(ktime_get_real_ns(), NSEC_PER_MSEC);
+	unsigned long now = jiffies;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct nip_flow_cpu *fc = per_cpu_ptr(nip_flow_cpus, cpu);
+		struct nip_flow_entry *e;
+		struct hlist_node *tmp;
+		int i;
+
+		spin_lock_bh(&fc->lock);
+		for (i = 0; i < NIP_FLOW_HSIZE; i++) {
+			hlist_for_each_entry_safe(e, tmp, &fc->hash[i], node) {
+				bool is_idle = time_after_eq(now, e->last + idle);
+				u8 reason = 0;
+
+				if (is_idle)
+					reason = NIP_FLOW_END_IDLE;
+				else if (time_after_eq(now, e->exported + active))
+					reason = NIP_FLOW_END_ACTIVE;
+				if (force)
+					reason = NIP_FLOW_END_FORCED;
+
+				if (reason && e->packets) {
+					nip_flow_export(e, cpu, reason, now_ms, now);
+					e->packets = 0;
+					e->bytes = 0;
+					e->exported = now;
+				}
+				if (is_idle || remove) {
+					hlist_del(&e->node);
+					kmem_cache_free(nip_flow_cache, e);
+					fc->count--;
+				}
+			}
+		}
+		spin_unlock_bh(&fc->lock);
+		cond_resched();
+	}
+}
+
+static void nip_flow_work_fn(struct work_struct *work)
+{
+	nip_flow_expire(false, false);
+	if (static_key_enabled(&nip_flow_acct_enabled))
+		schedule_delayed_work(&nip_flow_work, HZ);
+}
+
+static int nip_flow_enable(void)
+{
+	if (static_key_enabled(&nip_flow_acct_enabled))
+		return 0;
+
+	if (!nip_flow_ring) {
+		nip_flow_ring = vzalloc(array_size(NIP_FLOW_RING_SIZE, sizeof(*nip_flow_ring)));
+		if (!nip_flow_ring)
+			return -ENOMEM;
+	}
+	static_branch_enable(&nip_flow_acct_enabled);
+	schedule_delayed_work(&nip_flow_work, HZ);
+	return 0;
+}
+
+static void nip_flow_disable(void)
+{
+	if (!static_key_enabled(&nip_flow_acct_enabled))
+		return;
+
+	static_branch_disable(&nip_flow_acct_enabled);
+	cancel_delayed_work_sync(&nip_flow_work);
+	nip_flow_expire(true, true);
+}
+
+static int nip_flow_write(struct file *file, char *buf, size_t size)
+{
+	char *cmd = strim(buf);
+	unsigned int val;
+	int err = 0;
+
+	mutex_lock(&nip_flow_lock);
+	if (!strcmp(cmd, "on") || !strcmp(cmd, "1")) {
+		err = nip_flow_enable();
+	} else if (!strcmp(cmd, "off") || !strcmp(cmd, "0")) {
+		nip_flow_disable();
+	} else if (!strcmp(cmd, "flush")) {
+		if (nip_flow_ring)
+			nip_flow_expire(true, false);
+	} else if (sscanf(cmd, "idle %u", &val) == 1 && val) {
+		WRITE_ONCE(nip_flow_idle, val);
+	} else if (sscanf(cmd, "active %u", &val) == 1 && val) {
+		WRITE_ONCE(nip_flow_active, val);
+	} else if (sscanf(cmd, "max %u", &val) == 1) {
+		WRITE_ONCE(nip_flow_max, val);
+	} else {
+		err = -EINVAL;
+	}
+	mutex_unlock(&nip_flow_lock);
+	return err;
+}
+
+static int nip_flow_seq_show(struct seq_file *seq, void *v)
+{
+	unsigned int flows = 0;
+	u64 untracked = 0;
+	unsigned int pending;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		const struct nip_flow_cpu *fc = per_cpu_ptr(nip_flow_cpus, cpu);
+
+		flows += READ_ONCE(fc->count);
+		untracked += READ_ONCE(fc->untracked);
+	}
+
+	spin_lock_bh(&nip_flow_ring_lock);
+	pending = nip_flow_ring_head - nip_flow_ring_tail;
+	seq_printf(seq, "enabled: %d idle: %u active: %u max: %u\n",
+		   static_key_enabled(&nip_flow_acct_enabled), READ_ONCE(nip_flow_idle),
+		   READ_ONCE(nip_flow_active), READ_ONCE(nip_flow_max));
+	seq_printf(seq, "flows: %u untracked_packets: %llu exported: %llu lost: %llu pending: %u\n",
+		   flows, untracked, nip_flow_exported, nip_flow_lost, pending);
+	spin_unlock_bh(&nip_flow_ring_lock);
+	return 0;
+}
+
+/* Each read returns as many whole records as fit, 0 when none is queued */
+static ssize_t nip_flow_export_read(struct file *file, char __user *buf,
+				    size_t size, loff_t *ppos)
+{
+	struct nip_flow_record rec;
+	ssize_t done = 0;
+
+	while (size - done >= sizeof(rec)) {
+		spin_lock_bh(&nip_flow_ring_lock);
+		if (nip_flow_ring_tail == nip_flow_ring_head) {
+			spin_unlock_bh(&nip_flow_ring_lock);
+			break;
+		}
+		rec = nip_flow_ring[nip_flow_ring_tail & (NIP_FLOW_RING_SIZE - 1)];
+		nip_flow_ring_tail++;
+		spin_unlock_bh(&nip_flow_ring_lock);
+
+		if (copy_to_user(buf + done, &rec, sizeof(rec)))
+			return done ? done : -EFAULT;
+		done += sizeof(rec);
+	}
+	return done;
+}
+
+static const struct proc_ops nip_flow_export_ops = {
+	.proc_read	= nip_flow_export_read,
+	.proc_lseek	= noop_llseek,
+};
+
+int __init nip_flow_acct_init(void)
+{
+	int cpu;
+	int i;
+
+	BUILD_BUG_ON(sizeof(struct nip_flow_key) % sizeof(u32));
+	nip_flow_cache = KMEM_CACHE(nip_flow_entry, 0);
+	if (!nip_flow_cache)
+		return -ENOMEM;
+
+	nip_flow_cpus = alloc_percpu(struct nip_flow_cpu);
+	if (!nip_flow_cpus)
+		goto free_cache;
+
+	for_each_possible_cpu(cpu) {
+		struct nip_flow_cpu *fc = per_cpu_ptr(nip_flow_cpus, cpu);
+
+		spin_lock_init(&fc->lock);
+		for (i = 0; i < NIP_FLOW_HSIZE; i++)
+			INIT_HLIST_HEAD(&fc->hash[i]);
+	}
+
+	if (!proc_create_net_single_write("nip_flow", 0600, init_net.proc_net,
+					  nip_flow_seq_show, nip_flow_write, NULL))
+		goto free_percpu;
+	if (!proc_create("nip_flow_export", 0400, init_net.proc_net, &nip_flow_export_ops))
+		goto remove_ctl;
+	return 0;
+
+remove_ctl:
+	remove_proc_entry("nip_flow", init_net.proc_net);
+free_percpu:
+	free_percpu(nip_flow_cpus);
+free_cache:
+	kmem_cache_destroy(nip_flow_cache);
+	return -ENOMEM;
+}
+
+/* Only for a failed family init: the table was never switched on */
+void nip_flow_acct_exit(void)
+{
+	remove_proc_entry("nip_flow_export", init_net.proc_net);
+	remove_proc_entry("nip_flow", init_net.proc_net);
+	free_percpu(nip_flow_cpus);
+	kmem_cache_destroy(nip_flow_cache);
+}
@@ -15,13 +15,19 @@
 #include <linux/net.h>
 #include <linux/netdevice.h>
 #include <linux/nip.h>
+#include <linux/jhash.h>
 
 #include <net/sock.h>
 #include <net/protocol.h>
 #include <net/dst_metadata.h>
+#include <net/route.h>
 #include <net/transp_nip.h>
 #include <net/nip_route.h>
+#include <net/nip_addrconf.h>
 #include <net/nip.h>
+#include <net/nip_netfilter.h>
+#include <net/nip_prof.h>
+#include <net/nip_flow_acct.h>
 
 #include "nip_hdr.h"
 #include "tcp_nip_parameter.h"
@@ -45,9 +51,8 @@ static int _nip_update_recv_skb_len(struct sk_buff *skb,
 	return 0;
 }
 
-static int nip_rcv_finish(struct sk_buff *skb)
+static int nip_rcv_finish(struct net *net, struct sock *sk, struct sk_buff *skb)
 {
-	struct net *net = dev_net(skb->dev);
 	void (*edemux)(struct sk_buff *skb) = NULL;
 	int err = 0;
 
@@ -78,9 +83,46 @@ static int nip_rcv_finish(struct sk_buff *skb)
 	return dst_input(skb);
 }
 
-int nip_rcv(struct sk_buff *skb, struct net_device *dev,
-	    struct packet_type *pt, struct net_device *orig_dev)
+static u32 nip_flow_hashrnd __read_mostly;
+
+static void __nip_skb_set_hash(struct sk_buff *skb, const struct nip_hdr_decap *niph,
+			       int offset)
 {
+	u32 ports = 0;
+	u32 hash;
+
+	net_get_random_once(&nip_flow_hashrnd, sizeof(nip_flow_hashrnd));
+
+	if ((niph->nexthdr == IPPROTO_TCP || niph->nexthdr == IPPROTO_UDP) &&
+	    offset + sizeof(ports) <= skb_headlen(skb))
+		memcpy(&ports, skb->data + offset, sizeof(ports));
+
+	hash = jhash_3words(nip_addr_hash(&niph->saddr), nip_addr_hash(&niph->daddr),
+			    ports, nip_flow_hashrnd ^ niph->nexthdr);
+	skb_set_hash(skb, hash, ports ? PKT_HASH_TYPE_L4 : PKT_HASH_TYPE_L3);
+}
+
+/* The flow dissector does not know NewIP, so every NewIP packet would get
+ * the same software hash and RPS/RFS could not tell the flows apart.
+ * Devices carrying NewIP call this before netif_rx so RFS steers by flow,
+ * skb->data must point to the NewIP header. A hardware L4 hash is kept.
+ */
+void nip_skb_set_hash(struct sk_buff *skb)
+{
+	struct nip_hdr_decap niph = {0};
+	int offset;
+
+	if (skb->l4_hash)
+		return;
+
+	offset = nip_hdr_parse(skb->data, skb_headlen(skb), &niph);
+	if (offset > 0)
+		__nip_skb_set_hash(skb, &niph, offset);
+}
+
+static int __nip_rcv(struct sk_buff *skb, struct net_device *dev)
+{
+	int ret;
 	int offset = 0;
 	struct nip_hdr_decap niph = {0};
 
@@ -107,29 +149,66 @@ int nip_rcv(struct sk_buff *skb, struct net_device *dev,
 		goto drop;
 	}
 
+	/* saddr left out by the peer of a point-to-point link */
+	if (!niph.include_saddr)
+		nip_dev_peer_addr(dev, &niph.saddr);
+
 	niph.total_len = ntohs(niph.total_len);
 	NIPCB(skb)->dstaddr = niph.daddr;
 	NIPCB(skb)->srcaddr = niph.saddr;
 	NIPCB(skb)->nexthdr = niph.nexthdr;
+	NIPCB(skb)->tclass = niph.tclass;
 	skb->transport_header = skb->network_header + offset;
 	skb_orphan(skb);
 
+	/* sk_rxhash is saved from this, it must identify the flow */
+	if (!skb->l4_hash)
+		__nip_skb_set_hash(skb, &niph, offset);
+
+	/* Only same host traffic may skip transport checksum verification,
+	 * hardware has no idea of NewIP checksums.
+	 */
+	skb->ip_summed = (dev->flags & IFF_LOOPBACK) ? CHECKSUM_UNNECESSARY : CHECKSUM_NONE;
+
+	/* Keep the sender's traffic class when the packet is forwarded */
+	if (niph.include_tclass)
+		skb->priority = rt_tos2priority(niph.tclass);
+
 	/* SKB refreshes the length after replication */
 	if (_nip_update_recv_skb_len(skb, &niph))
 		goto drop;
 
-	return nip_rcv_finish(skb);
+	nip_flow_acct(dev_net(dev), skb, NIP_FLOW_DIR_IN);
+
+	/* Offloaded flows skip routing and every hook */
+	if (nip_flow_offload_xmit(dev_net(dev), skb))
+		return NET_RX_SUCCESS;
+
+	/* A hook drop comes back as an errno, report it as the rx path does */
+	ret = NIP_NF_HOOK(NF_INET_PRE_ROUTING, dev_net(dev), NULL, skb,
+			  dev, NULL, nip_rcv_finish);
+	return ret < 0 ? NET_RX_DROP : ret;
 drop:
 	kfree_skb(skb);
 out:
 	return NET_RX_DROP;
 }
 
+int nip_rcv(struct sk_buff *skb, struct net_device *dev,
+	    struct packet_type *pt, struct net_device *orig_dev)
+{
+	u64 start = nip_prof_begin();
+	int ret = __nip_rcv(skb, dev);
+
+	nip_prof_end(NIP_PROF_RCV, start);
+	return ret;
+}
+
 /* Deliver the packet to transport layer,
  * including TCP, UDP and ICMP.
  * Caller must hold rcu.
  */
-void nip_protocol_deliver_rcu(struct sk_buff *skb)
+static void __nip_protocol_deliver_rcu(struct sk_buff *skb)
 {
 	const struct ninet_protocol *ipprot;
 
@@ -149,8 +228,15 @@ discard:
 	kfree_skb(skb);
 }
 
-/* Generally called by dst_input */
-int nip_input(struct sk_buff *skb)
+void nip_protocol_deliver_rcu(struct sk_buff *skb)
+{
+	u64 start = nip_prof_begin();
+
+	__nip_protocol_deliver_rcu(skb);
+	nip_prof_end(NIP_PROF_DELIVER, start);
+}
+
+static int nip_input_finish(struct net *net, struct sock *sk, struct sk_buff *skb)
 {
 	rcu_read_lock();
 	nip_protocol_deliver_rcu(skb);
@@ -158,3 +244,10 @@ int nip_input(struct sk_buff *skb)
 
 	return 0;
 }
+
+/* Generally called by dst_input */
+int nip_input(struct sk_buff *skb)
+{
+	return NIP_NF_HOOK(NF_INET_LOCAL_IN, dev_net(skb->dev), NULL, skb,
+			   skb->dev, NULL, nip_input_finish);
+}
@@ -0,0 +1,435 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * NewIP netfilter hooks and flow offload
+ * Linux NewIP INET implementation
+ *
+ * Based on net/netfilter/core.c
+ * Based on net/netfilter/nf_flow_table_core.c
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": [%s:%d] " fmt, __func__, __LINE__
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/hash.h>
+#include <linux/netdevice.h>
+#include <linux/workqueue.h>
+
+#include <net/dst.h>
+#include <net/nip.h>
+#include <net/nip_route.h>
+#include <net/nip_netfilter.h>
+
+#include "tcp_nip_parameter.h"
+
+#define NIP_FLOW_OFFLOAD_HSIZE_SHIFT 6
+#define NIP_FLOW_OFFLOAD_HSIZE       (1 << NIP_FLOW_OFFLOAD_HSIZE_SHIFT)
+#define NIP_FLOW_OFFLOAD_MAX         1024
+#define NIP_FLOW_OFFLOAD_TIMEOUT     (30 * HZ)
+
+DEFINE_STATIC_KEY_FALSE(nip_nf_hooks_needed);
+EXPORT_SYMBOL_GPL(nip_nf_hooks_needed);
+
+static DEFINE_MUTEX(nip_nf_hook_mutex);
+
+struct nip_flow_offload {
+	struct hlist_node hnode;
+	struct nip_addr saddr;
+	struct nip_addr daddr;
+	int iif;
+	u32 ports; /* sport and dport as on the wire */
+	u8 nexthdr;
+	struct dst_entry *dst;
+	unsigned long timeout;
+	struct rcu_head rcu;
+};
+
+struct nip_flow_offload_table {
+	struct hlist_head head[NIP_FLOW_OFFLOAD_HSIZE];
+	spinlock_t lock; /* protect head and count */
+	unsigned int count;
+	struct delayed_work gc_work;
+};
+
+static struct nip_nf_hook_entries *
+nip_nf_hook_entries_grow(const struct nip_nf_hook_entries *old,
+			 const struct nf_hook_ops *reg)
+{
+	unsigned int num = old ? old->num : 0;
+	struct nip_nf_hook_entries *new;
+	bool inserted = false;
+	unsigned int i, j = 0;
+
+	new = kzalloc(struct_size(new, ops, num + 1), GFP_KERNEL);
+	if (!new)
+		return NULL;
+
+	for (i = 0; i < num; i++) {
+		if (!inserted && reg->priority < old->ops[i]->priority) {
+			new->ops[j++] = reg;
+			inserted = true;
+		}
+		new->ops[j++] = old->ops[i];
+	}
+	if (!inserted)
+		new->ops[j++] = reg;
+	new->num = j;
+	return new;
+}
+
+/* Returns NULL when @reg was the last hook */
+static struct nip_nf_hook_entries *
+nip_nf_hook_entries_shrink(const struct nip_nf_hook_entries *old,
+			   const struct nf_hook_ops *reg)
+{
+	struct nip_nf_hook_entries *new;
+	unsigned int i, j = 0;
+
+	if (old->num == 1)
+		return NULL;
+
+	new = kzalloc(struct_size(new, ops, old->num - 1), GFP_KERNEL | __GFP_NOFAIL);
+	for (i = 0; i < old->num; i++) {
+		if (old->ops[i] != reg)
+			new->ops[j++] = old->ops[i];
+	}
+	new->num = j;
+	return new;
+}
+
+int nip_nf_register_net_hook(struct net *net, const struct nf_hook_ops *reg)
+{
+	struct nip_nf_hook_entries *old, *new;
+
+	if (reg->hooknum >= NF_INET_NUMHOOKS)
+		return -EINVAL;
+
+	mutex_lock(&nip_nf_hook_mutex);
+	old = rcu_dereference_protected(net->newip.nf_hooks[reg->hooknum],
+					lockdep_is_held(&nip_nf_hook_mutex));
+	new = nip_nf_hook_entries_grow(old, reg);
+	if (!new) {
+		mutex_unlock(&nip_nf_hook_mutex);
+		return -ENOMEM;
+	}
+	rcu_assign_pointer(net->newip.nf_hooks[reg->hooknum], new);
+	mutex_unlock(&nip_nf_hook_mutex);
+
+	if (old)
+		kfree_rcu(old, rcu);
+	static_branch_inc(&nip_nf_hooks_needed);
+	nip_dbg("hook %u registered, priority=%d", reg->hooknum, reg->priority);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(nip_nf_register_net_hook);
+
+void nip_nf_unregister_net_hook(struct net *net, const struct nf_hook_ops *reg)
+{
+	struct nip_nf_hook_entries *old, *new;
+	unsigned int i;
+
+	if (reg->hooknum >= NF_INET_NUMHOOKS)
+		return;
+
+	mutex_lock(&nip_nf_hook_mutex);
+	old = rcu_dereference_protected(net->newip.nf_hooks[reg->hooknum],
+					lockdep_is_held(&nip_nf_hook_mutex));
+	for (i = 0; old && i < old->num; i++) {
+		if (old->ops[i] == reg)
+			break;
+	}
+	if (!old || i == old->num) {
+		mutex_unlock(&nip_nf_hook_mutex);
+		WARN(1, "hook not found, hooknum=%u\n", reg->hooknum);
+		return;
+	}
+	new = nip_nf_hook_entries_shrink(old, reg);
+	rcu_assign_pointer(net->newip.nf_hooks[reg->hooknum], new);
+	mutex_unlock(&nip_nf_hook_mutex);
+
+	kfree_rcu(old, rcu);
+	static_branch_dec(&nip_nf_hooks_needed);
+
+	/* Offloaded flows were accepted by hooks that may be gone now */
+	nip_flow_offload_flush(net, NULL);
+}
+EXPORT_SYMBOL_GPL(nip_nf_unregister_net_hook);
+
+int nip_nf_hook_slow(unsigned int hook, struct net *net, struct sock *sk,
+		     struct sk_buff *skb, struct net_device *in,
+		     struct net_device *out,
+		     int (*okfn)(struct net *, struct sock *, struct sk_buff *))
+{
+	const struct nip_nf_hook_entries *e;
+	struct nf_hook_state state;
+	unsigned int verdict;
+	int ret = 1;
+	u16 i;
+
+	rcu_read_lock();
+	e = rcu_dereference(net->newip.nf_hooks[hook]);
+	if (!e)
+		goto out;
+
+	nf_hook_state_init(&state, hook, NFPROTO_UNSPEC, in, out, sk, net, okfn);
+	for (i = 0; i < e->num; i++) {
+		const struct nf_hook_ops *ops = e->ops[i];
+
+		verdict = ops->hook(ops->priv, skb, &state);
+		switch (verdict & NF_VERDICT_MASK) {
+		case NF_ACCEPT:
+			break;
+		case NF_STOLEN:
+			ret = 0;
+			goto out;
+		default:
+			kfree_skb(skb);
+			ret = NF_DROP_GETERR(verdict);
+			if (ret == 0)
+				ret = -EPERM;
+			goto out;
+		}
+	}
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+/* Ports of a TCP or UDP packet, zero for the other protocols. A flow is
+ * only offloaded for the exact 5-tuple the hooks accepted.
+ */
+static u32 nip_flow_offload_ports(const struct sk_buff *skb)
+{
+	u32 ports = 0;
+
+	if ((NIPCB(skb)->nexthdr == IPPROTO_TCP || NIPCB(skb)->nexthdr == IPPROTO_UDP) &&
+	    skb_transport_offset(skb) + sizeof(ports) <= skb_headlen(skb))
+		memcpy(&ports, skb_transport_header(skb), sizeof(ports));
+	return ports;
+}
+
+static u32 nip_flow_offload_hash(const struct nip_addr *saddr,
+				 const struct nip_addr *daddr, u32 ports, int iif)
+{
+	return hash_32(nip_addr_hash(saddr) ^ nip_addr_hash(daddr) ^ ports ^ iif,
+		       NIP_FLOW_OFFLOAD_HSIZE_SHIFT);
+}
+
+static struct nip_flow_offload *
+nip_flow_offload_lookup(struct nip_flow_offload_table *tbl, const struct sk_buff *skb,
+			u32 ports, int iif)
+{
+	u32 hash = nip_flow_offload_hash(&NIPCB(skb)->srcaddr, &NIPCB(skb)->dstaddr,
+					 ports, iif);
+	struct nip_flow_offload *flow;
+
+	hlist_for_each_entry_rcu(flow, &tbl->head[hash], hnode) {
+		if (flow->iif == iif && flow->nexthdr == NIPCB(skb)->nexthdr &&
+		    flow->ports == ports &&
+		    nip_addr_eq(&flow->saddr, &NIPCB(skb)->srcaddr) &&
+		    nip_addr_eq(&flow->daddr, &NIPCB(skb)->dstaddr))
+			return flow;
+	}
+	return NULL;
+}
+
+static void nip_flow_offload_free_rcu(struct rcu_head *head)
+{
+	struct nip_flow_offload *flow = container_of(head, struct nip_flow_offload, rcu);
+
+	dst_release(flow->dst);
+	kfree(flow);
+}
+
+/* caller must hold tbl->lock */
+static void nip_flow_offload_del(struct nip_flow_offload_table *tbl,
+				 struct nip_flow_offload *flow)
+{
+	hlist_del_rcu(&flow->hnode);
+	tbl->count--;
+	call_rcu(&flow->rcu, nip_flow_offload_free_rcu);
+}
+
+int nip_flow_offload_add(struct net *net, const struct sk_buff *skb)
+{
+	struct nip_flow_offload_table *tbl = net->newip.nip_flowtable;
+	struct dst_entry *dst = skb_dst(skb);
+	struct nip_flow_offload *flow;
+	int iif = skb->skb_iif;
+	u32 ports;
+	u32 hash;
+	int err = 0;
+
+	if (!tbl || !dst)
+		return -EINVAL;
+
+	ports = nip_flow_offload_ports(skb);
+	hash = nip_flow_offload_hash(&NIPCB(skb)->srcaddr, &NIPCB(skb)->dstaddr,
+				     ports, iif);
+	spin_lock_bh(&tbl->lock);
+	flow = nip_flow_offload_lookup(tbl, skb, ports, iif);
+	if (flow) {
+		WRITE_ONCE(flow->timeout, jiffies + NIP_FLOW_OFFLOAD_TIMEOUT);
+		goto out;
+	}
+
+	if (tbl->count >= NIP_FLOW_OFFLOAD_MAX) {
+		err = -ENOSPC;
+		goto out;
+	}
+
+	flow = kzalloc(sizeof(*flow), GFP_ATOMIC);
+	if (!flow) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	flow->saddr = NIPCB(skb)->srcaddr;
+	flow->daddr = NIPCB(skb)->dstaddr;
+	flow->nexthdr = NIPCB(skb)->nexthdr;
+	flow->ports = ports;
+	flow->iif = iif;
+	flow->dst = dst_clone(dst);
+	flow->timeout = jiffies + NIP_FLOW_OFFLOAD_TIMEOUT;
+	hlist_add_head_rcu(&flow->hnode, &tbl->head[hash]);
+	tbl->count++;
+	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work,
+			   NIP_FLOW_OFFLOAD_TIMEOUT);
+out:
+	spin_unlock_bh(&tbl->lock);
+	return err;
+}
+EXPORT_SYMBOL_GPL(nip_flow_offload_add);
+
+/* Called from nip_rcv once NIPCB is filled. Returns true if @skb was sent */
+bool nip_flow_offload_xmit(struct net *net, struct sk_buff *skb)
+{
+	struct nip_flow_offload_table *tbl = net->newip.nip_flowtable;
+	struct nip_flow_offload *flow;
+	struct dst_entry *dst;
+
+	if (!static_branch_unlikely(&nip_nf_hooks_needed) ||
+	    !tbl || !READ_ONCE(tbl->count))
+		return false;
+
+	rcu_read_lock();
+	flow = nip_flow_offload_lookup(tbl, skb, nip_flow_offload_ports(skb),
+				       skb->dev->ifindex);
+	if (!flow || time_after(jiffies, READ_ONCE(flow->timeout))) {
+		rcu_read_unlock();
+		return false;
+	}
+
+	dst = flow->dst;
+	if (dst->obsolete > 0 || !netif_running(dst->dev)) {
+		rcu_read_unlock();
+		return false;
+	}
+
+	WRITE_ONCE(flow->timeout, jiffies + NIP_FLOW_OFFLOAD_TIMEOUT);
+	skb_dst_set(skb, dst_clone(dst));
+	rcu_read_unlock();
+
+	skb->protocol = htons(ETH_P_NEWIP);
+	skb->dev = dst->dev;
+	nip_finish_output(net, NULL, skb);
+	return true;
+}
+
+/* Flush flows using @dev, or all of them if @dev is NULL */
+void nip_flow_offload_flush(struct net *net, const struct net_device *dev)
+{
+	struct nip_flow_offload_table *tbl = net->newip.nip_flowtable;
+	struct nip_flow_offload *flow;
+	struct hlist_node *tmp;
+	int i;
+
+	if (!tbl)
+		return;
+
+	spin_lock_bh(&tbl->lock);
+	for (i = 0; i < NIP_FLOW_OFFLOAD_HSIZE; i++) {
+		hlist_for_each_entry_safe(flow, tmp, &tbl->head[i], hnode) {
+			if (!dev || flow->dst->dev == dev || flow->iif == dev->ifindex)
+				nip_flow_offload_del(tbl, flow);
+		}
+	}
+	spin_unlock_bh(&tbl->lock);
+}
+
+static void nip_flow_offload_gc(struct work_struct *work)
+{
+	struct nip_flow_offload_table *tbl = container_of(to_delayed_work(work),
+							  struct nip_flow_offload_table,
+							  gc_work);
+	struct nip_flow_offload *flow;
+	struct hlist_node *tmp;
+	int i;
+
+	spin_lock_bh(&tbl->lock);
+	for (i = 0; i < NIP_FLOW_OFFLOAD_HSIZE; i++) {
+		hlist_for_each_entry_safe(flow, tmp, &tbl->head[i], hnode) {
+			if (time_after(jiffies, READ_ONCE(flow->timeout)) ||
+			    flow->dst->obsolete > 0)
+				nip_flow_offload_del(tbl, flow);
+		}
+	}
+	if (tbl->count)
+		queue_delayed_work(system_power_efficient_wq, &tbl->gc_work,
+				   NIP_FLOW_OFFLOAD_TIMEOUT);
+	spin_unlock_bh(&tbl->lock);
+}
+
+static int __net_init nip_netfilter_net_init(struct net *net)
+{
+	struct nip_flow_offload_table *tbl;
+	int i;
+
+	tbl = kzalloc(sizeof(*tbl), GFP_KERNEL);
+	if (!tbl)
+		return -ENOMEM;
+
+	for (i = 0; i < NIP_FLOW_OFFLOAD_HSIZE; i++)
+		INIT_HLIST_HEAD(&tbl->head[i]);
+	spin_lock_init(&tbl->lock);
+	INIT_DELAYED_WORK(&tbl->gc_work, nip_flow_offload_gc);
+	net->newip.nip_flowtable = tbl;
+	return 0;
+}
+
+static void __net_exit nip_netfilter_net_exit(struct net *net)
+{
+	struct nip_flow_offload_table *tbl = net->newip.nip_flowtable;
+	int i;
+
+	for (i = 0; i < NF_INET_NUMHOOKS; i++)
+		WARN_ON(rcu_access_pointer(net->newip.nf_hooks[i]));
+
+	cancel_delayed_work_sync(&tbl->gc_work);
+	nip_flow_offload_flush(net, NULL);
+	net->newip.nip_flowtable = NULL;
+	rcu_barrier();
+	kfree(tbl);
+}
+
+static struct pernet_operations nip_netfilter_net_ops = {
+	.init = nip_netfilter_net_init,
+	.exit = nip_netfilter_net_exit,
+};
+
+int __init nip_netfilter_init(void)
+{
+	int err;
+
+	err = register_pernet_subsys(&nip_netfilter_net_ops);
+	if (err)
+		nip_dbg("register_pernet_subsys failed");
+	return err;
+}
+
+void nip_netfilter_cleanup(void)
+{
+	unregister_pernet_subsys(&nip_netfilter_net_ops);
+}
@@ -21,6 +21,7 @@
 #include <linux/module.h>
 #include <linux/time.h>
 #include <linux/netfilter.h>
+#include <asm/unaligned.h>
 
 #include <net/sock.h>
 #include <net/nndisc.h>
@@ -29,13 +30,18 @@
 #include <net/nip.h>
 #include <net/nip_udp.h>
 #include <net/nip_route.h>
+#include <net/nip_addrconf.h>
 #include <net/tcp_nip.h>
+#include <net/nip_netfilter.h>
+#include <net/nip_prof.h>
+#include <net/nip_flow_acct.h>
 
 #include "nip_hdr.h"
 #include "nip_checksum.h"
 #include "tcp_nip_parameter.h"
 
 #define NIP_BIT_TO_BYTE 1024
+
 void update_memory_rate(const char *upper_fun)
 {
 	struct sysinfo mem_info;
@@ -52,16 +58,40 @@ void update_memory_rate(const char *upper_fun)
 	nip_dbg("%s call cur-func mem total: %ld KB, mem used: %ld KB", upper_fun, total, used);
 }
 
-int nip_output(struct net *net, struct sock *sk, struct sk_buff *skb)
+/* Same host delivery: queue the packet on this CPU's backlog as the
+ * loopback driver does, but without neighbour resolution and a link layer
+ * header. The sender may hold a socket lock (TCP timers, an ACK sent from
+ * the receive path), so the packet is never received inline: nip_rcv runs
+ * later from softirq with no socket lock held, and PRE_ROUTING, profiling
+ * and flow accounting see it there. Checksums are neither built nor
+ * verified on this path, nip_rcv trusts loopback devices.
+ */
+static void nip_local_deliver(struct sk_buff *skb)
+{
+	skb_orphan(skb);
+	/* The output route is not valid for input, nip_rcv looks it up again */
+	skb_dst_drop(skb);
+	skb->pkt_type = PACKET_HOST;
+	skb_reset_mac_header(skb);
+
+	/* The backlog is processed when bottom halves are enabled again */
+	local_bh_disable();
+	netif_rx(skb);
+	local_bh_enable();
+}
+
+int nip_finish_output(struct net *net, struct sock *sk, struct sk_buff *skb)
 {
 	struct dst_entry *dst = skb_dst(skb);
 	struct nip_addr *nexthop;
 	struct neighbour *neigh;
 	int ret = 0;
-	struct net_device *dev = skb_dst(skb)->dev;
+	struct net_device *dev = skb->dev;
 
-	skb->protocol = htons(ETH_P_NEWIP);
-	skb->dev = dev;
+	if (nip_dst_loopback(dst)) {
+		nip_local_deliver(skb);
+		return 0;
+	}
 
 	/* prepare to build ethernet header */
 	nexthop = nip_nexthop((struct nip_rt_info *)dst, &NIPCB(skb)->dstaddr);
@@ -72,7 +102,10 @@ int nip_output(struct net *net, struct sock *sk, struct sk_buff *skb)
 	if (unlikely(!neigh))
 		neigh = __neigh_create(&nnd_tbl, nexthop, dev, false);
 	if (!IS_ERR(neigh)) {
-		int res = neigh_output(neigh, skb, false);
+		int res;
+
+		nndisc_pending_trim(neigh, skb);
+		res = neigh_output(neigh, skb, false);
 
 		rcu_read_unlock_bh();
 		return res;
@@ -84,16 +117,36 @@ int nip_output(struct net *net, struct sock *sk, struct sk_buff *skb)
 	return ret;
 }
 
+int nip_output(struct net *net, struct sock *sk, struct sk_buff *skb)
+{
+	struct net_device *dev = skb_dst(skb)->dev;
+	u64 start = nip_prof_begin();
+	int ret;
+
+	skb->protocol = htons(ETH_P_NEWIP);
+	skb->dev = dev;
+	nip_flow_acct(dev_net(dev), skb, NIP_FLOW_DIR_OUT);
+
+	ret = NIP_NF_HOOK(NF_INET_POST_ROUTING, dev_net(dev), sk, skb,
+			  NULL, dev, nip_finish_output);
+	nip_prof_end(NIP_PROF_OUTPUT, start);
+	return ret;
+}
+
 int nip_forward(struct sk_buff *skb)
 {
-	return nip_output(NULL, NULL, skb);
+	struct net_device *dev = skb_dst(skb)->dev;
+
+	return NIP_NF_HOOK(NF_INET_FORWARD, dev_net(dev), NULL, skb,
+			   skb->dev, dev, nip_output);
 }
 
 static int nip_local_out(struct net *net, struct sock *sk, struct sk_buff *skb)
 {
 	int err;
 
-	err = dst_output(net, sk, skb);
+	err = NIP_NF_HOOK(NF_INET_LOCAL_OUT, net, sk, skb,
+			  NULL, skb_dst(skb)->dev, dst_output);
 	return err;
 }
 
@@ -119,12 +172,17 @@ unsigned short nip_get_output_checksum(struct sk_buff *skb,
 	struct nip_pseudo_header nph = {0};
 	u8 *udp_hdr = skb_transport_header(skb);
 	unsigned short check_len = head->trans_hdr_len + head->usr_data_len;
+	unsigned short sum;
+	u64 start;
 
 	nph.nexthdr = IPPROTO_UDP;
 	nph.saddr = NIPCB(skb)->srcaddr;
 	nph.daddr = NIPCB(skb)->dstaddr;
 	nph.check_len = htons(check_len);
-	return nip_check_sum_build(udp_hdr, check_len, &nph);
+	start = nip_prof_begin();
+	sum = nip_check_sum_build(udp_hdr, check_len, &nph);
+	nip_prof_end(NIP_PROF_CHECKSUM, start);
+	return sum;
 }
 
 static struct sk_buff *_nip_alloc_skb(struct sock *sk,
@@ -133,7 +191,9 @@ static struct sk_buff *_nip_alloc_skb(struct sock *sk,
 				      struct dst_entry *dst)
 {
 	int len;
-	int nip_hdr_len = get_nip_hdr_len(NIP_HDR_UDP, &head->saddr, &head->daddr);
+	int nip_hdr_len = get_nip_hdr_len(NIP_HDR_UDP,
+					  head->saddr_elided ? NULL : &head->saddr,
+					  &head->daddr, head->tclass);
 	struct sk_buff *skb;
 
 	nip_hdr_len = nip_hdr_len == 0 ? NIP_HDR_MAX : nip_hdr_len;
@@ -203,11 +263,13 @@ static int _nip_udp_single_output(struct sock *sk,
 		return -EFBIG;
 	}
 
-	/* insert check sum */
-	check = nip_get_output_checksum(skb, head);
-	nip_build_udp_hdr(head->sport, head->dport,
-			  htons(head->trans_hdr_len + head->usr_data_len),
-			  skb->data - head->trans_hdr_len, htons(check));
+	/* insert check sum, same host delivery does not verify it */
+	if (!nip_dst_loopback(dst)) {
+		check = nip_get_output_checksum(skb, head);
+		nip_build_udp_hdr(head->sport, head->dport,
+				  htons(head->trans_hdr_len + head->usr_data_len),
+				  skb->data - head->trans_hdr_len, htons(check));
+	}
 
 	/* Refresh the data/tail of the SKB after the packet copy is complete */
 	skb_put(skb, head->usr_data_len);
@@ -223,6 +285,11 @@ static int _nip_udp_single_output(struct sock *sk,
 	refcount_add(skb->truesize, &sk->sk_wmem_alloc);
 	skb->priority = sk->sk_priority;
 
+	/* One TX queue per socket, the flow dissector cannot hash NewIP */
+	if (unlikely(!READ_ONCE(sk->sk_txhash)))
+		sk_set_txhash(sk);
+	skb_set_hash_from_sk(skb, sk);
+
 	ret = nip_send_skb(skb);
 	nip_dbg("output finish (ret=%d, datalen=%u)", ret, head->usr_data_len);
 	update_memory_rate(__func__);
@@ -239,7 +306,7 @@ int _nip_udp_output(struct sock *sk, void *from, int datalen,
 	u32 mtu = dst_mtu(dst);
 	struct nip_pkt_seg_info seg_info = {0};
 	struct nip_hdr_encap head = {0};
-	int nip_hdr_len = get_nip_hdr_len(NIP_HDR_UDP, saddr, daddr);
+	int nip_hdr_len;
 
 	head.saddr = *saddr;
 	head.daddr = *daddr;
@@ -248,8 +315,15 @@ int _nip_udp_output(struct sock *sk, void *from, int datalen,
 	head.usr_data = from;
 	head.ttl = NIP_DEFAULT_TTL;
 	head.nexthdr = IPPROTO_UDP;
+	head.tclass = inet_sk(sk)->tos;
 	head.trans_hdr_len = transhdrlen;
+	rcu_read_lock();
+	head.saddr_elided = nip_dev_elide_saddr(dst->dev, daddr);
+	rcu_read_unlock();
 
+	/* Segments are sized for the header really sent, not NIP_HDR_MAX */
+	nip_hdr_len = get_nip_hdr_len(NIP_HDR_UDP, head.saddr_elided ? NULL : saddr,
+				      daddr, head.tclass);
 	nip_hdr_len = nip_hdr_len == 0 ? NIP_HDR_MAX : nip_hdr_len;
 	nip_calc_pkt_frag_num(mtu, nip_hdr_len, datalen, &seg_info);
 
@@ -358,15 +432,40 @@ struct dst_entry *nip_sk_dst_lookup_flow(struct sock *sk, struct flow_nip *fln)
 	return dst;
 }
 
+/* The addresses of a connection are fixed once it is hashed, so the NewIP
+ * header is encoded once here instead of for every segment.
+ * Caller must hold rcu_read_lock.
+ */
+void tcp_nip_build_hdr_tmpl(struct sock *sk, const struct dst_entry *dst)
+{
+	struct tcp_nip_hdr_tmpl *tmpl = &tcp_nip_sk(sk)->hdr_tmpl;
+	struct nip_hdr_encap head = {0};
+
+	BUILD_BUG_ON(TCP_NIP_HDR_TMPL_MAX < NIP_HDR_MAX);
+
+	head.saddr = sk->sk_nip_rcv_saddr;
+	head.daddr = sk->sk_nip_daddr;
+	head.ttl = NIP_DEFAULT_TTL;
+	head.nexthdr = IPPROTO_TCP;
+	head.tclass = inet_sk(sk)->tos;
+	head.saddr_elided = nip_dev_elide_saddr(dst->dev, &head.daddr);
+	head.hdr_buf = tmpl->buf;
+	nip_hdr_comm_encap(&head);
+
+	tmpl->total_len_off = (unsigned char *)head.total_len_pos - tmpl->buf;
+	tmpl->tclass = head.tclass;
+	tmpl->saddr_elided = head.saddr_elided;
+	tmpl->len = head.hdr_buf_pos;
+}
+
 int tcp_nip_queue_xmit(struct sock *sk, struct sk_buff *skb, struct flowi *fl)
 {
 	int err = -EHOSTUNREACH;
 	struct net *net = sock_net(sk);
+	struct tcp_nip_hdr_tmpl *tmpl = &tcp_nip_sk(sk)->hdr_tmpl;
 	struct nip_addr *saddr, *daddr;
 	struct dst_entry *dst;
 	struct flow_nip fln;
-	struct nip_hdr_encap head = {0};
-	unsigned char hdr_buf[NIP_HDR_MAX]; /* Cache the newIP header */
 
 	rcu_read_lock();
 	skb->protocol = htons(ETH_P_NEWIP);
@@ -375,15 +474,6 @@ int tcp_nip_queue_xmit(struct sock *sk, struct sk_buff *skb, struct flowi *fl)
 	saddr = &sk->sk_nip_rcv_saddr;
 	daddr = &sk->sk_nip_daddr;
 
-	head.saddr = *saddr;
-	head.daddr = *daddr;
-	head.ttl = NIP_DEFAULT_TTL;
-	head.nexthdr = IPPROTO_TCP;
-	head.hdr_buf = hdr_buf;
-	nip_hdr_comm_encap(&head);
-	head.total_len = head.hdr_buf_pos + skb->len;
-	nip_update_total_len(&head, htons(head.total_len));
-
 	fln.daddr = sk->sk_nip_daddr;
 	dst = __sk_dst_check(sk, 0);
 	if (!dst) {
@@ -399,22 +489,26 @@ int tcp_nip_queue_xmit(struct sock *sk, struct sk_buff *skb, struct flowi *fl)
 	}
 	skb_dst_set_noref(skb, dst);
 
+	if (unlikely(!tmpl->len || tmpl->tclass != inet_sk(sk)->tos ||
+		     tmpl->saddr_elided != nip_dev_elide_saddr(dst->dev, daddr)))
+		tcp_nip_build_hdr_tmpl(sk, dst);
+
 	/* build nwk header */
-	skb_push(skb, head.hdr_buf_pos);
-	memcpy(skb->data, head.hdr_buf, head.hdr_buf_pos);
+	skb_push(skb, tmpl->len);
+	memcpy(skb->data, tmpl->buf, tmpl->len);
+	put_unaligned_be16(skb->len, skb->data + tmpl->total_len_off);
 
 	skb_reset_network_header(skb);
 	NIPCB(skb)->srcaddr = *saddr;
 	NIPCB(skb)->dstaddr = *daddr;
-	NIPCB(skb)->nexthdr = head.nexthdr;
+	NIPCB(skb)->nexthdr = IPPROTO_TCP;
 
 	skb->priority = sk->sk_priority;
-	head.total_len = skb->len;
 	err = nip_send_skb(skb);
 	if (err)
-		nip_dbg("failed to send skb, skb->len=%u", head.total_len);
+		nip_dbg("failed to send skb, skb->len=%u", skb->len);
 	else
-		nip_dbg("send skb ok, skb->len=%u", head.total_len);
+		nip_dbg("send skb ok, skb->len=%u", skb->len);
 
 out:
 	rcu_read_unlock();
@@ -0,0 +1,458 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * NewIP INET
+ * An implementation of the TCP/IP protocol suite for the LINUX
+ * operating system. NewIP INET is implemented using the  BSD Socket
+ * interface as the means of communication with the user level.
+ *
+ * NewIP/UDP packet generator, frames are built with the stack's own
+ * header encapsulation and handed straight to the driver.
+ *
+ * Based on net/core/pktgen.c
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": [%s:%d] " fmt, __func__, __LINE__
+
+#include <linux/kernel.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/nip.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include <net/nip.h>
+
+#include "nip_hdr.h"
+#include "nip_checksum.h"
+#include "tcp_nip_parameter.h"
+
+#define NIP_PKTGEN_FLOWS_MAX   1024
+#define NIP_PKTGEN_PAYLOAD_MAX 8192
+#define NIP_PKTGEN_SPORT_DEF   9000
+#define NIP_PKTGEN_DPORT_DEF   9
+#define NIP_PKTGEN_LEN_DEF     18
+#define NIP_PKTGEN_COUNT_DEF   1000000
+
+/* Commands written to /proc/net/nip_pktgen, one per write:
+ *   dev <ifname>          output device
+ *   dst_mac <xx:..:xx>    link layer destination
+ *   saddr <hex>           NewIP source address, e.g. "de00"
+ *   daddr <hex>           NewIP destination address
+ *   sport <port>          first source port, one per flow
+ *   dport <port>
+ *   len <bytes>           UDP payload length
+ *   flows <num>           number of flows (consecutive source ports)
+ *   count <num>           packets to send, 0 sends until "stop"
+ *   clone <num>           extra sends of each built skb, the device must
+ *                         support IFF_TX_SKB_SHARING
+ *   tclass <num>          traffic class, 0 leaves it out of the bitmap
+ *   no_saddr <0|1>        leave saddr out of the header
+ *   start                 run in the writer's context until done, saddr
+ *                         and daddr must be set
+ *   stop                  stop a running generator
+ */
+struct nip_pktgen_cfg {
+	char ifname[IFNAMSIZ];
+	u8 dst_mac[ETH_ALEN];
+	struct nip_addr saddr;
+	struct nip_addr daddr;
+	u16 sport;
+	u16 dport;
+	u32 len;
+	u32 flows;
+	u64 count;
+	u32 clone;
+	u8 tclass;
+	bool saddr_elided;
+};
+
+/* A run works on a copy of cfg and does not hold the lock, so that the
+ * status can be read and "stop" written while it sends.
+ */
+struct nip_pktgen {
+	struct mutex lock; /* protects cfg and running */
+	struct nip_pktgen_cfg cfg;
+	bool running;
+
+	bool stop;
+	u64 sent;
+	u64 errors;
+	u64 busy;
+	u64 elapsed_ns;
+};
+
+static unsigned int nip_pktgen_net_id __read_mostly;
+
+static inline struct nip_pktgen *nip_pktgen_pernet(struct net *net)
+{
+	return net_generic(net, nip_pktgen_net_id);
+}
+
+static int nip_pktgen_parse_addr(const char *str, struct nip_addr *addr)
+{
+	u8 buf[NIP_ADDR_BIT_LEN_MAX / NIP_ADDR_BIT_LEN_8];
+	size_t len = strlen(str);
+	u8 *end;
+
+	if (!len || len % 2 || len / 2 > sizeof(buf))
+		return -EINVAL;
+	if (hex2bin(buf, str, len / 2))
+		return -EINVAL;
+
+	memset(addr, 0, sizeof(*addr));
+	end = decode_nip_addr(buf, addr);
+	if (!end || end - buf != len / 2)
+		return -EINVAL;
+	return 0;
+}
+
+static struct sk_buff *nip_pktgen_build(const struct nip_pktgen_cfg *pg,
+					struct net_device *dev, u32 flow)
+{
+	struct nip_hdr_encap head = {0};
+	struct nip_pseudo_header nph = {0};
+	u16 udp_len = NIP_UDP_HDR_LEN + pg->len;
+	int hlen = LL_RESERVED_SPACE(dev);
+	int nip_hdr_len;
+	struct sk_buff *skb;
+	u8 *uh;
+	u16 check;
+
+	nip_hdr_len = get_nip_hdr_len(NIP_HDR_UDP,
+				      pg->saddr_elided ? NULL : &pg->saddr,
+				      &pg->daddr, pg->tclass);
+	nip_hdr_len = nip_hdr_len == 0 ? NIP_HDR_MAX : nip_hdr_len;
+	skb = alloc_skb(hlen + nip_hdr_len + udp_len + dev->needed_tailroom,
+			GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	skb_reserve(skb, hlen);
+
+	/* Fill in the Network-layer Header (newIP) */
+	skb_reset_network_header(skb);
+	head.saddr = pg->saddr;
+	head.daddr = pg->daddr;
+	head.ttl = NIP_DEFAULT_TTL;
+	head.nexthdr = IPPROTO_UDP;
+	head.tclass = pg->tclass;
+	head.saddr_elided = pg->saddr_elided;
+	head.sport = htons(pg->sport + flow);
+	head.dport = htons(pg->dport);
+	head.trans_hdr_len = NIP_UDP_HDR_LEN;
+	head.usr_data_len = pg->len;
+	head.hdr_buf = skb->data;
+	nip_hdr_udp_encap(&head);
+	skb_put(skb, head.hdr_buf_pos);
+
+	/* Fill in the Transport Layer Header (UDP), the payload stays zero */
+	skb_set_transport_header(skb, skb->len);
+	uh = skb_put_zero(skb, udp_len);
+	nip_build_udp_hdr(head.sport, head.dport, htons(udp_len), uh, htons(0));
+	nph.saddr = pg->saddr;
+	nph.daddr = pg->daddr;
+	nph.check_len = htons(udp_len);
+	nph.nexthdr = IPPROTO_UDP;
+	check = nip_check_sum_build(uh, udp_len, &nph);
+	nip_build_udp_hdr(head.sport, head.dport, htons(udp_len), uh, htons(check));
+
+	skb->protocol = htons(ETH_P_NEWIP);
+	skb->dev = dev;
+	skb->ip_summed = CHECKSUM_NONE;
+	skb_set_queue_mapping(skb, flow % dev->real_num_tx_queues);
+	if (dev_hard_header(skb, dev, ETH_P_NEWIP, pg->dst_mac, NULL, skb->len) < 0) {
+		kfree_skb(skb);
+		return NULL;
+	}
+	return skb;
+}
+
+/* Same as pktgen: the skb keeps an extra reference so that it can be sent
+ * again once the driver has consumed it.
+ */
+static netdev_tx_t nip_pktgen_xmit(struct net_device *dev, struct sk_buff *skb)
+{
+	struct netdev_queue *txq = skb_get_tx_queue(dev, skb);
+	netdev_tx_t ret = NETDEV_TX_BUSY;
+
+	local_bh_disable();
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	if (!netif_xmit_frozen_or_drv_stopped(txq)) {
+		refcount_inc(&skb->users);
+		ret = netdev_start_xmit(skb, dev, txq, false);
+		if (!dev_xmit_complete(ret))
+			refcount_dec(&skb->users);
+	}
+	HARD_TX_UNLOCK(dev, txq);
+	local_bh_enable();
+	return ret;
+}
+
+static int nip_pktgen_run(struct net *net, struct nip_pktgen *pg,
+			  const struct nip_pktgen_cfg *cfg)
+{
+	struct net_device *dev;
+	struct sk_buff **skbs;
+	u64 sent = 0;
+	u64 errors = 0;
+	u64 busy = 0;
+	u32 *uses;
+	u64 start;
+	u64 i = 0;
+	netdev_tx_t ret;
+	u32 flow;
+	int err = 0;
+
+	dev = dev_get_by_name(net, cfg->ifname);
+	if (!dev)
+		return -ENODEV;
+	if (!netif_running(dev) || !netif_carrier_ok(dev)) {
+		err = -ENETDOWN;
+		goto out_put;
+	}
+	/* Drivers such as veth change or free the skb they are given, it
+	 * cannot be sent again then
+	 */
+	if (cfg->clone && !(dev->priv_flags & IFF_TX_SKB_SHARING)) {
+		nip_dbg("%s does not support clone", dev->name);
+		err = -EOPNOTSUPP;
+		goto out_put;
+	}
+	if (get_nip_hdr_len(NIP_HDR_UDP, cfg->saddr_elided ? NULL : &cfg->saddr,
+			    &cfg->daddr, cfg->tclass) +
+	    NIP_UDP_HDR_LEN + cfg->len > dev->mtu) {
+		err = -EMSGSIZE;
+		goto out_put;
+	}
+
+	skbs = kcalloc(cfg->flows, sizeof(*skbs), GFP_KERNEL);
+	uses = kcalloc(cfg->flows, sizeof(*uses), GFP_KERNEL);
+	if (!skbs || !uses) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	start = ktime_get_ns();
+	for (flow = 0; !cfg->count || i < cfg->count;) {
+		if (!skbs[flow] || uses[flow] > cfg->clone) {
+			kfree_skb(skbs[flow]);
+			uses[flow] = 0;
+			skbs[flow] = nip_pktgen_build(cfg, dev, flow);
+			if (!skbs[flow]) {
+				err = -ENOMEM;
+				break;
+			}
+		}
+
+		ret = nip_pktgen_xmit(dev, skbs[flow]);
+		if (dev_xmit_complete(ret)) {
+			if (ret == NETDEV_TX_OK)
+				WRITE_ONCE(pg->sent, ++sent);
+			else
+				WRITE_ONCE(pg->errors, ++errors);
+			uses[flow]++;
+			if (++flow == cfg->flows)
+				flow = 0;
+			i++;
+		} else {
+			WRITE_ONCE(pg->busy, ++busy);
+			cpu_relax();
+		}
+
+		if (READ_ONCE(pg->stop) || signal_pending(current))
+			break;
+		cond_resched();
+	}
+	WRITE_ONCE(pg->elapsed_ns, ktime_get_ns() - start);
+	nip_dbg("%s: sent=%llu errors=%llu busy=%llu in %llu ns", dev->name,
+		sent, errors, busy, pg->elapsed_ns);
+
+	for (flow = 0; flow < cfg->flows; flow++)
+		kfree_skb(skbs[flow]);
+out_free:
+	kfree(uses);
+	kfree(skbs);
+out_put:
+	dev_put(dev);
+	return err;
+}
+
+static int nip_pktgen_start(struct net *net, struct nip_pktgen *pg)
+{
+	struct nip_pktgen_cfg cfg;
+	int err;
+
+	if (mutex_lock_interruptible(&pg->lock))
+		return -EINTR;
+	if (pg->running) {
+		mutex_unlock(&pg->lock);
+		return -EBUSY;
+	}
+	/* saddr is needed for the checksum even when it is left out */
+	if (!pg->cfg.saddr.bitlen || !pg->cfg.daddr.bitlen) {
+		mutex_unlock(&pg->lock);
+		return -EDESTADDRREQ;
+	}
+	cfg = pg->cfg;
+	pg->running = true;
+	pg->sent = 0;
+	pg->errors = 0;
+	pg->busy = 0;
+	pg->elapsed_ns = 0;
+	WRITE_ONCE(pg->stop, false);
+	mutex_unlock(&pg->lock);
+
+	err = nip_pktgen_run(net, pg, &cfg);
+
+	mutex_lock(&pg->lock);
+	pg->running = false;
+	mutex_unlock(&pg->lock);
+	return err;
+}
+
+static int nip_pktgen_set(struct nip_pktgen_cfg *pg, const char *key, const char *val)
+{
+	unsigned long long num;
+	struct nip_addr addr;
+
+	if (!strcmp(key, "dev")) {
+		if (!*val || strlen(val) >= IFNAMSIZ)
+			return -EINVAL;
+		strscpy(pg->ifname, val, IFNAMSIZ);
+		return 0;
+	}
+	if (!strcmp(key, "dst_mac"))
+		return mac_pton(val, pg->dst_mac) ? 0 : -EINVAL;
+	if (!strcmp(key, "saddr") || !strcmp(key, "daddr")) {
+		if (nip_pktgen_parse_addr(val, &addr))
+			return -EINVAL;
+		if (key[0] == 's')
+			pg->saddr = addr;
+		else
+			pg->daddr = addr;
+		return 0;
+	}
+
+	if (kstrtoull(val, 0, &num))
+		return -EINVAL;
+	if (!strcmp(key, "sport") && num <= U16_MAX)
+		pg->sport = num;
+	else if (!strcmp(key, "dport") && num <= U16_MAX)
+		pg->dport = num;
+	else if (!strcmp(key, "len") && num <= NIP_PKTGEN_PAYLOAD_MAX)
+		pg->len = num;
+	else if (!strcmp(key, "flows") && num && num <= NIP_PKTGEN_FLOWS_MAX)
+		pg->flows = num;
+	else if (!strcmp(key, "count"))
+		pg->count = num;
+	else if (!strcmp(key, "clone") && num <= U32_MAX)
+		pg->clone = num;
+	else if (!strcmp(key, "tclass") && num <= U8_MAX)
+		pg->tclass = num;
+	else if (!strcmp(key, "no_saddr") && num <= 1)
+		pg->saddr_elided = num;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+static int nip_pktgen_write(struct file *file, char *buf, size_t size)
+{
+	struct net *net = seq_file_single_net(file->private_data);
+	struct nip_pktgen *pg = nip_pktgen_pernet(net);
+	char *val = strim(buf);
+	char *key = strsep(&val, " \t");
+	int err;
+
+	if (!strcmp(key, "stop")) {
+		WRITE_ONCE(pg->stop, true);
+		return 0;
+	}
+
+	if (!strcmp(key, "start"))
+		return nip_pktgen_start(net, pg);
+
+	if (mutex_lock_interruptible(&pg->lock))
+		return -EINTR;
+	/* A run keeps its own copy, changes apply to the next one */
+	err = nip_pktgen_set(&pg->cfg, key, val ? skip_spaces(val) : "");
+	mutex_unlock(&pg->lock);
+	return err;
+}
+
+static int nip_pktgen_seq_show(struct seq_file *seq, void *v)
+{
+	struct nip_pktgen *pg = nip_pktgen_pernet(seq_file_single_net(seq));
+	struct nip_pktgen_cfg *cfg = &pg->cfg;
+	u64 elapsed_ns;
+	u64 sent;
+	u64 pps = 0;
+
+	if (mutex_lock_interruptible(&pg->lock))
+		return -EINTR;
+	seq_printf(seq, "dev: %s dst_mac: %pM\n", cfg->ifname, cfg->dst_mac);
+	seq_printf(seq, "saddr: %*phN daddr: %*phN no_saddr: %u tclass: %u\n",
+		   cfg->saddr.bitlen / NIP_ADDR_BIT_LEN_8, cfg->saddr.nip_addr_field8,
+		   cfg->daddr.bitlen / NIP_ADDR_BIT_LEN_8, cfg->daddr.nip_addr_field8,
+		   cfg->saddr_elided, cfg->tclass);
+	seq_printf(seq, "sport: %u dport: %u flows: %u len: %u\n",
+		   cfg->sport, cfg->dport, cfg->flows, cfg->len);
+	seq_printf(seq, "count: %llu clone: %u running: %u\n",
+		   cfg->count, cfg->clone, pg->running);
+
+	/* Counters of a running generator are read as it updates them */
+	sent = READ_ONCE(pg->sent);
+	elapsed_ns = READ_ONCE(pg->elapsed_ns);
+	if (elapsed_ns)
+		pps = div64_u64(sent * NSEC_PER_SEC, elapsed_ns);
+	seq_printf(seq, "result: sent %llu errors %llu busy %llu in %llu us, %llu pps\n",
+		   sent, READ_ONCE(pg->errors), READ_ONCE(pg->busy),
+		   div_u64(elapsed_ns, NSEC_PER_USEC), pps);
+	mutex_unlock(&pg->lock);
+	return 0;
+}
+
+static int __net_init nip_pktgen_net_init(struct net *net)
+{
+	struct nip_pktgen *pg = nip_pktgen_pernet(net);
+
+	mutex_init(&pg->lock);
+	pg->cfg.sport = NIP_PKTGEN_SPORT_DEF;
+	pg->cfg.dport = NIP_PKTGEN_DPORT_DEF;
+	pg->cfg.len = NIP_PKTGEN_LEN_DEF;
+	pg->cfg.flows = 1;
+	pg->cfg.count = NIP_PKTGEN_COUNT_DEF;
+	eth_broadcast_addr(pg->cfg.dst_mac);
+
+	if (!proc_create_net_single_write("nip_pktgen", 0600, net->proc_net,
+					  nip_pktgen_seq_show, nip_pktgen_write,
+					  NULL))
+		return -ENOMEM;
+	return 0;
+}
+
+static void __net_exit nip_pktgen_net_exit(struct net *net)
+{
+	remove_proc_entry("nip_pktgen", net->proc_net);
+}
+
+static struct pernet_operations nip_pktgen_net_ops = {
+	.init = nip_pktgen_net_init,
+	.exit = nip_pktgen_net_exit,
+	.id = &nip_pktgen_net_id,
+	.size = sizeof(struct nip_pktgen),
+};
+
+int __init nip_pktgen_init(void)
+{
+	return register_pernet_subsys(&nip_pktgen_net_ops);
+}
+
+void nip_pktgen_exit(void)
+{
+	unregister_pernet_subsys(&nip_pktgen_net_ops);
+}
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * NewIP INET
+ * An implementation of the TCP/IP protocol suite for the LINUX
+ * operating system. NewIP INET is implemented using the  BSD Socket
+ * interface as the means of communication with the user level.
+ *
+ * Per-CPU time counters (ns) around the main NewIP stages, exported through
+ * /proc/net/nip_prof of the initial namespace:
+ *   echo on > /proc/net/nip_prof     start counting (also resets)
+ *   echo off > /proc/net/nip_prof    stop, the table keeps its values
+ *   echo reset > /proc/net/nip_prof  clear the counters
+ * The counters cover every namespace.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": [%s:%d] " fmt, __func__, __LINE__
+
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <net/net_namespace.h>
+#include <net/nip_prof.h>
+
+DEFINE_STATIC_KEY_FALSE(nip_prof_enabled);
+DEFINE_PER_CPU(struct nip_prof_stat[NIP_PROF_STAGE_MAX], nip_prof_stats);
+
+static const char * const nip_prof_names[NIP_PROF_STAGE_MAX] = {
+	[NIP_PROF_RCV]             = "nip_rcv",
+	[NIP_PROF_ROUTE_INPUT]     = "nip_route_input",
+	[NIP_PROF_DELIVER]         = "nip_protocol_deliver_rcu",
+	[NIP_PROF_TCP_ESTABLISHED] = "tcp_nip_rcv_established",
+	[NIP_PROF_TCP_WRITE_XMIT]  = "tcp_nip_write_xmit",
+	[NIP_PROF_OUTPUT]          = "nip_output",
+	[NIP_PROF_CHECKSUM]        = "_nip_check_sum",
+};
+
+static DEFINE_MUTEX(nip_prof_lock);
+static u64 nip_prof_start_ns;
+static u64 nip_prof_stop_ns;
+
+/* Counters being updated while they are cleared only skew the next sample */
+static void nip_prof_reset(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu(nip_prof_stats, cpu), 0, sizeof(nip_prof_stats));
+	nip_prof_start_ns = ktime_get_ns();
+	nip_prof_stop_ns = 0;
+}
+
+static int nip_prof_write(struct file *file, char *buf, size_t size)
+{
+	char *cmd = strim(buf);
+	int err = 0;
+
+	mutex_lock(&nip_prof_lock);
+	if (!strcmp(cmd, "on") || !strcmp(cmd, "1")) {
+		if (!static_key_enabled(&nip_prof_enabled)) {
+			nip_prof_reset();
+			static_branch_enable(&nip_prof_enabled);
+		}
+	} else if (!strcmp(cmd, "off") || !strcmp(cmd, "0")) {
+		if (static_key_enabled(&nip_prof_enabled)) {
+			static_branch_disable(&nip_prof_enabled);
+			nip_prof_stop_ns = ktime_get_ns();
+		}
+	} else if (!strcmp(cmd, "reset")) {
+		nip_prof_reset();
+	} else {
+		err = -EINVAL;
+	}
+	mutex_unlock(&nip_prof_lock);
+	return err;
+}
+
+static int nip_prof_seq_show(struct seq_file *seq, void *v)
+{
+	u64 elapsed_ns;
+	int stage;
+
+	mutex_lock(&nip_prof_lock);
+	if (!nip_prof_start_ns)
+		elapsed_ns = 0;
+	else if (nip_prof_stop_ns)
+		elapsed_ns = nip_prof_stop_ns - nip_prof_start_ns;
+	else
+		elapsed_ns = ktime_get_ns() - nip_prof_start_ns;
+	seq_printf(seq, "enabled: %d elapsed_ms: %llu\n",
+		   static_key_enabled(&nip_prof_enabled),
+		   div_u64(elapsed_ns, NSEC_PER_MSEC));
+	seq_printf(seq, "%-26s %14s %12s %16s %12s\n",
+		   "stage", "calls", "calls/s", "ns", "ns/call");
+
+	for (stage = 0; stage < NIP_PROF_STAGE_MAX; stage++) {
+		u64 calls = 0;
+		u64 ns = 0;
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			const struct nip_prof_stat *st = &per_cpu(nip_prof_stats, cpu)[stage];
+
+			calls += READ_ONCE(st->calls);
+			ns += READ_ONCE(st->ns);
+		}
+		seq_printf(seq, "%-26s %14llu %12llu %16llu %12llu\n",
+			   nip_prof_names[stage], calls,
+			   elapsed_ns ? div64_u64(calls * NSEC_PER_MSEC,
+						  div_u64(elapsed_ns, NSEC_PER_USEC) ?: 1) : 0,
+			   ns, calls ? div64_u64(ns, calls) : 0);
+	}
+	mutex_unlock(&nip_prof_lock);
+	return 0;
+}
+
+int __init nip_prof_init(void)
+{
+	if (!proc_create_net_single_write("nip_prof", 0600, init_net.proc_net,
+					  nip_prof_seq_show, nip_prof_write, NULL))
+		return -ENOMEM;
+	return 0;
+}
+
+void nip_prof_exit(void)
+{
+	remove_proc_entry("nip_prof", init_net.proc_net);
+}
@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * NewIP INET
+ * An implementation of the TCP/IP protocol suite for the LINUX
+ * operating system. NewIP INET is implemented using the  BSD Socket
+ * interface as the means of communication with the user level.
+ *
+ * Address and route snapshots: SIOCNIPSNAPDUMP writes the permanent
+ * addresses and the main table of a namespace into one buffer,
+ * SIOCNIPSNAPRESTORE adds them back in a single call, so a node does not
+ * have to replay one ioctl per entry after a reboot.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": [%s:%d] " fmt, __func__, __LINE__
+
+#include <linux/kernel.h>
+#include <linux/capability.h>
+#include <linux/mm.h>
+#include <linux/netdevice.h>
+#include <linux/rtnetlink.h>
+#include <linux/route.h>
+#include <linux/uaccess.h>
+#include <net/if_ninet.h>
+#include <net/nip_addrconf.h>
+#include <net/nip_fib.h>
+#include <net/nip_route.h>
+#include <net/nip.h>
+#include "tcp_nip_parameter.h"
+
+/* Route flags that describe a route rather than its current state */
+#define NIP_SNAP_RTF_MASK	(RTF_UP | RTF_GATEWAY | RTF_LOCAL)
+#define NIP_SNAP_MAX_LEN	(16 << 20)
+
+struct nip_snap_buf {
+	struct nip_snap_hdr *hdr;
+	struct nip_snap_addr *addr;
+	struct nip_snap_route *route;
+	u32 naddr;
+	u32 nroute;
+};
+
+static size_t nip_snap_len(u32 naddr, u32 nroute)
+{
+	return sizeof(struct nip_snap_hdr) + (size_t)naddr * sizeof(struct nip_snap_addr) +
+	       (size_t)nroute * sizeof(struct nip_snap_route);
+}
+
+static void nip_snap_layout(struct nip_snap_buf *snap, void *buf)
+{
+	snap->hdr = buf;
+	snap->addr = (struct nip_snap_addr *)(snap->hdr + 1);
+	snap->route = (struct nip_snap_route *)(snap->addr + snap->naddr);
+}
+
+static bool nip_snap_addr_wanted(const struct ninet_ifaddr *ifp)
+{
+	return ifp->state != NINET_IFADDR_STATE_DEAD && (ifp->flags & IFA_F_PERMANENT);
+}
+
+/* Called with RTNL held, counts when ent is NULL */
+static u32 nip_snap_fill_addr(struct net *net, struct nip_snap_addr *ent, u32 max)
+{
+	struct ninet_ifaddr *ifp;
+	struct ninet_dev *idev;
+	struct net_device *dev;
+	u32 num = 0;
+
+	for_each_netdev(net, dev) {
+		idev = __nin_dev_get(dev);
+		if (!idev)
+			continue;
+
+		read_lock_bh(&idev->lock);
+		list_for_each_entry(ifp, &idev->addr_list, if_list) {
+			if (!nip_snap_addr_wanted(ifp))
+				continue;
+			if (ent) {
+				if (num == max)
+					break;
+				memset(&ent[num], 0, sizeof(ent[num]));
+				ent[num].flags = ifp->flags & IFA_F_NODAD;
+				strscpy(ent[num].dev_name, dev->name, IFNAMSIZ);
+				ent[num].addr = ifp->addr;
+			}
+			num++;
+		}
+		read_unlock_bh(&idev->lock);
+	}
+	return num;
+}
+
+static u32 nip_snap_fill_route(struct net *net, struct nip_snap_route *ent, u32 max)
+{
+	struct nip_fib_table *table = net->newip.nip_fib_main_tbl;
+	struct nip_fib_node *fn;
+	u32 num = 0;
+	int i;
+
+	rcu_read_lock_bh();
+	for (i = 0; i < NIN_ROUTE_HSIZE; i++) {
+		hlist_for_each_entry_rcu(fn, &table->nip_tb_head[i], fib_hlist) {
+			struct nip_rt_info *rt = fn->nip_route_info;
+
+			if (!rt->dst.dev)
+				continue;
+			if (ent) {
+				if (num == max)
+					goto out;
+				memset(&ent[num], 0, sizeof(ent[num]));
+				ent[num].flags = rt->rt_flags & NIP_SNAP_RTF_MASK;
+				ent[num].metric = rt->rt_metric;
+				strscpy(ent[num].dev_name, rt->dst.dev->name, IFNAMSIZ);
+				ent[num].dst = rt->rt_dst;
+				ent[num].gateway = rt->gateway;
+			}
+			num++;
+		}
+	}
+out:
+	rcu_read_unlock_bh();
+	return num;
+}
+
+int nip_snapshot_dump(struct net *net, void __user *arg)
+{
+	struct nip_snap_buf snap;
+	struct nip_snap_req req;
+	void *buf = NULL;
+	size_t len;
+	int err = 0;
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+
+	rtnl_lock();
+	snap.naddr = nip_snap_fill_addr(net, NULL, 0);
+	snap.nroute = nip_snap_fill_route(net, NULL, 0);
+	len = nip_snap_len(snap.naddr, snap.nroute);
+	if (len > NIP_SNAP_MAX_LEN) {
+		err = -E2BIG;
+		goto unlock;
+	}
+	if (req.len < len) {
+		err = -ENOSPC;
+		goto unlock;
+	}
+
+	buf = kvzalloc(len, GFP_KERNEL);
+	if (!buf) {
+		err = -ENOMEM;
+		goto unlock;
+	}
+	nip_snap_layout(&snap, buf);
+	snap.hdr->magic = NIP_SNAP_MAGIC;
+	snap.hdr->version = NIP_SNAP_VERSION;
+	/* DAD failures and expiring routes may have shrunk the tables since
+	 * they were counted, lay the routes out after the addresses found.
+	 */
+	snap.naddr = nip_snap_fill_addr(net, snap.addr, snap.naddr);
+	nip_snap_layout(&snap, buf);
+	snap.nroute = nip_snap_fill_route(net, snap.route, snap.nroute);
+	snap.hdr->naddr = snap.naddr;
+	snap.hdr->nroute = snap.nroute;
+	len = nip_snap_len(snap.naddr, snap.nroute);
+unlock:
+	rtnl_unlock();
+
+	req.len = len;
+	if (buf && copy_to_user(u64_to_user_ptr(req.buf), buf, len))
+		err = -EFAULT;
+	if ((!err || err == -ENOSPC) && copy_to_user(arg, &req, sizeof(req)))
+		err = -EFAULT;
+
+	kvfree(buf);
+	nip_dbg("naddr=%u nroute=%u err=%d", snap.naddr, snap.nroute, err);
+	return err;
+}
+
+static int nip_snap_check(struct nip_snap_buf *snap, void *buf, size_t len)
+{
+	struct nip_snap_hdr *hdr = buf;
+	u32 i;
+
+	if (len < sizeof(*hdr) || hdr->magic != NIP_SNAP_MAGIC ||
+	    hdr->version != NIP_SNAP_VERSION)
+		return -EINVAL;
+
+	if (hdr->naddr > NIP_SNAP_MAX_LEN || hdr->nroute > NIP_SNAP_MAX_LEN ||
+	    nip_snap_len(hdr->naddr, hdr->nroute) != len)
+		return -EINVAL;
+
+	snap->naddr = hdr->naddr;
+	snap->nroute = hdr->nroute;
+	nip_snap_layout(snap, buf);
+
+	for (i = 0; i < snap->naddr; i++) {
+		struct nip_snap_addr *ent = &snap->addr[i];
+
+		ent->dev_name[IFNAMSIZ - 1] = 0;
+		if (nip_addr_invalid(&ent->addr) || nip_addr_public(&ent->addr)) {
+			nip_dbg("addr %u invalid, bitlen=%u", i, ent->addr.bitlen);
+			return -EINVAL;
+		}
+	}
+
+	for (i = 0; i < snap->nroute; i++) {
+		struct nip_snap_route *ent = &snap->route[i];
+
+		ent->dev_name[IFNAMSIZ - 1] = 0;
+		if (nip_addr_invalid(&ent->dst) ||
+		    ((ent->flags & RTF_GATEWAY) && nip_addr_invalid(&ent->gateway))) {
+			nip_dbg("route %u invalid, bitlen=%u", i, ent->dst.bitlen);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/* Called with RTNL held */
+static int nip_snap_restore_addr(struct net *net, const struct nip_snap_addr *ent,
+				 u32 flags)
+{
+	struct net_device *dev;
+	u32 ifa_flags = ent->flags & IFA_F_NODAD;
+
+	dev = __dev_get_by_name(net, ent->dev_name);
+	if (!dev) {
+		nip_dbg("no device %s", ent->dev_name);
+		return -ENODEV;
+	}
+
+	if (flags & NIP_SNAP_F_NODAD)
+		ifa_flags |= IFA_F_NODAD;
+
+	return nip_addrconf_restore_addr(net, dev->ifindex, &ent->addr, ifa_flags);
+}
+
+/* Called with RTNL held */
+static int nip_snap_restore_route(struct net *net, const struct nip_snap_route *ent)
+{
+	struct nip_fib_config cfg;
+	struct net_device *dev;
+
+	dev = __dev_get_by_name(net, ent->dev_name);
+	if (!dev) {
+		nip_dbg("no device %s", ent->dev_name);
+		return -ENODEV;
+	}
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.fc_table = NIP_RT_TABLE_MAIN;
+	cfg.fc_ifindex = dev->ifindex;
+	cfg.fc_metric = ent->metric;
+	cfg.fc_flags = ent->flags & NIP_SNAP_RTF_MASK;
+	cfg.fc_nlinfo.nl_net = net;
+	cfg.fc_dst = ent->dst;
+	cfg.fc_gateway = ent->gateway;
+
+	return nip_route_add(&cfg);
+}
+
+int nip_snapshot_restore(struct net *net, void __user *arg)
+{
+	struct nip_snap_buf snap;
+	struct nip_snap_req req;
+	void *buf;
+	u32 i;
+	int err;
+
+	if (!ns_capable(net->user_ns, CAP_NET_ADMIN)) {
+		nip_dbg("not admin can`t cfg");
+		return -EPERM;
+	}
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+
+	if ((req.flags & ~NIP_SNAP_F_NODAD) || req.len < sizeof(struct nip_snap_hdr) ||
+	    req.len > NIP_SNAP_MAX_LEN)
+		return -EINVAL;
+
+	buf = kvmalloc(req.len, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	if (copy_from_user(buf, u64_to_user_ptr(req.buf), req.len)) {
+		err = -EFAULT;
+		goto out;
+	}
+
+	err = nip_snap_check(&snap, buf, req.len);
+	if (err)
+		goto out;
+
+	/* Routes need the addresses of their device, add those first */
+	rtnl_lock();
+	for (i = 0; i < snap.naddr; i++) {
+		err = nip_snap_restore_addr(net, &snap.addr[i], req.flags);
+		if (err && err != -EEXIST)
+			goto unlock;
+	}
+	for (i = 0; i < snap.nroute; i++) {
+		err = nip_snap_restore_route(net, &snap.route[i]);
+		if (err && err != -EEXIST)
+			goto unlock;
+	}
+	err = 0;
+unlock:
+	rtnl_unlock();
+	nip_dbg("naddr=%u nroute=%u err=%d", snap.naddr, snap.nroute, err);
+out:
+	kvfree(buf);
+	return err;
+}
@@ -21,6 +21,9 @@
 #include <linux/nip.h>
 #include <linux/nip_icmp.h>
 #include <linux/jhash.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/pkt_sched.h>
 #include <net/sock.h>
 #include <net/nip.h>
 #include <net/nip_udp.h>
@@ -34,6 +37,7 @@
 #include <net/flow.h>
 #include <net/inet_common.h>
 #include <net/nip_addrconf.h>
+#include <net/tcp_nip.h>
 #include <linux/newip_route.h>
 #include <linux/netfilter.h>
 #include "nip_hdr.h"
@@ -68,14 +72,47 @@ static u32 nndisc_hash(const void *pkey,
 static bool nndisc_key_eq(const struct neighbour *neigh, const void *pkey);
 static int nndisc_constructor(struct neighbour *neigh);
 
+/* Resolution failed, tell the local sender now instead of letting it
+ * find out through its own timeouts. Runs from the neighbour timer, so
+ * the socket may be owned by a process: only the soft error is recorded
+ * then, as tcp_v4_err() does.
+ */
+static void nndisc_report_unreach(struct sock *sk)
+{
+	if (!sk || !sk_fullsock(sk))
+		return;
+
+	bh_lock_sock(sk);
+	if (sk->sk_protocol == IPPROTO_TCP) {
+		if (sk->sk_state == TCP_SYN_SENT && !sock_owned_by_user(sk)) {
+			sk->sk_err = ENETUNREACH;
+			sk->sk_error_report(sk);
+			tcp_nip_done(sk);
+		} else {
+			/* Reported instead of ETIMEDOUT if retransmission gives up */
+			sk->sk_err_soft = ENETUNREACH;
+		}
+	} else if (sk->sk_type == SOCK_DGRAM && sk->sk_state == TCP_ESTABLISHED) {
+		/* An unconnected socket talks to many peers, a hard error would
+		 * fail its next unrelated recvmsg
+		 */
+		sk->sk_err = ENETUNREACH;
+		sk->sk_error_report(sk);
+	}
+	bh_unlock_sock(sk);
+}
+
 static void nndisc_error_report(struct neighbour *neigh, struct sk_buff *skb)
 {
+	atomic_long_inc(&dev_net(neigh->dev)->newip.nndisc_pending.failed);
+	nndisc_report_unreach(skb->sk);
 	kfree_skb(skb);
 }
 
 static const struct neigh_ops nndisc_generic_ops = {
 	.family = AF_NINET,
 	.solicit = nndisc_solicit,
+	.error_report = nndisc_error_report,
 	.output = neigh_resolve_output,
 	.connected_output = neigh_connected_output,
 };
@@ -313,6 +350,7 @@ static struct sk_buff *nndisc_alloc_skb(struct net_device *dev,
 	skb->ip_summed = CHECKSUM_NONE;
 	skb->csum = 0;
 	skb->dev = dev;
+	skb->priority = TC_PRIO_CONTROL;
 	memset(NIPCB(skb), 0, sizeof(struct ninet_skb_parm));
 
 	NIPCB(skb)->dstaddr = head->daddr;
@@ -361,6 +399,83 @@ static void nndisc_send_ns(struct net_device *dev,
 		nip_dbg("dst output fail");
 }
 
+/* A flow waiting for resolution is identified by its socket, forwarded
+ * traffic without one by its source address.
+ */
+static bool nndisc_pending_same_flow(const struct sk_buff *a, const struct sk_buff *b)
+{
+	if (a->sk || b->sk)
+		return a->sk == b->sk;
+	return nip_addr_eq(&NIPCB(a)->srcaddr, &NIPCB(b)->srcaddr);
+}
+
+/* Called before @skb is handed to an unresolved neighbour. Only the latest
+ * packets of each flow are kept, so one bulk sender cannot take the whole
+ * NIP_NEIGH_QUEUE_LEN_BYTES budget and push out everyone else.
+ */
+void nndisc_pending_trim(struct neighbour *neigh, const struct sk_buff *skb)
+{
+	struct nip_nndisc_pending_stats *stats = &dev_net(neigh->dev)->newip.nndisc_pending;
+	int limit = get_nip_neigh_pending_per_flow();
+	struct sk_buff_head drop;
+	struct sk_buff *cur, *tmp;
+	int cnt = 0;
+
+	if (!(READ_ONCE(neigh->nud_state) & (NUD_NONE | NUD_INCOMPLETE)))
+		return;
+
+	atomic_long_inc(&stats->queued);
+	if (limit <= 0)
+		return;
+
+	__skb_queue_head_init(&drop);
+	write_lock(&neigh->lock);
+	if (neigh->nud_state & NUD_INCOMPLETE) {
+		skb_queue_walk(&neigh->arp_queue, cur) {
+			if (nndisc_pending_same_flow(cur, skb))
+				cnt++;
+		}
+
+		/* Drop the oldest ones, leaving room for @skb */
+		skb_queue_walk_safe(&neigh->arp_queue, cur, tmp) {
+			if (cnt < limit)
+				break;
+			if (!nndisc_pending_same_flow(cur, skb))
+				continue;
+			__skb_unlink(cur, &neigh->arp_queue);
+			neigh->arp_queue_len_bytes -= cur->truesize;
+			__skb_queue_tail(&drop, cur);
+			cnt--;
+		}
+	}
+	write_unlock(&neigh->lock);
+
+	if (!skb_queue_empty(&drop)) {
+		atomic_long_add(skb_queue_len(&drop), &stats->flow_drops);
+		__skb_queue_purge(&drop);
+	}
+}
+
+static void nndisc_pending_resolved(struct neighbour *neigh)
+{
+	struct nip_nndisc_pending_stats *stats = &dev_net(neigh->dev)->newip.nndisc_pending;
+	unsigned long wait_ms;
+
+	read_lock_bh(&neigh->lock);
+	if (!(neigh->nud_state & NUD_INCOMPLETE) || skb_queue_empty(&neigh->arp_queue)) {
+		read_unlock_bh(&neigh->lock);
+		return;
+	}
+	/* updated is set when the neighbour entered NUD_INCOMPLETE */
+	wait_ms = jiffies_to_msecs(jiffies - neigh->updated);
+	read_unlock_bh(&neigh->lock);
+
+	atomic_long_inc(&stats->resolved);
+	atomic_long_add(wait_ms, &stats->wait_ms);
+	if (wait_ms > READ_ONCE(stats->wait_max_ms))
+		WRITE_ONCE(stats->wait_max_ms, wait_ms);
+}
+
 static void nndisc_solicit(struct neighbour *neigh, struct sk_buff *skb)
 {
 	struct net_device *dev = neigh->dev;
@@ -379,6 +494,8 @@ static void nndisc_solicit(struct neighbour *neigh, struct sk_buff *skb)
 			struct ninet_ifaddr *ifp;
 
 			list_for_each_entry(ifp, &idev->addr_list, if_list) {
+				if (ifp->flags & NINET_IFA_F_UNUSABLE)
+					continue;
 				saddr = &ifp->addr;
 				nndisc_send_ns(dev, target,
 					       &nip_broadcast_addr_arp,
@@ -458,6 +575,8 @@ bool nip_addr_local(struct net_device *dev, struct nip_addr *addr)
 		struct ninet_ifaddr *ifp;
 
 		list_for_each_entry(ifp, &idev->addr_list, if_list) {
+			if (ifp->flags & NINET_IFA_F_UNUSABLE)
+				continue;
 			if (nip_addr_eq(addr, &ifp->addr)) {
 				ret = true;
 				break;
@@ -470,6 +589,39 @@ out:
 	return ret;
 }
 
+static bool nip_addr_tentative(struct net_device *dev, const struct nip_addr *addr)
+{
+	struct ninet_dev *idev;
+	struct ninet_ifaddr *ifp;
+	bool ret = false;
+
+	rcu_read_lock();
+	idev = __nin_dev_get(dev);
+	if (!idev)
+		goto out;
+
+	read_lock_bh(&idev->lock);
+	list_for_each_entry(ifp, &idev->addr_list, if_list) {
+		if (nip_addr_eq(addr, &ifp->addr)) {
+			ret = !!(ifp->flags & IFA_F_TENTATIVE);
+			break;
+		}
+	}
+	read_unlock_bh(&idev->lock);
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+/* A DAD probe solicits the tentative address itself and is sourced from it,
+ * so a node owning the address answers to the broadcast address and a node
+ * probing the same address at the same time sees a probe for its own target.
+ */
+void nndisc_send_dad_ns(struct net_device *dev, const struct nip_addr *addr)
+{
+	nndisc_send_ns(dev, addr, &nip_broadcast_addr_arp, addr);
+}
+
 int nndisc_rcv_ns(struct sk_buff *skb)
 {
 	struct nnd_msg *msg = (struct nnd_msg *)skb_transport_header(skb);
@@ -479,6 +631,7 @@ int nndisc_rcv_ns(struct sk_buff *skb)
 	struct neighbour *neigh;
 	struct ethhdr *eth;
 	struct net_device *dev = skb->dev;
+	bool dad;
 	int err = 0;
 
 	p = decode_nip_addr(p, &addr);
@@ -494,14 +647,26 @@ int nndisc_rcv_ns(struct sk_buff *skb)
 		goto out;
 	}
 
+	eth = (struct ethhdr *)skb_mac_header(skb);
+	lladdr = eth->h_source;
+
+	/* Our own DAD probe looped back by the link */
+	if (dev->addr_len && !memcmp(lladdr, dev->dev_addr, dev->addr_len))
+		goto out;
+
+	dad = nip_addr_eq(&NIPCB(skb)->srcaddr, &addr);
+	if (nip_addr_tentative(dev, &addr)) {
+		/* Another node is probing the address we are probing */
+		if (dad && nip_get_nndisc_rcv_checksum(skb, p))
+			nip_addrconf_dad_failure(dev, &addr);
+		goto out;
+	}
+
 	if (!nip_addr_local(dev, &addr)) {
 		err = -ENXIO;
 		goto out;
 	}
 
-	eth = (struct ethhdr *)skb_mac_header(skb);
-	lladdr = eth->h_source;
-
 	/* checksum parse */
 	if (!nip_get_nndisc_rcv_checksum(skb, p)) {
 		nip_dbg("ns ICMP checksum failed, drop the packet");
@@ -509,6 +674,13 @@ int nndisc_rcv_ns(struct sk_buff *skb)
 		goto out;
 	}
 
+	/* Defend the address, the prober has no usable address to answer to */
+	if (dad) {
+		nip_dbg("defend address against a DAD probe");
+		nndisc_send_na(dev, &nip_broadcast_addr_arp, &addr);
+		goto out;
+	}
+
 	neigh = __neigh_lookup(&nnd_tbl, &NIPCB(skb)->srcaddr, dev, lladdr || !dev->addr_len);
 	if (neigh) {
 		neigh_update(neigh, lladdr, NUD_STALE, NEIGH_UPDATE_F_OVERRIDE, 0);
@@ -541,8 +713,15 @@ int nndisc_rcv_na(struct sk_buff *skb)
 		return 0;
 	}
 
+	if (nip_addr_tentative(dev, &NIPCB(skb)->srcaddr)) {
+		nip_addrconf_dad_failure(dev, &NIPCB(skb)->srcaddr);
+		kfree_skb(skb);
+		return 0;
+	}
+
 	neigh = neigh_lookup(&nnd_tbl, &NIPCB(skb)->srcaddr, dev);
 	if (neigh) {
+		nndisc_pending_resolved(neigh);
 		neigh_update(neigh, lladdr, NUD_REACHABLE, NEIGH_UPDATE_F_OVERRIDE, 0);
 		neigh_release(neigh);
 		kfree_skb(skb);
@@ -572,8 +751,72 @@ int nndisc_rcv(struct sk_buff *skb)
 	return ret;
 }
 
+struct nndisc_pending_walk {
+	struct net *net;
+	unsigned long neighs;
+	unsigned long pkts;
+};
+
+static void nndisc_pending_count(struct neighbour *neigh, void *cookie)
+{
+	struct nndisc_pending_walk *walk = cookie;
+
+	if (!net_eq(dev_net(neigh->dev), walk->net) || skb_queue_empty(&neigh->arp_queue))
+		return;
+
+	walk->neighs++;
+	walk->pkts += skb_queue_len(&neigh->arp_queue);
+}
+
+static int nndisc_pending_proc_show(struct seq_file *seq, void *v)
+{
+	struct net *net = seq->private;
+	struct nip_nndisc_pending_stats *stats = &net->newip.nndisc_pending;
+	struct nndisc_pending_walk walk = { .net = net };
+	unsigned long resolved = atomic_long_read(&stats->resolved);
+	unsigned long wait_ms = atomic_long_read(&stats->wait_ms);
+
+	neigh_for_each(&nnd_tbl, nndisc_pending_count, &walk);
+
+	seq_printf(seq, "pending_neigh\t%lu\n", walk.neighs);
+	seq_printf(seq, "pending_pkts\t%lu\n", walk.pkts);
+	seq_printf(seq, "queued\t%ld\n", atomic_long_read(&stats->queued));
+	seq_printf(seq, "flow_drops\t%ld\n", atomic_long_read(&stats->flow_drops));
+	seq_printf(seq, "failed\t%ld\n", atomic_long_read(&stats->failed));
+	seq_printf(seq, "resolved\t%lu\n", resolved);
+	seq_printf(seq, "wait_avg_ms\t%lu\n", resolved ? wait_ms / resolved : 0);
+	seq_printf(seq, "wait_max_ms\t%lu\n", READ_ONCE(stats->wait_max_ms));
+	return 0;
+}
+
+static int __net_init nndisc_net_init(struct net *net)
+{
+	if (!proc_create_net_single("nip_nndisc_pending", 0444, net->proc_net,
+				    nndisc_pending_proc_show, NULL))
+		return -ENOMEM;
+	return 0;
+}
+
+static void __net_exit nndisc_net_exit(struct net *net)
+{
+	remove_proc_entry("nip_nndisc_pending", net->proc_net);
+}
+
+static struct pernet_operations nndisc_net_ops = {
+	.init = nndisc_net_init,
+	.exit = nndisc_net_exit,
+};
+
 int __init nndisc_init(void)
 {
+	int err;
+
 	neigh_table_init(NEIGH_NND_TABLE, &nnd_tbl);
-	return 0;
+
+	err = register_pernet_subsys(&nndisc_net_ops);
+	if (err) {
+		nip_dbg("register_pernet_subsys failed");
+		neigh_table_clear(NEIGH_NND_TABLE, &nnd_tbl);
+	}
+	return err;
 }
@@ -40,6 +40,8 @@
 #include <net/nip_addrconf.h>
 #include <net/nndisc.h>
 #include <net/nip.h>
+#include <net/nip_netfilter.h>
+#include <net/nip_prof.h>
 
 #include <linux/newip_route.h>
 #include "nip_hdr.h"
@@ -258,7 +260,7 @@ struct dst_entry *nip_route_input_lookup(struct net *net,
 	return nip_fib_rule_lookup(net, fln, flags, tbl_type, nip_pol_route_input);
 }
 
-int nip_route_input(struct sk_buff *skb)
+static int __nip_route_input(struct sk_buff *skb)
 {
 	struct net *net = dev_net(skb->dev);
 	int flags = 0;
@@ -299,6 +301,15 @@ int nip_route_input(struct sk_buff *skb)
 	return 0;
 }
 
+int nip_route_input(struct sk_buff *skb)
+{
+	u64 start = nip_prof_begin();
+	int ret = __nip_route_input(skb);
+
+	nip_prof_end(NIP_PROF_ROUTE_INPUT, start);
+	return ret;
+}
+
 static struct nip_rt_info *nip_pol_route_output(struct net *net,
 						struct nip_fib_table *table,
 						struct flow_nip *fln, int flags)
@@ -581,6 +592,8 @@ static int nip_route_del(struct nip_fib_config *cfg)
 		dst_hold(&rt->dst);
 		rcu_read_unlock_bh();
 
+		/* Offloaded flows may hold the route being deleted */
+		nip_flow_offload_flush(net, NULL);
 		return __nip_del_rt(rt, &cfg->fc_nlinfo);
 	}
 	rcu_read_unlock_bh();
@@ -821,6 +834,7 @@ void nip_rt_ifdown(struct net *net, struct net_device *dev)
 		.net = net,
 	};
 
+	nip_flow_offload_flush(net, dev);
 	nip_fib_clean_all(net, nip_fib_ifdown, &adn);
 }
 
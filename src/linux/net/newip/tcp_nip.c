@@ -65,6 +65,8 @@
 #include <linux/times.h>
 #include <linux/random.h>
 #include <linux/seq_file.h>
+#include <linux/proc_fs.h>
+#include <linux/capability.h>
 
 #include <net/tcp.h>
 #include <net/ninet_hashtables.h>
@@ -78,6 +80,7 @@
 #include <net/tcp_nip.h>
 #include <net/nip_addrconf.h>
 #include <net/nip_route.h>
+#include <net/nip_prof.h>
 #include <linux/nip.h>
 #include "nip_checksum.h"
 #include "tcp_nip_parameter.h"
@@ -110,15 +113,18 @@ static const unsigned char new_state[16] = {
 bool nip_get_tcp_input_checksum(struct sk_buff *skb)
 {
 	struct nip_pseudo_header nph = {0};
+	unsigned short sum;
+	u64 start;
 
 	nph.nexthdr = NIPCB(skb)->nexthdr;
 	nph.saddr = NIPCB(skb)->srcaddr;
 	nph.daddr = NIPCB(skb)->dstaddr;
 
 	nph.check_len = htons(skb->len);
-	return nip_check_sum_parse(skb_transport_header(skb),
-				   skb->len, &nph)
-				   == 0xffff ? true : false;
+	start = nip_prof_begin();
+	sum = nip_check_sum_parse(skb_transport_header(skb), skb->len, &nph);
+	nip_prof_end(NIP_PROF_CHECKSUM, start);
+	return sum == 0xffff ? true : false;
 }
 
 static int tcp_nip_close_state(struct sock *sk)
@@ -361,6 +367,7 @@ static int tcp_nip_connect(struct sock *sk, struct sockaddr *uaddr,
 		inet_csk(sk)->icsk_ext_hdr_len = inet_opt->opt.optlen;
 
 	tcp_set_state(sk, TCP_SYN_SENT);
+	tcp_nip_sk(sk)->hdr_tmpl.len = 0;
 	sk_set_txhash(sk);
 	sk_dst_set(sk, dst);
 
@@ -576,7 +583,7 @@ static struct sock *tcp_nip_syn_recv_sock(const struct sock *sk, struct sk_buff
 	/* Negotiate MSS */
 	newtp->mss_cache = TCP_BASE_MSS;
 	newtp->out_of_order_queue = RB_ROOT;
-	newtp->advmss = dst_metric_advmss(dst);
+	newtp->advmss = tcp_nip_mtu_to_advmss(newsk, dst_mtu(dst));
 	if (tcp_sk(sk)->rx_opt.user_mss &&
 	    tcp_sk(sk)->rx_opt.user_mss < newtp->advmss)
 		newtp->advmss = tcp_sk(sk)->rx_opt.user_mss;
@@ -590,8 +597,15 @@ static struct sock *tcp_nip_syn_recv_sock(const struct sock *sk, struct sk_buff
 	*own_req = inet_ehash_nolisten(newsk, req_to_sk(req_unhash),
 				       &found_dup_sk);
 
-	/* newip newsk doesn't save this dst. release it. */
-	dst_release(dst);
+	/* The child starts with the route resolved for the handshake and
+	 * its header encoded, its first segments do neither.
+	 */
+	if (*own_req) {
+		sk_dst_set(newsk, dst);
+		tcp_nip_build_hdr_tmpl(newsk, dst);
+	} else {
+		dst_release(dst);
+	}
 	return newsk;
 
 out_overflow:
@@ -1307,6 +1321,8 @@ static int tcp_nip_do_rcv(struct sock *sk, struct sk_buff *skb)
 				sk->sk_rx_dst = NULL;
 			}
 		}
+		sock_rps_save_rxhash(sk, skb);
+		sk_mark_napi_id(sk, skb);
 		tcp_nip_rcv_established(sk, skb, tcp_hdr(skb), skb->len);
 		return 0;
 	}
@@ -1393,7 +1409,7 @@ static int tcp_nip_rcv(struct sk_buff *skb)
 		goto discard_it;
 	}
 
-	if (!nip_get_tcp_input_checksum(skb)) {
+	if (skb->ip_summed != CHECKSUM_UNNECESSARY && !nip_get_tcp_input_checksum(skb)) {
 		nip_dbg("checksum fail, drop skb");
 		goto discard_it;
 	}
@@ -1405,6 +1421,7 @@ static int tcp_nip_rcv(struct sk_buff *skb)
 		goto discard_it;
 	}
 
+lookup:
 	sk = __ninet_lookup_skb(&tcp_hashinfo, skb, __tcp_hdrlen(th),
 				th->source, th->dest, dif, &refcounted);
 	if (!sk) {
@@ -1424,6 +1441,13 @@ static int tcp_nip_rcv(struct sk_buff *skb)
 		nip_dbg("TCP server into third shake hands, sk->sk_state:%d", sk->sk_state);
 		sk = req->rsk_listener;
 
+		/* The listener lock is not taken on this path, it may have been
+		 * closed since the request was hashed
+		 */
+		if (unlikely(sk->sk_state != TCP_LISTEN)) {
+			inet_csk_reqsk_queue_drop_and_put(sk, req);
+			goto lookup;
+		}
 		sock_hold(sk);
 		refcounted = true;
 		nsk = NULL;
@@ -1463,6 +1487,7 @@ static int tcp_nip_rcv(struct sk_buff *skb)
 		ret  = tcp_nip_do_rcv(sk, skb);
 		goto put_and_return;
 	}
+	sk_incoming_cpu_update(sk);
 	bh_lock_sock_nested(sk);
 
 	ret = 0;
@@ -1699,6 +1724,7 @@ struct proto tcp_nip_prot = {
 	.sysctl_rmem_offset	= offsetof(struct net, ipv4.sysctl_tcp_rmem),
 	.max_header		= MAX_TCP_HEADER,
 	.obj_size		= sizeof(struct tcp_nip_sock),
+	.slab_flags		= SLAB_TYPESAFE_BY_RCU,
 	.rsk_prot		= &tcp_nip_request_sock_ops,
 	.h.hashinfo		= &tcp_hashinfo,
 	.no_autobind		= true,
@@ -1719,6 +1745,125 @@ static struct inet_protosw tcp_nip_protosw = {
 				INET_PROTOSW_ICSK,
 };
 
+struct tcp_nip_mem_stat {
+	u32 estab;
+	u32 idle;
+	u32 reqsk;
+	u32 tw;
+	u64 rmem;
+	u64 wmem_queued;
+	u64 fwd_alloc;
+};
+
+static void tcp_nip_mem_sock_stat(struct sock *sk, struct tcp_nip_mem_stat *st)
+{
+	int rmem;
+	int wmem;
+
+	if (sk->sk_state == TCP_TIME_WAIT) {
+		st->tw++;
+		return;
+	}
+	if (sk->sk_state == TCP_NEW_SYN_RECV) {
+		st->reqsk++;
+		return;
+	}
+
+	rmem = sk_rmem_alloc_get(sk);
+	wmem = READ_ONCE(sk->sk_wmem_queued);
+	st->estab++;
+	st->rmem += rmem;
+	st->wmem_queued += wmem;
+	st->fwd_alloc += sk->sk_forward_alloc;
+	if (!rmem && !wmem && RB_EMPTY_ROOT(&tcp_sk(sk)->out_of_order_queue))
+		st->idle++;
+}
+
+/* Walk the established hash, only sockets of this netns are counted */
+static void tcp_nip_mem_collect(struct net *net, struct tcp_nip_mem_stat *st)
+{
+	struct inet_hashinfo *hinfo = tcp_nip_prot.h.hashinfo;
+	unsigned int i;
+
+	for (i = 0; i <= hinfo->ehash_mask; i++) {
+		struct inet_ehash_bucket *head = &hinfo->ehash[i];
+		spinlock_t *lock = inet_ehash_lockp(hinfo, i);
+		struct hlist_nulls_node *node;
+		struct sock *sk;
+
+		if (hlist_nulls_empty(&head->chain))
+			continue;
+
+		spin_lock_bh(lock);
+		sk_nulls_for_each(sk, node, &head->chain) {
+			if (sk->sk_family != AF_NINET || !net_eq(sock_net(sk), net))
+				continue;
+			tcp_nip_mem_sock_stat(sk, st);
+		}
+		spin_unlock_bh(lock);
+		cond_resched();
+	}
+}
+
+#define TCP_NIP_MEM_IDLE_ESTIMATE 1000000ULL
+static int tcp_nip_mem_seq_show(struct seq_file *seq, void *v)
+{
+	struct net *net = seq->private;
+	struct tcp_nip_mem_stat st = {0};
+	unsigned int sk_slab = kmem_cache_size(tcp_nip_prot.slab);
+	unsigned int req_slab = kmem_cache_size(tcp_nip_prot.rsk_prot->slab);
+	u64 idle_bytes = sk_slab;
+
+	seq_printf(seq, "sock_obj_size: %u\n", tcp_nip_prot.obj_size);
+	seq_printf(seq, "sock_slab_size: %u\n", sk_slab);
+	seq_printf(seq, "reqsk_slab_size: %u\n", req_slab);
+	seq_printf(seq, "nip_common_offset: %zu\n", offsetof(struct tcp_nip_sock, common));
+	seq_printf(seq, "nip_common_size: %zu\n", sizeof(struct tcp_nip_common));
+	seq_printf(seq, "sndbuf_limit: %d\n", get_nip_sndbuf());
+	seq_printf(seq, "rcvbuf_limit: %d\n", get_nip_rcvbuf());
+
+	/* The walk takes every ehash bucket lock, do not let any reader
+	 * load the lookup path with it
+	 */
+	if (!file_ns_capable(seq->file, net->user_ns, CAP_NET_ADMIN))
+		return 0;
+
+	tcp_nip_mem_collect(net, &st);
+
+	/* An idle socket holds nothing but its slab object and whatever
+	 * forward alloc it kept, the buffer budgets above are only limits.
+	 */
+	if (st.estab)
+		idle_bytes += div_u64(st.fwd_alloc, st.estab);
+
+	seq_printf(seq, "sockets: %u idle: %u reqsk: %u timewait: %u\n",
+		   st.estab, st.idle, st.reqsk, st.tw);
+	seq_printf(seq, "rmem_alloc: %llu wmem_queued: %llu forward_alloc: %llu\n",
+		   st.rmem, st.wmem_queued, st.fwd_alloc);
+	seq_printf(seq, "idle_bytes_per_sock: %llu\n", idle_bytes);
+	seq_printf(seq, "idle_1m_sock_kbytes: %llu\n",
+		   div_u64(idle_bytes * TCP_NIP_MEM_IDLE_ESTIMATE, 1024));
+	return 0;
+}
+
+static int __net_init tcp_nip_mem_net_init(struct net *net)
+{
+	if (!proc_create_net_single("nip_tcp_mem", 0444, net->proc_net,
+				    tcp_nip_mem_seq_show, NULL))
+		return -ENOMEM;
+	return 0;
+}
+
+static void __net_exit tcp_nip_mem_net_exit(struct net *net)
+{
+	remove_proc_entry("nip_tcp_mem", net->proc_net);
+}
+
+static struct pernet_operations tcp_nip_mem_net_ops = {
+	.init = tcp_nip_mem_net_init,
+	.exit = tcp_nip_mem_net_exit,
+};
+
 int __init tcp_nip_init(void)
 {
 	int ret;
@@ -1732,9 +1877,15 @@ int __init tcp_nip_init(void)
 	if (ret)
 		goto out_nip_tcp_protocol;
 
+	ret = register_pernet_subsys(&tcp_nip_mem_net_ops);
+	if (ret)
+		goto out_nip_tcp_protosw;
+
 out:
 	return ret;
 
+out_nip_tcp_protosw:
+	ninet_unregister_protosw(&tcp_nip_protosw);
 out_nip_tcp_protocol:
 	ninet_del_protocol(&tcp_nip_protocol, IPPROTO_TCP);
 	goto out;
@@ -1742,6 +1893,7 @@ out_nip_tcp_protocol:
 
 void tcp_nip_exit(void)
 {
+	unregister_pernet_subsys(&tcp_nip_mem_net_ops);
 	ninet_unregister_protosw(&tcp_nip_protosw);
 	ninet_del_protocol(&tcp_nip_protocol, IPPROTO_TCP);
 }
@@ -19,6 +19,7 @@
 #include <net/tcp.h>
 #include <net/tcp_nip.h>
 #include <net/inet_common.h>
+#include <net/nip_prof.h>
 #include <linux/module.h>
 #include <linux/sysctl.h>
 #include <linux/kernel.h>
@@ -272,6 +273,289 @@ static void tcp_nip_ofo_queue(struct sock *sk)
 	}
 }
 
+/* Insert skb into rb tree, ordered by TCP_SKB_CB(skb)->seq */
+static void tcp_nip_rbtree_insert(struct rb_root *root, struct sk_buff *skb)
+{
+	struct rb_node **p = &root->rb_node;
+	struct rb_node *parent = NULL;
+	struct sk_buff *skb1;
+
+	while (*p) {
+		parent = *p;
+		skb1 = rb_to_skb(parent);
+		if (before(TCP_SKB_CB(skb)->seq, TCP_SKB_CB(skb1)->seq))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&skb->rbnode, parent, p);
+	rb_insert_color(&skb->rbnode, root);
+}
+
+static struct sk_buff *tcp_nip_skb_next(struct sk_buff *skb, struct sk_buff_head *list)
+{
+	if (list)
+		return !skb_queue_is_last(list, skb) ? skb->next : NULL;
+
+	return skb_rb_next(skb);
+}
+
+static struct sk_buff *tcp_nip_collapse_one(struct sock *sk, struct sk_buff *skb,
+					    struct sk_buff_head *list,
+					    struct rb_root *root)
+{
+	struct sk_buff *next = tcp_nip_skb_next(skb, list);
+
+	if (list)
+		__skb_unlink(skb, list);
+	else
+		rb_erase(&skb->rbnode, root);
+
+	__kfree_skb(skb);
+	NET_INC_STATS(sock_net(sk), LINUX_MIB_TCPRCVCOLLAPSED);
+
+	return next;
+}
+
+/* Collapse contiguous sequence of skbs head..tail with
+ * sequence numbers start..end.
+ *
+ * If tail is NULL, this means until the end of the queue.
+ *
+ * Segments with FIN/SYN are not collapsed (only because this
+ * simplifies code)
+ */
+static void tcp_nip_collapse(struct sock *sk, struct sk_buff_head *list,
+			     struct rb_root *root, struct sk_buff *head,
+			     struct sk_buff *tail, u32 start, u32 end)
+{
+	struct sk_buff *skb = head;
+	struct sk_buff *n;
+	struct sk_buff_head tmp;
+	bool end_of_skbs;
+
+	/* First, check that queue is collapsible and find
+	 * the point where collapsing can be useful.
+	 */
+restart:
+	for (end_of_skbs = true; skb && skb != tail; skb = n) {
+		n = tcp_nip_skb_next(skb, list);
+
+		/* No new bits? It is possible on ofo queue. */
+		if (!before(start, TCP_SKB_CB(skb)->end_seq)) {
+			skb = tcp_nip_collapse_one(sk, skb, list, root);
+			if (!skb)
+				break;
+			goto restart;
+		}
+
+		/* The first skb to collapse is:
+		 * - not SYN/FIN and
+		 * - bloated or contains data before "start" or
+		 *   overlaps to the next one.
+		 */
+		if (!(TCP_SKB_CB(skb)->tcp_flags & (TCPHDR_SYN | TCPHDR_FIN)) &&
+		    (tcp_win_from_space(sk, skb->truesize) > skb->len ||
+		     before(TCP_SKB_CB(skb)->seq, start))) {
+			end_of_skbs = false;
+			break;
+		}
+
+		if (n && n != tail &&
+		    TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(n)->seq) {
+			end_of_skbs = false;
+			break;
+		}
+
+		/* Decided to skip this, advance start seq. */
+		start = TCP_SKB_CB(skb)->end_seq;
+	}
+	if (end_of_skbs ||
+	    (TCP_SKB_CB(skb)->tcp_flags & (TCPHDR_SYN | TCPHDR_FIN)))
+		return;
+
+	__skb_queue_head_init(&tmp);
+
+	while (before(start, end)) {
+		int copy = min_t(int, SKB_MAX_ORDER(0, 0), end - start);
+		struct sk_buff *nskb;
+
+		nskb = alloc_skb(copy, GFP_ATOMIC);
+		if (!nskb)
+			break;
+
+		memcpy(nskb->cb, skb->cb, sizeof(skb->cb));
+		TCP_SKB_CB(nskb)->seq = start;
+		TCP_SKB_CB(nskb)->end_seq = start;
+		if (list)
+			__skb_queue_before(list, skb, nskb);
+		else
+			__skb_queue_tail(&tmp, nskb); /* defer rbtree insertion */
+		skb_set_owner_r(nskb, sk);
+
+		/* Copy data, releasing collapsed skbs. */
+		while (copy > 0) {
+			int offset = start - TCP_SKB_CB(skb)->seq;
+			int size = TCP_SKB_CB(skb)->end_seq - start;
+
+			BUG_ON(offset < 0);
+			if (size > 0) {
+				size = min(copy, size);
+				if (skb_copy_bits(skb, offset, skb_put(nskb, size), size))
+					BUG();
+				TCP_SKB_CB(nskb)->end_seq += size;
+				copy -= size;
+				start += size;
+			}
+			if (!before(start, TCP_SKB_CB(skb)->end_seq)) {
+				skb = tcp_nip_collapse_one(sk, skb, list, root);
+				if (!skb ||
+				    skb == tail ||
+				    (TCP_SKB_CB(skb)->tcp_flags & (TCPHDR_SYN | TCPHDR_FIN)))
+					goto end;
+			}
+		}
+	}
+end:
+	skb_queue_walk_safe(&tmp, skb, n)
+		tcp_nip_rbtree_insert(root, skb);
+}
+
+/* Collapse ofo queue. Algorithm: select contiguous sequence of skbs
+ * and tcp_nip_collapse() them until all the queue is collapsed.
+ */
+static void tcp_nip_collapse_ofo_queue(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 range_truesize;
+	u32 sum_tiny = 0;
+	struct sk_buff *skb;
+	struct sk_buff *head;
+	u32 start;
+	u32 end;
+
+	skb = skb_rb_first(&tp->out_of_order_queue);
+new_range:
+	if (!skb) {
+		tp->ooo_last_skb = skb_rb_last(&tp->out_of_order_queue);
+		return;
+	}
+	start = TCP_SKB_CB(skb)->seq;
+	end = TCP_SKB_CB(skb)->end_seq;
+	range_truesize = skb->truesize;
+
+	for (head = skb;;) {
+		skb = skb_rb_next(skb);
+
+		/* Range is terminated when we see a gap or when
+		 * we are at the queue end.
+		 */
+		if (!skb ||
+		    after(TCP_SKB_CB(skb)->seq, end) ||
+		    before(TCP_SKB_CB(skb)->end_seq, start)) {
+			/* Do not attempt collapsing tiny skbs */
+			if (range_truesize != head->truesize ||
+			    end - start >= SKB_WITH_OVERHEAD(SK_MEM_QUANTUM)) {
+				tcp_nip_collapse(sk, NULL, &tp->out_of_order_queue,
+						 head, skb, start, end);
+			} else {
+				sum_tiny += range_truesize;
+				if (sum_tiny > sk->sk_rcvbuf >> 3)
+					return;
+			}
+			goto new_range;
+		}
+
+		range_truesize += skb->truesize;
+		if (unlikely(before(TCP_SKB_CB(skb)->seq, start)))
+			start = TCP_SKB_CB(skb)->seq;
+		if (after(TCP_SKB_CB(skb)->end_seq, end))
+			end = TCP_SKB_CB(skb)->end_seq;
+	}
+}
+
+/* Purge the out-of-order queue from its tail, the segments
+ * furthest from rcv_nxt are the last ones the reader needs.
+ * Return true if queue has shrunk.
+ */
+static bool tcp_nip_prune_ofo_queue(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct rb_node *node;
+	struct rb_node *prev;
+	int goal;
+
+	if (RB_EMPTY_ROOT(&tp->out_of_order_queue))
+		return false;
+
+	NET_INC_STATS(sock_net(sk), LINUX_MIB_OFOPRUNED);
+	goal = sk->sk_rcvbuf >> 3;
+	node = &tp->ooo_last_skb->rbnode;
+	do {
+		prev = rb_prev(node);
+		rb_erase(node, &tp->out_of_order_queue);
+		goal -= rb_to_skb(node)->truesize;
+		tcp_nip_drop(sk, rb_to_skb(node));
+		if (!prev || goal <= 0) {
+			sk_mem_reclaim(sk);
+			if (atomic_read(&sk->sk_rmem_alloc) <= sk->sk_rcvbuf &&
+			    !tcp_under_memory_pressure(sk))
+				break;
+			goal = sk->sk_rcvbuf >> 3;
+		}
+		node = prev;
+	} while (node);
+	tp->ooo_last_skb = rb_to_skb(prev);
+
+	return true;
+}
+
+/* Reduce allocated memory if we can, trying to get
+ * the socket within its memory limits again.
+ * Small segments carry a truesize far above their payload, so the
+ * receive and out-of-order queues are first compacted into dense skbs,
+ * the out-of-order queue is only pruned if that is not enough.
+ *
+ * Return less than zero if we should start dropping frames
+ * until the socket owning process reads some of the data
+ * to stabilize the situation.
+ */
+static int tcp_nip_prune_queue(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	NET_INC_STATS(sock_net(sk), LINUX_MIB_PRUNECALLED);
+
+	if (atomic_read(&sk->sk_rmem_alloc) <= sk->sk_rcvbuf)
+		return 0;
+
+	tcp_nip_collapse_ofo_queue(sk);
+	if (!skb_queue_empty(&sk->sk_receive_queue))
+		tcp_nip_collapse(sk, &sk->sk_receive_queue, NULL,
+				 skb_peek(&sk->sk_receive_queue),
+				 NULL, tp->copied_seq, tp->rcv_nxt);
+	sk_mem_reclaim(sk);
+
+	if (atomic_read(&sk->sk_rmem_alloc) <= sk->sk_rcvbuf)
+		return 0;
+
+	/* Collapsing did not help, destructive actions follow. */
+	tcp_nip_prune_ofo_queue(sk);
+
+	if (atomic_read(&sk->sk_rmem_alloc) <= sk->sk_rcvbuf)
+		return 0;
+
+	/* If we are really being abused, tell the caller to silently
+	 * drop receive data on the floor. It will get retransmitted
+	 * and hopefully then we'll have sufficient space.
+	 */
+	NET_INC_STATS(sock_net(sk), LINUX_MIB_RCVPRUNED);
+
+	/* Massive buffer overcommit. */
+	tp->pred_flags = 0;
+	return -1;
+}
+
 /* The tcp_nip_data_queue function is responsible for receiving the socket data. For the packets
  * whose start sequence number is after the sequence to be received by the socket and whose
  * start sequence number is within the receiving window, current function is called to add them
@@ -288,7 +572,8 @@ static void tcp_nip_data_queue_ofo(struct sock *sk, struct sk_buff *skb)
 	u32 end_seq;
 	bool fragstolen;
 
-	if (unlikely(atomic_read(&sk->sk_rmem_alloc) > sk->sk_rcvbuf)) {
+	if (unlikely(atomic_read(&sk->sk_rmem_alloc) > sk->sk_rcvbuf) &&
+	    tcp_nip_prune_queue(sk) < 0) {
 		nip_dbg("no memory, drop pkt");
 		NET_INC_STATS(sock_net(sk), LINUX_MIB_TCPOFODROP);
 		sk->sk_data_ready(sk);
@@ -519,6 +804,12 @@ out_of_window:
 			TCP_SKB_CB(skb)->seq, TCP_SKB_CB(skb)->end_seq,
 			tp->rcv_nxt, skb->len);
 
+		/* In-order data is always accepted inside the window,
+		 * only compact the queues to make room for it.
+		 */
+		if (unlikely(atomic_read(&sk->sk_rmem_alloc) > sk->sk_rcvbuf))
+			tcp_nip_prune_queue(sk);
+
 		__skb_queue_tail(&sk->sk_receive_queue, skb);
 		skb_set_owner_r(skb, sk);
 		tp->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
@@ -740,77 +1031,6 @@ struct request_sock *ninet_reqsk_alloc(const struct request_sock_ops *ops,
 	return req;
 }
 
-void tcp_nip_parse_mss(struct tcp_options_received *opt_rx,
-		       const struct tcphdr *th,
-		       const unsigned char *ptr,
-		       int opsize,
-		       int estab)
-{
-	if (opsize == TCPOLEN_MSS && th->syn && !estab) {
-		u16 in_mss = get_unaligned_be16(ptr);
-
-		nip_dbg("in_mss %d", in_mss);
-
-		if (in_mss) {
-			if (opt_rx->user_mss &&
-			    opt_rx->user_mss < in_mss)
-				in_mss = opt_rx->user_mss;
-			opt_rx->mss_clamp = in_mss;
-		}
-	}
-}
-
-/* Function
- *    Look for tcp options. Normally only called on SYN and SYNACK packets.
- *    Parsing of TCP options in SKB
- * Parameter
- *    skb: Transfer control block buffer
- *    opt_rx: Saves the structure for TCP options
- *    estab: WANTCOOKIE
- *    foc: Len field
- */
-void tcp_nip_parse_options(const struct sk_buff *skb,
-			   struct tcp_options_received *opt_rx, int estab,
-			   struct tcp_fastopen_cookie *foc)
-{
-	const unsigned char *ptr;
-	const struct tcphdr *th = tcp_hdr(skb);
-	/* The length of the TCP option = Length of TCP header - The length of the TCP structure */
-	int length = (th->doff * 4) - sizeof(struct tcphdr);
-
-	/* A pointer to the option position */
-	ptr = (const unsigned char *)(th + 1);
-	opt_rx->saw_tstamp = 0;
-
-	while (length > 0) {
-		int opcode = *ptr++;
-		int opsize;
-
-		switch (opcode) {
-		case TCPOPT_EOL:
-			return;
-		case TCPOPT_NOP:
-			length--;
-			continue;
-		default:
-			opsize = *ptr++;
-			if (opsize < 2) /* "2 - silly options" */
-				return;
-			if (opsize > length)
-				return; /* don't parse partial options */
-			switch (opcode) {
-			case TCPOPT_MSS:
-				tcp_nip_parse_mss(opt_rx, th, ptr, opsize, estab);
-				break;
-			default:
-				break;
-			}
-			ptr += opsize - TCP_NUM_2;
-			length -= opsize;
-		}
-	}
-}
-
 static void tcp_nip_common_init(struct request_sock *req)
 {
 	struct tcp_nip_request_sock *niptreq = tcp_nip_rsk(req);
@@ -897,6 +1117,9 @@ struct sock *tcp_nip_create_openreq_child(const struct sock *sk,
 		newtp->snd_nxt = treq->snt_isn + 1;
 		newtp->snd_up = treq->snt_isn + 1;
 
+		/* Keep the TX queue the SYN+ACK went out on */
+		newsk->sk_txhash = treq->txhash;
+
 		INIT_LIST_HEAD(&newtp->tsq_node);
 
 		/* The ACK segment number of the send window that
@@ -1537,8 +1760,8 @@ discard:
 	return false;
 }
 
-void tcp_nip_rcv_established(struct sock *sk, struct sk_buff *skb,
-			     const struct tcphdr *th, unsigned int len)
+static void __tcp_nip_rcv_established(struct sock *sk, struct sk_buff *skb,
+				      const struct tcphdr *th)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 
@@ -1562,6 +1785,15 @@ discard:
 	tcp_nip_drop(sk, skb);
 }
 
+void tcp_nip_rcv_established(struct sock *sk, struct sk_buff *skb,
+			     const struct tcphdr *th, unsigned int len)
+{
+	u64 start = nip_prof_begin();
+
+	__tcp_nip_rcv_established(sk, skb, th);
+	nip_prof_end(NIP_PROF_TCP_ESTABLISHED, start);
+}
+
 static u32 tcp_default_init_rwnd(u32 mss)
 {
 	u32 init_rwnd = TCP_INIT_CWND * 2;
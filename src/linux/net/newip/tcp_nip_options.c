@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * NewIP INET
+ * An implementation of the TCP/IP protocol suite for the LINUX
+ * operating system. NewIP INET is implemented using the  BSD Socket
+ * interface as the means of communication with the user level.
+ *
+ * TCP option parsing. Kept apart from tcp_nip_input.c so that
+ * examples/nip_decode_fuzz.c can build it in userspace against the
+ * headers in examples/nip_kshim.
+ *
+ * Based on net/ipv4/tcp_input.c
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": [%s:%d] " fmt, __func__, __LINE__
+
+#include <net/tcp.h>
+#include <net/tcp_nip.h>
+#include <asm/unaligned.h>
+#include "tcp_nip_parameter.h"
+
+static void tcp_nip_parse_mss(struct tcp_options_received *opt_rx,
+			      const struct tcphdr *th,
+			      const unsigned char *ptr,
+			      int opsize,
+			      int estab)
+{
+	if (opsize == TCPOLEN_MSS && th->syn && !estab) {
+		u16 in_mss = get_unaligned_be16(ptr);
+
+		nip_dbg("in_mss %d", in_mss);
+
+		if (in_mss) {
+			if (opt_rx->user_mss &&
+			    opt_rx->user_mss < in_mss)
+				in_mss = opt_rx->user_mss;
+			opt_rx->mss_clamp = in_mss;
+		}
+	}
+}
+
+/* Function
+ *    Look for tcp options. Normally only called on SYN and SYNACK packets.
+ *    Parsing of TCP options in SKB
+ * Parameter
+ *    skb: Transfer control block buffer
+ *    opt_rx: Saves the structure for TCP options
+ *    estab: WANTCOOKIE
+ *    foc: Len field
+ */
+void tcp_nip_parse_options(const struct sk_buff *skb,
+			   struct tcp_options_received *opt_rx, int estab,
+			   struct tcp_fastopen_cookie *foc)
+{
+	const unsigned char *ptr;
+	const struct tcphdr *th = tcp_hdr(skb);
+	/* The length of the TCP option = Length of TCP header - The length of the TCP structure */
+	int length = (th->doff * 4) - sizeof(struct tcphdr);
+
+	/* A pointer to the option position */
+	ptr = (const unsigned char *)(th + 1);
+	opt_rx->saw_tstamp = 0;
+
+	while (length > 0) {
+		int opcode = *ptr++;
+		int opsize;
+
+		switch (opcode) {
+		case TCPOPT_EOL:
+			return;
+		case TCPOPT_NOP:
+			length--;
+			continue;
+		default:
+			/* The last option byte has no room for a length */
+			if (length < TCP_NUM_2)
+				return;
+			opsize = *ptr++;
+			if (opsize < 2) /* "2 - silly options" */
+				return;
+			if (opsize > length)
+				return; /* don't parse partial options */
+			switch (opcode) {
+			case TCPOPT_MSS:
+				tcp_nip_parse_mss(opt_rx, th, ptr, opsize, estab);
+				break;
+			default:
+				break;
+			}
+			ptr += opsize - TCP_NUM_2;
+			length -= opsize;
+		}
+	}
+}
@@ -21,6 +21,7 @@
 #include <linux/compiler.h>
 #include <linux/module.h>
 #include <net/nip_udp.h>
+#include <net/nip_prof.h>
 #include "nip_hdr.h"
 #include "nip_checksum.h"
 #include "tcp_nip_parameter.h"
@@ -43,17 +44,32 @@ struct tcp_nip_out_options {
 static bool tcp_nip_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 			       int push_one, gfp_t gfp);
 
+/* Length of the NewIP header this connection sends, it depends on the
+ * length of both addresses and on the traffic class.
+ */
+static int tcp_nip_hdr_len(const struct sock *sk)
+{
+	int nip_hdr_len = get_nip_hdr_len(NIP_HDR_COMM, &sk->sk_nip_rcv_saddr,
+					  &sk->sk_nip_daddr, inet_sk(sk)->tos);
+
+	return nip_hdr_len == 0 ? NIP_HDR_MAX : nip_hdr_len;
+}
+
+/* advmss for this connection, dst_metric_advmss only knows NIP_HDR_MAX */
+int tcp_nip_mtu_to_advmss(const struct sock *sk, u32 mtu)
+{
+	return mtu - tcp_nip_hdr_len(sk) - sizeof(struct tcphdr);
+}
+
 /* Calculate MSS not accounting any TCP options.  */
 static inline int __tcp_nip_mtu_to_mss(struct sock *sk, int pmtu)
 {
 	const struct tcp_sock *tp = tcp_sk(sk);
 	const struct inet_connection_sock *icsk = inet_csk(sk);
 	int mss_now;
-	int nip_hdr_len = get_nip_hdr_len(NIP_HDR_COMM, &sk->sk_nip_rcv_saddr, &sk->sk_nip_daddr);
 
 	/* Calculate base mss without TCP options: It is MMS_S - sizeof(tcphdr) of rfc1122 */
-	nip_hdr_len = nip_hdr_len == 0 ? NIP_HDR_MAX : nip_hdr_len;
-	mss_now = pmtu - nip_hdr_len - sizeof(struct tcphdr);
+	mss_now = pmtu - tcp_nip_hdr_len(sk) - sizeof(struct tcphdr);
 
 	/* IPv6 adds a frag_hdr in case RTAX_FEATURE_ALLFRAG is set */
 	if (icsk->icsk_af_ops->net_frag_header_len) {
@@ -270,7 +286,7 @@ static void tcp_nip_connect_init(struct sock *sk)
 
 	if (!tp->window_clamp)
 		tp->window_clamp = dst_metric(dst, RTAX_WINDOW);
-	tp->advmss = tcp_mss_clamp(tp, dst_metric_advmss(dst));
+	tp->advmss = tcp_mss_clamp(tp, tcp_nip_mtu_to_advmss(sk, dst_mtu(dst)));
 
 	tcp_initialize_rcv_mss(sk);
 
@@ -347,7 +363,6 @@ static __u16 tcp_nip_advertise_mss(struct sock *sk)
 	u32 mtu;
 
 	if (dst) {
-		int nip_hdr_len;
 		int nip_mss;
 		unsigned int metric = dst_metric_advmss(dst);
 
@@ -357,10 +372,7 @@ static __u16 tcp_nip_advertise_mss(struct sock *sk)
 		}
 
 		mtu = dst_mtu(dst);
-		nip_hdr_len = get_nip_hdr_len(NIP_HDR_COMM, &sk->sk_nip_rcv_saddr,
-					      &sk->sk_nip_daddr);
-		nip_hdr_len = nip_hdr_len == 0 ? NIP_HDR_MAX : nip_hdr_len;
-		nip_mss = mtu - nip_hdr_len - sizeof(struct tcphdr);
+		nip_mss = tcp_nip_mtu_to_advmss(sk, mtu);
 		if (nip_mss > mss) {
 			mss = nip_mss;
 			tp->advmss = mss;
@@ -437,13 +449,18 @@ unsigned short nip_get_output_checksum_tcp(struct sk_buff *skb, struct nip_addr
 {
 	struct nip_pseudo_header nph = {0};
 	u8 *tcp_hdr = skb_transport_header(skb);
+	unsigned short sum;
+	u64 start;
 
 	nph.nexthdr = IPPROTO_TCP;
 	nph.saddr = src_addr;
 	nph.daddr = dst_addr;
 
 	nph.check_len = htons(skb->len);
-	return nip_check_sum_build(tcp_hdr, skb->len, &nph);
+	start = nip_prof_begin();
+	sum = nip_check_sum_build(tcp_hdr, skb->len, &nph);
+	nip_prof_end(NIP_PROF_CHECKSUM, start);
+	return sum;
 }
 
 static int __tcp_nip_transmit_skb(struct sock *sk, struct sk_buff *skb,
@@ -540,9 +557,11 @@ static int __tcp_nip_transmit_skb(struct sock *sk, struct sk_buff *skb,
 		ntohs(inet->inet_sport), ntohs(inet->inet_dport), ntohs(th->window),
 		sk->sk_rcvbuf, atomic_read(&sk->sk_rmem_alloc), ack, skb->len);
 
-	/* Fill in checksum */
-	check = nip_get_output_checksum_tcp(skb, sk->sk_nip_rcv_saddr, sk->sk_nip_daddr);
-	th->check = htons(check);
+	/* Fill in checksum, same host delivery does not verify it */
+	if (!nip_dst_loopback(__sk_dst_get(sk))) {
+		check = nip_get_output_checksum_tcp(skb, sk->sk_nip_rcv_saddr, sk->sk_nip_daddr);
+		th->check = htons(check);
+	}
 
 	if (likely(tcb->tcp_flags & TCPHDR_ACK))
 		tcp_nip_event_ack_sent(sk, tcp_skb_pcount(skb), rcv_nxt);
@@ -723,7 +742,9 @@ static int get_nip_mss(const struct sock *sk, struct dst_entry *dst, struct requ
 		mss = user_mss;
 
 	mtu = dst_mtu(dst);
-	nip_hdr_len = get_nip_hdr_len(NIP_HDR_COMM, &ireq->ir_nip_loc_addr, &ireq->ir_nip_rmt_addr);
+	/* The child sends with the traffic class of the listener */
+	nip_hdr_len = get_nip_hdr_len(NIP_HDR_COMM, &ireq->ir_nip_loc_addr,
+				      &ireq->ir_nip_rmt_addr, inet_sk(sk)->tos);
 	nip_hdr_len = nip_hdr_len == 0 ? NIP_HDR_MAX : nip_hdr_len;
 	nip_mss = mtu - nip_hdr_len - sizeof(struct tcphdr);
 
@@ -816,9 +837,12 @@ struct sk_buff *tcp_nip_make_synack(const struct sock *sk, struct dst_entry *dst
 	th->doff = (tcp_header_size >> 2);
 	__TCP_INC_STATS(sock_net(sk), TCP_MIB_OUTSEGS);
 
-	/* Fill in checksum */
-	check = nip_get_output_checksum_tcp(skb,  ireq->ir_nip_loc_addr,  ireq->ir_nip_rmt_addr);
-	th->check = htons(check);
+	/* Fill in checksum, same host delivery does not verify it */
+	if (!nip_dst_loopback(dst)) {
+		check = nip_get_output_checksum_tcp(skb, ireq->ir_nip_loc_addr,
+						    ireq->ir_nip_rmt_addr);
+		th->check = htons(check);
+	}
 
 	/* Do not fool tcpdump (if any), clean our debris */
 	skb->tstamp = 0;
@@ -1039,8 +1063,8 @@ static int tcp_nip_init_tso_segs(struct sk_buff *skb, unsigned int mss_now)
 	return tso_segs;
 }
 
-static bool tcp_nip_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
-			       int push_one, gfp_t gfp)
+static bool __tcp_nip_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
+				 int push_one, gfp_t gfp)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct tcp_nip_common *ntp = &tcp_nip_sk(sk)->common;
@@ -1087,6 +1111,16 @@ static bool tcp_nip_write_xmit(struct sock *sk, unsigned int mss_now, int nonagl
 	return !tp->packets_out && tcp_nip_send_head(sk);
 }
 
+static bool tcp_nip_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
+			       int push_one, gfp_t gfp)
+{
+	u64 start = nip_prof_begin();
+	bool ret = __tcp_nip_write_xmit(sk, mss_now, nonagle, push_one, gfp);
+
+	nip_prof_end(NIP_PROF_TCP_WRITE_XMIT, start);
+	return ret;
+}
+
 int tcp_nip_rtx_synack(const struct sock *sk, struct request_sock *req)
 {
 	const struct tcp_request_sock_ops *af_ops = tcp_rsk(req)->af_specific;
@@ -279,6 +279,18 @@ int get_nip_probe_max(void)
 	return g_nip_probe_max;
 }
 
+/*********************************************************************************************/
+/*                            neighbour parameters                                           */
+/*********************************************************************************************/
+/* Packets of one flow kept while the neighbour is unresolved, 0 means no per-flow limit */
+int g_nip_neigh_pending_per_flow = 8;
+module_param_named(nip_neigh_pending_per_flow, g_nip_neigh_pending_per_flow, int, 0644);
+
+int get_nip_neigh_pending_per_flow(void)
+{
+	return g_nip_neigh_pending_per_flow;
+}
+
 /*********************************************************************************************/
 /*                            window mode parameters                                         */
 /*********************************************************************************************/
@@ -39,6 +39,7 @@ int get_nip_idle_ka_probes_out(void);
 int get_nip_keepalive_time(void);
 int get_nip_keepalive_intvl(void);
 int get_nip_probe_max(void);
+int get_nip_neigh_pending_per_flow(void);
 bool get_nip_tcp_snd_win_enable(void);
 bool get_nip_tcp_rcv_win_enable(void);
 bool get_nip_debug(void);
@@ -105,6 +105,15 @@ static bool retransmits_nip_timed_out(struct sock *sk,
 	return inet_csk(sk)->icsk_retransmits > boundary;
 }
 
+/* Move the flow to another TX queue after a timeout, the old path may be
+ * the reason for the loss. Nothing is in flight any more, so no reordering.
+ */
+static void tcp_nip_rethink_txhash(struct sock *sk)
+{
+	sk_rethink_txhash(sk);
+	sk_tx_queue_clear(sk);
+}
+
 static int tcp_nip_write_timeout(struct sock *sk)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
@@ -113,9 +122,13 @@ static int tcp_nip_write_timeout(struct sock *sk)
 	bool syn_set = false;
 
 	if ((1 << sk->sk_state) & (TCPF_SYN_SENT | TCPF_SYN_RECV)) {
+		if (icsk->icsk_retransmits)
+			tcp_nip_rethink_txhash(sk);
 		retry_until = icsk->icsk_syn_retries ? : net->ipv4.sysctl_tcp_syn_retries;
 		syn_set = true;
 	} else {
+		if (retransmits_nip_timed_out(sk, net->ipv4.sysctl_tcp_retries1, 0, false))
+			tcp_nip_rethink_txhash(sk);
 		retry_until = net->ipv4.sysctl_tcp_retries2;
 		if (sock_flag(sk, SOCK_DEAD)) {
 			const bool alive = icsk->icsk_rto < TCP_RTO_MAX;
@@ -36,6 +36,7 @@
 #include <net/raw.h>
 #include <net/sock_reuseport.h>
 #include <net/udp.h>
+#include <net/nip_prof.h>
 #include "nip_hdr.h"
 #include "nip_checksum.h"
 #include "tcp_nip_parameter.h"
@@ -260,7 +261,14 @@ static int __nip_udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
 	int rc;
 
-	sk_incoming_cpu_update(sk);
+	/* Only a connected socket is a single flow worth steering */
+	if (sk->sk_state == TCP_ESTABLISHED) {
+		sock_rps_save_rxhash(sk, skb);
+		sk_mark_napi_id(sk, skb);
+		sk_incoming_cpu_update(sk);
+	} else {
+		sk_mark_napi_id_once(sk, skb);
+	}
 
 	rc = __udp_enqueue_schedule_skb(sk, skb);
 	if (rc < 0) {
@@ -275,14 +283,18 @@ bool nip_get_udp_input_checksum(struct sk_buff *skb)
 	struct nip_pseudo_header nph = {0};
 	struct udphdr *udphead = udp_hdr(skb);
 	unsigned short check_len = ntohs(udphead->len);
+	unsigned short sum;
+	u64 start;
 
 	nph.nexthdr = NIPCB(skb)->nexthdr;
 	nph.saddr = NIPCB(skb)->srcaddr;
 	nph.daddr = NIPCB(skb)->dstaddr;
 	nph.check_len = udphead->len;
 
-	return nip_check_sum_parse(skb_transport_header(skb), check_len, &nph)
-	       == 0xffff ? true : false;
+	start = nip_prof_begin();
+	sum = nip_check_sum_parse(skb_transport_header(skb), check_len, &nph);
+	nip_prof_end(NIP_PROF_CHECKSUM, start);
+	return sum == 0xffff ? true : false;
 }
 
 /* Udp packets are received at the network layer */
@@ -292,7 +304,7 @@ int nip_udp_input(struct sk_buff *skb)
 	int rc = 0;
 	struct udphdr *udphead = udp_hdr(skb);
 
-	if (!nip_get_udp_input_checksum(skb)) {
+	if (skb->ip_summed != CHECKSUM_UNNECESSARY && !nip_get_udp_input_checksum(skb)) {
 		nip_dbg("checksum failed, drop the packet");
 		kfree_skb(skb);
 		rc = -1;
@@ -38,6 +38,7 @@ desc (optional) 字段说明。
 local _ttl        = ProtoField.uint8 (nip_proto_name .. ".ttl",        "ttl       (  1 Byte)",  base.DEC)
 local _total_len  = ProtoField.uint16(nip_proto_name .. ".total_len",  "total_len (  2 Byte)",  base.DEC)
 local _nexthdr    = ProtoField.uint8 (nip_proto_name .. ".nexthdr",    "nexthdr   (  1 Byte)",  base.DEC)
+local _tclass     = ProtoField.uint8 (nip_proto_name .. ".tclass",     "tclass    (  1 Byte)",  base.DEC)
 local _daddr      = ProtoField.bytes (nip_proto_name .. ".daddr",      "daddr     (1~8 Byte)",  base.SPACE)
 local _saddr      = ProtoField.bytes (nip_proto_name .. ".saddr",      "saddr     (1~8 Byte)",  base.SPACE)
 local _hdr_len    = ProtoField.uint8 (nip_proto_name .. ".hdr_len",    "hdr_len   (  1 Byte)",  base.DEC)
@@ -48,6 +49,7 @@ nip_proto_obj.fields = {
 	_ttl, 
 	_total_len, 
 	_nexthdr, 
+	_tclass, 
 	_daddr, 
 	_saddr, 
 	_hdr_len, 
@@ -74,7 +76,7 @@ local _pkt_hdr_type      = ProtoField.uint8(bitmap1_name .. ".pkt_hdr_type",
 local _include_ttl       = ProtoField.uint8(bitmap1_name .. ".include_ttl",       "include_ttl      ", base.DEC, Payload_type, 0x40) --_bitmap1的7bit
 local _include_total_len = ProtoField.uint8(bitmap1_name .. ".include_total_len", "include_total_len", base.DEC, Payload_type, 0x20) --_bitmap1的6bit
 local _include_nexthdr   = ProtoField.uint8(bitmap1_name .. ".include_nexthdr",   "include_nexthdr  ", base.DEC, Payload_type, 0x10) --_bitmap1的5bit
-local _include_reserve1  = ProtoField.uint8(bitmap1_name .. ".include_reserve1",  "include_reserve1 ", base.DEC, Payload_type, 0x08) --_bitmap1的4bit
+local _include_tclass    = ProtoField.uint8(bitmap1_name .. ".include_tclass",    "include_tclass   ", base.DEC, Payload_type, 0x08) --_bitmap1的4bit
 local _include_daddr     = ProtoField.uint8(bitmap1_name .. ".include_daddr",     "include_daddr    ", base.DEC, Payload_type, 0x04) --_bitmap1的3bit
 local _include_saddr     = ProtoField.uint8(bitmap1_name .. ".include_saddr",     "include_saddr    ", base.DEC, Payload_type, 0x02) --_bitmap1的2bit
 local _include_bitmap2   = ProtoField.uint8(bitmap1_name .. ".include_bitmap2",   "include_bitmap2  ", base.DEC, Payload_type, 0x01) --_bitmap1的1bit
@@ -82,7 +84,7 @@ local _include_bitmap2   = ProtoField.uint8(bitmap1_name .. ".include_bitmap2",
 -- 将字段添加都协议中
 bitmap1_obj.fields = {
 	_bitmap1, _pkt_hdr_type, _include_ttl, _include_total_len, _include_nexthdr,
-	_include_reserve1, _include_daddr, _include_saddr, _include_bitmap2
+	_include_tclass, _include_daddr, _include_saddr, _include_bitmap2
 }
 
 --定义 bitmap2 子菜单
@@ -162,6 +164,7 @@ function nip_dissector(tvb, pinfo, treeitem)
 	local include_ttl		= bit.band(bit.rshift(bitmap1, 6), 0x00000001)	--右移 6 位 与 0x01 相与，获取 include_ttl 位
 	local include_total_len	= bit.band(bit.rshift(bitmap1, 5), 0x00000001)	--右移 5 位 与 0x01 相与，获取 include_total_len 位
 	local include_nexthdr	= bit.band(bit.rshift(bitmap1, 4), 0x00000001)	--右移 4 位 与 0x01 相与，获取 include_nexthdr 位
+	local include_tclass	= bit.band(bit.rshift(bitmap1, 3), 0x00000001)	--右移 3 位 与 0x01 相与，获取 include_tclass 位
 	local include_daddr		= bit.band(bit.rshift(bitmap1, 2), 0x00000001)	--右移 2 位 与 0x01 相与，获取 include_daddr 位
 	local include_saddr		= bit.band(bit.rshift(bitmap1, 1), 0x00000001)	--右移 1 位 与 0x01 相与，获取 include_saddr 位
 	local include_bitmap2	= bit.band(bitmap1, 0x00000001)					--获取 include_bitmap2 位
@@ -177,7 +180,7 @@ function nip_dissector(tvb, pinfo, treeitem)
 		bitmap1_tree:add(_include_ttl,       bitmap1)
 		bitmap1_tree:add(_include_total_len, bitmap1)
 		bitmap1_tree:add(_include_nexthdr,   bitmap1)
-		bitmap1_tree:add(_include_reserve1,  bitmap1)
+		bitmap1_tree:add(_include_tclass,    bitmap1)
 		bitmap1_tree:add(_include_daddr,     bitmap1)
 		bitmap1_tree:add(_include_saddr,     bitmap1)
 		bitmap1_tree:add(_include_bitmap2,   bitmap1)
@@ -219,6 +222,11 @@ function nip_dissector(tvb, pinfo, treeitem)
 		offset = offset + 1	--_nexthdr 占用1字节
 	end
 	
+	if include_tclass ~= 0 then
+		nip_tree:add(_tclass, tvb(offset, 1))
+		offset = offset + 1	--_tclass 占用1字节
+	end
+	
 	if include_daddr ~= 0 then
 		local first_addr = tvb(offset, 1):uint()
 		local addr_len = get_nip_addr_len (first_addr)
@@ -0,0 +1,554 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2022 Huawei Device Co., Ltd.
+ *
+ * Wireshark dissector for the NewIP protocol stack, compiled replacement
+ * of tools/wireshark_cfg_for_newip.lua.
+ *
+ * The header is decoded with nip_hdr_parse() from src/common, so the
+ * plugin accepts and rejects exactly what the kernel does; decap error
+ * codes are reported as expert info. NewIP addresses are a Wireshark
+ * address type, which gives TCP/UDP conversations, the Conversations
+ * and Endpoints tables and "newip.src/dst/addr" filters.
+ */
+#include "config.h"
+
+#include <epan/packet.h>
+#include <epan/expert.h>
+#include <epan/prefs.h>
+#include <epan/ipproto.h>
+#include <epan/tap.h>
+#include <epan/address_types.h>
+#include <epan/conversation_table.h>
+
+#include "nip_hdr.h"
+
+#define NEWIP_ETHERTYPE   0xEADD
+/* The parser reads at most NIP_HDR_PARSE_MAX bytes, one more keeps the
+ * longest header from looking truncated when payload follows it
+ */
+#define NEWIP_HDR_COPY    (NIP_HDR_PARSE_MAX + 1)
+#define NEWIP_MAC_LEN_MAX 32
+
+static int proto_newip = -1;
+static int proto_newip_nd = -1;
+
+static int hf_newip_bitmap1 = -1;
+static int hf_newip_bitmap1_invalid = -1;
+static int hf_newip_bitmap1_ttl = -1;
+static int hf_newip_bitmap1_total_len = -1;
+static int hf_newip_bitmap1_nexthdr = -1;
+static int hf_newip_bitmap1_tclass = -1;
+static int hf_newip_bitmap1_daddr = -1;
+static int hf_newip_bitmap1_saddr = -1;
+static int hf_newip_bitmap1_more = -1;
+static int hf_newip_bitmap2 = -1;
+static int hf_newip_bitmap2_hdr_len = -1;
+static int hf_newip_bitmap2_reserved = -1;
+static int hf_newip_bitmap2_more = -1;
+static int hf_newip_bitmap_ext = -1;
+static int hf_newip_ttl = -1;
+static int hf_newip_total_len = -1;
+static int hf_newip_nexthdr = -1;
+static int hf_newip_tclass = -1;
+static int hf_newip_dst = -1;
+static int hf_newip_src = -1;
+static int hf_newip_addr = -1;
+static int hf_newip_hdr_len = -1;
+static int hf_newip_decap_err = -1;
+
+static int hf_newip_nd_type = -1;
+static int hf_newip_nd_code = -1;
+static int hf_newip_nd_checksum = -1;
+static int hf_newip_nd_target = -1;
+static int hf_newip_nd_mac_len = -1;
+static int hf_newip_nd_mac = -1;
+
+static gint ett_newip = -1;
+static gint ett_newip_bitmap1 = -1;
+static gint ett_newip_bitmap2 = -1;
+static gint ett_newip_nd = -1;
+
+static expert_field ei_newip_decap_err = EI_INIT;
+static expert_field ei_newip_saddr_elided = EI_INIT;
+static expert_field ei_newip_total_len = EI_INIT;
+static expert_field ei_newip_nd_addr = EI_INIT;
+
+static int newip_tap = -1;
+static int newip_address_type = -1;
+
+static dissector_handle_t newip_handle;
+static dissector_table_t ip_dissector_table;
+static heur_dissector_list_t newip_heur_subdissector_list;
+
+static gboolean newip_try_heuristic_first = FALSE;
+
+typedef struct _newip_tap_info_t {
+	address src;
+	address dst;
+	guint8 nexthdr;
+} newip_tap_info_t;
+
+static const value_string newip_decap_err_vals[] = {
+	{ NIP_HDR_BITMAP_INVALID,         "Bitmap invalid" },
+	{ NIP_HDR_BITMAP_NUM_OUT_RANGE,   "Too many bitmap bytes" },
+	{ NIP_HDR_NO_TTL,                 "No TTL" },
+	{ NIP_HDR_NO_NEXT_HDR,            "No next header" },
+	{ NIP_HDR_NO_DADDR,               "No destination address" },
+	{ NIP_HDR_DECAP_DADDR_ERR,        "Destination address decap error" },
+	{ NIP_HDR_DADDR_INVALID,          "Destination address invalid" },
+	{ NIP_HDR_DECAP_SADDR_ERR,        "Source address decap error" },
+	{ NIP_HDR_SADDR_INVALID,          "Source address invalid" },
+	{ NIP_HDR_RCV_BUF_READ_OUT_RANGE, "Header longer than the packet" },
+	{ NIP_HDR_UNKNOWN_AND_NO_HDR_LEN, "Unknown bitmap bit without header length" },
+	{ NIP_HDR_LEN_INVALID,            "Header length invalid" },
+	{ NIP_HDR_LEN_OUT_RANGE,          "Header length out of range" },
+	{ 0, NULL }
+};
+
+static const value_string newip_nd_type_vals[] = {
+	{ 0x01, "Neighbor request" },
+	{ 0x02, "Neighbor response" },
+	{ 0, NULL }
+};
+
+static int * const newip_bitmap1_fields[] = {
+	&hf_newip_bitmap1_invalid,
+	&hf_newip_bitmap1_ttl,
+	&hf_newip_bitmap1_total_len,
+	&hf_newip_bitmap1_nexthdr,
+	&hf_newip_bitmap1_tclass,
+	&hf_newip_bitmap1_daddr,
+	&hf_newip_bitmap1_saddr,
+	&hf_newip_bitmap1_more,
+	NULL
+};
+
+static int * const newip_bitmap2_fields[] = {
+	&hf_newip_bitmap2_hdr_len,
+	&hf_newip_bitmap2_reserved,
+	&hf_newip_bitmap2_more,
+	NULL
+};
+
+/* Address type: hex bytes separated by ':' so that the string is also a
+ * valid display filter value, a zero length address is an elided saddr
+ */
+static int newip_addr_to_str(const address *addr, gchar *buf, int buf_len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const guint8 *p = (const guint8 *)addr->data;
+	int pos = 0;
+
+	if (!addr->len)
+		return (int)g_strlcpy(buf, "peer", buf_len) + 1;
+
+	for (int i = 0; i < addr->len && pos + 3 <= buf_len; i++) {
+		if (i)
+			buf[pos++] = ':';
+		buf[pos++] = hex[p[i] >> 4];
+		buf[pos++] = hex[p[i] & 0xF];
+	}
+	buf[pos] = '\0';
+	return pos + 1;
+}
+
+static int newip_addr_str_len(const address *addr)
+{
+	return addr->len ? addr->len * 3 : (int)sizeof("peer");
+}
+
+static const char *newip_col_filter_str(const address *addr _U_, gboolean is_src)
+{
+	return is_src ? "newip.src" : "newip.dst";
+}
+
+/* Conversations and Endpoints tables */
+static const char *newip_conv_get_filter_type(conv_item_t *conv, conv_filter_type_e filter)
+{
+	if (conv->src_address.type != newip_address_type)
+		return CONV_FILTER_INVALID;
+
+	switch (filter) {
+	case CONV_FT_SRC_ADDRESS:
+		return "newip.src";
+	case CONV_FT_DST_ADDRESS:
+		return "newip.dst";
+	case CONV_FT_ANY_ADDRESS:
+		return "newip.addr";
+	default:
+		return CONV_FILTER_INVALID;
+	}
+}
+
+static ct_dissector_info_t newip_ct_dissector_info = { &newip_conv_get_filter_type };
+
+static tap_packet_status newip_conversation_packet(void *pct, packet_info *pinfo,
+						   epan_dissect_t *edt _U_, const void *vip)
+{
+	conv_hash_t *hash = (conv_hash_t *)pct;
+	const newip_tap_info_t *info = (const newip_tap_info_t *)vip;
+
+	add_conversation_table_data(hash, &info->src, &info->dst, 0, 0, 1,
+				    pinfo->fd->pkt_len, &pinfo->rel_ts, &pinfo->abs_ts,
+				    &newip_ct_dissector_info, ENDPOINT_NONE);
+	return TAP_PACKET_REDRAW;
+}
+
+static const char *newip_host_get_filter_type(hostlist_talker_t *host, conv_filter_type_e filter)
+{
+	if (filter == CONV_FT_ANY_ADDRESS && host->myaddress.type == newip_address_type)
+		return "newip.addr";
+	return CONV_FILTER_INVALID;
+}
+
+static hostlist_dissector_info_t newip_host_dissector_info = { &newip_host_get_filter_type };
+
+static tap_packet_status newip_hostlist_packet(void *pit, packet_info *pinfo,
+					       epan_dissect_t *edt _U_, const void *vip)
+{
+	conv_hash_t *hash = (conv_hash_t *)pit;
+	const newip_tap_info_t *info = (const newip_tap_info_t *)vip;
+
+	add_hostlist_table_data(hash, &info->src, 0, TRUE, 1, pinfo->fd->pkt_len,
+				&newip_host_dissector_info, ENDPOINT_NONE);
+	add_hostlist_table_data(hash, &info->dst, 0, FALSE, 1, pinfo->fd->pkt_len,
+				&newip_host_dissector_info, ENDPOINT_NONE);
+	return TAP_PACKET_REDRAW;
+}
+
+/* Length of the NewIP address at offset, 0 if it does not decode */
+static int newip_addr_len(tvbuff_t *tvb, int offset)
+{
+	guint8 buf[NIP_ADDR_BIT_LEN_MAX / NIP_ADDR_BIT_LEN_8] = {0};
+	struct nip_addr addr;
+	int avail = tvb_captured_length_remaining(tvb, offset);
+
+	if (avail <= 0)
+		return 0;
+	tvb_memcpy(tvb, buf, offset, MIN((int)sizeof(buf), avail));
+	memset(&addr, 0, sizeof(addr));
+	if (!decode_nip_addr(buf, &addr))
+		return 0;
+	return addr.bitlen / NIP_ADDR_BIT_LEN_8;
+}
+
+static void dissect_newip_nd(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
+{
+	proto_item *ti;
+	proto_tree *nd_tree;
+	proto_item *type_item;
+	guint8 type;
+	guint8 mac_len;
+	int offset = 0;
+	int len;
+
+	col_set_str(pinfo->cinfo, COL_PROTOCOL, "NewIP ND");
+	ti = proto_tree_add_item(tree, proto_newip_nd, tvb, 0, -1, ENC_NA);
+	nd_tree = proto_item_add_subtree(ti, ett_newip_nd);
+
+	type = tvb_get_guint8(tvb, offset);
+	type_item = proto_tree_add_item(nd_tree, hf_newip_nd_type, tvb, offset, 1, ENC_NA);
+	offset += 1;
+	proto_tree_add_item(nd_tree, hf_newip_nd_code, tvb, offset, 1, ENC_NA);
+	offset += 1;
+	proto_tree_add_item(nd_tree, hf_newip_nd_checksum, tvb, offset, 2, ENC_BIG_ENDIAN);
+	offset += 2;
+	col_add_str(pinfo->cinfo, COL_INFO, val_to_str(type, newip_nd_type_vals, "Type %u"));
+
+	if (type == 0x01) {
+		len = newip_addr_len(tvb, offset);
+		if (!len) {
+			expert_add_info(pinfo, type_item, &ei_newip_nd_addr);
+			return;
+		}
+		proto_tree_add_item(nd_tree, hf_newip_nd_target, tvb, offset, len, ENC_NA);
+		col_append_fstr(pinfo->cinfo, COL_INFO, ", who has %s",
+				tvb_bytes_to_str_punct(pinfo->pool, tvb, offset, len, ':'));
+	} else if (type == 0x02) {
+		mac_len = tvb_get_guint8(tvb, offset);
+		proto_tree_add_item(nd_tree, hf_newip_nd_mac_len, tvb, offset, 1, ENC_NA);
+		offset += 1;
+		if (mac_len && mac_len <= NEWIP_MAC_LEN_MAX) {
+			proto_tree_add_item(nd_tree, hf_newip_nd_mac, tvb, offset, mac_len, ENC_NA);
+			col_append_fstr(pinfo->cinfo, COL_INFO, ", at %s",
+					tvb_bytes_to_str_punct(pinfo->pool, tvb, offset, mac_len, ':'));
+		}
+	}
+}
+
+static void newip_handoff(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, guint8 nexthdr)
+{
+	heur_dtbl_entry_t *hdtbl_entry;
+
+	if (nexthdr == IPPROTO_NIP_ICMP) {
+		dissect_newip_nd(tvb, pinfo, tree);
+		return;
+	}
+
+	/* Same order as the IP dissectors: optional heuristics first, then
+	 * the "ip.proto" table, which brings TCP/UDP with their own heuristic
+	 * sub-dissectors and conversation tracking on the NewIP addresses
+	 */
+	if (newip_try_heuristic_first &&
+	    dissector_try_heuristic(newip_heur_subdissector_list, tvb, pinfo, tree,
+				    &hdtbl_entry, NULL))
+		return;
+	if (dissector_try_uint_new(ip_dissector_table, nexthdr, tvb, pinfo, tree, TRUE, NULL))
+		return;
+	if (!newip_try_heuristic_first &&
+	    dissector_try_heuristic(newip_heur_subdissector_list, tvb, pinfo, tree,
+				    &hdtbl_entry, NULL))
+		return;
+	call_data_dissector(tvb, pinfo, tree);
+}
+
+static int dissect_newip(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U_)
+{
+	guint8 buf[NEWIP_HDR_COPY] = {0};
+	struct nip_hdr_decap niph;
+	newip_tap_info_t *info;
+	proto_tree *newip_tree;
+	proto_item *ti;
+	proto_item *item;
+	guint total_len;
+	int hdr_len;
+	guint copied;
+	int offset = 1;
+	int len;
+
+	col_set_str(pinfo->cinfo, COL_PROTOCOL, "NewIP");
+	col_clear(pinfo->cinfo, COL_INFO);
+
+	ti = proto_tree_add_item(tree, proto_newip, tvb, 0, -1, ENC_NA);
+	newip_tree = proto_item_add_subtree(ti, ett_newip);
+
+	copied = MIN(sizeof(buf), tvb_captured_length(tvb));
+	tvb_memcpy(tvb, buf, 0, copied);
+	memset(&niph, 0, sizeof(niph));
+	hdr_len = nip_hdr_parse(buf, copied, &niph);
+
+	proto_tree_add_bitmask(newip_tree, tvb, 0, hf_newip_bitmap1, ett_newip_bitmap1,
+			       newip_bitmap1_fields, ENC_NA);
+	if (hdr_len < 0) {
+		item = proto_tree_add_uint(newip_tree, hf_newip_decap_err, tvb, 0, 1, -hdr_len);
+		proto_item_set_generated(item);
+		expert_add_info_format(pinfo, item, &ei_newip_decap_err, "Header decap failed: %s",
+				       val_to_str_const(-hdr_len, newip_decap_err_vals, "Unknown"));
+		col_add_fstr(pinfo->cinfo, COL_INFO, "Malformed NewIP header (%s)",
+			     val_to_str_const(-hdr_len, newip_decap_err_vals, "Unknown"));
+		call_data_dissector(tvb_new_subset_remaining(tvb, 1), pinfo, tree);
+		return tvb_captured_length(tvb);
+	}
+
+	/* Field offsets follow the order of nip_hdr_parse(): bitmaps, ttl,
+	 * total_len, nexthdr, tclass, daddr, saddr, hdr_len
+	 */
+	while (buf[offset - 1] & NIP_BITMAP_HAVE_MORE_BIT) {
+		if (offset == 1)
+			proto_tree_add_bitmask(newip_tree, tvb, offset, hf_newip_bitmap2,
+					       ett_newip_bitmap2, newip_bitmap2_fields, ENC_NA);
+		else
+			proto_tree_add_item(newip_tree, hf_newip_bitmap_ext, tvb, offset, 1, ENC_NA);
+		offset++;
+	}
+
+	proto_tree_add_item(newip_tree, hf_newip_ttl, tvb, offset, 1, ENC_NA);
+	offset += 1;
+
+	if (niph.include_total_len) {
+		total_len = tvb_get_ntohs(tvb, offset);
+		item = proto_tree_add_item(newip_tree, hf_newip_total_len, tvb, offset, 2,
+					   ENC_BIG_ENDIAN);
+		offset += 2;
+		/* Shorter than the frame: link layer padding */
+		if (total_len > tvb_reported_length(tvb))
+			expert_add_info(pinfo, item, &ei_newip_total_len);
+		else
+			tvb = tvb_new_subset_length(tvb, 0, total_len);
+	}
+
+	proto_tree_add_item(newip_tree, hf_newip_nexthdr, tvb, offset, 1, ENC_NA);
+	offset += 1;
+
+	if (niph.include_tclass) {
+		proto_tree_add_item(newip_tree, hf_newip_tclass, tvb, offset, 1, ENC_NA);
+		offset += 1;
+	}
+
+	len = niph.daddr.bitlen / NIP_ADDR_BIT_LEN_8;
+	proto_tree_add_item(newip_tree, hf_newip_dst, tvb, offset, len, ENC_NA);
+	item = proto_tree_add_item(newip_tree, hf_newip_addr, tvb, offset, len, ENC_NA);
+	proto_item_set_hidden(item);
+	set_address_tvb(&pinfo->dst, newip_address_type, len, tvb, offset);
+	offset += len;
+
+	if (niph.include_saddr) {
+		len = niph.saddr.bitlen / NIP_ADDR_BIT_LEN_8;
+		proto_tree_add_item(newip_tree, hf_newip_src, tvb, offset, len, ENC_NA);
+		item = proto_tree_add_item(newip_tree, hf_newip_addr, tvb, offset, len, ENC_NA);
+		proto_item_set_hidden(item);
+		set_address_tvb(&pinfo->src, newip_address_type, len, tvb, offset);
+		offset += len;
+	} else {
+		expert_add_info(pinfo, ti, &ei_newip_saddr_elided);
+		set_address(&pinfo->src, newip_address_type, 0, NULL);
+	}
+	copy_address_shallow(&pinfo->net_src, &pinfo->src);
+	copy_address_shallow(&pinfo->net_dst, &pinfo->dst);
+
+	if (niph.include_hdr_len)
+		proto_tree_add_item(newip_tree, hf_newip_hdr_len, tvb, offset, 1, ENC_NA);
+
+	proto_item_set_len(ti, hdr_len);
+	proto_item_append_text(ti, ", Src: %s, Dst: %s",
+			       address_to_str(pinfo->pool, &pinfo->src),
+			       address_to_str(pinfo->pool, &pinfo->dst));
+
+	info = wmem_new0(pinfo->pool, newip_tap_info_t);
+	copy_address_shallow(&info->src, &pinfo->src);
+	copy_address_shallow(&info->dst, &pinfo->dst);
+	info->nexthdr = niph.nexthdr;
+	tap_queue_packet(newip_tap, pinfo, info);
+
+	newip_handoff(tvb_new_subset_remaining(tvb, hdr_len), pinfo, tree, niph.nexthdr);
+	return tvb_captured_length(tvb);
+}
+
+void proto_register_newip(void)
+{
+	static hf_register_info hf[] = {
+		{ &hf_newip_bitmap1,
+		  { "Bitmap 1", "newip.bitmap1", FT_UINT8, BASE_HEX, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_bitmap1_invalid,
+		  { "Invalid", "newip.bitmap1.invalid", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_INVALID_SET, NULL, HFILL } },
+		{ &hf_newip_bitmap1_ttl,
+		  { "Include TTL", "newip.bitmap1.ttl", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_INCLUDE_TTL, NULL, HFILL } },
+		{ &hf_newip_bitmap1_total_len,
+		  { "Include total length", "newip.bitmap1.total_len", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_INCLUDE_TOTAL_LEN, NULL, HFILL } },
+		{ &hf_newip_bitmap1_nexthdr,
+		  { "Include next header", "newip.bitmap1.nexthdr", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_INCLUDE_NEXT_HDR, NULL, HFILL } },
+		{ &hf_newip_bitmap1_tclass,
+		  { "Include traffic class", "newip.bitmap1.tclass", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_INCLUDE_TCLASS, NULL, HFILL } },
+		{ &hf_newip_bitmap1_daddr,
+		  { "Include destination address", "newip.bitmap1.daddr", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_INCLUDE_DADDR, NULL, HFILL } },
+		{ &hf_newip_bitmap1_saddr,
+		  { "Include source address", "newip.bitmap1.saddr", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_INCLUDE_SADDR, NULL, HFILL } },
+		{ &hf_newip_bitmap1_more,
+		  { "Bitmap 2 follows", "newip.bitmap1.more", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_HAVE_BYTE_2, NULL, HFILL } },
+		{ &hf_newip_bitmap2,
+		  { "Bitmap 2", "newip.bitmap2", FT_UINT8, BASE_HEX, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_bitmap2_hdr_len,
+		  { "Include header length", "newip.bitmap2.hdr_len", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_INCLUDE_HDR_LEN, NULL, HFILL } },
+		{ &hf_newip_bitmap2_reserved,
+		  { "Reserved", "newip.bitmap2.reserved", FT_UINT8, BASE_HEX, NULL,
+		    NIP_INVALID_BITMAP_2 & ~NIP_BITMAP_HAVE_BYTE_3, NULL, HFILL } },
+		{ &hf_newip_bitmap2_more,
+		  { "Bitmap 3 follows", "newip.bitmap2.more", FT_BOOLEAN, 8, NULL,
+		    NIP_BITMAP_HAVE_BYTE_3, NULL, HFILL } },
+		{ &hf_newip_bitmap_ext,
+		  { "Bitmap (unknown)", "newip.bitmap_ext", FT_UINT8, BASE_HEX, NULL, 0x0,
+		    NULL, HFILL } },
+		{ &hf_newip_ttl,
+		  { "TTL", "newip.ttl", FT_UINT8, BASE_DEC, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_total_len,
+		  { "Total length", "newip.total_len", FT_UINT16, BASE_DEC, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_nexthdr,
+		  { "Next header", "newip.nexthdr", FT_UINT8, BASE_DEC | BASE_EXT_STRING,
+		    &ipproto_val_ext, 0x0, NULL, HFILL } },
+		{ &hf_newip_tclass,
+		  { "Traffic class", "newip.tclass", FT_UINT8, BASE_HEX, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_dst,
+		  { "Destination address", "newip.dst", FT_BYTES, SEP_COLON, NULL, 0x0,
+		    NULL, HFILL } },
+		{ &hf_newip_src,
+		  { "Source address", "newip.src", FT_BYTES, SEP_COLON, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_addr,
+		  { "Source or destination address", "newip.addr", FT_BYTES, SEP_COLON, NULL, 0x0,
+		    NULL, HFILL } },
+		{ &hf_newip_hdr_len,
+		  { "Header length", "newip.hdr_len", FT_UINT8, BASE_DEC, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_decap_err,
+		  { "Decap error", "newip.decap_err", FT_UINT8, BASE_DEC,
+		    VALS(newip_decap_err_vals), 0x0, NULL, HFILL } },
+
+		{ &hf_newip_nd_type,
+		  { "Type", "newip_nd.type", FT_UINT8, BASE_DEC, VALS(newip_nd_type_vals), 0x0,
+		    NULL, HFILL } },
+		{ &hf_newip_nd_code,
+		  { "Code", "newip_nd.code", FT_UINT8, BASE_DEC, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_nd_checksum,
+		  { "Checksum", "newip_nd.checksum", FT_UINT16, BASE_HEX, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_nd_target,
+		  { "Target address", "newip_nd.target", FT_BYTES, SEP_COLON, NULL, 0x0,
+		    NULL, HFILL } },
+		{ &hf_newip_nd_mac_len,
+		  { "MAC length", "newip_nd.mac_len", FT_UINT8, BASE_DEC, NULL, 0x0, NULL, HFILL } },
+		{ &hf_newip_nd_mac,
+		  { "MAC", "newip_nd.mac", FT_BYTES, SEP_COLON, NULL, 0x0, NULL, HFILL } },
+	};
+
+	static gint *ett[] = {
+		&ett_newip,
+		&ett_newip_bitmap1,
+		&ett_newip_bitmap2,
+		&ett_newip_nd,
+	};
+
+	static ei_register_info ei[] = {
+		{ &ei_newip_decap_err,
+		  { "newip.decap_err.expert", PI_MALFORMED, PI_ERROR,
+		    "Header decap failed", EXPFILL } },
+		{ &ei_newip_saddr_elided,
+		  { "newip.saddr_elided", PI_PROTOCOL, PI_NOTE,
+		    "Source address elided, the receiver uses its point-to-point peer", EXPFILL } },
+		{ &ei_newip_total_len,
+		  { "newip.total_len.bad", PI_MALFORMED, PI_WARN,
+		    "Total length larger than the frame", EXPFILL } },
+		{ &ei_newip_nd_addr,
+		  { "newip_nd.target.bad", PI_MALFORMED, PI_ERROR,
+		    "Target address does not decode", EXPFILL } },
+	};
+
+	module_t *newip_module;
+	expert_module_t *expert_newip;
+
+	proto_newip = proto_register_protocol("NewIP Protocol", "NewIP", "newip");
+	proto_newip_nd = proto_register_protocol("NewIP Neighbor Discovery", "NewIP ND", "newip_nd");
+	proto_register_field_array(proto_newip, hf, array_length(hf));
+	proto_register_subtree_array(ett, array_length(ett));
+	expert_newip = expert_register_protocol(proto_newip);
+	expert_register_field_array(expert_newip, ei, array_length(ei));
+
+	newip_module = prefs_register_protocol(proto_newip, NULL);
+	prefs_register_bool_preference(newip_module, "try_heuristic_first",
+				       "Try heuristic sub-dissectors first",
+				       "Try to decode a packet using a heuristic sub-dissector "
+				       "before using the sub-dissector registered for its next header",
+				       &newip_try_heuristic_first);
+
+	newip_heur_subdissector_list = register_heur_dissector_list("newip", proto_newip);
+	newip_handle = register_dissector("newip", dissect_newip, proto_newip);
+	newip_tap = register_tap("newip");
+	register_conversation_table(proto_newip, TRUE, newip_conversation_packet,
+				    newip_hostlist_packet);
+	newip_address_type = address_type_dissector_register("AT_NEWIP", "NewIP address",
+							     newip_addr_to_str, newip_addr_str_len,
+							     NULL, newip_col_filter_str,
+							     NULL, NULL, NULL);
+}
+
+void proto_reg_handoff_newip(void)
+{
+	ip_dissector_table = find_dissector_table("ip.proto");
+	dissector_add_uint("ethertype", NEWIP_ETHERTYPE, newip_handle);
+}